@@ -5,6 +5,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 
 // Prendiamo in ingresso il parametro "num" che rappresenta la posizione di un blocco nella memoria, 
@@ -26,12 +32,97 @@ int BitMap_indexToBlock(BitMapEntryKey entry) {
 }
 
 
+// Legge, a partire dall'entry "entry", una parola di 64 bit della bitmap. I byte vengono ordinati in modo che il primo blocco
+// corrisponda al bit più significativo della parola (lo stesso ordine MSB-first usato da BitMap_set).
+// Se la bitmap finisce prima di 8 byte, i byte mancanti vengono letti come 0
+// Loads the 64 bit word starting at entry "entry", MSB-first, padding with zeros past the end of the bitmap
+static inline uint64_t BitMap_loadWord(const BitMap* bitmap, int entry) {
+	uint64_t word = 0;
+	int num_entries = (bitmap->num_bits + 7) / 8;
+
+	// Copio solo i byte effettivamente presenti nella bitmap
+	int len = num_entries - entry < 8 ? num_entries - entry : 8;
+	memcpy(&word, bitmap->entries + entry, len);
+
+	// Su architetture little-endian inverto l'ordine dei byte, così il primo byte finisce nella parte alta della parola
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+// Salta, a partire dall'entry "entry", tutti i byte che valgono "skip" (0xFF se cerchiamo un bit a 0, 0x00 se cerchiamo un bit a 1),
+// controllando più parole alla volta con le istruzioni SIMD, se disponibili. Restituisce la prima entry da controllare parola per parola
+// Skips whole vectors of entries equal to "skip" and returns the first entry that has to be checked word by word
+static inline int BitMap_skipEntries(const BitMap* bitmap, int entry, char skip) {
+	int num_entries = (bitmap->num_bits + 7) / 8;
+#if defined(__AVX2__)
+	const __m256i full256 = _mm256_set1_epi8(skip);
+	while(entry + 32 <= num_entries) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (bitmap->entries + entry));
+		if(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, full256)) != -1) break;
+		entry += 32;
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i full128 = _mm_set1_epi8(skip);
+	while(entry + 16 <= num_entries) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (bitmap->entries + entry));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(v, full128)) != 0xFFFF) break;
+		entry += 16;
+	}
+#endif
+	return entry;
+}
+
+// Restituisce 1 se la parola di 64 bit numero "word" (allineata, cioè le entry da 8*word a 8*word+7) contiene almeno un bit a 0
+// che appartiene alla bitmap, 0 altrimenti
+// Returns 1 if the aligned 64-bit word "word" has at least a bit at 0 inside the bitmap
+
+static int BitMap_wordHasFree(const BitMap* bitmap, int word) {
+	uint64_t free_bits = ~BitMap_loadWord(bitmap, word * 8);
+
+	// Nell'ultima parola ignoro i bit che si trovano oltre la fine della bitmap
+	int remaining = bitmap->num_bits - word * 64;
+	if(remaining < 64) free_bits &= ~(~0ULL >> remaining);
+	return free_bits != 0;
+}
+
+// Aggiorna il riassunto della bitmap dopo che è cambiata la parola "word": risale i livelli finché il bit del genitore non cambia.
+// Le parole dei livelli possono essere condivise da parti della bitmap modificate da thread diversi (ad esempio i gruppi
+// di allocazione del DiskDriver), quindi ogni bit viene cambiato in modo atomico; dopo averlo cambiato ricontrollo il figlio:
+// se nel frattempo un altro thread lo ha cambiato nell'altro senso, rifaccio il livello, così vince sempre lo stato più recente
+// Updates the summary after the word "word" of the bitmap has changed
+static void BitMap_updateSummary(BitMap* bitmap, int word) {
+	BitMapSummary* summary = bitmap->summary;
+	int level = 0, has_free = BitMap_wordHasFree(bitmap, word);
+	while(level < summary->levels) {
+		uint64_t mask = 1ULL << (word % 64);
+		uint64_t* parent = &summary->level[level][word / 64];
+		uint64_t old = has_free ? __atomic_fetch_or(parent, mask, __ATOMIC_SEQ_CST) : __atomic_fetch_and(parent, ~mask, __ATOMIC_SEQ_CST);
+		uint64_t updated = has_free ? (old | mask) : (old & ~mask);
+
+		// Ricontrollo il figlio: se è cambiato, aggiorno di nuovo questo livello
+		int child_free = level == 0 ? BitMap_wordHasFree(bitmap, word) : __atomic_load_n(&summary->level[level - 1][word], __ATOMIC_SEQ_CST) != 0;
+		if(child_free != has_free) {
+			has_free = child_free;
+			continue;
+		}
+
+		// Se la parola di questo livello non è cambiata, i livelli superiori sono già corretti
+		if(updated == old) return;
+		has_free = updated != 0;
+		word = word / 64;
+		level++;
+	}
+}
+
 // Imposta il bit all'indice "pos" in bitmap a "status"
 // Sets the bit at index pos in bitmap to status
  int BitMap_set(BitMap* bitmap, int pos, int status) {
 	
 		// Controllo che pos sia contenuto nella BitMap
-		if(pos > bitmap->num_bits) return -1;
+		if(pos < 0 || pos >= bitmap->num_bits) return -1;
 
 		// Dichiaro la BitMapEntryKey e la maschera per i bit
     BitMapEntryKey bmek = BitMap_blockToIndex(pos);
@@ -44,33 +135,301 @@ int BitMap_indexToBlock(BitMapEntryKey entry) {
     	bitmap->entries[bmek.entry_num] &= ~(mask);
     }
 
+		// Se la bitmap ha un riassunto, lo aggiorno
+		if(bitmap->summary != NULL) BitMap_updateSummary(bitmap, pos / 64);
+
 		// Restituisco il bit "status" dopo aver modificato la entry
     return status;
  }
 
+// Imposta a "status" tutti gli "n" bit a partire da "start": i byte interi vengono scritti con una memset,
+// mentre per il primo e l'ultimo byte (che possono essere parziali) si usa una maschera
+// Sets to status the n bits starting from start, using masks for the partial bytes and memset for the others
+static int BitMap_fillRange(BitMap* bitmap, int start, int n, int status) {
+
+	// Controllo che l'intervallo sia contenuto nella BitMap
+	if(start < 0 || n < 0 || start > bitmap->num_bits - n) return -1;
+	if(n == 0) return 0;
+
+	int end = start + n;
+	int first_entry = start / 8, last_entry = (end - 1) / 8;
+
+	// Maschere dei bit coinvolti nel primo e nell'ultimo byte (ordine MSB-first)
+	uint8_t first_mask = 0xFF >> (start % 8);
+	uint8_t last_mask = 0xFF << (7 - (end - 1) % 8);
+	if(first_entry == last_entry) {
+		first_mask &= last_mask;
+	}else{
+		if(status) bitmap->entries[last_entry] |= last_mask;
+		else bitmap->entries[last_entry] &= ~last_mask;
+		memset(bitmap->entries + first_entry + 1, status ? 0xFF : 0x00, last_entry - first_entry - 1);
+	}
+	if(status) bitmap->entries[first_entry] |= first_mask;
+	else bitmap->entries[first_entry] &= ~first_mask;
+
+	// Se la bitmap ha un riassunto, aggiorno tutte le parole toccate
+	if(bitmap->summary != NULL) {
+		int word;
+		for(word = start / 64; word <= (end - 1) / 64; word++) BitMap_updateSummary(bitmap, word);
+	}
+	return 0;
+}
+
+// Imposta a 1 gli "n" bit a partire da "start"
+// Sets to 1 the n bits starting from start
+int BitMap_setRange(BitMap* bitmap, int start, int n) {
+	return BitMap_fillRange(bitmap, start, n, 1);
+}
+
+// Imposta a 0 gli "n" bit a partire da "start"
+// Sets to 0 the n bits starting from start
+int BitMap_clearRange(BitMap* bitmap, int start, int n) {
+	return BitMap_fillRange(bitmap, start, n, 0);
+}
+
+// Conta i bit a 1 in "len" byte consecutivi, 8 byte alla volta. Il corpo viene compilato due volte: una generica
+// e una con il target "popcnt", che usa l'istruzione hardware e viene scelta solo se il processore la supporta
+// Counts the bits at 1 in len bytes, 8 bytes at a time
+static inline __attribute__((always_inline)) int BitMap_popcountBody(const char* entries, int len) {
+	int count = 0;
+	uint64_t word;
+	for(; len >= 8; entries += 8, len -= 8) {
+		memcpy(&word, entries, 8);
+		count += __builtin_popcountll(word);
+	}
+	for(; len > 0; entries++, len--) count += __builtin_popcount((uint8_t) *entries);
+	return count;
+}
+
+static int BitMap_popcountGeneric(const char* entries, int len) {
+	return BitMap_popcountBody(entries, len);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("popcnt")))
+static int BitMap_popcountHardware(const char* entries, int len) {
+	return BitMap_popcountBody(entries, len);
+}
+#endif
+
+static int BitMap_popcount(const char* entries, int len) {
+#if defined(__x86_64__) || defined(__i386__)
+	if(__builtin_cpu_supports("popcnt")) return BitMap_popcountHardware(entries, len);
+#endif
+	return BitMap_popcountGeneric(entries, len);
+}
+
+// Restituisce quanti degli "n" bit a partire da "start" hanno status "status"
+// Returns how many of the n bits starting from start have status "status"
+int BitMap_countRange(BitMap* bitmap, int start, int n, int status) {
+
+	// Controllo che l'intervallo sia contenuto nella BitMap
+	if(start < 0 || n < 0 || start > bitmap->num_bits - n) return -1;
+	if(n == 0) return 0;
+
+	int end = start + n;
+	int first_entry = start / 8, last_entry = (end - 1) / 8;
+	uint8_t first_mask = 0xFF >> (start % 8);
+	uint8_t last_mask = 0xFF << (7 - (end - 1) % 8);
+
+	// Conto i bit a 1: il primo e l'ultimo byte con le maschere, quelli in mezzo con popcount
+	int ones;
+	if(first_entry == last_entry) {
+		ones = __builtin_popcount((uint8_t) bitmap->entries[first_entry] & first_mask & last_mask);
+	}else{
+		ones = __builtin_popcount((uint8_t) bitmap->entries[first_entry] & first_mask)
+			+ __builtin_popcount((uint8_t) bitmap->entries[last_entry] & last_mask)
+			+ BitMap_popcount(bitmap->entries + first_entry + 1, last_entry - first_entry - 1);
+	}
+	return status ? ones : n - ones;
+}
+
+// Alloca il riassunto della bitmap, con tutti i bit a 0: ogni livello ha un bit per ogni parola del livello inferiore,
+// fino ad arrivare ad un livello formato da una sola parola
+// Allocates an empty summary of the bitmap
+int BitMap_allocSummary(BitMap* bitmap) {
+	BitMap_freeSummary(bitmap);
+	BitMapSummary* summary = calloc(1, sizeof(BitMapSummary));
+	if(summary == NULL) return -1;
+	int bits = (bitmap->num_bits + 63) / 64;
+	do {
+		int words = (bits + 63) / 64;
+		summary->num_words[summary->levels] = words;
+		summary->level[summary->levels] = calloc(words > 0 ? words : 1, sizeof(uint64_t));
+		if(summary->level[summary->levels] == NULL) {
+			bitmap->summary = summary;
+			BitMap_freeSummary(bitmap);
+			return -1;
+		}
+		summary->levels++;
+		bits = words;
+	} while(bits > 1 && summary->levels < BITMAP_SUMMARY_LEVELS);
+	bitmap->summary = summary;
+	return 0;
+}
+
+// Riempie il livello 0 del riassunto per le parole della bitmap da "first_word" a "first_word + num_words": ogni parola del livello 0
+// copre 64 parole della bitmap, quindi thread diversi possono riempire insieme intervalli che iniziano a multipli di 64 parole
+// Fills level 0 of the summary for a range of words of the bitmap
+void BitMap_summarizeRange(BitMap* bitmap, int first_word, int num_words) {
+	int i, words = (bitmap->num_bits + 63) / 64;
+	if(first_word + num_words > words) num_words = words - first_word;
+	for(i = first_word; i < first_word + num_words; i++) {
+		if(BitMap_wordHasFree(bitmap, i)) bitmap->summary->level[0][i / 64] |= 1ULL << (i % 64);
+	}
+}
+
+// Ricalcola i livelli del riassunto sopra il livello 0, ognuno a partire da quello inferiore
+// Rebuilds the levels of the summary above level 0
+void BitMap_summarizeLevels(BitMap* bitmap) {
+	BitMapSummary* summary = bitmap->summary;
+	int i, level;
+	for(level = 1; level < summary->levels; level++) {
+		memset(summary->level[level], 0, summary->num_words[level] * sizeof(uint64_t));
+		for(i = 0; i < summary->num_words[level - 1]; i++) {
+			if(summary->level[level - 1][i]) summary->level[level][i / 64] |= 1ULL << (i % 64);
+		}
+	}
+}
+
+// Costruisce (o ricostruisce) il riassunto della bitmap, leggendo tutte le sue parole
+// Builds the summary of the bitmap, scanning all its words
+int BitMap_buildSummary(BitMap* bitmap) {
+	if(BitMap_allocSummary(bitmap) == -1) return -1;
+	BitMap_summarizeRange(bitmap, 0, (bitmap->num_bits + 63) / 64);
+	BitMap_summarizeLevels(bitmap);
+	return 0;
+}
+
+// Ricostruisce il riassunto della bitmap a partire dal suo livello 0 (salvato prima), senza leggere la bitmap
+// Builds the summary of the bitmap from a saved copy of its level 0
+int BitMap_loadSummary(BitMap* bitmap, const uint64_t* level0) {
+	if(BitMap_allocSummary(bitmap) == -1) return -1;
+	memcpy(bitmap->summary->level[0], level0, bitmap->summary->num_words[0] * sizeof(uint64_t));
+	BitMap_summarizeLevels(bitmap);
+	return 0;
+}
+
+// Libera la memoria occupata dal riassunto della bitmap
+// Releases the summary of the bitmap
+void BitMap_freeSummary(BitMap* bitmap) {
+	if(bitmap->summary == NULL) return;
+	int level;
+	for(level = 0; level < bitmap->summary->levels; level++) free(bitmap->summary->level[level]);
+	free(bitmap->summary);
+	bitmap->summary = NULL;
+}
+
+// Restituisce la prima parola (allineata) della bitmap, a partire da "word", che contiene almeno un bit a 0, oppure -1.
+// Sale di livello finché non trova una parola con un bit a 1 dopo la posizione cercata, poi scende seguendo il primo bit a 1
+// Returns the first aligned word, starting from "word", having at least a bit at 0, or -1 if there is none
+static int BitMap_nextFreeWord(const BitMapSummary* summary, int word) {
+	int level;
+	for(level = 0; level < summary->levels; level++) {
+		if(word / 64 >= summary->num_words[level]) return -1;
+		uint64_t bits = summary->level[level][word / 64] & (~0ULL << (word % 64));
+		if(bits) {
+			word = (word / 64) * 64 + __builtin_ctzll(bits);
+
+			// Scendo fino al livello 0 seguendo, ad ogni livello, il primo bit a 1
+			while(level-- > 0) word = word * 64 + __builtin_ctzll(summary->level[level][word]);
+			return word;
+		}
+
+		// In questa parola non c'è niente: al livello superiore riparto dalla parola successiva
+		word = word / 64 + 1;
+	}
+	return -1;
+}
+
 // Restituisce l'indice del primo bit avente status "status" nella bitmap bitmap, iniziando a cercare dalla posizione "start"
 // Returns the index of the first bit having status "status" in the bitmap bitmap, and starts looking from position start
 int BitMap_get(BitMap* bitmap, int start, int status) {
 
 	// Se si inizia a cercare da una posizione che esce dall'entry, si restituisce -1
-	if(start > bitmap->num_bits) return -1;
+	if(start < 0 || start >= bitmap->num_bits) return -1;
 
-	// Definiamo le variabili che si useranno all'interno
-	int posizione, i, result;
+	// Se cerchiamo un bit a 0 e la bitmap ha un riassunto, lo usiamo per saltare direttamente alla prima parola con un bit libero
+	if(status == 0 && bitmap->summary != NULL) {
+		int word = start / 64;
+		uint64_t free_bits = ~BitMap_loadWord(bitmap, word * 8) & (~0ULL >> (start % 64));
+		if(free_bits == 0) {
+			word = BitMap_nextFreeWord(bitmap->summary, word + 1);
+			if(word == -1) return -1;
+			free_bits = ~BitMap_loadWord(bitmap, word * 8);
+		}
+		int i = word * 64 + __builtin_clzll(free_bits);
+		return i < bitmap->num_bits ? i : -1;
+	}
 
-	// Per ogni bit a partire da "start", verifichiamo
-	for(i = start; i <= bitmap->num_bits; i++) {
+	// Cerchiamo sempre un bit a 1: se "status" è 0 neghiamo ogni parola letta, così i bit liberi diventano 1
+	uint64_t flip = status ? 0 : ~0ULL;
+	char skip = status ? 0x00 : (char) 0xFF;
 
-		// Se sforiamo le entries, restituisce -1 perché "status" non è stato trovato
-		if(i == bitmap->num_bits) return -1;
-		BitMapEntryKey bmek = BitMap_blockToIndex(i);
-	 	result = (bitmap->entries[bmek.entry_num] & (1 << (7 - bmek.bit_num))); 
+	// Leggo la parola che contiene "start" e azzero i bit che precedono "start"
+	int entry = start / 8;
+	uint64_t word = (BitMap_loadWord(bitmap, entry) ^ flip) & (~0ULL >> (start % 8));
 
-		// Se dobbiamo verificare "status=1", il risultato deve essere ">0", altrimenti deve essere "=0"
-		if(status == 1) {
-			if(result > 0) return i;
-		}else{
-			if(result == 0) return i;
+	// Finché la parola corrente non contiene bit utili, passiamo alla successiva
+	while(word == 0) {
+		entry += 8;
+		if(entry * 8 >= bitmap->num_bits) return -1;
+
+		// Salto in blocco le entry completamente piene (o completamente vuote)
+		entry = BitMap_skipEntries(bitmap, entry, skip);
+		word = BitMap_loadWord(bitmap, entry) ^ flip;
+	}
+
+	// Il primo bit a 1 della parola (partendo dal più significativo) è quello cercato
+	int i = entry * 8 + __builtin_clzll(word);
+
+	// Se sforiamo le entries, restituisce -1 perché "status" non è stato trovato
+	return i < bitmap->num_bits ? i : -1;
+}
+
+// Restituisce l'indice del primo gruppo di "n" bit consecutivi a 0, iniziando a cercare dalla posizione "start" (first-fit)
+// Returns the index of the first run of n contiguous bits at 0, starting from position start (first-fit)
+int BitMap_getRun(BitMap* bitmap, int start, int n) {
+
+	// Controllo che i parametri abbiano senso
+	if(n <= 0 || start < 0) return -1;
+
+	// Per ogni gruppo di bit liberi, cerco dove inizia (primo bit a 0) e dove finisce (primo bit a 1 successivo)
+	while(start < bitmap->num_bits) {
+		int inizio = BitMap_get(bitmap, start, 0);
+		if(inizio == -1) return -1;
+		int fine = BitMap_get(bitmap, inizio, 1);
+		if(fine == -1) fine = bitmap->num_bits;
+
+		// Se il gruppo è abbastanza lungo, lo restituisco, altrimenti riparto dalla sua fine
+		if(fine - inizio >= n) return inizio;
+		start = fine;
+	}
+	return -1;
+}
+
+// Restituisce l'indice del più piccolo gruppo di almeno "n" bit consecutivi a 0, iniziando a cercare dalla posizione "start" (best-fit)
+// Returns the index of the smallest run of at least n contiguous bits at 0, starting from position start (best-fit)
+int BitMap_getBestRun(BitMap* bitmap, int start, int n) {
+
+	// Controllo che i parametri abbiano senso
+	if(n <= 0 || start < 0) return -1;
+
+	int migliore = -1, lunghezza_migliore = 0;
+	while(start < bitmap->num_bits) {
+		int inizio = BitMap_get(bitmap, start, 0);
+		if(inizio == -1) break;
+		int fine = BitMap_get(bitmap, inizio, 1);
+		if(fine == -1) fine = bitmap->num_bits;
+
+		// Tengo il gruppo più corto tra quelli abbastanza lunghi; se è lungo esattamente "n" non posso fare di meglio
+		int lunghezza = fine - inizio;
+		if(lunghezza >= n && (migliore == -1 || lunghezza < lunghezza_migliore)) {
+			migliore = inizio;
+			lunghezza_migliore = lunghezza;
+			if(lunghezza == n) break;
 		}
+		start = fine;
 	}
+	return migliore;
 }
@@ -1,9 +1,23 @@
 #pragma once
 #include <stdint.h>
 
+// maximum number of levels of a BitMapSummary (enough for 2^31 bits)
+#define BITMAP_SUMMARY_LEVELS 8
+
+// in-memory summary of a bitmap, used to find free bits in O(levels)
+// bit i of level 0 is 1 if the 64-bit word i of the bitmap has at least a bit at 0
+// bit i of level k is 1 if the word i of level k-1 is not 0
+// the last level always has a single word
+typedef struct {
+	int levels;
+	int num_words[BITMAP_SUMMARY_LEVELS];
+	uint64_t* level[BITMAP_SUMMARY_LEVELS];
+} BitMapSummary;
+
 typedef struct{
 	int num_bits;
 	char* entries;
+	BitMapSummary* summary; // NULL if the bitmap has no summary
 }  BitMap;
 
 typedef struct {
@@ -22,5 +36,49 @@ int BitMap_indexToBlock(BitMapEntryKey entry);
 // in the bitmap bmap, and starts looking from position start
 int BitMap_get(BitMap* bmap, int start, int status);
 
+// returns the index of the first run of n contiguous bits at 0
+// in the bitmap bmap, starting from position start (first-fit)
+// returns -1 if there is no such run
+int BitMap_getRun(BitMap* bmap, int start, int n);
+
+// returns the index of the smallest run of at least n contiguous bits at 0
+// in the bitmap bmap, starting from position start (best-fit)
+// returns -1 if there is no such run
+int BitMap_getBestRun(BitMap* bmap, int start, int n);
+
 // sets the bit at index pos in bmap to status
+// if bmap has a summary, it is kept up to date
 int BitMap_set(BitMap* bmap, int pos, int status);
+
+// sets to 1 the n bits starting from index start
+// returns -1 if the range is not inside bmap, 0 otherwise
+int BitMap_setRange(BitMap* bmap, int start, int n);
+
+// sets to 0 the n bits starting from index start
+// returns -1 if the range is not inside bmap, 0 otherwise
+int BitMap_clearRange(BitMap* bmap, int start, int n);
+
+// returns how many of the n bits starting from index start have status "status"
+// returns -1 if the range is not inside bmap
+int BitMap_countRange(BitMap* bmap, int start, int n, int status);
+
+// (re)builds the summary of bmap, scanning all its entries
+// returns -1 if the summary could not be allocated, 0 otherwise
+int BitMap_buildSummary(BitMap* bmap);
+
+// the steps of BitMap_buildSummary, for callers that scan the bitmap in parallel:
+// allocates an empty summary (-1 if it could not be allocated, 0 otherwise)
+int BitMap_allocSummary(BitMap* bmap);
+// fills level 0 of the summary for num_words 64-bit words of the bitmap starting at first_word;
+// ranges starting at multiples of 64 words can be filled by different threads at the same time
+void BitMap_summarizeRange(BitMap* bmap, int first_word, int num_words);
+// rebuilds the levels above level 0
+void BitMap_summarizeLevels(BitMap* bmap);
+
+// (re)builds the summary of bmap from a copy of its level 0 (summary->level[0],
+// summary->num_words[0] words), without scanning the bitmap
+// returns -1 if the summary could not be allocated, 0 otherwise
+int BitMap_loadSummary(BitMap* bmap, const uint64_t* level0);
+
+// releases the summary of bmap
+void BitMap_freeSummary(BitMap* bmap);
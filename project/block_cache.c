@@ -0,0 +1,363 @@
+#include "block_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+// Restituisce l'indice del bucket della tabella hash in cui si trova il blocco "block_num"
+// Returns the bucket of the hash table for block_num
+static inline int BlockCache_bucket(const BlockCache* cache, int block_num) {
+	return (int) (((unsigned int) block_num * 2654435761u) & (cache->num_buckets - 1));
+}
+
+// Cerca il blocco "block_num" tra le entry della cache (residenti o fantasma). Restituisce l'indice dell'entry, oppure -1
+// Looks up block_num among the entries of the cache (resident or ghost), returns -1 if it is not there
+static int BlockCache_lookup(const BlockCache* cache, int block_num) {
+	int e = cache->buckets[BlockCache_bucket(cache, block_num)];
+	while(e != -1 && cache->entries[e].block_num != block_num) e = cache->entries[e].hash_next;
+	return e;
+}
+
+// Aggiunge l'entry "e" alla tabella hash
+// Adds entry e to the hash table
+static void BlockCache_hashInsert(BlockCache* cache, int e) {
+	int bucket = BlockCache_bucket(cache, cache->entries[e].block_num);
+	cache->entries[e].hash_next = cache->buckets[bucket];
+	cache->buckets[bucket] = e;
+}
+
+// Toglie l'entry "e" dalla tabella hash
+// Removes entry e from the hash table
+static void BlockCache_hashRemove(BlockCache* cache, int e) {
+	int* link = &cache->buckets[BlockCache_bucket(cache, cache->entries[e].block_num)];
+	while(*link != e) link = &cache->entries[*link].hash_next;
+	*link = cache->entries[e].hash_next;
+}
+
+// Toglie l'entry "e" dalla lista in cui si trova
+// Unlinks entry e from its list
+static void BlockCache_unlink(BlockCache* cache, int e) {
+	BlockCacheEntry* entry = &cache->entries[e];
+	if(entry->prev != -1) cache->entries[entry->prev].next = entry->next;
+	else cache->head[entry->list] = entry->next;
+	if(entry->next != -1) cache->entries[entry->next].prev = entry->prev;
+	else cache->tail[entry->list] = entry->prev;
+	cache->size[entry->list]--;
+}
+
+// Inserisce l'entry "e" in testa (dalla parte dei blocchi usati più di recente) alla lista "list"
+// Links entry e at the MRU end of list
+static void BlockCache_pushFront(BlockCache* cache, int e, int list) {
+	BlockCacheEntry* entry = &cache->entries[e];
+	entry->list = list;
+	entry->prev = -1;
+	entry->next = cache->head[list];
+	if(cache->head[list] != -1) cache->entries[cache->head[list]].prev = e;
+	else cache->tail[list] = e;
+	cache->head[list] = e;
+	cache->size[list]++;
+}
+
+// Rimette l'entry "e" (già tolta dalla sua lista) tra quelle libere
+// Gives entry e (already unlinked) back to the free entries
+static void BlockCache_freeEntry(BlockCache* cache, int e) {
+	BlockCache_hashRemove(cache, e);
+	cache->entries[e].list = CACHE_FREE;
+	cache->entries[e].next = cache->free_entries;
+	cache->free_entries = e;
+}
+
+// Scrive su disco il frame dell'entry "e", se è stato modificato
+// Writes back the frame of entry e if it is dirty
+static int BlockCache_writeBack(BlockCache* cache, int e) {
+	BlockCacheEntry* entry = &cache->entries[e];
+	if(!entry->dirty) return 0;
+	if(cache->write(cache->ctx, entry->block_num, cache->frames + (size_t) entry->frame * cache->block_size) == -1) return -1;
+	entry->dirty = 0;
+	cache->writebacks++;
+	return 0;
+}
+
+// Libera il frame dell'entry "e" (scrivendolo su disco se necessario), che resta nella sua lista
+// Releases the frame of entry e, writing it back first
+static int BlockCache_dropFrame(BlockCache* cache, int e) {
+	if(BlockCache_writeBack(cache, e) == -1) return -1;
+	cache->free_frames[cache->num_free_frames++] = cache->entries[e].frame;
+	cache->entries[e].frame = -1;
+	cache->evictions++;
+	return 0;
+}
+
+// Cerca, partendo dal blocco usato meno di recente, il primo blocco della lista "list" che non è in uso
+// Finds the least recently used entry of list that is not pinned, -1 if there is none
+static int BlockCache_victim(const BlockCache* cache, int list) {
+	int e = cache->tail[list];
+	while(e != -1 && cache->entries[e].pins > 0) e = cache->entries[e].prev;
+	return e;
+}
+
+// Passo REPLACE di ARC: libera un frame spostando un blocco da T1 in B1, oppure da T2 in B2.
+// Si sceglie T1 se è più grande della dimensione obiettivo "target" (o uguale, se il blocco richiesto era in B2);
+// se la lista scelta ha tutti i blocchi in uso, si prova con l'altra
+// ARC's REPLACE: frees a frame by demoting the LRU block of T1 (to B1) or of T2 (to B2)
+static int BlockCache_replace(BlockCache* cache, int in_b2) {
+	int from = CACHE_T2;
+	if(cache->size[CACHE_T1] > 0 && (cache->size[CACHE_T1] > cache->target || (in_b2 && cache->size[CACHE_T1] == cache->target))) from = CACHE_T1;
+
+	int e = BlockCache_victim(cache, from);
+	if(e == -1) {
+		from = from == CACHE_T1 ? CACHE_T2 : CACHE_T1;
+		e = BlockCache_victim(cache, from);
+	}
+	if(e == -1 || BlockCache_dropFrame(cache, e) == -1) return -1;
+
+	// Il blocco resta nella cache solo come "fantasma", senza dati
+	BlockCache_unlink(cache, e);
+	BlockCache_pushFront(cache, e, from == CACHE_T1 ? CACHE_B1 : CACHE_B2);
+	return 0;
+}
+
+// Elimina del tutto il blocco fantasma usato meno di recente della lista "list"
+// Forgets the LRU ghost of list
+static void BlockCache_dropGhost(BlockCache* cache, int list) {
+	int e = cache->tail[list];
+	if(e == -1) return;
+	BlockCache_unlink(cache, e);
+	BlockCache_freeEntry(cache, e);
+}
+
+// Hit su un blocco residente: passa in testa a T2, perché è stato usato almeno due volte, e il suo frame viene bloccato
+// A hit on a resident block: it moves to the MRU end of T2 and its frame is pinned
+static char* BlockCache_hit(BlockCache* cache, int e) {
+	BlockCache_unlink(cache, e);
+	BlockCache_pushFront(cache, e, CACHE_T2);
+	cache->entries[e].pins++;
+	cache->hits++;
+	return cache->frames + (size_t) cache->entries[e].frame * cache->block_size;
+}
+
+
+// Crea una cache con tanti frame quanti ne entrano in "budget" byte (almeno CACHE_MIN_FRAMES).
+// I frame sono allineati alla pagina, così possono essere usati anche con O_DIRECT
+// Creates a cache of budget bytes of frames, aligned so that they can be used with O_DIRECT
+BlockCache* BlockCache_create(size_t budget, int block_size, BlockCacheRead read, BlockCacheWrite write, void* ctx) {
+	if(block_size <= 0 || read == NULL || write == NULL) return NULL;
+
+	BlockCache* cache = calloc(1, sizeof(BlockCache));
+	if(cache == NULL) return NULL;
+	cache->num_frames = budget / block_size;
+	if(cache->num_frames < CACHE_MIN_FRAMES) cache->num_frames = CACHE_MIN_FRAMES;
+	cache->block_size = block_size;
+	cache->read = read;
+	cache->write = write;
+	cache->ctx = ctx;
+
+	// La tabella hash ha almeno un bucket per ogni entry (residente o fantasma), in numero pari a una potenza di 2
+	cache->num_buckets = 1;
+	while(cache->num_buckets < 2 * cache->num_frames) cache->num_buckets *= 2;
+
+	if(posix_memalign((void **) &cache->frames, 4096, (size_t) cache->num_frames * block_size) != 0) cache->frames = NULL;
+	cache->free_frames = malloc(cache->num_frames * sizeof(int));
+	cache->entries = malloc(2 * cache->num_frames * sizeof(BlockCacheEntry));
+	cache->buckets = malloc(cache->num_buckets * sizeof(int));
+	if(cache->frames == NULL || cache->free_frames == NULL || cache->entries == NULL || cache->buckets == NULL) {
+		free(cache->frames);
+		free(cache->free_frames);
+		free(cache->entries);
+		free(cache->buckets);
+		free(cache);
+		return NULL;
+	}
+
+	// All'inizio tutti i frame e tutte le entry sono liberi, e le quattro liste sono vuote
+	int i;
+	for(i = 0; i < cache->num_frames; i++) cache->free_frames[i] = cache->num_frames - 1 - i;
+	cache->num_free_frames = cache->num_frames;
+	for(i = 0; i < 2 * cache->num_frames; i++) {
+		cache->entries[i].list = CACHE_FREE;
+		cache->entries[i].next = i + 1 < 2 * cache->num_frames ? i + 1 : -1;
+	}
+	cache->free_entries = 0;
+	for(i = 0; i < cache->num_buckets; i++) cache->buckets[i] = -1;
+	for(i = 0; i < 4; i++) {
+		cache->head[i] = cache->tail[i] = -1;
+		cache->size[i] = 0;
+	}
+	cache->target = 0;
+	pthread_mutex_init(&cache->lock, NULL);
+	return cache;
+}
+
+// Restituisce il frame che contiene il blocco "block_num" (bloccato finché non viene chiamata BlockCache_release),
+// caricandolo dal disco se non è nella cache, e aggiorna le liste secondo ARC:
+//  - un blocco già presente passa in testa a T2 (usato almeno due volte);
+//  - un blocco fantasma in B1 (o B2) fa crescere (o diminuire) la dimensione obiettivo di T1, e passa in T2;
+//  - un blocco nuovo entra in T1, così una scansione che legge ogni blocco una sola volta sposta solo i blocchi di T1
+// Returns the pinned frame of block_num, loading it on a miss and updating the ARC lists
+char* BlockCache_get(BlockCache* cache, int block_num, int load) {
+	pthread_mutex_lock(&cache->lock);
+	int e = BlockCache_lookup(cache, block_num);
+
+	// Il blocco è nella cache
+	if(e != -1 && (cache->entries[e].list == CACHE_T1 || cache->entries[e].list == CACHE_T2)) {
+		char* frame = BlockCache_hit(cache, e);
+		pthread_mutex_unlock(&cache->lock);
+		return frame;
+	}
+	cache->misses++;
+
+	int c = cache->num_frames, list;
+	if(e != -1) {
+
+		// Il blocco era stato tolto da poco dalla cache: se era in B1, T1 era troppo piccola; se era in B2, lo era T2
+		int in_b2 = cache->entries[e].list == CACHE_B2;
+		if(!in_b2) {
+			int delta = cache->size[CACHE_B1] >= cache->size[CACHE_B2] ? 1 : cache->size[CACHE_B2] / cache->size[CACHE_B1];
+			cache->target = cache->target + delta > c ? c : cache->target + delta;
+		}else{
+			int delta = cache->size[CACHE_B2] >= cache->size[CACHE_B1] ? 1 : cache->size[CACHE_B1] / cache->size[CACHE_B2];
+			cache->target = cache->target - delta < 0 ? 0 : cache->target - delta;
+		}
+		if(cache->num_free_frames == 0 && BlockCache_replace(cache, in_b2) == -1) {
+			pthread_mutex_unlock(&cache->lock);
+			return NULL;
+		}
+		BlockCache_unlink(cache, e);
+		list = CACHE_T2;
+	}else{
+
+		// Blocco mai visto (o dimenticato): tengo |T1| + |B1| <= c e il totale delle entry <= 2c
+		int l1 = cache->size[CACHE_T1] + cache->size[CACHE_B1];
+		int total = l1 + cache->size[CACHE_T2] + cache->size[CACHE_B2];
+		int ret = 0;
+		if(l1 >= c) {
+			if(cache->size[CACHE_T1] < c) {
+				BlockCache_dropGhost(cache, CACHE_B1);
+				if(cache->num_free_frames == 0) ret = BlockCache_replace(cache, 0);
+			}else{
+
+				// T1 occupa tutta la cache: il suo blocco meno recente viene eliminato senza diventare un fantasma
+				int v = BlockCache_victim(cache, CACHE_T1);
+				if(v != -1 && BlockCache_dropFrame(cache, v) == 0) {
+					BlockCache_unlink(cache, v);
+					BlockCache_freeEntry(cache, v);
+				}else{
+					ret = -1;
+				}
+			}
+		}else if(total >= c) {
+			if(total >= 2 * c) BlockCache_dropGhost(cache, CACHE_B2);
+			if(cache->num_free_frames == 0) ret = BlockCache_replace(cache, 0);
+		}
+
+		// Se sono finite le entry (perché ci sono blocchi in uso), dimentico un fantasma
+		if(ret == 0 && cache->free_entries == -1) BlockCache_dropGhost(cache, cache->size[CACHE_B1] > 0 ? CACHE_B1 : CACHE_B2);
+		if(ret == -1 || cache->free_entries == -1 || cache->num_free_frames == 0) {
+			pthread_mutex_unlock(&cache->lock);
+			return NULL;
+		}
+
+		e = cache->free_entries;
+		cache->free_entries = cache->entries[e].next;
+		cache->entries[e].block_num = block_num;
+		BlockCache_hashInsert(cache, e);
+		list = CACHE_T1;
+	}
+
+	// Assegno un frame al blocco e, se richiesto, lo leggo dal disco
+	BlockCacheEntry* entry = &cache->entries[e];
+	entry->frame = cache->free_frames[--cache->num_free_frames];
+	entry->dirty = 0;
+	entry->pins = 1;
+	char* frame = cache->frames + (size_t) entry->frame * cache->block_size;
+	if(load && cache->read(cache->ctx, block_num, frame) == -1) {
+		cache->free_frames[cache->num_free_frames++] = entry->frame;
+		entry->frame = -1;
+		BlockCache_freeEntry(cache, e);
+		pthread_mutex_unlock(&cache->lock);
+		return NULL;
+	}
+	BlockCache_pushFront(cache, e, list);
+	pthread_mutex_unlock(&cache->lock);
+	return frame;
+}
+
+// Restituisce il frame del blocco "block_num" (bloccato) solo se è già nella cache, senza leggerlo dal disco
+// Returns the pinned frame of block_num only if it is cached
+char* BlockCache_find(BlockCache* cache, int block_num) {
+	pthread_mutex_lock(&cache->lock);
+	char* frame = NULL;
+	int e = BlockCache_lookup(cache, block_num);
+	if(e != -1 && (cache->entries[e].list == CACHE_T1 || cache->entries[e].list == CACHE_T2)) frame = BlockCache_hit(cache, e);
+	pthread_mutex_unlock(&cache->lock);
+	return frame;
+}
+
+// Sblocca il frame del blocco "block_num" e, se "dirty" vale 1, lo segna come da scrivere su disco
+// Unpins the frame of block_num, marking it dirty if asked
+void BlockCache_release(BlockCache* cache, int block_num, int dirty) {
+	pthread_mutex_lock(&cache->lock);
+	int e = BlockCache_lookup(cache, block_num);
+	if(e != -1 && cache->entries[e].frame != -1) {
+		if(cache->entries[e].pins > 0) cache->entries[e].pins--;
+		if(dirty) cache->entries[e].dirty = 1;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+// Segna il frame del blocco "block_num" (se è nella cache) come da scrivere su disco
+// Marks the frame of block_num as dirty
+void BlockCache_markDirty(BlockCache* cache, int block_num) {
+	pthread_mutex_lock(&cache->lock);
+	int e = BlockCache_lookup(cache, block_num);
+	if(e != -1 && cache->entries[e].frame != -1) cache->entries[e].dirty = 1;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+// Confronta due entry della cache "arg" in base al numero del blocco (per qsort_r)
+static int BlockCache_compareBlocks(const void* a, const void* b, void* arg) {
+	const BlockCache* cache = (const BlockCache *) arg;
+	int x = cache->entries[*(const int *) a].block_num, y = cache->entries[*(const int *) b].block_num;
+	return (x > y) - (x < y);
+}
+
+// Scrive su disco tutti i frame modificati, in ordine di blocco, in modo che le scritture siano il più possibile sequenziali
+// Writes back all the dirty frames, sorted by block number
+int BlockCache_flush(BlockCache* cache) {
+	pthread_mutex_lock(&cache->lock);
+
+	// Raccolgo i frame modificati delle due liste dei blocchi residenti
+	int* dirty = malloc(cache->num_frames * sizeof(int));
+	int n = 0, list, e, ret = 0;
+	if(dirty == NULL) {
+		pthread_mutex_unlock(&cache->lock);
+		return -1;
+	}
+	for(list = CACHE_T1; list <= CACHE_T2; list++) {
+		for(e = cache->head[list]; e != -1; e = cache->entries[e].next) {
+			if(cache->entries[e].dirty) dirty[n++] = e;
+		}
+	}
+
+	// Li ordino per numero di blocco e li scrivo
+	qsort_r(dirty, n, sizeof(int), BlockCache_compareBlocks, cache);
+	for(e = 0; e < n; e++) {
+		if(BlockCache_writeBack(cache, dirty[e]) == -1) ret = -1;
+	}
+	free(dirty);
+
+	pthread_mutex_unlock(&cache->lock);
+	return ret == -1 ? -1 : n;
+}
+
+// Scrive su disco i frame modificati e libera la memoria della cache
+// Writes back the dirty frames and frees the cache
+void BlockCache_destroy(BlockCache* cache) {
+	if(cache == NULL) return;
+	BlockCache_flush(cache);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->frames);
+	free(cache->free_frames);
+	free(cache->entries);
+	free(cache->buckets);
+	free(cache);
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// lists of the ARC policy: T1 and T2 hold resident blocks (seen once / seen at least twice),
+// B1 and B2 hold only the numbers of blocks recently evicted from T1 and T2 (ghosts)
+#define CACHE_T1 0
+#define CACHE_T2 1
+#define CACHE_B1 2
+#define CACHE_B2 3
+#define CACHE_FREE 4
+
+// minimum number of frames of a cache, whatever the memory budget
+#define CACHE_MIN_FRAMES 16
+
+// functions used by the cache to move a block between the disk and a frame
+// they return -1 on error, 0 otherwise
+typedef int (*BlockCacheRead)(void* ctx, int block_num, char* dest);
+typedef int (*BlockCacheWrite)(void* ctx, int block_num, const char* src);
+
+// an entry of the cache: a resident block (T1, T2) has a frame, a ghost (B1, B2) has none
+typedef struct {
+  int block_num;
+  int list;            // CACHE_T1, CACHE_T2, CACHE_B1, CACHE_B2 or CACHE_FREE
+  int prev, next;      // position in its list (-1 at the ends)
+  int hash_next;       // next entry in the same bucket of the hash table
+  int frame;           // frame holding the data, -1 for ghosts
+  int pins;            // how many pointers to the frame are in use
+  int dirty;           // 1 if the frame has to be written back
+} BlockCacheEntry;
+
+// a block cache with a fixed number of frames, managed with ARC (adaptive replacement cache):
+// blocks read once and blocks read again are kept in two lists whose sizes adapt to the workload,
+// so a long sequential scan can't push out the blocks that are used often
+typedef struct {
+  int num_frames;      // c: resident blocks at most
+  int block_size;
+  char* frames;        // num_frames * block_size bytes, aligned for O_DIRECT
+  int* free_frames;    // stack of unused frames
+  int num_free_frames;
+
+  BlockCacheEntry* entries; // 2 * num_frames entries (resident + ghosts)
+  int free_entries;    // list of unused entries (through next), -1 if empty
+  int* buckets;        // hash table block_num -> entry
+  int num_buckets;
+
+  int head[4], tail[4], size[4]; // MRU end, LRU end and size of T1, T2, B1, B2
+  int target;          // p: target size of T1
+
+  BlockCacheRead read;
+  BlockCacheWrite write;
+  void* ctx;
+  pthread_mutex_t lock;
+
+  // statistics
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t writebacks;
+} BlockCache;
+
+// creates a cache using at most budget bytes for the frames (at least CACHE_MIN_FRAMES frames)
+// read and write move blocks between the disk and the frames, ctx is passed to them
+// returns NULL if the memory can't be allocated
+BlockCache* BlockCache_create(size_t budget, int block_size, BlockCacheRead read, BlockCacheWrite write, void* ctx);
+
+// returns the frame holding block_num, reading it from the disk if it is not cached
+// (if load is 0 the block is not read: the caller is going to overwrite all of it)
+// the frame is pinned: it will not be evicted until BlockCache_release is called
+// returns NULL if the block can't be read or all the frames are pinned
+char* BlockCache_get(BlockCache* cache, int block_num, int load);
+
+// returns the pinned frame holding block_num if it is cached, NULL otherwise (nothing is read)
+char* BlockCache_find(BlockCache* cache, int block_num);
+
+// unpins the frame of block_num; if dirty is 1, the frame will be written back
+void BlockCache_release(BlockCache* cache, int block_num, int dirty);
+
+// marks the frame of block_num (if cached) as to be written back
+void BlockCache_markDirty(BlockCache* cache, int block_num);
+
+// writes back all the dirty frames, in block order
+// returns the number of frames written back, -1 if one of the writes failed
+int BlockCache_flush(BlockCache* cache);
+
+// writes back the dirty frames and releases the cache
+void BlockCache_destroy(BlockCache* cache);
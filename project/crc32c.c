@@ -0,0 +1,118 @@
+#include "crc32c.h"
+#include <pthread.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// Polinomio di Castagnoli, con i bit in ordine inverso
+#define CRC32C_POLY 0x82f63b78
+
+// Tabelle dello slicing-by-8: la tabella k dà il CRC di un byte seguito da k byte a 0
+static uint32_t crc32c_table[8][256];
+
+// Versione scelta al primo uso
+static uint32_t (*crc32c_update)(uint32_t crc, const unsigned char* data, size_t len);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+// Calcola il CRC un byte alla volta, con la prima tabella
+// Updates the (inverted) crc one byte at a time
+static inline uint32_t CRC32C_bytes(uint32_t crc, const unsigned char* data, size_t len) {
+	while(len--) crc = crc32c_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+// Slicing-by-8: ogni passo legge 8 byte e combina 8 letture nelle tabelle, invece di 8 passi dipendenti uno dall'altro
+// Slicing-by-8 version, on the inverted crc
+static uint32_t CRC32C_slicing8(uint32_t crc, const unsigned char* data, size_t len) {
+
+	// Arrivo ad un indirizzo allineato a 8 byte un byte alla volta
+	while(len > 0 && ((uintptr_t) data & 7) != 0) {
+		crc = crc32c_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	while(len >= 8) {
+		uint32_t low, high;
+		memcpy(&low, data, 4);
+		memcpy(&high, data + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		low = __builtin_bswap32(low);
+		high = __builtin_bswap32(high);
+#endif
+		low ^= crc;
+		crc = crc32c_table[7][low & 0xff] ^ crc32c_table[6][(low >> 8) & 0xff] ^ crc32c_table[5][(low >> 16) & 0xff] ^ crc32c_table[4][low >> 24]
+			^ crc32c_table[3][high & 0xff] ^ crc32c_table[2][(high >> 8) & 0xff] ^ crc32c_table[1][(high >> 16) & 0xff] ^ crc32c_table[0][high >> 24];
+		data += 8;
+		len -= 8;
+	}
+	return CRC32C_bytes(crc, data, len);
+}
+
+#if defined(__x86_64__)
+// Istruzione crc32 di SSE4.2: 8 byte per istruzione. La funzione viene compilata per SSE4.2 anche se il resto del programma
+// non lo è, e viene usata solo se la cpu ha l'istruzione
+// Hardware version, with the SSE4.2 crc32 instruction
+__attribute__((target("sse4.2")))
+static uint32_t CRC32C_sse42(uint32_t crc, const unsigned char* data, size_t len) {
+	uint64_t crc64 = crc;
+	while(len > 0 && ((uintptr_t) data & 7) != 0) {
+		crc64 = _mm_crc32_u8((uint32_t) crc64, *data++);
+		len--;
+	}
+	while(len >= 8) {
+		uint64_t word;
+		memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		data += 8;
+		len -= 8;
+	}
+	crc = (uint32_t) crc64;
+	while(len--) crc = _mm_crc32_u8(crc, *data++);
+	return crc;
+}
+#endif
+
+// Riempie le tabelle e sceglie la versione da usare
+// Fills the tables and chooses the version
+static void CRC32C_init(void) {
+	int i, k;
+	for(i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for(k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32c_table[0][i] = crc;
+	}
+	for(i = 0; i < 256; i++) {
+		for(k = 1; k < 8; k++) crc32c_table[k][i] = crc32c_table[0][crc32c_table[k - 1][i] & 0xff] ^ (crc32c_table[k - 1][i] >> 8);
+	}
+
+	crc32c_update = CRC32C_slicing8;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse4.2")) crc32c_update = CRC32C_sse42;
+#endif
+}
+
+// Calcola il CRC32C di "len" byte, continuando da "crc" (il CRC viene invertito all'inizio e alla fine, come in zlib)
+// Returns the CRC32C of data, continuing from crc
+uint32_t CRC32C_update(uint32_t crc, const void* data, size_t len) {
+	pthread_once(&crc32c_once, CRC32C_init);
+	return ~crc32c_update(~crc, data, len);
+}
+
+// Come CRC32C_update, sempre con lo slicing-by-8
+// Same as CRC32C_update, always in software
+uint32_t CRC32C_updateSoftware(uint32_t crc, const void* data, size_t len) {
+	pthread_once(&crc32c_once, CRC32C_init);
+	return ~CRC32C_slicing8(~crc, data, len);
+}
+
+// Restituisce 1 se viene usata l'istruzione di SSE4.2
+// Returns 1 if the hardware version is used
+int CRC32C_hardware(void) {
+	pthread_once(&crc32c_once, CRC32C_init);
+#if defined(__x86_64__)
+	return crc32c_update == CRC32C_sse42;
+#else
+	return 0;
+#endif
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC32C (Castagnoli polynomial, the one of iSCSI and ext4), used for the checksums of the blocks
+// the hardware version (SSE4.2 crc32 instruction) is chosen at run time if the cpu has it,
+// otherwise a slicing-by-8 table version is used
+
+// returns the CRC32C of the len bytes of data, continuing from crc
+// (0 for the first piece: CRC32C_update(0, "123456789", 9) is 0xe3069283)
+uint32_t CRC32C_update(uint32_t crc, const void* data, size_t len);
+
+// same as CRC32C_update, always with the slicing-by-8 version
+uint32_t CRC32C_updateSoftware(uint32_t crc, const void* data, size_t len);
+
+// returns 1 if CRC32C_update uses the SSE4.2 instruction, 0 otherwise
+int CRC32C_hardware(void);
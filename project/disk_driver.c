@@ -8,6 +8,1441 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 
+// Cursore di allocazione del thread corrente, usato da DiskDriver_allocBlock quando non viene passato un cursore
+static __thread DiskCursor thread_cursor = { -1, 0 };
+
+// Numero di thread che hanno già scelto un gruppo: serve a far partire thread diversi da gruppi diversi
+static int thread_groups = 0;
+
+// Segna come da sincronizzare tutte le pagine del file che contengono i "len" byte a partire dalla posizione "offset"
+// Marks as dirty the pages of the file containing the len bytes starting at offset
+static void DiskDriver_markDirtyOffset(DiskDriver* disk, size_t offset, size_t len) {
+	int first = offset / disk->page_size, last = (offset + len - 1) / disk->page_size;
+	pthread_mutex_lock(&disk->dirty_lock);
+	BitMap_setRange(&disk->dirty_pages, first, last - first + 1);
+	pthread_mutex_unlock(&disk->dirty_lock);
+}
+
+// Segna come da sincronizzare tutte le pagine della mmap che contengono i "len" byte a partire da "addr"
+// Marks as dirty the pages of the mapping containing the len bytes starting at addr
+static void DiskDriver_markDirtyRange(DiskDriver* disk, const void* addr, size_t len) {
+	DiskDriver_markDirtyOffset(disk, (const char *) addr - (const char *) disk->header, len);
+}
+
+// Dimentica che gli "n" blocchi a partire da "start" sono stati verificati: il loro checksum verrà controllato alla prossima lettura.
+// Viene chiamata quando i blocchi vengono letti di nuovo dal file, anche mentre chi legge ha già checksum_lock, quindi usa solo operazioni atomiche
+// Forgets that the blocks were verified, because they are read again from the file
+static void DiskDriver_checksumForget(DiskDriver* disk, int start, int n) {
+	if(disk->checksum_verified == NULL) return;
+	int i = start, end = start + n;
+	while(i < end && i % 8 != 0) {
+		__atomic_fetch_and(&disk->checksum_verified[i / 8], (unsigned char) ~(1 << (i % 8)), __ATOMIC_RELAXED);
+		i++;
+	}
+	for(; i + 8 <= end; i += 8) __atomic_store_n(&disk->checksum_verified[i / 8], 0, __ATOMIC_RELAXED);
+	for(; i < end; i++) __atomic_fetch_and(&disk->checksum_verified[i / 8], (unsigned char) ~(1 << (i % 8)), __ATOMIC_RELAXED);
+}
+
+// Segna come occupati (status = 1) o liberi (status = 0) i "len" blocchi del gruppo "group" a partire da "start",
+// aggiornando il contatore dei blocchi liberi del gruppo. Chi la chiama deve avere il lock del gruppo.
+// Restituisce quanti blocchi hanno effettivamente cambiato stato
+// Marks len blocks of a group as used or free, the lock of the group must be held
+static int DiskDriver_markGroup(DiskDriver* disk, DiskGroup* group, int start, int len, int status) {
+
+	// Conto i blocchi che cambiano stato, poi li imposto tutti insieme
+	int changed = BitMap_countRange(&disk->bitmap, start, len, !status);
+	if(status) BitMap_setRange(&disk->bitmap, start, len);
+	else BitMap_clearRange(&disk->bitmap, start, len);
+
+	// Il contatore viene letto anche senza lock (da DiskDriver_freeCount e dalla ricerca di un gruppo), quindi lo cambio in modo atomico
+	__atomic_add_fetch(&group->free_blocks, status ? -changed : changed, __ATOMIC_RELAXED);
+	return changed;
+}
+
+// Segna come occupati (status = 1) o liberi (status = 0) gli "n" blocchi a partire da "start", aggiornando
+// il contatore di ogni gruppo di allocazione coinvolto (ognuno con il suo lock). Il contatore nel DiskHeader
+// non viene toccato: è la somma di quelli dei gruppi, e viene salvato da DiskDriver_flush.
+// Restituisce quanti blocchi hanno effettivamente cambiato stato
+// Marks n blocks starting from start as used or free, keeping the free counters of the groups up to date
+static int DiskDriver_markRange(DiskDriver* disk, int start, int n, int status) {
+	int changed = 0, first = start, total = n;
+
+	// Divido l'intervallo nelle parti che appartengono a ciascun gruppo
+	while(n > 0) {
+		DiskGroup* group = &disk->groups[start / DISK_GROUP_BLOCKS];
+		int len = group->first_block + group->num_blocks - start;
+		if(len > n) len = n;
+
+		pthread_mutex_lock(&group->lock);
+		changed += DiskDriver_markGroup(disk, group, start, len, status);
+		pthread_mutex_unlock(&group->lock);
+
+		start += len;
+		n -= len;
+	}
+
+	// I byte della bitmap appena modificati andranno sincronizzati
+	DiskDriver_markDirtyOffset(disk, disk->header->bitmap_offset + first / 8, (first + total - 1) / 8 - first / 8 + 1);
+	return changed;
+}
+
+// Riserva il primo blocco libero del gruppo "group" tra "start" e la fine del gruppo. La ricerca fatta prima senza lock
+// è solo un suggerimento: un altro thread può aver preso il blocco nel frattempo, quindi qui lo cerco di nuovo con il lock del gruppo.
+// Restituisce il blocco riservato, -1 se nel gruppo non ci sono blocchi liberi dopo "start"
+// Reserves the first free block of the group from start, holding the lock of the group
+static int DiskDriver_claimBlock(DiskDriver* disk, DiskGroup* group, int start) {
+	int end = group->first_block + group->num_blocks, block = -1;
+	if(start < group->first_block) start = group->first_block;
+	if(start >= end) return -1;
+
+	pthread_mutex_lock(&group->lock);
+	if(group->free_blocks > 0) {
+		block = BitMap_get(&disk->bitmap, start, 0);
+		if(block >= end) block = -1;
+		if(block != -1) DiskDriver_markGroup(disk, group, block, 1, 1);
+	}
+	pthread_mutex_unlock(&group->lock);
+
+	if(block != -1) DiskDriver_markDirtyOffset(disk, disk->header->bitmap_offset + block / 8, 1);
+	return block;
+}
+
+// Riserva gli "n" blocchi a partire da "start" solo se sono ancora tutti liberi. Prendo i lock di tutti i gruppi coinvolti,
+// in ordine crescente (così due thread non si bloccano a vicenda), quindi nessuno può occupare una parte dell'intervallo
+// tra il controllo e la modifica. Restituisce 0, o -1 se nel frattempo un blocco è stato occupato
+// Reserves the n blocks starting from start if they are all still free
+static int DiskDriver_claimRange(DiskDriver* disk, int start, int n) {
+	int first_group = start / DISK_GROUP_BLOCKS, last_group = (start + n - 1) / DISK_GROUP_BLOCKS, i, ret = 0;
+	for(i = first_group; i <= last_group; i++) pthread_mutex_lock(&disk->groups[i].lock);
+
+	if(BitMap_countRange(&disk->bitmap, start, n, 1) > 0) {
+		ret = -1;
+	}else{
+		int block = start, end = start + n;
+		for(i = first_group; i <= last_group; i++) {
+			int group_end = disk->groups[i].first_block + disk->groups[i].num_blocks;
+			int len = (group_end < end ? group_end : end) - block;
+			DiskDriver_markGroup(disk, &disk->groups[i], block, len, 1);
+			block += len;
+		}
+	}
+
+	for(i = last_group; i >= first_group; i--) pthread_mutex_unlock(&disk->groups[i].lock);
+	if(ret == 0) DiskDriver_markDirtyOffset(disk, disk->header->bitmap_offset + start / 8, (start + n - 1) / 8 - start / 8 + 1);
+	return ret;
+}
+
+// Conta i blocchi liberi del disco sommando i contatori dei gruppi
+// Returns the free blocks of the disk, summing the counters of the groups
+int DiskDriver_freeCount(DiskDriver* disk) {
+	int free_blocks = 0, i;
+	for(i = 0; i < disk->num_groups; i++) free_blocks += __atomic_load_n(&disk->groups[i].free_blocks, __ATOMIC_RELAXED);
+	return free_blocks;
+}
+
+// Salva nel DiskHeader il numero dei blocchi liberi e il primo blocco libero, che durante l'uso non vengono aggiornati
+// Stores the free counter and the first free block in the DiskHeader
+static void DiskDriver_updateHeader(DiskDriver* disk) {
+	int free_blocks = DiskDriver_freeCount(disk);
+	int first_free_block = BitMap_get(&disk->bitmap, 0, 0);
+	if(disk->header->free_blocks == free_blocks && disk->header->first_free_block == first_free_block) return;
+	disk->header->free_blocks = free_blocks;
+	disk->header->first_free_block = first_free_block;
+	DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+}
+
+
+// Posizione nel file del blocco "block_num": i blocchi iniziano a data_offset, dopo il DiskHeader e la bitmap
+// Returns the offset of block block_num in the file
+static inline off_t DiskDriver_blockOffset(DiskDriver* disk, int block_num) {
+	return disk->data_offset + (off_t) block_num * BLOCK_SIZE;
+}
+
+// Spazio occupato nel file dalla bitmap quando si trova dopo i blocchi (un multiplo di DISK_DATA_ALIGN, per O_DIRECT)
+// Space taken by a bitmap of entries bytes placed after the blocks
+static inline size_t DiskDriver_bitmapSpace(size_t entries) {
+	return (entries + DISK_DATA_ALIGN - 1) & ~(size_t) (DISK_DATA_ALIGN - 1);
+}
+
+// Dimensione del file di un disco: finisce con i blocchi o, se DiskDriver_grow ha spostato la bitmap dopo di loro, con la bitmap
+// Size of the file of a disk
+static off_t DiskDriver_fileSize(const DiskHeader* header) {
+	if(header->bitmap_offset < header->data_offset) return header->data_offset + (off_t) header->num_blocks * BLOCK_SIZE;
+	return header->bitmap_offset + DiskDriver_bitmapSpace(header->bitmap_entries);
+}
+
+// Funzione che scrive su disco (o avvia la scrittura di) "len" byte a partire dalla posizione "offset" del file
+typedef int (*DiskRangeWriter)(DiskDriver* disk, size_t offset, size_t len);
+
+// Passa a "write_range" gli intervalli di pagine segnate come modificate. Le pagine vicine vengono unite in un unico intervallo:
+// scrivere un intervallo che contiene qualche pagina pulita non costa niente, mentre ogni intervallo in più è una chiamata di sistema.
+// Restituisce il numero di intervalli scritti, -1 se una delle scritture non è andata a buon fine
+// Passes the dirty ranges (merging nearby pages) to write_range, returns how many ranges were written or -1
+static int DiskDriver_syncRanges(DiskDriver* disk, DiskRangeWriter write_range) {
+	int ret = 0, start = 0, end, ranges = 0;
+
+	pthread_mutex_lock(&disk->dirty_lock);
+	while((start = BitMap_get(&disk->dirty_pages, start, 1)) != -1) {
+
+		// L'intervallo da sincronizzare va dalla prima pagina modificata alla prima pagina non modificata successiva,
+		// ma se dopo poche pagine pulite ce ne sono altre modificate, le unisco nello stesso intervallo
+		end = start;
+		do {
+			end = BitMap_get(&disk->dirty_pages, end, 0);
+			if(end == -1) end = disk->dirty_pages.num_bits;
+			int next = BitMap_get(&disk->dirty_pages, end, 1);
+			if(next == -1 || next - end > DISK_FLUSH_MERGE_GAP) break;
+			end = next;
+		} while(1);
+
+		// Tolgo le pagine dalla bitmap prima di scriverle: se nel frattempo vengono modificate di nuovo, verranno risegnate
+		BitMap_clearRange(&disk->dirty_pages, start, end - start);
+		pthread_mutex_unlock(&disk->dirty_lock);
+
+		size_t offset = (size_t) start * disk->page_size;
+		size_t len = (size_t) end * disk->page_size;
+		if(len > disk->file_size) len = disk->file_size;
+		if(write_range(disk, offset, len - offset) == -1) ret = -1;
+		ranges++;
+
+		pthread_mutex_lock(&disk->dirty_lock);
+		start = end;
+	}
+	pthread_mutex_unlock(&disk->dirty_lock);
+
+	return ret == -1 ? -1 : ranges;
+}
+
+
+/* Backend mmap: tutto il disco è mappato in memoria, i blocchi si leggono e si scrivono direttamente nella mappa */
+
+// Mappa in memoria tutto il file (DiskHeader, bitmap e blocchi)
+// Maps the whole file in memory
+static int DiskDriver_mmapOpen(DiskDriver* disk, int num_blocks, const DiskConfig* config) {
+	disk->map_size = disk->file_size;
+	disk->header = (DiskHeader*) mmap(0, disk->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, disk->fd, 0);
+	if(disk->header == MAP_FAILED) {
+		disk->header = NULL;
+		return -1;
+	}
+	disk->bitmap_data = (char *) disk->header + disk->header->bitmap_offset;
+	return 0;
+}
+
+// Il blocco si trova già nella mappa, e ci resta finché il disco è aperto
+// The block is already in the mapping
+static char* DiskDriver_mmapGetBlock(DiskDriver* disk, int block_num, int load) {
+	return (char *) disk->header + DiskDriver_blockOffset(disk, block_num);
+}
+
+// Segna come da sincronizzare le pagine della mappa che contengono il blocco
+// Marks the pages of the block as dirty
+static void DiskDriver_mmapMarkBlock(DiskDriver* disk, int block_num) {
+	DiskDriver_markDirtyRange(disk, (char *) disk->header + DiskDriver_blockOffset(disk, block_num), BLOCK_SIZE);
+}
+
+// Con la mmap non c'è niente da sbloccare
+// Nothing to unpin with the mmap backend
+static void DiskDriver_mmapReleaseBlock(DiskDriver* disk, int block_num) {
+}
+
+// Con la mmap le richieste asincrone vengono eseguite subito, copiando il blocco da o verso la mappa
+// Serves an asynchronous request at once, copying the block from or to the mapping
+static int DiskDriver_mmapSubmitBlock(DiskDriver* disk, int op, void* buffer, int block_num, void* tag) {
+	char* block = (char *) disk->header + DiskDriver_blockOffset(disk, block_num);
+	if(op == DISK_IO_READ) {
+		memcpy(buffer, block, BLOCK_SIZE);
+	}else{
+		memcpy(block, buffer, BLOCK_SIZE);
+		DiskDriver_mmapMarkBlock(disk, block_num);
+	}
+	return DiskIO_complete(disk->io, op, DiskDriver_blockOffset(disk, block_num), op == DISK_IO_READ ? buffer : NULL, tag, BLOCK_SIZE);
+}
+
+// Consigli di posix_fadvise e di madvise corrispondenti alle costanti DISK_ADVISE_*
+static const int disk_fadvise[] = { POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM, POSIX_FADV_WILLNEED, POSIX_FADV_DONTNEED };
+static const int disk_madvise[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, MADV_DONTNEED };
+
+// Passa il consiglio sugli "n" blocchi a partire da "block_num" alla page cache del file (con WILLNEED il kernel inizia a leggerli)
+// Gives the advice on the blocks to the page cache of the file
+static void DiskDriver_fadvise(DiskDriver* disk, int block_num, int n, int advice) {
+	posix_fadvise(disk->fd, DiskDriver_blockOffset(disk, block_num), (off_t) n * BLOCK_SIZE, disk_fadvise[advice]);
+}
+
+// Con la mmap il consiglio va dato alla mappa, che decide quanto leggere ad ogni page fault; l'intervallo parte dall'inizio della pagina.
+// Con DONTNEED le pagine vengono tolte dalla mappa (quelle modificate restano nella page cache), e poi scartate dalla page cache
+// Gives the advice on the pages of the mapping that hold the blocks
+static void DiskDriver_mmapAdvise(DiskDriver* disk, int block_num, int n, int advice) {
+	size_t start = DiskDriver_blockOffset(disk, block_num), end = start + (size_t) n * BLOCK_SIZE;
+	start &= ~(disk->page_size - 1);
+	madvise((char *) disk->header + start, end - start, disk_madvise[advice]);
+	if(advice == DISK_ADVISE_DONTNEED) {
+		DiskDriver_fadvise(disk, block_num, n, advice);
+		DiskDriver_checksumForget(disk, block_num, n);
+	}
+}
+
+// Avvia la scrittura su disco delle pagine modificate dell'intervallo, senza aspettarla
+// Starts the writeback of a range of the mapping
+static int DiskDriver_startWriteback(DiskDriver* disk, size_t offset, size_t len) {
+	return sync_file_range(disk->fd, offset, len, SYNC_FILE_RANGE_WRITE);
+}
+
+// Avvia la scrittura di ogni intervallo modificato, e alla fine aspetta la fine di tutte le scritture con una sola fdatasync
+// Starts the writeback of every dirty range, then waits for all of them with a single fdatasync
+static int DiskDriver_mmapSync(DiskDriver* disk) {
+	int ranges = DiskDriver_syncRanges(disk, DiskDriver_startWriteback);
+	if(ranges != 0) __atomic_fetch_add(&disk->syncs, 1, __ATOMIC_RELAXED);
+	if(ranges != 0 && fdatasync(disk->fd) == -1) return -1;
+	return ranges == -1 ? -1 : 0;
+}
+
+// Allunga la mappa fino alla nuova fine del file: prima provo ad allungarla sul posto, altrimenti la sposto.
+// Poi copio la bitmap nella sua nuova posizione (se cambia) e azzero i byte che si aggiungono
+// Extends the mapping with mremap (moving it if needed), then moves and extends the bitmap
+static int DiskDriver_mmapGrow(DiskDriver* disk, int num_blocks, off_t bitmap_offset, size_t bitmap_entries) {
+	void* map = mremap(disk->header, disk->map_size, disk->file_size, 0);
+	if(map == MAP_FAILED) map = mremap(disk->header, disk->map_size, disk->file_size, MREMAP_MAYMOVE);
+	if(map == MAP_FAILED) return -1;
+	disk->header = (DiskHeader*) map;
+	disk->map_size = disk->file_size;
+
+	size_t old_entries = disk->header->bitmap_entries;
+	char* bitmap = (char *) map + bitmap_offset;
+	memmove(bitmap, (char *) map + disk->header->bitmap_offset, old_entries);
+	memset(bitmap + old_entries, 0, bitmap_entries - old_entries);
+	disk->bitmap_data = bitmap;
+	return 0;
+}
+
+// Toglie la mappa di tutto il file
+// Unmaps the whole file
+static void DiskDriver_mmapClose(DiskDriver* disk) {
+	munmap(disk->header, disk->map_size);
+}
+
+
+/* Backend pread: DiskHeader e bitmap vengono letti in memoria, i blocchi passano per pread/pwrite e per una cache di blocchi */
+
+// Legge dal file il blocco "block_num" (usata dalla cache quando il blocco non è presente)
+// Reads block block_num from the file, for the block cache
+static int DiskDriver_preadBlock(void* ctx, int block_num, char* dest) {
+	DiskDriver* disk = (DiskDriver *) ctx;
+	DiskDriver_checksumForget(disk, block_num, 1);
+	return pread(disk->fd, dest, BLOCK_SIZE, DiskDriver_blockOffset(disk, block_num)) == BLOCK_SIZE ? 0 : -1;
+}
+
+// Scrive nel file il blocco "block_num" (usata dalla cache per i frame modificati)
+// Writes block block_num to the file, for the block cache
+static int DiskDriver_pwriteBlock(void* ctx, int block_num, const char* src) {
+	DiskDriver* disk = (DiskDriver *) ctx;
+	return pwrite(disk->fd, src, BLOCK_SIZE, DiskDriver_blockOffset(disk, block_num)) == BLOCK_SIZE ? 0 : -1;
+}
+
+// Legge in memoria DiskHeader e bitmap e crea la cache dei blocchi. Con O_DIRECT tutte le letture e scritture devono
+// essere allineate a 512 byte: lo sono i frame della cache, il buffer di DiskHeader e bitmap e, visto che data_offset
+// è un multiplo di DISK_DATA_ALIGN, anche i blocchi nel file
+// Reads header and bitmap in memory and creates the block cache; O_DIRECT is used only if the blocks are aligned
+static int DiskDriver_preadOpen(DiskDriver* disk, int num_blocks, const DiskConfig* config) {
+	size_t meta_size = disk->data_offset;
+	size_t buffer_size = (meta_size + 4095) & ~(size_t) 4095;
+
+	void* meta;
+	if(posix_memalign(&meta, 4096, buffer_size) != 0) return -1;
+	memset(meta, 0, buffer_size);
+
+	disk->direct_io = 0;
+	if(config->direct_io && meta_size % 512 == 0 && fcntl(disk->fd, F_SETFL, fcntl(disk->fd, F_GETFL) | O_DIRECT) == 0) disk->direct_io = 1;
+
+	// Con O_DIRECT leggo tutto il buffer, che è un multiplo di 512 byte
+	if(pread(disk->fd, meta, disk->direct_io ? buffer_size : meta_size, 0) < (ssize_t) meta_size) {
+		free(meta);
+		return -1;
+	}
+
+	// Se DiskDriver_grow ha spostato la bitmap dopo i blocchi, la leggo in un buffer a parte
+	DiskHeader* header = (DiskHeader*) meta;
+	void* bitmap = (char *) meta + header->bitmap_offset;
+	if(header->bitmap_offset >= disk->data_offset) {
+		size_t space = DiskDriver_bitmapSpace(header->bitmap_entries);
+		if(posix_memalign(&bitmap, 4096, space) != 0) {
+			free(meta);
+			return -1;
+		}
+		if(pread(disk->fd, bitmap, space, header->bitmap_offset) != (ssize_t) space) {
+			free(bitmap);
+			free(meta);
+			return -1;
+		}
+	}
+
+	disk->cache = BlockCache_create(config->cache_bytes ? config->cache_bytes : DISK_CACHE_DEFAULT_BYTES, BLOCK_SIZE, DiskDriver_preadBlock, DiskDriver_pwriteBlock, disk);
+	if(disk->cache == NULL) {
+		if(bitmap != (char *) meta + header->bitmap_offset) free(bitmap);
+		free(meta);
+		return -1;
+	}
+	disk->header = header;
+	disk->bitmap_data = bitmap;
+	disk->map_size = meta_size;
+	return 0;
+}
+
+// Il blocco viene cercato nella cache (e letto dal file, se non c'è), e resta bloccato nel suo frame
+// Gets the pinned frame of the block from the cache
+static char* DiskDriver_preadGetBlock(DiskDriver* disk, int block_num, int load) {
+	return BlockCache_get(disk->cache, block_num, load);
+}
+
+// Il frame del blocco dovrà essere scritto nel file
+// Marks the frame of the block as dirty
+static void DiskDriver_preadMarkBlock(DiskDriver* disk, int block_num) {
+	BlockCache_markDirty(disk->cache, block_num);
+}
+
+// Sblocca il frame: da ora in poi la cache può riutilizzarlo
+// Unpins the frame of the block
+static void DiskDriver_preadReleaseBlock(DiskDriver* disk, int block_num) {
+	BlockCache_release(disk->cache, block_num, 0);
+}
+
+// Accoda una lettura o una scrittura asincrona. Una lettura di un blocco presente nella cache viene servita subito dal suo frame;
+// una scrittura aggiorna anche la cache, così le letture successive non trovano il contenuto vecchio.
+// Se non c'è un engine asincrono, la richiesta viene eseguita subito con pread/pwrite
+// Queues an asynchronous request, serving cached reads from the frame and keeping the cache up to date on writes
+static int DiskDriver_preadSubmitBlock(DiskDriver* disk, int op, void* buffer, int block_num, void* tag) {
+	off_t offset = DiskDriver_blockOffset(disk, block_num);
+	char* frame;
+	if(op == DISK_IO_READ) {
+		if((frame = BlockCache_find(disk->cache, block_num)) != NULL) {
+			memcpy(buffer, frame, BLOCK_SIZE);
+			BlockCache_release(disk->cache, block_num, 0);
+			return DiskIO_complete(disk->io, op, offset, buffer, tag, BLOCK_SIZE);
+		}
+		if(disk->io->engine == DISK_IO_MEMORY) {
+			int ret = DiskDriver_preadBlock(disk, block_num, buffer);
+			return DiskIO_complete(disk->io, op, offset, buffer, tag, ret == 0 ? BLOCK_SIZE : -1);
+		}
+		return DiskIO_prepareRead(disk->io, disk->fd, offset, buffer, tag);
+	}
+
+	if((frame = BlockCache_get(disk->cache, block_num, 0)) != NULL) {
+		memcpy(frame, buffer, BLOCK_SIZE);
+		BlockCache_release(disk->cache, block_num, 0);
+	}
+	if(disk->io->engine == DISK_IO_MEMORY) {
+		int ret = DiskDriver_pwriteBlock(disk, block_num, buffer);
+		return DiskIO_complete(disk->io, op, offset, NULL, tag, ret == 0 ? BLOCK_SIZE : -1);
+	}
+	return DiskIO_prepareWrite(disk->io, disk->fd, offset, buffer, tag);
+}
+
+// Scrive nel file un intervallo di DiskHeader e bitmap: la parte prima dei blocchi viene dal buffer letto all'apertura,
+// quella della bitmap spostata dopo i blocchi dal suo buffer. Le parti dell'intervallo che cadono sui blocchi vengono saltate
+// Writes a range of header and bitmap to the file, skipping the parts that fall on the blocks
+static int DiskDriver_pwriteRange(DiskDriver* disk, size_t offset, size_t len) {
+	size_t end = offset + len;
+	if(offset < (size_t) disk->data_offset) {
+		size_t meta_end = end < (size_t) disk->data_offset ? end : (size_t) disk->data_offset;
+		if(pwrite(disk->fd, (char *) disk->header + offset, meta_end - offset, offset) != (ssize_t) (meta_end - offset)) return -1;
+	}
+
+	size_t bitmap_start = disk->header->bitmap_offset;
+	if(bitmap_start >= (size_t) disk->data_offset) {
+		size_t bitmap_end = bitmap_start + DiskDriver_bitmapSpace(disk->header->bitmap_entries);
+		size_t from = offset > bitmap_start ? offset : bitmap_start, to = end < bitmap_end ? end : bitmap_end;
+		if(from < to && pwrite(disk->fd, disk->bitmap_data + (from - bitmap_start), to - from, from) != (ssize_t) (to - from)) return -1;
+	}
+	return 0;
+}
+
+// Scrive nel file prima i blocchi modificati della cache, poi le parti modificate di DiskHeader e bitmap
+// (così la bitmap non segna mai come occupato un blocco il cui contenuto non è ancora stato scritto),
+// e aspetta tutte le scritture con una sola fdatasync
+// Writes back the dirty frames, then the dirty ranges of header and bitmap, then waits with a single fdatasync
+static int DiskDriver_preadSync(DiskDriver* disk) {
+	int blocks = BlockCache_flush(disk->cache);
+	int ranges = DiskDriver_syncRanges(disk, DiskDriver_pwriteRange);
+	if(blocks != 0 || ranges != 0) __atomic_fetch_add(&disk->syncs, 1, __ATOMIC_RELAXED);
+	if((blocks != 0 || ranges != 0) && fdatasync(disk->fd) == -1) return -1;
+	return blocks == -1 || ranges == -1 ? -1 : 0;
+}
+
+// I blocchi si raggiungono già con pread/pwrite: basta estendere la bitmap nel buffer di DiskHeader e bitmap oppure,
+// se deve essere spostata dopo i blocchi, copiarla in un nuovo buffer allineato (per O_DIRECT)
+// Extends the bitmap in the metadata buffer, or moves it to a new aligned buffer
+static int DiskDriver_preadGrow(DiskDriver* disk, int num_blocks, off_t bitmap_offset, size_t bitmap_entries) {
+	size_t old_entries = disk->header->bitmap_entries;
+	char* bitmap = disk->bitmap_data;
+	if(bitmap_offset != disk->header->bitmap_offset) {
+		void* buffer;
+		if(posix_memalign(&buffer, 4096, DiskDriver_bitmapSpace(bitmap_entries)) != 0) return -1;
+		memset(buffer, 0, DiskDriver_bitmapSpace(bitmap_entries));
+		memcpy(buffer, disk->bitmap_data, old_entries);
+		if(disk->header->bitmap_offset >= disk->data_offset) free(disk->bitmap_data);
+		bitmap = buffer;
+	}
+	memset(bitmap + old_entries, 0, bitmap_entries - old_entries);
+	disk->bitmap_data = bitmap;
+	return 0;
+}
+
+// Libera la cache dei blocchi (già sincronizzata) e i buffer di DiskHeader e bitmap
+// Frees the block cache and the buffers of header and bitmap
+static void DiskDriver_preadClose(DiskDriver* disk) {
+	BlockCache_destroy(disk->cache);
+	disk->cache = NULL;
+	if(disk->header->bitmap_offset >= disk->data_offset) free(disk->bitmap_data);
+	free(disk->header);
+}
+
+/* Backend a finestre: DiskHeader e bitmap restano mappati, i blocchi vengono raggiunti attraverso poche finestre di mappatura,
+   mappate al primo accesso e tolte quando servono per altre finestre (la meno usata di recente) */
+
+// Mappa DiskHeader e bitmap e prepara gli slot delle finestre; le pagine da sincronizzare riguardano comunque tutto il file
+// Maps header and bitmap and prepares the slots of the windows
+static int DiskDriver_windowsOpen(DiskDriver* disk, int num_blocks, const DiskConfig* config) {
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t data_size = (size_t) num_blocks * BLOCK_SIZE;
+
+	// La finestra deve iniziare ad un multiplo della pagina: data_offset lo è, quindi basta che lo sia la dimensione della finestra
+	disk->window_size = config->window_bytes ? config->window_bytes : DISK_WINDOW_DEFAULT_BYTES;
+	disk->window_size = (disk->window_size + page_size - 1) / page_size * page_size;
+	if(disk->window_size > data_size) disk->window_size = (data_size + page_size - 1) / page_size * page_size;
+	disk->num_windows = (data_size + disk->window_size - 1) / disk->window_size;
+	disk->max_windows = config->max_windows > 0 ? config->max_windows : DISK_WINDOW_DEFAULT_COUNT;
+
+	disk->header = (DiskHeader*) mmap(0, disk->data_offset, PROT_READ | PROT_WRITE, MAP_SHARED, disk->fd, 0);
+	if(disk->header == MAP_FAILED) {
+		disk->header = NULL;
+		return -1;
+	}
+
+	// Se DiskDriver_grow ha spostato la bitmap dopo i blocchi, la mappo a parte
+	disk->bitmap_data = (char *) disk->header + disk->header->bitmap_offset;
+	if(disk->header->bitmap_offset >= disk->data_offset) {
+		disk->bitmap_data = mmap(0, DiskDriver_bitmapSpace(disk->header->bitmap_entries), PROT_READ | PROT_WRITE, MAP_SHARED, disk->fd, disk->header->bitmap_offset);
+		if(disk->bitmap_data == MAP_FAILED) return -1;
+	}
+	disk->windows = calloc(disk->max_windows, sizeof(DiskWindow));
+	disk->window_slots = malloc(disk->num_windows * sizeof(int));
+	if(disk->windows == NULL || disk->window_slots == NULL) return -1;
+	memset(disk->window_slots, -1, disk->num_windows * sizeof(int));
+	disk->window_clock = 0;
+	disk->window_maps = 0;
+	disk->window_unmaps = 0;
+	pthread_mutex_init(&disk->window_lock, NULL);
+	disk->map_size = disk->data_offset;
+	return 0;
+}
+
+// Restituisce l'indirizzo del blocco nella sua finestra, mappandola se non lo è già. Se tutti gli slot sono occupati,
+// toglie la finestra usata meno di recente tra quelle senza blocchi in uso: le sue pagine restano nella page cache,
+// quindi le modifiche non ancora sincronizzate non vanno perse
+// Returns the address of the block inside its window, mapping the window (and unmapping the LRU one) if needed
+static char* DiskDriver_windowsGetBlock(DiskDriver* disk, int block_num, int load) {
+	off_t offset = (off_t) block_num * BLOCK_SIZE;
+	int window = offset / disk->window_size, i;
+
+	pthread_mutex_lock(&disk->window_lock);
+	int slot = disk->window_slots[window];
+	if(slot == -1) {
+
+		// Cerco uno slot libero o, se non ce ne sono, quello della finestra usata meno di recente e non bloccata
+		for(i = 0; i < disk->max_windows; i++) {
+			DiskWindow* candidate = &disk->windows[i];
+			if(candidate->addr == NULL) {
+				slot = i;
+				break;
+			}
+			if(candidate->pins == 0 && (slot == -1 || candidate->last_use < disk->windows[slot].last_use)) slot = i;
+		}
+		if(slot == -1) {
+			pthread_mutex_unlock(&disk->window_lock);
+			return NULL;
+		}
+
+		DiskWindow* victim = &disk->windows[slot];
+		if(victim->addr != NULL) {
+			munmap(victim->addr, victim->len);
+			disk->window_slots[victim->window] = -1;
+			victim->addr = NULL;
+			disk->window_unmaps++;
+		}
+
+		// L'ultima finestra può essere più corta delle altre
+		size_t len = (size_t) disk->header->num_blocks * BLOCK_SIZE - (size_t) window * disk->window_size;
+		if(len > disk->window_size) len = disk->window_size;
+		void* addr = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, disk->fd, disk->data_offset + (off_t) window * disk->window_size);
+		if(addr == MAP_FAILED) {
+			pthread_mutex_unlock(&disk->window_lock);
+			return NULL;
+		}
+		victim->addr = addr;
+		victim->len = len;
+		victim->window = window;
+		victim->pins = 0;
+		disk->window_slots[window] = slot;
+		disk->window_maps++;
+
+		// I blocchi della finestra vengono letti di nuovo dal file: andranno verificati di nuovo
+		DiskDriver_checksumForget(disk, (size_t) window * disk->window_size / BLOCK_SIZE, len / BLOCK_SIZE);
+	}
+
+	DiskWindow* w = &disk->windows[slot];
+	w->pins++;
+	w->last_use = ++disk->window_clock;
+	pthread_mutex_unlock(&disk->window_lock);
+	return w->addr + (offset - (off_t) window * disk->window_size);
+}
+
+// Segna come da sincronizzare le pagine del file che contengono il blocco
+// Marks the pages of the file holding the block as dirty
+static void DiskDriver_windowsMarkBlock(DiskDriver* disk, int block_num) {
+	DiskDriver_markDirtyOffset(disk, DiskDriver_blockOffset(disk, block_num), BLOCK_SIZE);
+}
+
+// Sblocca la finestra del blocco: quando non ha più blocchi in uso, può essere tolta
+// Unpins the window of the block
+static void DiskDriver_windowsReleaseBlock(DiskDriver* disk, int block_num) {
+	int window = (off_t) block_num * BLOCK_SIZE / disk->window_size;
+	pthread_mutex_lock(&disk->window_lock);
+	int slot = disk->window_slots[window];
+	if(slot != -1 && disk->windows[slot].pins > 0) disk->windows[slot].pins--;
+	pthread_mutex_unlock(&disk->window_lock);
+}
+
+// Come con la mmap, le richieste asincrone vengono eseguite subito copiando il blocco da o verso la sua finestra
+// Serves an asynchronous request at once, copying the block from or to its window
+static int DiskDriver_windowsSubmitBlock(DiskDriver* disk, int op, void* buffer, int block_num, void* tag) {
+	off_t offset = DiskDriver_blockOffset(disk, block_num);
+	void* dest = op == DISK_IO_READ ? buffer : NULL;
+	char* block = DiskDriver_windowsGetBlock(disk, block_num, 1);
+	if(block == NULL) return DiskIO_complete(disk->io, op, offset, dest, tag, -1);
+	if(op == DISK_IO_READ) {
+		memcpy(buffer, block, BLOCK_SIZE);
+	}else{
+		memcpy(block, buffer, BLOCK_SIZE);
+		DiskDriver_windowsMarkBlock(disk, block_num);
+	}
+	DiskDriver_windowsReleaseBlock(disk, block_num);
+	return DiskIO_complete(disk->io, op, offset, dest, tag, BLOCK_SIZE);
+}
+
+// Aggiunge le nuove finestre (l'ultima finestra, se era più corta e mappata, viene tolta: sarà rimappata intera)
+// ed estende la bitmap: nella mappa di DiskHeader e bitmap, oppure in una nuova mappa dopo i blocchi
+// Adds the new windows and extends (or moves) the bitmap
+static int DiskDriver_windowsGrow(DiskDriver* disk, int num_blocks, off_t bitmap_offset, size_t bitmap_entries) {
+	int last = disk->num_windows - 1, i;
+	int slot = disk->window_slots[last];
+	if(slot != -1 && disk->windows[slot].len < disk->window_size) {
+		if(disk->windows[slot].pins > 0) return -1;
+		munmap(disk->windows[slot].addr, disk->windows[slot].len);
+		disk->windows[slot].addr = NULL;
+		disk->window_slots[last] = -1;
+	}
+
+	int num_windows = ((size_t) num_blocks * BLOCK_SIZE + disk->window_size - 1) / disk->window_size;
+	int* slots = realloc(disk->window_slots, num_windows * sizeof(int));
+	if(slots == NULL) return -1;
+	for(i = disk->num_windows; i < num_windows; i++) slots[i] = -1;
+	disk->window_slots = slots;
+	disk->num_windows = num_windows;
+
+	size_t old_entries = disk->header->bitmap_entries;
+	char* bitmap = disk->bitmap_data;
+	if(bitmap_offset != disk->header->bitmap_offset) {
+		bitmap = mmap(0, DiskDriver_bitmapSpace(bitmap_entries), PROT_READ | PROT_WRITE, MAP_SHARED, disk->fd, bitmap_offset);
+		if(bitmap == MAP_FAILED) return -1;
+		memcpy(bitmap, disk->bitmap_data, old_entries);
+		if(disk->header->bitmap_offset >= disk->data_offset) munmap(disk->bitmap_data, DiskDriver_bitmapSpace(old_entries));
+	}
+	memset(bitmap + old_entries, 0, bitmap_entries - old_entries);
+	disk->bitmap_data = bitmap;
+	return 0;
+}
+
+// Toglie tutte le finestre ancora mappate, poi le mappe della bitmap (se è separata) e del DiskHeader
+// Unmaps the windows, the bitmap and the header
+static void DiskDriver_windowsClose(DiskDriver* disk) {
+	int i;
+	for(i = 0; i < disk->max_windows; i++) {
+		if(disk->windows[i].addr != NULL) munmap(disk->windows[i].addr, disk->windows[i].len);
+	}
+	if(disk->header->bitmap_offset >= disk->data_offset) munmap(disk->bitmap_data, DiskDriver_bitmapSpace(disk->header->bitmap_entries));
+	munmap(disk->header, disk->map_size);
+	free(disk->windows);
+	free(disk->window_slots);
+	disk->windows = NULL;
+	disk->window_slots = NULL;
+	pthread_mutex_destroy(&disk->window_lock);
+}
+
+// Backend disponibili, nell'ordine delle costanti DISK_BACKEND_*
+static const DiskBackend disk_backends[] = {
+	{ "mmap", DiskDriver_mmapOpen, DiskDriver_mmapGetBlock, DiskDriver_mmapMarkBlock, DiskDriver_mmapReleaseBlock,
+		DiskDriver_mmapSubmitBlock, DiskDriver_mmapSync, DiskDriver_mmapGrow, DiskDriver_mmapAdvise, DiskDriver_mmapClose },
+	{ "pread", DiskDriver_preadOpen, DiskDriver_preadGetBlock, DiskDriver_preadMarkBlock, DiskDriver_preadReleaseBlock,
+		DiskDriver_preadSubmitBlock, DiskDriver_preadSync, DiskDriver_preadGrow, DiskDriver_fadvise, DiskDriver_preadClose },
+	{ "windows", DiskDriver_windowsOpen, DiskDriver_windowsGetBlock, DiskDriver_windowsMarkBlock, DiskDriver_windowsReleaseBlock,
+		DiskDriver_windowsSubmitBlock, DiskDriver_mmapSync, DiskDriver_windowsGrow, DiskDriver_fadvise, DiskDriver_windowsClose },
+};
+
+
+/* Formato su disco: DiskHeader, bitmap e blocchi; i dischi scritti prima che il formato avesse una versione vengono convertiti */
+
+// DiskHeader dei dischi senza versione: tutti i campi a 32 bit, seguiti da una bitmap di un byte per blocco e dai blocchi
+typedef struct {
+	int num_blocks;
+	int bitmap_blocks;
+	int bitmap_entries;
+	int free_blocks;
+	int first_free_block;
+} DiskHeaderLegacy;
+
+// Dimensione dei pezzi in cui vengono spostati i blocchi durante la conversione
+#define DISK_MIGRATE_CHUNK (1 << 20)
+
+// Compila la parte del DiskHeader che descrive la posizione di bitmap e blocchi di un disco di "num_blocks" blocchi
+// Fills in the fields of the header describing where bitmap and blocks are
+static void DiskDriver_layout(DiskHeader* header, int64_t num_blocks) {
+	header->magic = DISK_MAGIC;
+	header->version = DISK_VERSION;
+	header->num_blocks = num_blocks;
+	header->bitmap_entries = (num_blocks + 7) / 8;
+	header->bitmap_blocks = count_blocks(header->bitmap_entries);
+	header->bitmap_offset = sizeof(DiskHeader);
+	header->data_offset = (header->bitmap_offset + header->bitmap_entries + DISK_DATA_ALIGN - 1) & ~(int64_t) (DISK_DATA_ALIGN - 1);
+}
+
+// Sposta "len" byte del file dalla posizione "from" alla posizione "to" (le due zone possono sovrapporsi)
+// Moves len bytes of the file from from to to, the two ranges can overlap
+static int DiskDriver_moveRange(int fd, off_t from, off_t to, off_t len) {
+	char* buffer = malloc(DISK_MIGRATE_CHUNK);
+	if(buffer == NULL) return -1;
+
+	// Se i dati si spostano in avanti copio partendo dalla fine, altrimenti dall'inizio, così non sovrascrivo niente che devo ancora copiare
+	off_t done = 0;
+	while(done < len) {
+		off_t chunk = len - done < DISK_MIGRATE_CHUNK ? len - done : DISK_MIGRATE_CHUNK;
+		off_t pos = to > from ? len - done - chunk : done;
+		if(pread(fd, buffer, chunk, from + pos) != chunk || pwrite(fd, buffer, chunk, to + pos) != chunk) {
+			free(buffer);
+			return -1;
+		}
+		done += chunk;
+	}
+	free(buffer);
+	return 0;
+}
+
+// Converte un disco senza versione nel formato attuale: i blocchi vengono spostati a data_offset, la bitmap (un bit per blocco)
+// e il nuovo DiskHeader vengono scritti all'inizio del file. La conversione non è atomica: se si interrompe, il disco va ripristinato da una copia
+// Converts a disk without version to the current format, moving the blocks and rewriting bitmap and header
+static int DiskDriver_migrate(int fd) {
+	DiskHeaderLegacy legacy;
+	struct stat st;
+	if(pread(fd, &legacy, sizeof(legacy), 0) != sizeof(legacy) || fstat(fd, &st) == -1) return -1;
+	if(legacy.num_blocks <= 0 || legacy.bitmap_entries < (legacy.num_blocks + 7) / 8) return -1;
+
+	// I dischi con la politica di allocazione hanno due campi in più nel DiskHeader: li riconosco dalla dimensione del file
+	off_t blocks_size = (off_t) legacy.num_blocks * BLOCK_SIZE;
+	off_t legacy_header = sizeof(DiskHeaderLegacy);
+	int alloc_fields[2] = { DISK_ALLOC_GROUPS, 0 };
+	if(st.st_size == legacy_header + 2 * sizeof(int) + legacy.bitmap_entries + blocks_size) {
+		if(pread(fd, alloc_fields, sizeof(alloc_fields), legacy_header) != sizeof(alloc_fields)) return -1;
+		legacy_header += sizeof(alloc_fields);
+	}else if(st.st_size < legacy_header + legacy.bitmap_entries + blocks_size) {
+		return -1;
+	}
+	off_t legacy_data = legacy_header + legacy.bitmap_entries;
+
+	// Compilo il nuovo DiskHeader e leggo la bitmap prima di spostare i blocchi, che potrebbero sovrascriverla
+	DiskHeader header;
+	memset(&header, 0, sizeof(header));
+	DiskDriver_layout(&header, legacy.num_blocks);
+	header.free_blocks = legacy.free_blocks;
+	header.first_free_block = legacy.first_free_block;
+	header.alloc_policy = alloc_fields[0];
+	header.alloc_cursor = alloc_fields[1];
+
+	size_t meta_size = header.data_offset - header.bitmap_offset;
+	char* meta = calloc(meta_size, 1);
+	if(meta == NULL) return -1;
+	if(pread(fd, meta, header.bitmap_entries, legacy_header) != header.bitmap_entries) {
+		free(meta);
+		return -1;
+	}
+
+	// Sposto i blocchi: in avanti dopo aver allungato il file, all'indietro prima di accorciarlo
+	int ret = 0;
+	if(header.data_offset > legacy_data) {
+		ret = posix_fallocate(fd, 0, header.data_offset + blocks_size) == 0 ? 0 : -1;
+		if(ret == 0) ret = DiskDriver_moveRange(fd, legacy_data, header.data_offset, blocks_size);
+	}else{
+		ret = DiskDriver_moveRange(fd, legacy_data, header.data_offset, blocks_size);
+		if(ret == 0) ret = ftruncate(fd, header.data_offset + blocks_size);
+	}
+
+	// Per ultimi scrivo la bitmap e il DiskHeader, e aspetto che tutto sia sul disco
+	if(ret == 0 && pwrite(fd, meta, meta_size, header.bitmap_offset) != (ssize_t) meta_size) ret = -1;
+	if(ret == 0 && pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) ret = -1;
+	if(ret == 0) ret = fdatasync(fd);
+	free(meta);
+	return ret;
+}
+
+// Dimensione del DiskHeader di ogni versione del formato (la versione 1 non è mai stata scritta su disco)
+static const size_t disk_header_sizes[DISK_VERSION + 1] = { 0, 0, 80, 96, 120, 136, 152, sizeof(DiskHeader) };
+
+// Aggiorna il DiskHeader di un disco di una versione precedente: i campi nuovi valgono 0, e la bitmap che lo seguiva viene
+// spostata dopo i blocchi (dove DiskDriver_grow può già metterla). La copia va in una zona nuova del file e il DiskHeader
+// viene scritto per ultimo, quindi se l'aggiornamento si interrompe il disco resta quello di prima
+// Upgrades the header of an older version, moving the bitmap after the blocks
+static int DiskDriver_upgrade(int fd, DiskHeader* header) {
+	if(header->version < 2) return -1;
+	size_t old_size = disk_header_sizes[header->version];
+	memset((char *) header + old_size, 0, sizeof(DiskHeader) - old_size);
+
+	if(header->bitmap_offset < (off_t) sizeof(DiskHeader)) {
+		off_t data_end = header->data_offset + header->num_blocks * BLOCK_SIZE;
+		off_t bitmap_offset = (data_end + DISK_DATA_ALIGN - 1) & ~(off_t) (DISK_DATA_ALIGN - 1);
+		if(posix_fallocate(fd, 0, bitmap_offset + DiskDriver_bitmapSpace(header->bitmap_entries)) != 0) return -1;
+		if(DiskDriver_moveRange(fd, header->bitmap_offset, bitmap_offset, header->bitmap_entries) == -1) return -1;
+		header->bitmap_offset = bitmap_offset;
+	}
+
+	header->version = DISK_VERSION;
+	if(fdatasync(fd) == -1 || pwrite(fd, header, sizeof(DiskHeader), 0) != sizeof(DiskHeader)) return -1;
+	return fdatasync(fd);
+}
+
+// Legge il DiskHeader di un disco esistente, convertendo prima il disco se non ha una versione, o aggiornandolo se è di una versione precedente
+// Reads the header of an existing disk, converting the disk if it has no version and upgrading older versions
+static int DiskDriver_readHeader(int fd, DiskHeader* header) {
+	if(pread(fd, header, sizeof(DiskHeader), 0) != sizeof(DiskHeader) || header->magic != DISK_MAGIC) {
+		if(DiskDriver_migrate(fd) == -1) return -1;
+		if(pread(fd, header, sizeof(DiskHeader), 0) != sizeof(DiskHeader)) return -1;
+	}
+
+	// Un disco scritto da una versione più recente, o con più blocchi di quelli che si possono numerare, non può essere aperto
+	if(header->version > DISK_VERSION || header->num_blocks <= 0 || header->num_blocks > DISK_MAX_BLOCKS) return -1;
+	if(header->version < DISK_VERSION && DiskDriver_upgrade(fd, header) == -1) return -1;
+	return 0;
+}
+
+
+/* Riassunto dell'allocatore: DiskDriver_unmount salva dopo il disco i contatori dei blocchi liberi (del disco e di ogni gruppo),
+   il livello 0 del riassunto della bitmap e il cursore, così che l'apertura di un disco chiuso correttamente non debba leggere la bitmap */
+
+// Inizio del riassunto, seguito dal livello 0 del riassunto della bitmap (una parola a 64 bit per gruppo, perché un gruppo
+// copre 64 parole della bitmap) e dal numero di blocchi liberi di ogni gruppo
+typedef struct {
+	uint32_t magic;
+	int32_t num_groups;
+	int64_t num_blocks;
+	int64_t free_blocks;
+	int64_t alloc_cursor;
+} DiskSummary;
+
+// Parole della bitmap in un gruppo
+#define DISK_GROUP_WORDS (DISK_GROUP_BLOCKS / 64)
+
+// Checksum del riassunto (FNV-1a a 32 bit)
+// Checksum of the allocator summary (32-bit FNV-1a)
+static uint32_t DiskDriver_checksum(const void* data, size_t len) {
+	const unsigned char* bytes = data;
+	uint32_t hash = 2166136261u;
+	size_t i;
+	for(i = 0; i < len; i++) hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+// Dimensione del riassunto di un disco con "num_groups" gruppi
+// Size of the allocator summary
+static inline size_t DiskDriver_summarySize(int num_groups) {
+	return sizeof(DiskSummary) + (size_t) num_groups * (sizeof(uint64_t) + sizeof(int32_t));
+}
+
+// Divide i blocchi in gruppi di allocazione, senza contare i blocchi liberi
+// Creates the allocation groups, without counting their free blocks
+static int DiskDriver_initGroups(DiskDriver* disk) {
+	int i;
+	disk->num_groups = (disk->header->num_blocks + DISK_GROUP_BLOCKS - 1) / DISK_GROUP_BLOCKS;
+	disk->groups = calloc(disk->num_groups, sizeof(DiskGroup));
+	if(disk->groups == NULL) return -1;
+	for(i = 0; i < disk->num_groups; i++) {
+		disk->groups[i].first_block = i * DISK_GROUP_BLOCKS;
+		disk->groups[i].num_blocks = disk->header->num_blocks - disk->groups[i].first_block;
+		if(disk->groups[i].num_blocks > DISK_GROUP_BLOCKS) disk->groups[i].num_blocks = DISK_GROUP_BLOCKS;
+		pthread_mutex_init(&disk->groups[i].lock, NULL);
+	}
+	return 0;
+}
+
+// Legge il riassunto salvato da DiskDriver_unmount, se il disco è stato chiuso correttamente, e da lì ricostruisce contatori dei gruppi
+// e riassunto della bitmap. Restituisce -1 (senza aver cambiato niente) se il disco non è pulito o il riassunto non è valido
+// Loads the allocator summary of a clean disk, returns -1 if the disk is not clean or the summary is not valid
+static int DiskDriver_loadSummary(DiskDriver* disk) {
+	DiskHeader* header = disk->header;
+	size_t size = DiskDriver_summarySize(disk->num_groups);
+	if(header->clean != 1 || header->summary_bytes != (int64_t) size || header->summary_offset < DiskDriver_fileSize(header)) return -1;
+
+	char* buffer = malloc(size);
+	if(buffer == NULL) return -1;
+	DiskSummary* summary = (DiskSummary *) buffer;
+	if(pread(disk->fd, buffer, size, header->summary_offset) != (ssize_t) size || DiskDriver_checksum(buffer, size) != header->summary_checksum
+		|| summary->magic != DISK_SUMMARY_MAGIC || summary->num_groups != disk->num_groups || summary->num_blocks != header->num_blocks
+		|| BitMap_loadSummary(&disk->bitmap, (uint64_t *) (buffer + sizeof(DiskSummary))) == -1) {
+		free(buffer);
+		return -1;
+	}
+
+	int i;
+	int32_t* group_free = (int32_t *) (buffer + sizeof(DiskSummary) + disk->num_groups * sizeof(uint64_t));
+	for(i = 0; i < disk->num_groups; i++) disk->groups[i].free_blocks = group_free[i];
+	header->free_blocks = summary->free_blocks;
+	header->alloc_cursor = summary->alloc_cursor;
+	free(buffer);
+	return 0;
+}
+
+// Gruppi di cui un thread della scansione calcola blocchi liberi e riassunto
+typedef struct {
+	DiskDriver* disk;
+	int first_group;
+	int last_group;
+	int64_t free_blocks;
+} DiskScan;
+
+// Legge la parte di bitmap dei gruppi assegnati al thread: ogni gruppo corrisponde ad una parola del livello 0 del riassunto,
+// quindi thread con gruppi diversi non scrivono mai sulla stessa parola
+// Counts the free blocks of a range of groups and fills their words of the summary
+static void* DiskDriver_scanGroups(void* arg) {
+	DiskScan* scan = (DiskScan *) arg;
+	DiskDriver* disk = scan->disk;
+	int i;
+	scan->free_blocks = 0;
+	for(i = scan->first_group; i < scan->last_group; i++) {
+		BitMap_summarizeRange(&disk->bitmap, i * DISK_GROUP_WORDS, DISK_GROUP_WORDS);
+		disk->groups[i].free_blocks = BitMap_countRange(&disk->bitmap, disk->groups[i].first_block, disk->groups[i].num_blocks, 0);
+		scan->free_blocks += disk->groups[i].free_blocks;
+	}
+	return NULL;
+}
+
+// Ricostruisce contatori dei gruppi e riassunto della bitmap leggendo tutta la bitmap, dividendo i gruppi tra più thread
+// (il thread chiamante fa la prima parte). Il numero di blocchi liberi del disco viene ricalcolato dalla bitmap, quindi dopo
+// un crash non resta sbagliato anche se il DiskHeader era stato scritto prima (o dopo) la bitmap
+// Rebuilds counters and summary by scanning the bitmap with up to DISK_SCAN_THREADS threads
+static int DiskDriver_scan(DiskDriver* disk) {
+	if(BitMap_allocSummary(&disk->bitmap) == -1) return -1;
+
+	int threads = sysconf(_SC_NPROCESSORS_ONLN), i;
+	if(threads > DISK_SCAN_THREADS) threads = DISK_SCAN_THREADS;
+	if(threads > disk->num_groups) threads = disk->num_groups;
+	if(threads < 1) threads = 1;
+
+	DiskScan scans[DISK_SCAN_THREADS];
+	pthread_t tids[DISK_SCAN_THREADS];
+	int started[DISK_SCAN_THREADS] = { 0 };
+	for(i = 0; i < threads; i++) {
+		scans[i].disk = disk;
+		scans[i].first_group = (int64_t) disk->num_groups * i / threads;
+		scans[i].last_group = (int64_t) disk->num_groups * (i + 1) / threads;
+		if(i > 0) started[i] = pthread_create(&tids[i], NULL, DiskDriver_scanGroups, &scans[i]) == 0;
+	}
+
+	// Se un thread non è partito, la sua parte la fa il thread chiamante
+	int64_t free_blocks = 0;
+	for(i = 0; i < threads; i++) {
+		if(started[i]) pthread_join(tids[i], NULL);
+		else DiskDriver_scanGroups(&scans[i]);
+		free_blocks += scans[i].free_blocks;
+	}
+	BitMap_summarizeLevels(&disk->bitmap);
+	disk->header->free_blocks = free_blocks;
+	return 0;
+}
+
+// Scrive il riassunto dopo la fine del disco (ad un multiplo di DISK_DATA_ALIGN) e aspetta che sia sul disco,
+// poi segna il disco come pulito nel DiskHeader: se la scrittura si interrompe, il disco resta non pulito
+// Writes the allocator summary after the disk, then marks the disk as clean
+static int DiskDriver_writeSummary(DiskDriver* disk) {
+	DiskHeader* header = disk->header;
+	size_t size = DiskDriver_summarySize(disk->num_groups);
+	off_t offset = (DiskDriver_fileSize(header) + DISK_DATA_ALIGN - 1) & ~(off_t) (DISK_DATA_ALIGN - 1);
+
+	char* buffer = calloc(size, 1);
+	if(buffer == NULL) return -1;
+	DiskSummary* summary = (DiskSummary *) buffer;
+	summary->magic = DISK_SUMMARY_MAGIC;
+	summary->num_groups = disk->num_groups;
+	summary->num_blocks = header->num_blocks;
+	summary->free_blocks = header->free_blocks;
+	summary->alloc_cursor = header->alloc_cursor;
+
+	int i;
+	int32_t* group_free = (int32_t *) (buffer + sizeof(DiskSummary) + disk->num_groups * sizeof(uint64_t));
+	memcpy(buffer + sizeof(DiskSummary), disk->bitmap.summary->level[0], disk->num_groups * sizeof(uint64_t));
+	for(i = 0; i < disk->num_groups; i++) group_free[i] = disk->groups[i].free_blocks;
+
+	int ret = pwrite(disk->fd, buffer, size, offset) == (ssize_t) size ? 0 : -1;
+	if(ret == 0) {
+		__atomic_fetch_add(&disk->syncs, 1, __ATOMIC_RELAXED);
+		ret = fdatasync(disk->fd);
+	}
+	if(ret == 0) {
+		header->clean = 1;
+		header->summary_checksum = DiskDriver_checksum(buffer, size);
+		header->summary_offset = offset;
+		header->summary_bytes = size;
+		DiskDriver_markDirtyRange(disk, header, sizeof(DiskHeader));
+		ret = DiskDriver_flush(disk);
+	}
+	free(buffer);
+	return ret;
+}
+
+
+/* Checksum dei blocchi: una tabella di blocchi riservati contiene il CRC32C di ogni blocco del disco. La tabella viene letta
+   un blocco alla volta, quando serve, e i suoi blocchi modificati vengono scritti da DiskDriver_flush insieme agli altri */
+
+// Restituisce 1 se il blocco ha un checksum nella tabella (i blocchi della tabella non ce l'hanno)
+// Returns 1 if the block is covered by the checksum table
+static inline int DiskDriver_checksumCovers(DiskDriver* disk, int block_num) {
+	int64_t start = disk->header->checksum_block, n = disk->header->checksum_blocks;
+	if(block_num >= start && block_num < start + n) return 0;
+	return block_num < n * (int64_t) DISK_CHECKSUMS_PER_BLOCK;
+}
+
+// Legge nella memoria il blocco "table_block" della tabella, se non è già stato letto (con checksum_lock)
+// Loads a block of the checksum table, if it was not loaded yet
+static int DiskDriver_checksumLoad(DiskDriver* disk, int table_block) {
+	if(BitMap_get(&disk->checksum_loaded, table_block, 1) == table_block) return 0;
+	const char* block = disk->backend->getBlock(disk, disk->header->checksum_block + table_block, 1);
+	if(block == NULL) return -1;
+	memcpy(disk->checksums + (size_t) table_block * DISK_CHECKSUMS_PER_BLOCK, block, BLOCK_SIZE);
+	disk->backend->releaseBlock(disk, disk->header->checksum_block + table_block);
+	BitMap_set(&disk->checksum_loaded, table_block, 1);
+	return 0;
+}
+
+// Aggiorna il checksum del blocco con il suo nuovo contenuto "data": il blocco della tabella dovrà essere scritto,
+// e il blocco non ha bisogno di essere verificato finché resta in memoria
+// Updates the checksum of a block written with data
+static void DiskDriver_checksumUpdate(DiskDriver* disk, int block_num, const void* data) {
+	if(disk->checksums == NULL || !DiskDriver_checksumCovers(disk, block_num)) return;
+	uint32_t crc = CRC32C_update(0, data, BLOCK_SIZE);
+	int table_block = block_num / DISK_CHECKSUMS_PER_BLOCK;
+
+	pthread_mutex_lock(&disk->checksum_lock);
+	if(DiskDriver_checksumLoad(disk, table_block) == 0) {
+		disk->checksums[block_num] = crc;
+		BitMap_set(&disk->checksum_dirty, table_block, 1);
+		__atomic_fetch_or(&disk->checksum_verified[block_num / 8], (unsigned char) (1 << (block_num % 8)), __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&disk->checksum_lock);
+}
+
+// Controlla che il contenuto "data" del blocco corrisponda al suo checksum. Se il blocco è già stato verificato da quando è stato
+// letto dal file non viene controllato di nuovo, a meno che "force" sia 1 (letture asincrone, che non passano dalla cache).
+// Restituisce -1 se il checksum non corrisponde (o la tabella non può essere letta), 0 altrimenti
+// Verifies a block against its checksum, lazily; returns -1 on mismatch
+static int DiskDriver_checksumVerify(DiskDriver* disk, int block_num, const void* data, int force) {
+	if(disk->checksums == NULL || !DiskDriver_checksumCovers(disk, block_num)) return 0;
+	unsigned char bit = 1 << (block_num % 8);
+	if(!force && (__atomic_load_n(&disk->checksum_verified[block_num / 8], __ATOMIC_RELAXED) & bit)) return 0;
+
+	uint32_t crc = CRC32C_update(0, data, BLOCK_SIZE);
+	int ret = -1;
+	pthread_mutex_lock(&disk->checksum_lock);
+	if(DiskDriver_checksumLoad(disk, block_num / DISK_CHECKSUMS_PER_BLOCK) == 0 && disk->checksums[block_num] == crc) ret = 0;
+	if(ret == 0) __atomic_fetch_or(&disk->checksum_verified[block_num / 8], bit, __ATOMIC_RELAXED);
+	else disk->checksum_errors++;
+	disk->checksum_verifies++;
+	pthread_mutex_unlock(&disk->checksum_lock);
+	return ret;
+}
+
+// Copia nei loro blocchi le parti modificate della tabella, che verranno sincronizzate insieme agli altri blocchi
+// Copies the dirty blocks of the checksum table to the disk (they are synced with the other blocks)
+static int DiskDriver_checksumFlush(DiskDriver* disk) {
+	int ret = 0, i = 0;
+	pthread_mutex_lock(&disk->checksum_lock);
+	while((i = BitMap_get(&disk->checksum_dirty, i, 1)) != -1) {
+		int block_num = disk->header->checksum_block + i;
+		char* block = disk->backend->getBlock(disk, block_num, 0);
+		if(block == NULL) {
+			ret = -1;
+			break;
+		}
+		memcpy(block, disk->checksums + (size_t) i * DISK_CHECKSUMS_PER_BLOCK, BLOCK_SIZE);
+		disk->backend->markBlock(disk, block_num);
+		disk->backend->releaseBlock(disk, block_num);
+		BitMap_set(&disk->checksum_dirty, i, 0);
+	}
+	pthread_mutex_unlock(&disk->checksum_lock);
+	return ret;
+}
+
+// Libera la memoria della tabella dei checksum
+// Frees the in-memory checksum table
+static void DiskDriver_freeChecksums(DiskDriver* disk) {
+	if(disk->checksums == NULL) return;
+	free(disk->checksums);
+	free(disk->checksum_loaded.entries);
+	free(disk->checksum_dirty.entries);
+	free(disk->checksum_verified);
+	pthread_mutex_destroy(&disk->checksum_lock);
+	disk->checksums = NULL;
+	disk->checksum_verified = NULL;
+}
+
+// Prepara la memoria per una tabella di "table_blocks" blocchi: nessun blocco della tabella è ancora stato letto
+// e nessun blocco del disco è ancora stato verificato
+// Allocates the in-memory checksum table, nothing loaded and nothing verified
+static int DiskDriver_openChecksums(DiskDriver* disk, int table_blocks) {
+	disk->checksums = calloc((size_t) table_blocks * DISK_CHECKSUMS_PER_BLOCK, sizeof(uint32_t));
+	disk->checksum_loaded.num_bits = disk->checksum_dirty.num_bits = table_blocks;
+	disk->checksum_loaded.entries = calloc((table_blocks + 7) / 8, 1);
+	disk->checksum_dirty.entries = calloc((table_blocks + 7) / 8, 1);
+	disk->checksum_loaded.summary = disk->checksum_dirty.summary = NULL;
+	disk->checksum_verified = calloc((disk->header->num_blocks + 7) / 8, 1);
+	pthread_mutex_init(&disk->checksum_lock, NULL);
+	if(disk->checksums == NULL || disk->checksum_loaded.entries == NULL || disk->checksum_dirty.entries == NULL || disk->checksum_verified == NULL) {
+		DiskDriver_freeChecksums(disk);
+		return -1;
+	}
+	return 0;
+}
+
+/* Tabella di deduplicazione: ogni voce descrive una sequenza di blocchi condivisa da tutte le scritture dello stesso contenuto,
+   con il numero dei suoi riferimenti. La tabella è tutta in memoria, con due hash (per impronta e per primo blocco) costruiti
+   all'apertura; i blocchi della tabella modificati vengono scritti da DiskDriver_flush */
+
+// Bucket di una chiave (impronta o primo blocco) in una tabella di "buckets" bucket
+// Bucket of a key of the dedup hashes
+static inline int DiskDriver_dedupBucket(uint64_t key, int buckets) {
+	return (int) (((key * 0x9e3779b97f4a7c15ull) >> 32) % (uint64_t) buckets);
+}
+
+// Inserisce la voce "e" nei due hash
+// Links entry e into both hashes
+static void DiskDriver_dedupLink(DiskDedup* dedup, int e) {
+	int f = DiskDriver_dedupBucket(dedup->entries[e].fingerprint, dedup->num_entries);
+	int b = DiskDriver_dedupBucket(dedup->entries[e].block, dedup->num_entries);
+	dedup->next_fingerprint[e] = dedup->by_fingerprint[f];
+	dedup->by_fingerprint[f] = e;
+	dedup->next_block[e] = dedup->by_block[b];
+	dedup->by_block[b] = e;
+}
+
+// Toglie la voce "e" da un hash, cercando la voce che la precede nel suo bucket
+// Unlinks entry e from one of the hashes
+static void DiskDriver_dedupUnlinkFrom(int* heads, int* next, int bucket, int e) {
+	int* link = &heads[bucket];
+	while(*link != e) link = &next[*link];
+	*link = next[e];
+}
+
+// Libera la voce "e": la toglie dai due hash, la azzera e la mette in testa alla lista delle voci libere (con la tabella bloccata)
+// Frees entry e, that will be written as free by the next flush
+static void DiskDriver_dedupRemove(DiskDedup* dedup, int e) {
+	DiskDriver_dedupUnlinkFrom(dedup->by_fingerprint, dedup->next_fingerprint, DiskDriver_dedupBucket(dedup->entries[e].fingerprint, dedup->num_entries), e);
+	DiskDriver_dedupUnlinkFrom(dedup->by_block, dedup->next_block, DiskDriver_dedupBucket(dedup->entries[e].block, dedup->num_entries), e);
+	memset(&dedup->entries[e], 0, sizeof(DiskDedupEntry));
+	dedup->next_fingerprint[e] = dedup->first_free;
+	dedup->first_free = e;
+	dedup->used--;
+	BitMap_set(&dedup->dirty, e / DISK_DEDUP_PER_BLOCK, 1);
+}
+
+// Restituisce la voce della sequenza che inizia con il blocco "block_num", -1 se non c'è
+// Returns the entry of the run starting at block_num, or -1
+static int DiskDriver_dedupFind(DiskDedup* dedup, int block_num) {
+	int e = dedup->by_block[DiskDriver_dedupBucket(block_num, dedup->num_entries)];
+	while(e != -1 && dedup->entries[e].block != block_num) e = dedup->next_block[e];
+	return e;
+}
+
+// Libera la memoria della tabella di deduplicazione
+// Frees the in-memory dedup table
+static void DiskDriver_freeDedup(DiskDriver* disk) {
+	DiskDedup* dedup = disk->dedup;
+	if(dedup == NULL) return;
+	free(dedup->entries);
+	free(dedup->by_fingerprint);
+	free(dedup->by_block);
+	free(dedup->next_fingerprint);
+	free(dedup->next_block);
+	free(dedup->dirty.entries);
+	pthread_mutex_destroy(&dedup->lock);
+	free(dedup);
+	disk->dedup = NULL;
+}
+
+// Prepara la memoria per una tabella di "table_blocks" blocchi e, se "load" è 1, la legge dal disco costruendo i due hash
+// e la lista delle voci libere; altrimenti la tabella è vuota e tutta da scrivere
+// Allocates the in-memory dedup table, loading it from the disk or starting empty
+static int DiskDriver_openDedup(DiskDriver* disk, int table_blocks, int load) {
+	DiskDedup* dedup = calloc(1, sizeof(DiskDedup));
+	if(dedup == NULL) return -1;
+	disk->dedup = dedup;
+	dedup->num_entries = table_blocks * DISK_DEDUP_PER_BLOCK;
+	dedup->entries = calloc(dedup->num_entries, sizeof(DiskDedupEntry));
+	dedup->by_fingerprint = malloc(dedup->num_entries * sizeof(int));
+	dedup->by_block = malloc(dedup->num_entries * sizeof(int));
+	dedup->next_fingerprint = malloc(dedup->num_entries * sizeof(int));
+	dedup->next_block = malloc(dedup->num_entries * sizeof(int));
+	dedup->dirty.num_bits = table_blocks;
+	dedup->dirty.entries = calloc((table_blocks + 7) / 8, 1);
+	dedup->dirty.summary = NULL;
+	pthread_mutex_init(&dedup->lock, NULL);
+	if(dedup->entries == NULL || dedup->by_fingerprint == NULL || dedup->by_block == NULL || dedup->next_fingerprint == NULL
+		|| dedup->next_block == NULL || dedup->dirty.entries == NULL) {
+		DiskDriver_freeDedup(disk);
+		return -1;
+	}
+
+	// Leggo i blocchi della tabella (ognuno con DISK_DEDUP_PER_BLOCK voci, il resto del blocco non è usato)
+	int i, e;
+	for(i = 0; load && i < table_blocks; i++) {
+		const char * block = disk->backend->getBlock(disk, disk->header->dedup_block + i, 1);
+		if(block == NULL || DiskDriver_checksumVerify(disk, disk->header->dedup_block + i, block, 0) == -1) {
+			if(block != NULL) disk->backend->releaseBlock(disk, disk->header->dedup_block + i);
+			DiskDriver_freeDedup(disk);
+			return -1;
+		}
+		memcpy(dedup->entries + (size_t) i * DISK_DEDUP_PER_BLOCK, block, DISK_DEDUP_PER_BLOCK * sizeof(DiskDedupEntry));
+		disk->backend->releaseBlock(disk, disk->header->dedup_block + i);
+	}
+	if(!load) BitMap_setRange(&dedup->dirty, 0, table_blocks);
+
+	// Le voci in uso entrano negli hash, quelle libere nella lista (dall'ultima, così la prima voce libera è in testa)
+	for(i = 0; i < dedup->num_entries; i++) dedup->by_fingerprint[i] = dedup->by_block[i] = -1;
+	dedup->first_free = -1;
+	for(e = dedup->num_entries - 1; e >= 0; e--) {
+		if(dedup->entries[e].refs > 0) {
+			DiskDriver_dedupLink(dedup, e);
+			dedup->used++;
+		}else{
+			dedup->next_fingerprint[e] = dedup->first_free;
+			dedup->first_free = e;
+		}
+	}
+	return 0;
+}
+
+// Copia nei loro blocchi le parti modificate della tabella (aggiornandone il checksum), che verranno sincronizzate insieme agli altri blocchi
+// Copies the dirty blocks of the dedup table to the disk
+static int DiskDriver_dedupFlush(DiskDriver* disk) {
+	DiskDedup* dedup = disk->dedup;
+	int ret = 0, i = 0;
+	pthread_mutex_lock(&dedup->lock);
+	while((i = BitMap_get(&dedup->dirty, i, 1)) != -1) {
+		int block_num = disk->header->dedup_block + i;
+		char* block = disk->backend->getBlock(disk, block_num, 0);
+		if(block == NULL) {
+			ret = -1;
+			break;
+		}
+		memset(block, 0, BLOCK_SIZE);
+		memcpy(block, dedup->entries + (size_t) i * DISK_DEDUP_PER_BLOCK, DISK_DEDUP_PER_BLOCK * sizeof(DiskDedupEntry));
+		DiskDriver_checksumUpdate(disk, block_num, block);
+		disk->backend->markBlock(disk, block_num);
+		disk->backend->releaseBlock(disk, block_num);
+		BitMap_set(&dedup->dirty, i, 0);
+	}
+	pthread_mutex_unlock(&dedup->lock);
+	return ret;
+}
+
+// Toglie un riferimento alle sequenze che iniziano con uno degli "n" blocchi di "blocks" (le voci che restano senza riferimenti
+// vengono liberate) e copia in "out" i blocchi che si possono davvero liberare: tutti tranne quelli delle sequenze ancora condivise.
+// Restituisce il numero di blocchi copiati in "out", -1 se manca la memoria
+// Drops a reference from the shared runs in blocks, returning in out the blocks that can be freed
+static int DiskDriver_dedupRelease(DiskDriver* disk, const int* blocks, int n, int* out) {
+	DiskDedup* dedup = disk->dedup;
+	int i, j, num_kept = 0, num_out = 0;
+	pthread_mutex_lock(&dedup->lock);
+
+	// Prima tolgo i riferimenti, ricordando le sequenze che ne hanno ancora (una sequenza elencata due volte perde due riferimenti)
+	int* kept = malloc(n * sizeof(int));
+	if(kept == NULL) {
+		pthread_mutex_unlock(&dedup->lock);
+		return -1;
+	}
+	for(i = 0; dedup->used > 0 && i < n; i++) {
+		int e = DiskDriver_dedupFind(dedup, blocks[i]);
+		if(e == -1) continue;
+		if(--dedup->entries[e].refs > 0) {
+			kept[num_kept++] = e;
+			BitMap_set(&dedup->dirty, e / DISK_DEDUP_PER_BLOCK, 1);
+		}else{
+			DiskDriver_dedupRemove(dedup, e);
+		}
+	}
+
+	// Poi tengo solo i blocchi che non fanno parte di quelle sequenze
+	for(i = 0; i < n; i++) {
+		for(j = 0; j < num_kept; j++) {
+			const DiskDedupEntry* entry = &dedup->entries[kept[j]];
+			if(blocks[i] >= entry->block && blocks[i] < entry->block + entry->num_blocks) break;
+		}
+		if(j == num_kept) out[num_out++] = blocks[i];
+	}
+	pthread_mutex_unlock(&dedup->lock);
+	free(kept);
+	return num_out;
+}
+
+
+/* Snapshot: ogni snapshot ha la sua bitmap dei blocchi che usa, e in memoria c'è la loro unione, i blocchi congelati. Un blocco congelato
+   non viene mai liberato: se il file system lo libera viene solo segnato come rilasciato, e viene liberato quando non c'è più nessuno
+   snapshot che lo usa. La regione degli snapshot contiene la tabella (un blocco) e la bitmap dei blocchi rilasciati */
+
+// Numero di blocchi occupati da una bitmap di "num_bits" bit
+// Blocks used by a bitmap of num_bits bits
+static inline int DiskDriver_bitmapBlocksFor(int64_t num_bits) {
+	return (int) (((num_bits + 7) / 8 + BLOCK_SIZE - 1) / BLOCK_SIZE);
+}
+
+// Restituisce 1 se il bit "bit" della bitmap vale 1, senza cercare il successivo come BitMap_get
+// Tests a single bit of a bitmap
+static inline int DiskDriver_testBit(const BitMap* bitmap, int bit) {
+	BitMapEntryKey key = BitMap_blockToIndex(bit);
+	return bit >= 0 && bit < bitmap->num_bits && ((unsigned char) bitmap->entries[key.entry_num] >> (7 - key.bit_num) & 1);
+}
+
+// Libera la memoria degli snapshot
+// Frees the in-memory snapshots
+static void DiskDriver_freeSnapshots(DiskDriver* disk) {
+	DiskSnapshots* snapshots = disk->snapshots;
+	if(snapshots == NULL) return;
+	free(snapshots->frozen.entries);
+	free(snapshots->released.entries);
+	free(snapshots->dirty.entries);
+	pthread_mutex_destroy(&snapshots->lock);
+	free(snapshots);
+	disk->snapshots = NULL;
+}
+
+// Prepara la memoria per gli snapshot: tabella vuota, nessun blocco congelato o rilasciato
+// Allocates the in-memory snapshots, all empty
+static int DiskDriver_allocSnapshots(DiskDriver* disk) {
+	DiskSnapshots* snapshots = calloc(1, sizeof(DiskSnapshots));
+	if(snapshots == NULL) return -1;
+	disk->snapshots = snapshots;
+	int num_blocks = disk->header->num_blocks, region_blocks = 1 + DiskDriver_bitmapBlocksFor(num_blocks);
+	snapshots->frozen.num_bits = snapshots->released.num_bits = num_blocks;
+	snapshots->frozen.entries = calloc((num_blocks + 7) / 8, 1);
+	snapshots->released.entries = calloc((num_blocks + 7) / 8, 1);
+	snapshots->dirty.num_bits = region_blocks;
+	snapshots->dirty.entries = calloc((region_blocks + 7) / 8, 1);
+	snapshots->frozen.summary = snapshots->released.summary = snapshots->dirty.summary = NULL;
+	pthread_mutex_init(&snapshots->lock, NULL);
+	if(snapshots->frozen.entries == NULL || snapshots->released.entries == NULL || snapshots->dirty.entries == NULL) {
+		DiskDriver_freeSnapshots(disk);
+		return -1;
+	}
+	return 0;
+}
+
+// Aggiunge a "frozen" (una bitmap dei blocchi del disco) i blocchi dello snapshot "snapshot", leggendo la sua bitmap dal disco.
+// Se un blocco della bitmap non si legge o non corrisponde al suo checksum restituisce -1: i blocchi dello snapshot non si conoscono
+// Adds the blocks of a snapshot to the frozen ones, returns -1 if its bitmap cannot be read
+static int DiskDriver_freezeSnapshot(DiskDriver* disk, const DiskSnapshot* snapshot, char* frozen) {
+	int bytes = (snapshot->num_blocks + 7) / 8, i, j;
+	for(i = 0; i < DiskDriver_bitmapBlocksFor(snapshot->num_blocks); i++) {
+		int block_num = snapshot->bitmap_block + i;
+		const char * block = disk->backend->getBlock(disk, block_num, 1);
+		if(block == NULL) return -1;
+		if(DiskDriver_checksumVerify(disk, block_num, block, 0) == -1) {
+			disk->backend->releaseBlock(disk, block_num);
+			return -1;
+		}
+		for(j = 0; j < BLOCK_SIZE && i * BLOCK_SIZE + j < bytes; j++) frozen[i * BLOCK_SIZE + j] |= block[j];
+		disk->backend->releaseBlock(disk, block_num);
+	}
+	return 0;
+}
+
+// Legge la regione degli snapshot (tabella e blocchi rilasciati) e ricostruisce i blocchi congelati dalle bitmap degli snapshot
+// Loads the snapshot region and rebuilds the frozen blocks
+static int DiskDriver_openSnapshots(DiskDriver* disk) {
+	if(DiskDriver_allocSnapshots(disk) == -1) return -1;
+	DiskSnapshots* snapshots = disk->snapshots;
+	int bytes = (disk->header->num_blocks + 7) / 8, i;
+	for(i = 0; i < disk->header->snapshot_blocks && i < snapshots->dirty.num_bits; i++) {
+		int block_num = disk->header->snapshot_block + i, offset = (i - 1) * BLOCK_SIZE;
+		const char * block = disk->backend->getBlock(disk, block_num, 1);
+		if(block == NULL || DiskDriver_checksumVerify(disk, block_num, block, 0) == -1) {
+			if(block != NULL) disk->backend->releaseBlock(disk, block_num);
+			DiskDriver_freeSnapshots(disk);
+			return -1;
+		}
+		if(i == 0) {
+			memcpy(snapshots->table, block, sizeof(snapshots->table));
+		}else{
+			memcpy(snapshots->released.entries + offset, block, bytes - offset < BLOCK_SIZE ? bytes - offset : BLOCK_SIZE);
+		}
+		disk->backend->releaseBlock(disk, block_num);
+	}
+	for(i = 0; i < DISK_MAX_SNAPSHOTS; i++) {
+		if(snapshots->table[i].num_blocks > 0 && DiskDriver_freezeSnapshot(disk, &snapshots->table[i], snapshots->frozen.entries) == -1) {
+			DiskDriver_freeSnapshots(disk);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Copia nei loro blocchi le parti modificate della regione (la tabella e la bitmap dei blocchi rilasciati), aggiornandone il checksum
+// Copies the dirty blocks of the snapshot region to the disk
+static int DiskDriver_snapshotFlush(DiskDriver* disk) {
+	DiskSnapshots* snapshots = disk->snapshots;
+	int ret = 0, i = 0, bytes = (disk->header->num_blocks + 7) / 8;
+	pthread_mutex_lock(&snapshots->lock);
+	while((i = BitMap_get(&snapshots->dirty, i, 1)) != -1) {
+		int block_num = disk->header->snapshot_block + i, offset = (i - 1) * BLOCK_SIZE;
+		char* block = disk->backend->getBlock(disk, block_num, 0);
+		if(block == NULL) {
+			ret = -1;
+			break;
+		}
+		memset(block, 0, BLOCK_SIZE);
+		if(i == 0) {
+			memcpy(block, snapshots->table, sizeof(snapshots->table));
+		}else{
+			memcpy(block, snapshots->released.entries + offset, bytes - offset < BLOCK_SIZE ? bytes - offset : BLOCK_SIZE);
+		}
+		DiskDriver_checksumUpdate(disk, block_num, block);
+		disk->backend->markBlock(disk, block_num);
+		disk->backend->releaseBlock(disk, block_num);
+		BitMap_set(&snapshots->dirty, i, 0);
+	}
+	pthread_mutex_unlock(&snapshots->lock);
+	return ret;
+}
+
+// Toglie dagli "n" blocchi di "blocks" quelli congelati, segnandoli come rilasciati; restituisce quanti blocchi restano da liberare
+// Releases the frozen blocks among blocks, keeping in blocks only those that can be freed
+static int DiskDriver_snapshotRelease(DiskDriver* disk, int* blocks, int n) {
+	DiskSnapshots* snapshots = disk->snapshots;
+	int i, num_out = 0;
+	pthread_mutex_lock(&snapshots->lock);
+	for(i = 0; i < n; i++) {
+		if(!DiskDriver_testBit(&snapshots->frozen, blocks[i])) {
+			blocks[num_out++] = blocks[i];
+			continue;
+		}
+		BitMap_set(&snapshots->released, blocks[i], 1);
+		BitMap_set(&snapshots->dirty, 1 + blocks[i] / 8 / BLOCK_SIZE, 1);
+	}
+	pthread_mutex_unlock(&snapshots->lock);
+	return num_out;
+}
 
 // Apre il file (creandolo, se necessario), allocando lo spazio necessario sul disco e calcolando quanto deve essere grane la mappa se il file è 
 // stato appena creato.
@@ -15,77 +1450,200 @@
 // opens the file (creating it if necessary) allocates the necessary space on the disk calculates how big the bitmap should be
 // If the file was new compiles a disk header, and fills in the bitmap of appropriate size with all 0 (to denote the free space)
 void DiskDriver_init(DiskDriver* disk, const char* filename, int num_blocks) {
+	DiskDriver_initConfig(disk, filename, num_blocks, NULL);
+}
+
+// Come DiskDriver_init, ma il backend con cui si accede al disco viene scelto dalla configurazione (senza configurazione si usa la mmap)
+// same as DiskDriver_init, with the backend chosen by config
+void DiskDriver_initConfig(DiskDriver* disk, const char* filename, int num_blocks, const DiskConfig* config) {
 
-	// Calcoliamo quanti blocchi dovremo memorizzare nel disco
-	int bitmap_entries = num_blocks;
+	// Senza una configurazione valida uso il backend mmap
+	DiskConfig default_config = { DISK_BACKEND_MMAP, 0, 0, DISK_IO_AUTO };
+	if(config == NULL || config->backend < DISK_BACKEND_MMAP || config->backend > DISK_BACKEND_WINDOWS) config = &default_config;
 
 	// Variabile in cui memorizzare il file descriptor che ci aiuterà ad utilizzare il file stesso
 	int file;
 
-	// Se il file esiste, calcoliamo alcuni dati, se non esiste, lo creiamo e inseriamo "Ciao mondo"
-	if(!access(filename, F_OK)) { // se il file esiste
-		file = open(filename, O_RDWR, 0666);
-		if(!file) {
-			printf("C'è stato un errore nell'apertura del file. Il programma è stato bloccato.");
-			return;
-		}
+	// Se il file esiste lo apriamo, se non esiste lo creiamo
+	int new_file = access(filename, F_OK) != 0;
+	file = open(filename, new_file ? O_CREAT | O_RDWR : O_RDWR, 0666);
 
-		// alloco la memoria necessaria al file per evitare "bus error"
-		int ret = posix_fallocate(file, 0, sizeof(DiskHeader) + bitmap_entries + num_blocks*BLOCK_SIZE);
-		disk->fd = file;
-		disk->header = (DiskHeader*) mmap(0, sizeof(DiskHeader) + bitmap_entries + (num_blocks*BLOCK_SIZE), PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
-		
-	}else{
-		// Se il file è stato appena creato
-		file = open(filename, O_CREAT | O_RDWR, 0666);
+	// Verifico che l'apertura sia avvenuta corretamente
+	if(file == -1) {
+		printf("C'è stato un errore nell'apertura del file. Il programma è stato bloccato.");
+		return;
+	}
+
+	// Memorizzo come file descriptor del disco il file appena aperto
+	disk->fd = file;
+
+	// Se il file esiste leggo il suo DiskHeader (convertendo il disco, se è nel formato senza versione),
+	// altrimenti calcolo dove si troveranno bitmap e blocchi
+	DiskHeader header;
+	if(!new_file && DiskDriver_readHeader(file, &header) == -1) {
+		printf("Il file non contiene un disco valido.");
+		return;
+	}
+	if(new_file) {
+		memset(&header, 0, sizeof(header));
+		DiskDriver_layout(&header, num_blocks);
+		header.free_blocks = num_blocks;
 
-		// Verifico che l'apertura sia avvenuta corretamente
-		if(!file) {
-			printf("C'è stato un errore nell'apertura del file. Il programma è stato bloccato.");
+		// Alloco la memoria necessaria al file per evitare "bus error", e scrivo il DiskHeader in modo che il backend lo trovi
+		if(posix_fallocate(file, 0, DiskDriver_fileSize(&header)) != 0) {
+			printf("Non è stato possibile allocare lo spazio del disco. Il programma è stato bloccato.");
+			return;
+		}
+		if(pwrite(file, &header, sizeof(header), 0) != sizeof(header)) {
+			printf("Non è stato possibile scrivere il DiskHeader. Il programma è stato bloccato.");
 			return;
 		}
+	}
+	num_blocks = header.num_blocks;
+	disk->data_offset = header.data_offset;
+	disk->file_size = DiskDriver_fileSize(&header);
 
-		// Memorizzo come file descriptor del disco il file appena aperto
-		disk->fd=file;
+	// Il backend rende accessibili DiskHeader e bitmap (mappandoli o leggendoli in memoria)
+	disk->backend = &disk_backends[config->backend];
+	disk->cache = NULL;
+	disk->direct_io = 0;
+	disk->windows = NULL;
+	disk->window_slots = NULL;
+	disk->checksums = NULL;
+	disk->checksum_verified = NULL;
+	disk->checksum_verifies = 0;
+	disk->checksum_errors = 0;
+	disk->dedup = NULL;
+	disk->snapshots = NULL;
+	disk->read_only = 0;
+	if(disk->backend->open(disk, num_blocks, config) == -1) {
+		printf("C'è stato un errore nell'apertura del disco con il backend %s.", disk->backend->name);
+		return;
+	}
 
-		// Alloco la memoria necessaria al file per evitare "bus error"
-		int ret = posix_fallocate(file, 0, sizeof(DiskHeader) + bitmap_entries + num_blocks*BLOCK_SIZE);
+	// Le richieste asincrone passano per io_uring (o per il pool di thread); con la mmap, o se non si riesce ad avviare
+	// nessun engine, vengono eseguite subito
+	disk->io = NULL;
+	if(config->backend == DISK_BACKEND_PREAD) disk->io = DiskIO_create(config->io_engine, BLOCK_SIZE);
+	if(disk->io == NULL) disk->io = DiskIO_create(DISK_IO_MEMORY, BLOCK_SIZE);
 
-		// Creiamo un DiskHeader che andrà inserito nel DiskDriver
-		disk->header = (DiskHeader*) mmap(0, sizeof(DiskHeader) + bitmap_entries + (num_blocks*BLOCK_SIZE), PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
-		disk->header->num_blocks = num_blocks;
-		disk->header->bitmap_blocks = count_blocks(bitmap_entries);
-		disk->header->bitmap_entries = bitmap_entries;
-		disk->header->free_blocks = num_blocks ;
-	}
+	// Creo la bitmap del disco (un bit per ogni blocco) e divido i blocchi in gruppi di allocazione. Se il disco è stato chiuso
+	// con DiskDriver_unmount, blocchi liberi dei gruppi e riassunto della bitmap vengono dal riassunto salvato; altrimenti
+	// (disco nuovo o crash) li ricostruisco leggendo tutta la bitmap
+	disk->bitmap.num_bits = disk->header->num_blocks;
+	disk->bitmap.entries = disk->bitmap_data;
+	disk->bitmap.summary = NULL;
+	disk->run_policy = DISK_FIRST_FIT;
+	DiskDriver_initGroups(disk);
+	disk->clean_mount = DiskDriver_loadSummary(disk) == 0;
+	if(!disk->clean_mount) DiskDriver_scan(disk);
 
-	lseek(file, 0, SEEK_SET);
-	// Memorizzo in bitmap_data il puntatore alla mmap saltando lo spazio dedicato a DiskHeader
-	disk->bitmap_data = (char *) disk->header + sizeof(DiskHeader);
+	// Preparo la bitmap delle pagine da sincronizzare: all'inizio non c'è niente da scrivere (tranne il DiskHeader di un disco nuovo)
+	disk->page_size = sysconf(_SC_PAGESIZE);
+	disk->dirty_pages.num_bits = (disk->file_size + disk->page_size - 1) / disk->page_size;
+	disk->dirty_pages.entries = calloc((disk->dirty_pages.num_bits + 7) / 8, 1);
+	disk->dirty_pages.summary = NULL;
+	pthread_mutex_init(&disk->dirty_lock, NULL);
+	disk->durability = DISK_SYNC_WRITE;
+	disk->flush_interval_ms = 0;
+	disk->flusher_running = 0;
+	disk->syncs = 0;
+	if(new_file) DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
 
 	// Calcolo il primo blocco libero dopo aver assegnato il valore alle entries
 	disk->header->first_free_block = DiskDriver_getFreeBlock(disk,0);
 
+	// Controllo la politica di allocazione e il cursore letti dal file
+	if(disk->header->alloc_policy != DISK_ALLOC_NEXT_FIT && disk->header->alloc_policy != DISK_ALLOC_FIRST_FIT) disk->header->alloc_policy = DISK_ALLOC_GROUPS;
+	if(disk->header->alloc_cursor < 0 || disk->header->alloc_cursor >= disk->header->num_blocks) disk->header->alloc_cursor = 0;
+
+	// Se il disco ha la tabella dei checksum preparo la sua memoria (i blocchi della tabella vengono letti quando servono)
+	int64_t table_blocks = (disk->header->num_blocks + DISK_CHECKSUMS_PER_BLOCK - 1) / DISK_CHECKSUMS_PER_BLOCK;
+	if(disk->header->checksum_blocks > 0 && disk->header->checksum_blocks == table_blocks) DiskDriver_openChecksums(disk, table_blocks);
+
+	// Se il disco ha la tabella di deduplicazione la leggo tutta. Se non si riesce, non si sa più quali blocchi sono condivisi:
+	// liberandoli si rovinerebbero gli altri file che li usano, quindi il disco viene montato in sola lettura
+	if(disk->header->dedup_blocks > 0 && DiskDriver_openDedup(disk, disk->header->dedup_blocks, 1) == -1) {
+		printf("Non è stato possibile leggere la tabella di deduplicazione. Il disco è in sola lettura.");
+		disk->read_only = 1;
+	}
+
+	// Se il disco ha degli snapshot leggo la loro regione e le loro bitmap. Se non si riesce, non si sa più quali blocchi sono
+	// congelati: liberandoli verrebbero riusati e gli snapshot si rovinerebbero, quindi il disco viene montato in sola lettura
+	if(disk->header->snapshot_blocks > 0 && DiskDriver_openSnapshots(disk) == -1) {
+		printf("Non è stato possibile leggere gli snapshot. Il disco è in sola lettura.");
+		disk->read_only = 1;
+	}
+
+	// Da qui il disco può cambiare: tolgo il segno di disco pulito prima di qualsiasi scrittura, così un crash non lascia
+	// un riassunto vecchio a cui credere. Un disco in sola lettura invece non viene scritto, e il suo riassunto resta valido
+	if(disk->header->clean && !disk->read_only) {
+		disk->header->clean = 0;
+		DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+		DiskDriver_flush(disk);
+	}
+
 	return;
 }
 
 
-// reads the block in position block_num, returns -1 if the block is free accrding to the bitmap 0 otherwise 
-int DiskDriver_readBlock(DiskDriver* disk, void * dest, int block_num){
+// Restituisce un puntatore in sola lettura al blocco "block_num", direttamente all'interno della mmap o della cache (senza copiarlo),
+// oppure NULL se il blocco non fa parte del disco, è libero o non può essere letto. Il puntatore resta valido fino a DiskDriver_releaseBlockPtr
+// returns a read-only pointer to block block_num inside the mapping or the cache, NULL if it is free, not on the disk or unreadable
+const void* DiskDriver_getBlockPtr(DiskDriver* disk, int block_num) {
 
 	// Se il blocco da leggere è maggiore del numero di blocchi contenuti, restituisco un errore
-	if(block_num >= disk->header->num_blocks) return -1;
+	if(block_num < 0 || block_num >= disk->header->num_blocks) return NULL;
 
-	// Creo la bitmap che andrò ad utilizzare per la BitMap_get()
-	BitMap bitmap;
-	bitmap.num_bits = disk->header->bitmap_entries * 8;
-	bitmap.entries = disk->bitmap_data;
-	
 	// Se il blocco che si vuole leggere è vuoto, restituiamo un errore
-	if(BitMap_get(&bitmap, block_num, 0) == block_num) return -1;
-	
+	if(BitMap_get(&disk->bitmap, block_num, 0) == block_num) return NULL;
+
+	// Se il disco ha i checksum, il blocco viene verificato (solo la prima volta dopo essere stato letto dal file)
+	const char * block = disk->backend->getBlock(disk, block_num, 1);
+	if(block != NULL && DiskDriver_checksumVerify(disk, block_num, block, 0) == -1) {
+		disk->backend->releaseBlock(disk, block_num);
+		return NULL;
+	}
+	return block;
+}
+
+// Come DiskDriver_getBlockPtr, ma il blocco può essere modificato direttamente: dopo averlo modificato bisogna chiamare DiskDriver_markDirty
+// same as DiskDriver_getBlockPtr, but the block can be modified in place (then call DiskDriver_markDirty)
+void* DiskDriver_getBlockPtrMut(DiskDriver* disk, int block_num) {
+	return (void *) DiskDriver_getBlockPtr(disk, block_num);
+}
+
+// Rilascia un puntatore restituito da DiskDriver_getBlockPtr: con la cache, il frame del blocco può di nuovo essere riutilizzato
+// releases a pointer returned by DiskDriver_getBlockPtr
+void DiskDriver_releaseBlockPtr(DiskDriver* disk, int block_num) {
+	if(block_num < 0 || block_num >= disk->header->num_blocks) return;
+	disk->backend->releaseBlock(disk, block_num);
+}
+
+// Segna come modificato il blocco "block_num", scritto tramite DiskDriver_getBlockPtrMut; con DISK_SYNC_WRITE viene sincronizzato subito
+// marks block block_num as modified; with DISK_SYNC_WRITE it is synced immediately
+int DiskDriver_markDirty(DiskDriver* disk, int block_num) {
+	if(block_num < 0 || block_num >= disk->header->num_blocks || disk->read_only) return -1;
+	if(disk->checksums != NULL) {
+		const char * block = disk->backend->getBlock(disk, block_num, 1);
+		if(block == NULL) return -1;
+		DiskDriver_checksumUpdate(disk, block_num, block);
+		disk->backend->releaseBlock(disk, block_num);
+	}
+	disk->backend->markBlock(disk, block_num);
+	return disk->durability == DISK_SYNC_WRITE ? DiskDriver_flush(disk) : 0;
+}
+
+// reads the block in position block_num, returns -1 if the block is free accrding to the bitmap 0 otherwise 
+int DiskDriver_readBlock(DiskDriver* disk, void * dest, int block_num){
+
+	// Cerco il blocco nella mmap (o nella cache): se è libero o non fa parte del disco, restituisco un errore
+	const void * block = DiskDriver_getBlockPtr(disk, block_num);
+	if(block == NULL) return -1;
+
 	// Leggo il blocco block_num e lo inserisco in dest
-	memcpy(dest, disk->bitmap_data + disk->header->bitmap_entries + (block_num * BLOCK_SIZE), BLOCK_SIZE);
+	memcpy(dest, block, BLOCK_SIZE);
+	DiskDriver_releaseBlockPtr(disk, block_num);
 
 	// Se non ho restituito nulla finora, vuol dire che la funzione è andata a buon fine
 	return 0;
@@ -95,68 +1653,120 @@ int DiskDriver_readBlock(DiskDriver* disk, void * dest, int block_num){
 // writes a block in position block_num, and alters the bitmap accordingly, returns -1 if operation not possible
 int DiskDriver_writeBlock(DiskDriver * disk, void * src, int block_num) {
 	
-	// Se il numero del blocco da scrivere è maggiore del numero di blocchi esistenti, restituisco un errore
-	if(block_num > disk->header->num_blocks) return -1;
+	// Se il numero del blocco da scrivere è maggiore del numero di blocchi esistenti (o il disco è in sola lettura), restituisco un errore
+	if(block_num < 0 || block_num >= disk->header->num_blocks || disk->read_only) return -1;
 
-	// Creo la bitmap che andrò ad utilizzare per la BitMap_get()
-	BitMap bitmap;
-	bitmap.num_bits = disk->header->bitmap_entries * 8;
-	bitmap.entries = disk->bitmap_data;
-	
-	// Se il blocco è libero allora decremento free_block
-	if(BitMap_get(&bitmap,block_num,0) == block_num) disk->header->free_blocks--;
+	// Cerco il blocco nella mmap (o un frame della cache, senza leggerlo dal file, visto che verrà sovrascritto tutto)
+	char * block = disk->backend->getBlock(disk, block_num, 0);
+	if(block == NULL) return -1;
 
-	if(strlen(src) * 8 > BLOCK_SIZE) return -1;
+	// Scrivo che il blocco è occupato (se era libero, decremento free_blocks e i blocchi liberi del suo gruppo)
+	DiskDriver_markRange(disk, block_num, 1, 1);
 
-	// Scrivo che il blocco è occupato
-	BitMap_set(&bitmap, block_num, 1);
+	// Scrivo il contenuto di src in block_num (aggiornando il suo checksum), e segno il blocco come da sincronizzare
+	memcpy(block, src, BLOCK_SIZE);
+	DiskDriver_checksumUpdate(disk, block_num, src);
+	disk->backend->markBlock(disk, block_num);
+	disk->backend->releaseBlock(disk, block_num);
 
-	// Scrivo il contenuto di src in block_num
-	memcpy(disk->bitmap_data + disk->header->bitmap_entries + (block_num * BLOCK_SIZE), src, BLOCK_SIZE);
+	// Se richiesto dalla modalità di durabilità, mi assicuro che il contenuto della write sia memorizzato su disk
+	if(disk->durability == DISK_SYNC_WRITE && DiskDriver_flush(disk) == -1) return -1;
+
+  return 0;
+}
 
-	// Mi assicuro che il contenuto della write sia memorizzato su disk 
-	if(DiskDriver_flush(disk) == -1) return -1;
 
-	disk->header->first_free_block = DiskDriver_getFreeBlock(disk,0);		
+// Come DiskDriver_writeBlock, ma il blocco non viene mai sincronizzato qui: verrà scritto dalla prossima DiskDriver_flush.
+// Il journal la usa per i suoi record e per riportare i blocchi al loro posto, decidendo da sé quando sincronizzare
+// Writes a block without syncing it, whatever the durability mode
+int DiskDriver_stageBlock(DiskDriver* disk, const void* src, int block_num) {
+	if(block_num < 0 || block_num >= disk->header->num_blocks || disk->read_only) return -1;
 
-  return 0;
+	char * block = disk->backend->getBlock(disk, block_num, 0);
+	if(block == NULL) return -1;
+	DiskDriver_markRange(disk, block_num, 1, 1);
+	memcpy(block, src, BLOCK_SIZE);
+	DiskDriver_checksumUpdate(disk, block_num, src);
+	disk->backend->markBlock(disk, block_num);
+	disk->backend->releaseBlock(disk, block_num);
+	return 0;
 }
 
 
 // frees a block in position block_num, and alters the bitmap accordingly, returns -1 if operation not possible
 int DiskDriver_freeBlock(DiskDriver* disk, int block_num) {
 
-	// Se il blocco che devo liberare non fa parte del mio disk, restituisco -1
-	if(block_num > disk->header->num_blocks) return -1;
+	// Se il blocco che devo liberare non fa parte del mio disk (o il disco è in sola lettura), restituisco -1
+	if(block_num < 0 || block_num >= disk->header->num_blocks || disk->read_only) return -1;
+
+	// Se il blocco inizia una sequenza condivisa, la sequenza perde un riferimento (e i blocchi restano occupati finché ne ha altri);
+	// se lo usa uno snapshot, viene solo rilasciato
+	if(disk->dedup != NULL || disk->snapshots != NULL) return DiskDriver_freeBlocks(disk, &block_num, 1);
 
-	// Incremento il numero di blocchi liberi nel DiskHeader
-	if(DiskDriver_getFreeBlock(disk,block_num-1) != block_num) disk->header->free_blocks++;
+	// Imposto il blocco come libero nella BitMap (se era occupato, incremento i blocchi liberi del disco e del suo gruppo)
+	DiskDriver_markRange(disk, block_num, 1, 0);
+	if(disk->durability == DISK_SYNC_WRITE) DiskDriver_flush(disk);
 
-	// Creo la bitmap che andrò ad utilizzare per la BitMap_get()
-	BitMap bitmap;
-	bitmap.num_bits = disk->header->bitmap_entries * 8;
-	bitmap.entries = disk->bitmap_data;
+	return 0;
+}
 
-	// Imposto il blocco come libero nella BitMap
-	BitMap_set(&bitmap, block_num, 0);
-	disk->bitmap_data = bitmap.entries;
-	DiskDriver_flush(disk);
 
-	// Nel caso in cui il blocco è precedente a quello salvato in DiskHeader lo cambio
-	if(block_num < disk->header->first_free_block) disk->header->first_free_block = block_num;
+// Libera gli "n" blocchi elencati in "blocks". I blocchi con indici consecutivi vengono liberati come un unico intervallo,
+// e free_blocks viene aggiornato (e il disco sincronizzato) una sola volta per tutto il gruppo
+// Frees the n blocks listed in blocks, updating free_blocks and flushing only once
+int DiskDriver_freeBlocks(DiskDriver* disk, int* blocks, int n) {
 
-	return 0;
+	// Se uno dei blocchi non fa parte del disco (o il disco è in sola lettura), non libero niente e restituisco -1
+	int i, j;
+	if(disk->read_only) return -1;
+	for(i = 0; i < n; i++) {
+		if(blocks[i] < 0 || blocks[i] >= disk->header->num_blocks) return -1;
+	}
+
+	// Con la tabella di deduplicazione, le sequenze condivise elencate perdono un riferimento e i loro blocchi restano occupati
+	// finché ne hanno altri; i blocchi usati da uno snapshot vengono solo rilasciati: libero solo i blocchi rimasti
+	int* freed = blocks;
+	if(disk->dedup != NULL || disk->snapshots != NULL) {
+		freed = malloc(n * sizeof(int));
+		if(freed == NULL) return -1;
+		if(disk->dedup != NULL) {
+			n = DiskDriver_dedupRelease(disk, blocks, n, freed);
+		}else{
+			memcpy(freed, blocks, n * sizeof(int));
+		}
+		if(n != -1 && disk->snapshots != NULL) n = DiskDriver_snapshotRelease(disk, freed, n);
+		if(n == -1) {
+			free(freed);
+			return -1;
+		}
+	}
+
+	// Libero insieme ogni intervallo di blocchi consecutivi
+	for(i = 0; i < n; i = j) {
+		for(j = i + 1; j < n && freed[j] == freed[j - 1] + 1; j++);
+		DiskDriver_markRange(disk, freed[i], j - i, 0);
+	}
+	if(freed != blocks) free(freed);
+
+	return disk->durability == DISK_SYNC_WRITE ? DiskDriver_flush(disk) : 0;
 }
 
+// Libera gli "n" blocchi consecutivi a partire da "start" come un unico intervallo
+// Frees the n consecutive blocks starting from start
+int DiskDriver_freeRange(DiskDriver* disk, int start, int n) {
+
+	// Se l'intervallo non fa parte del disco (o il disco è in sola lettura), restituisco -1
+	if(start < 0 || n < 0 || start > disk->header->num_blocks - n || disk->read_only) return -1;
+	if(n == 0) return 0;
+
+	DiskDriver_markRange(disk, start, n, 0);
+
+	return disk->durability == DISK_SYNC_WRITE ? DiskDriver_flush(disk) : 0;
+}
 
 // returns the first free block in the disk from position (checking the bitmap)
 int DiskDriver_getFreeBlock(DiskDriver* disk, int start) {
 	
-	// Creo la bitmap che andrò ad utilizzare per la BitMap_get()
-	BitMap bitmap;
-	bitmap.num_bits = disk->header->bitmap_entries * 8;
-	bitmap.entries = disk->bitmap_data;
-	
 	// Controllo che l'indice start non sia maggiore dei blocchi disponibili
 	if(start > disk->header->num_blocks) return -1;
 
@@ -164,17 +1774,817 @@ int DiskDriver_getFreeBlock(DiskDriver* disk, int start) {
 	if(disk->header->num_blocks <= 0 ) return -1;
 
 	// Controlliamo nella BitMap quale è il primo blocco libero
-	return BitMap_get(&bitmap, start, 0);
+	return BitMap_get(&disk->bitmap, start, 0);
 	
 }
 
-// writes the data (flushing the mmaps)
+// Sposta il cursore salvato nel DiskHeader subito dopo il blocco "block_num", ricominciando dall'inizio alla fine del disco.
+// Con più thread il cursore è solo un suggerimento per la prossima ricerca, quindi non serve un lock
+// Moves the next-fit cursor of the DiskHeader right after block_num, wrapping around
+static inline void DiskDriver_moveAllocCursor(DiskDriver* disk, int block_num) {
+	__atomic_store_n(&disk->header->alloc_cursor, block_num + 1 < disk->header->num_blocks ? block_num + 1 : 0, __ATOMIC_RELAXED);
+	DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+}
+
+// Cerca "n" blocchi liberi consecutivi e li riserva, segnandoli come occupati nella bitmap.
+// Con DISK_FIRST_FIT si parte da "hint" (e, se non si trova niente, si riprova dall'inizio), con DISK_BEST_FIT si sceglie il gruppo più piccolo
+// Finds n contiguous free blocks and reserves them, returns the first block of the run or -1
+int DiskDriver_allocRun(DiskDriver* disk, int n, int hint) {
+
+	// Se non ci sono abbastanza blocchi liberi (o il disco è in sola lettura), è inutile cercare
+	if(n <= 0 || n > DiskDriver_freeCount(disk) || disk->read_only) return -1;
+
+	// Senza un suggerimento valido, con DISK_ALLOC_NEXT_FIT riparto da dove è finita l'ultima allocazione
+	if(hint < 0 || hint >= disk->header->num_blocks) hint = disk->header->alloc_policy == DISK_ALLOC_NEXT_FIT ? disk->header->alloc_cursor : 0;
+
+	// Cerco il gruppo di blocchi secondo la politica del disco e lo riservo, segnandolo come occupato in modo che le prossime
+	// ricerche non lo restituiscano. Se un altro thread ne ha occupato una parte dopo la ricerca, cerco di nuovo
+	int first;
+	do {
+		if(disk->run_policy == DISK_BEST_FIT) {
+			first = BitMap_getBestRun(&disk->bitmap, 0, n);
+		}else{
+			first = BitMap_getRun(&disk->bitmap, hint, n);
+			if(first == -1 && hint > 0) first = BitMap_getRun(&disk->bitmap, 0, n);
+		}
+		if(first == -1) return -1;
+	} while(DiskDriver_claimRange(disk, first, n) == -1);
+	if(disk->header->alloc_policy == DISK_ALLOC_NEXT_FIT) DiskDriver_moveAllocCursor(disk, first + n - 1);
+
+	return first;
+}
+
+// Inizializza un cursore in modo che le allocazioni avvengano vicino al blocco "block_num"
+// Initializes a cursor so that it allocates near block_num
+void DiskDriver_initCursor(DiskDriver* disk, DiskCursor* cursor, int block_num) {
+	if(block_num < 0 || block_num >= disk->header->num_blocks) {
+		cursor->group = -1;
+		cursor->next = 0;
+	}else{
+		cursor->group = block_num / DISK_GROUP_BLOCKS;
+		cursor->next = block_num;
+	}
+}
+
+// Cerca un blocco libero usando il cursore e lo riserva. Il blocco viene cercato nel gruppo del cursore partendo da cursor->next;
+// se il gruppo è pieno, il cursore passa al gruppo successivo che ha blocchi liberi. Senza cursore si usa quello del thread
+// Finds a free block through the cursor (or the cursor of the calling thread) and reserves it
+int DiskDriver_allocBlock(DiskDriver* disk, DiskCursor* cursor) {
+
+	// Se il disco è in sola lettura, restituisco un errore
+	if(disk->read_only) return -1;
+
+	// Senza cursore decide la politica del disco: il primo blocco libero, il cursore salvato nel DiskHeader
+	// oppure (DISK_ALLOC_GROUPS) il cursore del thread. Il blocco trovato nella bitmap viene riservato con il lock
+	// del suo gruppo; se nel frattempo un altro thread l'ha preso (e dopo di lui il gruppo è pieno), cerco di nuovo
+	int block;
+	if(cursor == NULL && disk->header->alloc_policy == DISK_ALLOC_FIRST_FIT) {
+		while((block = BitMap_get(&disk->bitmap, 0, 0)) != -1) {
+			block = DiskDriver_claimBlock(disk, &disk->groups[block / DISK_GROUP_BLOCKS], block);
+			if(block != -1) return block;
+		}
+		return -1;
+	}
+	if(cursor == NULL && disk->header->alloc_policy == DISK_ALLOC_NEXT_FIT) {
+		while((block = BitMap_get(&disk->bitmap, __atomic_load_n(&disk->header->alloc_cursor, __ATOMIC_RELAXED), 0)) != -1
+			|| (block = BitMap_get(&disk->bitmap, 0, 0)) != -1) {
+			block = DiskDriver_claimBlock(disk, &disk->groups[block / DISK_GROUP_BLOCKS], block);
+			if(block != -1) {
+				DiskDriver_moveAllocCursor(disk, block);
+				return block;
+			}
+		}
+		return -1;
+	}
+
+	// Altrimenti uso il cursore del thread; la prima volta il thread sceglie un gruppo diverso da quelli degli altri thread
+	if(cursor == NULL) {
+		cursor = &thread_cursor;
+		if(cursor->group == -1) {
+			cursor->group = __atomic_fetch_add(&thread_groups, 1, __ATOMIC_RELAXED) % disk->num_groups;
+			cursor->next = cursor->group * DISK_GROUP_BLOCKS;
+		}
+	}
+
+	// Controllo che il cursore sia valido per questo disco
+	if(cursor->group < 0 || cursor->group >= disk->num_groups) cursor->group = 0;
+
+	// Cerco un gruppo con almeno un blocco libero, a partire da quello del cursore
+	int i;
+	for(i = 0; i < disk->num_groups; i++) {
+		DiskGroup* group = &disk->groups[(cursor->group + i) % disk->num_groups];
+		if(__atomic_load_n(&group->free_blocks, __ATOMIC_RELAXED) < 1) continue;
+
+		// Se cambio gruppo, riparto dal suo inizio
+		if(i > 0 || cursor->next < group->first_block || cursor->next >= group->first_block + group->num_blocks) {
+			cursor->group = group->first_block / DISK_GROUP_BLOCKS;
+			cursor->next = group->first_block;
+		}
+
+		// Riservo il primo blocco libero dal cursore fino alla fine del gruppo e, se non c'è, dall'inizio del gruppo
+		block = DiskDriver_claimBlock(disk, group, cursor->next);
+		if(block == -1 && cursor->next > group->first_block) block = DiskDriver_claimBlock(disk, group, group->first_block);
+		if(block == -1) continue;
+
+		// Sposto il cursore subito dopo il blocco
+		cursor->next = block + 1;
+		return block;
+	}
+	return -1;
+}
+
+// Ingrandisce il disco fino a "new_num_blocks" blocchi: allunga il file, fa estendere al backend la mappa (o il buffer) e la bitmap,
+// poi aggiorna DiskHeader, bitmap e gruppi. La bitmap resta dov'è finché c'è spazio prima dei blocchi, altrimenti viene spostata
+// dopo di loro; i blocchi invece non si spostano mai. Restituisce -1 se il disco non può crescere, 0 altrimenti
+// Grows the disk (the flusher must be stopped)
+static int DiskDriver_growDisk(DiskDriver* disk, int new_num_blocks) {
+	DiskHeader* header = disk->header;
+	int old_num_blocks = header->num_blocks, i;
+
+	// Calcolo la nuova posizione della bitmap: se non c'è più spazio prima dei blocchi (o era già stata spostata)
+	// va dopo l'ultimo blocco, ad un multiplo di DISK_DATA_ALIGN
+	size_t entries = ((size_t) new_num_blocks + 7) / 8;
+	off_t data_end = disk->data_offset + (off_t) new_num_blocks * BLOCK_SIZE;
+	off_t bitmap_offset = header->bitmap_offset;
+	size_t file_size = data_end;
+	if(bitmap_offset >= disk->data_offset || bitmap_offset + (off_t) entries > disk->data_offset) {
+		bitmap_offset = (data_end + DISK_DATA_ALIGN - 1) & ~(off_t) (DISK_DATA_ALIGN - 1);
+		file_size = bitmap_offset + DiskDriver_bitmapSpace(entries);
+	}
+
+	// Preparo la memoria di pagine da sincronizzare e gruppi prima di toccare il file, così un errore non lascia il disco a metà
+	int num_pages = (file_size + disk->page_size - 1) / disk->page_size;
+	int old_bytes = (disk->dirty_pages.num_bits + 7) / 8, new_bytes = (num_pages + 7) / 8;
+	char* dirty = realloc(disk->dirty_pages.entries, new_bytes);
+	if(dirty == NULL) return -1;
+	memset(dirty + old_bytes, 0, new_bytes - old_bytes);
+	disk->dirty_pages.entries = dirty;
+	disk->dirty_pages.num_bits = num_pages;
+
+	int num_groups = (new_num_blocks + DISK_GROUP_BLOCKS - 1) / DISK_GROUP_BLOCKS;
+	DiskGroup* groups = realloc(disk->groups, num_groups * sizeof(DiskGroup));
+	if(groups == NULL) return -1;
+	disk->groups = groups;
+
+	// Allungo il file, poi il backend rende accessibili i nuovi blocchi e la bitmap estesa
+	size_t old_file_size = disk->file_size;
+	if(posix_fallocate(disk->fd, 0, file_size) != 0) return -1;
+	disk->file_size = file_size;
+	if(disk->backend->grow(disk, new_num_blocks, bitmap_offset, entries) == -1) {
+		disk->file_size = old_file_size;
+		return -1;
+	}
+	header = disk->header;
+
+	// Aggiorno il DiskHeader: i nuovi blocchi sono tutti liberi
+	header->num_blocks = new_num_blocks;
+	header->bitmap_entries = entries;
+	header->bitmap_blocks = count_blocks(entries);
+	header->bitmap_offset = bitmap_offset;
+	header->free_blocks += new_num_blocks - old_num_blocks;
+	if(header->first_free_block == -1) header->first_free_block = old_num_blocks;
+
+	// Ricostruisco la bitmap sui nuovi byte e il suo riassunto
+	BitMap_freeSummary(&disk->bitmap);
+	disk->bitmap.entries = disk->bitmap_data;
+	disk->bitmap.num_bits = new_num_blocks;
+	BitMap_clearRange(&disk->bitmap, old_num_blocks, new_num_blocks - old_num_blocks);
+	BitMap_buildSummary(&disk->bitmap);
+
+	// Ricalcolo l'ultimo gruppo, che poteva essere incompleto, e aggiungo quelli nuovi
+	for(i = disk->num_groups > 0 ? disk->num_groups - 1 : 0; i < num_groups; i++) {
+		disk->groups[i].first_block = i * DISK_GROUP_BLOCKS;
+		disk->groups[i].num_blocks = new_num_blocks - disk->groups[i].first_block;
+		if(disk->groups[i].num_blocks > DISK_GROUP_BLOCKS) disk->groups[i].num_blocks = DISK_GROUP_BLOCKS;
+		disk->groups[i].free_blocks = BitMap_countRange(&disk->bitmap, disk->groups[i].first_block, disk->groups[i].num_blocks, 0);
+		if(i >= disk->num_groups) pthread_mutex_init(&disk->groups[i].lock, NULL);
+	}
+	disk->num_groups = num_groups;
+
+	// Scrivo prima la bitmap e poi il DiskHeader: finché il DiskHeader non è sincronizzato, il file descrive ancora il disco vecchio
+	int ret = 0;
+	DiskDriver_markDirtyOffset(disk, bitmap_offset, entries);
+	if(DiskDriver_flush(disk) == -1) ret = -1;
+	DiskDriver_markDirtyRange(disk, header, sizeof(DiskHeader));
+	if(DiskDriver_flush(disk) == -1) ret = -1;
+	return ret;
+}
+
+// Dopo la crescita del disco la tabella dei checksum deve coprire anche i nuovi blocchi: se serve un blocco in più,
+// la tabella (letta tutta in memoria) viene riscritta in una nuova zona e quella vecchia viene liberata
+// Moves the checksum table to a larger region after the disk has grown
+static int DiskDriver_growChecksums(DiskDriver* disk, int old_num_blocks) {
+	int num_blocks = disk->header->num_blocks, i;
+	unsigned char* verified = realloc(disk->checksum_verified, (num_blocks + 7) / 8);
+	if(verified == NULL) return -1;
+	memset(verified + (old_num_blocks + 7) / 8, 0, (num_blocks + 7) / 8 - (old_num_blocks + 7) / 8);
+	disk->checksum_verified = verified;
+
+	int old_blocks = disk->header->checksum_blocks, old_start = disk->header->checksum_block;
+	int table_blocks = (num_blocks + DISK_CHECKSUMS_PER_BLOCK - 1) / DISK_CHECKSUMS_PER_BLOCK;
+	if(table_blocks == old_blocks) return 0;
+
+	for(i = 0; i < old_blocks; i++) {
+		if(DiskDriver_checksumLoad(disk, i) == -1) return -1;
+	}
+	uint32_t* checksums = realloc(disk->checksums, (size_t) table_blocks * DISK_CHECKSUMS_PER_BLOCK * sizeof(uint32_t));
+	char* loaded = realloc(disk->checksum_loaded.entries, (table_blocks + 7) / 8);
+	char* dirty = loaded != NULL ? realloc(disk->checksum_dirty.entries, (table_blocks + 7) / 8) : NULL;
+	if(checksums != NULL) disk->checksums = checksums;
+	if(loaded != NULL) disk->checksum_loaded.entries = loaded;
+	if(dirty != NULL) disk->checksum_dirty.entries = dirty;
+	if(checksums == NULL || loaded == NULL || dirty == NULL) return -1;
+	int start = DiskDriver_allocRun(disk, table_blocks, num_blocks - table_blocks);
+	if(start == -1) return -1;
+
+	memset(checksums + (size_t) old_blocks * DISK_CHECKSUMS_PER_BLOCK, 0, (size_t) (table_blocks - old_blocks) * DISK_CHECKSUMS_PER_BLOCK * sizeof(uint32_t));
+	disk->checksum_loaded.num_bits = disk->checksum_dirty.num_bits = table_blocks;
+	BitMap_setRange(&disk->checksum_loaded, 0, table_blocks);
+	BitMap_setRange(&disk->checksum_dirty, 0, table_blocks);
+
+	// Il DiskHeader punta alla nuova tabella prima di liberare la vecchia: liberarla può già sincronizzare la tabella
+	disk->header->checksum_block = start;
+	disk->header->checksum_blocks = table_blocks;
+	DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+	DiskDriver_freeRange(disk, old_start, old_blocks);
+	return DiskDriver_flush(disk);
+}
+
+// Allunga le bitmap dei blocchi congelati e rilasciati fino ai nuovi blocchi (che non sono di nessuno snapshot) e, se la bitmap
+// dei blocchi rilasciati non entra più nella regione, sposta la regione in un gruppo di blocchi più grande
+// Grows the frozen and released bitmaps, moving the snapshot region if it gets bigger
+static int DiskDriver_growSnapshots(DiskDriver* disk, int old_num_blocks) {
+	DiskSnapshots* snapshots = disk->snapshots;
+	int num_blocks = disk->header->num_blocks, old_bytes = (old_num_blocks + 7) / 8, bytes = (num_blocks + 7) / 8;
+	char* frozen = realloc(snapshots->frozen.entries, bytes);
+	if(frozen != NULL) snapshots->frozen.entries = frozen;
+	char* released = realloc(snapshots->released.entries, bytes);
+	if(released != NULL) snapshots->released.entries = released;
+	if(frozen == NULL || released == NULL) return -1;
+	memset(frozen + old_bytes, 0, bytes - old_bytes);
+	memset(released + old_bytes, 0, bytes - old_bytes);
+	snapshots->frozen.num_bits = snapshots->released.num_bits = num_blocks;
+
+	int old_start = disk->header->snapshot_block, old_blocks = disk->header->snapshot_blocks;
+	int region_blocks = 1 + DiskDriver_bitmapBlocksFor(num_blocks);
+	if(region_blocks == old_blocks) return 0;
+	char* dirty = realloc(snapshots->dirty.entries, (region_blocks + 7) / 8);
+	if(dirty == NULL) return -1;
+	snapshots->dirty.entries = dirty;
+	snapshots->dirty.num_bits = region_blocks;
+	int start = DiskDriver_allocRun(disk, region_blocks, num_blocks - region_blocks);
+	if(start == -1) return -1;
+	BitMap_setRange(&snapshots->dirty, 0, region_blocks);
+
+	// Come per la tabella dei checksum, il DiskHeader punta alla nuova regione prima di liberare la vecchia
+	disk->header->snapshot_block = start;
+	disk->header->snapshot_blocks = region_blocks;
+	DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+	DiskDriver_freeRange(disk, old_start, old_blocks);
+	return DiskDriver_flush(disk);
+}
+
+// Ingrandisce il disco senza chiuderlo: i FileHandle e i DirectoryHandle aperti restano validi. Durante l'operazione il thread
+// della modalità periodica viene fermato, e quello che era già stato modificato viene sincronizzato prima di cambiare il file
+// Grows the disk to new_num_blocks blocks without closing it
+int DiskDriver_grow(DiskDriver* disk, int new_num_blocks) {
+	if(new_num_blocks < disk->header->num_blocks || disk->read_only) return -1;
+	if(new_num_blocks == disk->header->num_blocks) return 0;
+
+	int durability = disk->durability, interval_ms = disk->flush_interval_ms;
+	if(durability == DISK_SYNC_PERIODIC) DiskDriver_setDurability(disk, DISK_SYNC_FLUSH, 0);
+
+	int old_num_blocks = disk->header->num_blocks;
+	int ret = DiskDriver_flush(disk);
+	if(ret == 0) ret = DiskDriver_growDisk(disk, new_num_blocks);
+	if(ret == 0 && disk->checksums != NULL) ret = DiskDriver_growChecksums(disk, old_num_blocks);
+	if(ret == 0 && disk->snapshots != NULL) ret = DiskDriver_growSnapshots(disk, old_num_blocks);
+
+	if(durability == DISK_SYNC_PERIODIC) DiskDriver_setDurability(disk, durability, interval_ms);
+	return ret;
+}
+
+// Sceglie la politica usata da DiskDriver_allocBlock senza cursore; la politica viene salvata nel DiskHeader
+// Chooses the policy of DiskDriver_allocBlock without cursor, storing it in the DiskHeader
+int DiskDriver_setAllocPolicy(DiskDriver* disk, int policy) {
+	if(policy != DISK_ALLOC_GROUPS && policy != DISK_ALLOC_NEXT_FIT && policy != DISK_ALLOC_FIRST_FIT) return -1;
+	if(disk->read_only) return -1;
+
+	disk->header->alloc_policy = policy;
+	DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+	return disk->durability == DISK_SYNC_WRITE ? DiskDriver_flush(disk) : 0;
+}
+
+// Salva nel DiskHeader la regione del journal del file system (i blocchi devono essere già occupati nella bitmap)
+// Stores the journal region of the file system in the DiskHeader
+int DiskDriver_setJournal(DiskDriver* disk, int start, int num_blocks) {
+	if(num_blocks < 0 || start < 0 || start > disk->header->num_blocks - num_blocks || disk->read_only) return -1;
+
+	disk->header->journal_block = num_blocks > 0 ? start : 0;
+	disk->header->journal_blocks = num_blocks;
+	DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+	return disk->durability == DISK_SYNC_WRITE ? DiskDriver_flush(disk) : 0;
+}
+
+// Salva nel DiskHeader la versione delle strutture del file system
+// Stores the version of the file system in the DiskHeader
+int DiskDriver_setFsVersion(DiskDriver* disk, int version) {
+	if(disk->read_only) return -1;
+	disk->header->fs_version = version;
+	DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+	return disk->durability == DISK_SYNC_WRITE ? DiskDriver_flush(disk) : 0;
+}
+
+// Riserva la tabella dei checksum (verso la fine del disco, come il journal) e calcola il checksum di tutti i blocchi occupati;
+// poi scrive la tabella e il DiskHeader che la descrive
+// Reserves the checksum table and computes the checksum of every block in use
+int DiskDriver_enableChecksums(DiskDriver* disk) {
+	if(disk->checksums != NULL) return 0;
+	if(disk->read_only) return -1;
+	int num_blocks = disk->header->num_blocks, i;
+	int table_blocks = (num_blocks + DISK_CHECKSUMS_PER_BLOCK - 1) / DISK_CHECKSUMS_PER_BLOCK;
+	int start = DiskDriver_allocRun(disk, table_blocks, num_blocks - table_blocks);
+	if(start == -1) return -1;
+	if(DiskDriver_openChecksums(disk, table_blocks) == -1) {
+		DiskDriver_freeRange(disk, start, table_blocks);
+		return -1;
+	}
+	disk->header->checksum_block = start;
+	disk->header->checksum_blocks = table_blocks;
+
+	// La tabella è tutta in memoria e tutta da scrivere; i blocchi liberi hanno checksum 0 finché non vengono scritti
+	BitMap_setRange(&disk->checksum_loaded, 0, table_blocks);
+	BitMap_setRange(&disk->checksum_dirty, 0, table_blocks);
+	for(i = 0; (i = BitMap_get(&disk->bitmap, i, 1)) != -1; i++) {
+		if(!DiskDriver_checksumCovers(disk, i)) continue;
+		const char * block = disk->backend->getBlock(disk, i, 1);
+		if(block == NULL) continue;
+		disk->checksums[i] = CRC32C_update(0, block, BLOCK_SIZE);
+		disk->backend->releaseBlock(disk, i);
+	}
+
+	DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+	return DiskDriver_flush(disk);
+}
+
+// Libera i blocchi della tabella dei checksum e la sua memoria
+// Frees the checksum table
+int DiskDriver_disableChecksums(DiskDriver* disk) {
+	if(disk->checksums == NULL) return 0;
+	if(disk->read_only) return -1;
+	DiskDriver_freeChecksums(disk);
+	DiskDriver_freeRange(disk, disk->header->checksum_block, disk->header->checksum_blocks);
+	disk->header->checksum_block = 0;
+	disk->header->checksum_blocks = 0;
+	DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+	return DiskDriver_flush(disk);
+}
+
+// Riserva la tabella di deduplicazione (verso la fine del disco, come la tabella dei checksum), vuota, e il DiskHeader che la descrive
+// Reserves an empty dedup table of at least num_entries entries
+int DiskDriver_enableDedup(DiskDriver* disk, int num_entries) {
+	if(disk->dedup != NULL) return 0;
+	if(disk->read_only) return -1;
+	if(num_entries < 1) num_entries = 1;
+	int num_blocks = disk->header->num_blocks;
+	int table_blocks = (num_entries + DISK_DEDUP_PER_BLOCK - 1) / DISK_DEDUP_PER_BLOCK;
+	int start = DiskDriver_allocRun(disk, table_blocks, num_blocks - table_blocks);
+	if(start == -1) return -1;
+	if(DiskDriver_openDedup(disk, table_blocks, 0) == -1) {
+		DiskDriver_freeRange(disk, start, table_blocks);
+		return -1;
+	}
+	disk->header->dedup_block = start;
+	disk->header->dedup_blocks = table_blocks;
+	DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+	return DiskDriver_flush(disk);
+}
+
+// Libera i blocchi della tabella di deduplicazione e la sua memoria
+// Frees the dedup table
+int DiskDriver_disableDedup(DiskDriver* disk) {
+	if(disk->dedup == NULL) return 0;
+	if(disk->read_only) return -1;
+	DiskDriver_freeDedup(disk);
+	DiskDriver_freeRange(disk, disk->header->dedup_block, disk->header->dedup_blocks);
+	disk->header->dedup_block = 0;
+	disk->header->dedup_blocks = 0;
+	DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+	return DiskDriver_flush(disk);
+}
+
+// Cerca tra le sequenze con la stessa impronta e lo stesso numero di blocchi una che contenga proprio "data": l'impronta serve solo a trovare
+// i candidati, i byte vengono sempre confrontati. La sequenza trovata guadagna un riferimento
+// Looks for a run with the same content as data, adding a reference to it
+int DiskDriver_dedupLookup(DiskDriver* disk, uint64_t fingerprint, const void* data, int n) {
+	DiskDedup* dedup = disk->dedup;
+	if(dedup == NULL || n <= 0) return -1;
+	int e, i, ret = -1;
+	pthread_mutex_lock(&dedup->lock);
+	dedup->lookups++;
+	for(e = dedup->by_fingerprint[DiskDriver_dedupBucket(fingerprint, dedup->num_entries)]; e != -1 && ret == -1; e = dedup->next_fingerprint[e]) {
+		DiskDedupEntry* entry = &dedup->entries[e];
+		if(entry->fingerprint != fingerprint || entry->num_blocks != n) continue;
+		for(i = 0; i < n; i++) {
+			const void* block = DiskDriver_getBlockPtr(disk, entry->block + i);
+			int same = block != NULL && memcmp(block, (const char *) data + (size_t) i * BLOCK_SIZE, BLOCK_SIZE) == 0;
+			if(block != NULL) DiskDriver_releaseBlockPtr(disk, entry->block + i);
+			if(!same) break;
+		}
+		if(i < n) continue;
+		entry->refs++;
+		BitMap_set(&dedup->dirty, e / DISK_DEDUP_PER_BLOCK, 1);
+		dedup->hits++;
+		ret = entry->block;
+	}
+	pthread_mutex_unlock(&dedup->lock);
+	return ret;
+}
+
+// Registra una sequenza appena scritta, con un riferimento, nella prima voce libera della tabella
+// Registers a run of n blocks with one reference
+int DiskDriver_dedupInsert(DiskDriver* disk, uint64_t fingerprint, int block_num, int n) {
+	DiskDedup* dedup = disk->dedup;
+	if(dedup == NULL || n <= 0 || block_num < 0 || block_num > disk->header->num_blocks - n || disk->read_only) return -1;
+	pthread_mutex_lock(&dedup->lock);
+	int e = dedup->first_free;
+	if(e != -1) {
+		dedup->first_free = dedup->next_fingerprint[e];
+		dedup->entries[e].fingerprint = fingerprint;
+		dedup->entries[e].block = block_num;
+		dedup->entries[e].num_blocks = n;
+		dedup->entries[e].refs = 1;
+		DiskDriver_dedupLink(dedup, e);
+		dedup->used++;
+		BitMap_set(&dedup->dirty, e / DISK_DEDUP_PER_BLOCK, 1);
+	}
+	pthread_mutex_unlock(&dedup->lock);
+	return e == -1 ? -1 : 0;
+}
+
+// Somma, per ogni sequenza della tabella, i blocchi risparmiati dai riferimenti oltre il primo
+// Returns the blocks saved by sharing
+int64_t DiskDriver_dedupSaved(DiskDriver* disk) {
+	DiskDedup* dedup = disk->dedup;
+	if(dedup == NULL) return 0;
+	int64_t saved = 0;
+	int e;
+	pthread_mutex_lock(&dedup->lock);
+	for(e = 0; e < dedup->num_entries; e++) {
+		if(dedup->entries[e].refs > 1) saved += (int64_t) (dedup->entries[e].refs - 1) * dedup->entries[e].num_blocks;
+	}
+	pthread_mutex_unlock(&dedup->lock);
+	return saved;
+}
+
+// Copia in "used" la bitmap del disco, un gruppo alla volta con il suo lock, poi toglie le regioni del DiskDriver (il journal, le tabelle
+// dei checksum e della deduplicazione, la regione e le bitmap degli snapshot) e i blocchi rilasciati, che il file system non usa più
+// Copies the blocks used by the file system
+int DiskDriver_usedBlocks(DiskDriver* disk, BitMap* used) {
+	DiskHeader* header = disk->header;
+	int i;
+	if(used->num_bits != header->num_blocks) return -1;
+	for(i = 0; i < disk->num_groups; i++) {
+		DiskGroup* group = &disk->groups[i];
+		pthread_mutex_lock(&group->lock);
+		memcpy(used->entries + group->first_block / 8, disk->bitmap.entries + group->first_block / 8, (group->num_blocks + 7) / 8);
+		pthread_mutex_unlock(&group->lock);
+	}
+	BitMap_clearRange(used, header->journal_block, header->journal_blocks);
+	BitMap_clearRange(used, header->checksum_block, header->checksum_blocks);
+	BitMap_clearRange(used, header->dedup_block, header->dedup_blocks);
+	BitMap_clearRange(used, header->snapshot_block, header->snapshot_blocks);
+
+	DiskSnapshots* snapshots = disk->snapshots;
+	if(snapshots != NULL) {
+		int bytes = (header->num_blocks + 7) / 8;
+		pthread_mutex_lock(&snapshots->lock);
+		for(i = 0; i < DISK_MAX_SNAPSHOTS; i++) {
+			if(snapshots->table[i].num_blocks > 0) {
+				BitMap_clearRange(used, snapshots->table[i].bitmap_block, DiskDriver_bitmapBlocksFor(snapshots->table[i].num_blocks));
+			}
+		}
+		for(i = 0; i < bytes; i++) used->entries[i] &= ~snapshots->released.entries[i];
+		pthread_mutex_unlock(&snapshots->lock);
+	}
+	return 0;
+}
+
+// Registra lo snapshot: scrive la sua bitmap (i blocchi condivisi con il file system e le copie fatte per lo snapshot) in un gruppo di blocchi
+// verso la fine del disco, congela tutti i suoi blocchi e rilascia subito le copie, che il file system non usa. Il primo snapshot riserva
+// anche la regione degli snapshot
+// Records a snapshot, freezing its blocks
+int DiskDriver_snapshot(DiskDriver* disk, const char* name, int root, const BitMap* shared, const BitMap* copies) {
+	if(name == NULL || strlen(name) >= sizeof(((DiskSnapshot *) 0)->name) || DiskDriver_findSnapshot(disk, name) != -1 || disk->read_only) return -1;
+	int num_blocks = disk->header->num_blocks, bytes = (num_blocks + 7) / 8, bitmap_blocks = DiskDriver_bitmapBlocksFor(num_blocks), slot = 0, i, j;
+	if(shared->num_bits != num_blocks || copies->num_bits != num_blocks) return -1;
+	while(disk->snapshots != NULL && slot < DISK_MAX_SNAPSHOTS && disk->snapshots->table[slot].num_blocks > 0) slot++;
+	if(slot == DISK_MAX_SNAPSHOTS) return -1;
+
+	// Riservo la bitmap dello snapshot e, se è il primo, la regione degli snapshot
+	int bitmap_block = DiskDriver_allocRun(disk, bitmap_blocks, num_blocks - bitmap_blocks), new_region = disk->snapshots == NULL;
+	if(bitmap_block == -1) return -1;
+	if(new_region) {
+		int region_blocks = 1 + bitmap_blocks;
+		int start = DiskDriver_allocRun(disk, region_blocks, num_blocks - region_blocks);
+		if(start == -1 || DiskDriver_allocSnapshots(disk) == -1) {
+			if(start != -1) DiskDriver_markRange(disk, start, region_blocks, 0);
+			DiskDriver_markRange(disk, bitmap_block, bitmap_blocks, 0);
+			return -1;
+		}
+		disk->header->snapshot_block = start;
+		disk->header->snapshot_blocks = region_blocks;
+	}
+	DiskSnapshots* snapshots = disk->snapshots;
+
+	// Scrivo la bitmap dello snapshot
+	int ret = 0;
+	for(i = 0; i < bitmap_blocks && ret == 0; i++) {
+		char* block = disk->backend->getBlock(disk, bitmap_block + i, 0);
+		if(block == NULL) {
+			ret = -1;
+			break;
+		}
+		memset(block, 0, BLOCK_SIZE);
+		for(j = 0; j < BLOCK_SIZE && i * BLOCK_SIZE + j < bytes; j++) block[j] = shared->entries[i * BLOCK_SIZE + j] | copies->entries[i * BLOCK_SIZE + j];
+		DiskDriver_checksumUpdate(disk, bitmap_block + i, block);
+		disk->backend->markBlock(disk, bitmap_block + i);
+		disk->backend->releaseBlock(disk, bitmap_block + i);
+	}
+
+	// Aggiungo lo snapshot alla tabella e le copie ai blocchi rilasciati, e sincronizzo
+	if(ret == 0) {
+		pthread_mutex_lock(&snapshots->lock);
+		for(i = 0; i < bytes; i++) snapshots->released.entries[i] |= copies->entries[i];
+		strcpy(snapshots->table[slot].name, name);
+		snapshots->table[slot].root = root;
+		snapshots->table[slot].bitmap_block = bitmap_block;
+		snapshots->table[slot].num_blocks = num_blocks;
+		BitMap_setRange(&snapshots->dirty, 0, snapshots->dirty.num_bits);
+		pthread_mutex_unlock(&snapshots->lock);
+		DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+		ret = DiskDriver_flush(disk);
+
+		// Se la sincronizzazione non riesce tolgo lo snapshot: il disco torna com'era, e chi chiama può liberare le copie
+		if(ret == -1) {
+			pthread_mutex_lock(&snapshots->lock);
+			for(i = 0; i < bytes; i++) snapshots->released.entries[i] &= ~copies->entries[i];
+			memset(&snapshots->table[slot], 0, sizeof(DiskSnapshot));
+			pthread_mutex_unlock(&snapshots->lock);
+		}
+	}
+
+	// In caso di errore libero la bitmap dello snapshot e, se l'avevo appena riservata, la regione
+	if(ret == -1) {
+		DiskDriver_markRange(disk, bitmap_block, bitmap_blocks, 0);
+		if(new_region) {
+			DiskDriver_markRange(disk, disk->header->snapshot_block, disk->header->snapshot_blocks, 0);
+			DiskDriver_freeSnapshots(disk);
+			disk->header->snapshot_block = 0;
+			disk->header->snapshot_blocks = 0;
+		}
+		DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+		return -1;
+	}
+
+	// Solo ora i blocchi dello snapshot diventano congelati
+	pthread_mutex_lock(&snapshots->lock);
+	for(i = 0; i < bytes; i++) snapshots->frozen.entries[i] |= shared->entries[i] | copies->entries[i];
+	pthread_mutex_unlock(&snapshots->lock);
+	return 0;
+}
+
+int DiskDriver_findSnapshot(DiskDriver* disk, const char* name) {
+	int i;
+	for(i = 0; disk->snapshots != NULL && name != NULL && i < DISK_MAX_SNAPSHOTS; i++) {
+		if(disk->snapshots->table[i].num_blocks > 0 && strcmp(disk->snapshots->table[i].name, name) == 0) return disk->snapshots->table[i].root;
+	}
+	return -1;
+}
+
+// Cancella lo snapshot: libera la sua bitmap, ricostruisce i blocchi congelati con gli snapshot rimasti e libera i blocchi rilasciati
+// che non sono più congelati. Se non resta nessuno snapshot, libera anche la regione. Il disco viene sincronizzato una volta sola
+// Deletes a snapshot, freeing the released blocks no other snapshot uses
+int DiskDriver_deleteSnapshot(DiskDriver* disk, const char* name) {
+	DiskSnapshots* snapshots = disk->snapshots;
+	int slot, remaining = 0, i, j;
+	if(snapshots == NULL || name == NULL || disk->read_only) return -1;
+	for(slot = 0; slot < DISK_MAX_SNAPSHOTS; slot++) {
+		if(snapshots->table[slot].num_blocks > 0 && strcmp(snapshots->table[slot].name, name) == 0) break;
+	}
+	if(slot == DISK_MAX_SNAPSHOTS) return -1;
+
+	// Ricostruisco i blocchi congelati dagli altri snapshot a parte: se la bitmap di uno di loro non si legge non cambio niente,
+	// altrimenti verrebbero liberati dei blocchi che usa ancora
+	int bytes = (disk->header->num_blocks + 7) / 8;
+	char* frozen = calloc(bytes, 1);
+	if(frozen == NULL) return -1;
+	for(i = 0; i < DISK_MAX_SNAPSHOTS; i++) {
+		if(i == slot || snapshots->table[i].num_blocks == 0) continue;
+		if(DiskDriver_freezeSnapshot(disk, &snapshots->table[i], frozen) == -1) {
+			free(frozen);
+			return -1;
+		}
+		remaining++;
+	}
+	memcpy(snapshots->frozen.entries, frozen, bytes);
+	free(frozen);
+	DiskDriver_markRange(disk, snapshots->table[slot].bitmap_block, DiskDriver_bitmapBlocksFor(snapshots->table[slot].num_blocks), 0);
+	memset(&snapshots->table[slot], 0, sizeof(DiskSnapshot));
+
+	// Libero i blocchi rilasciati che nessuno snapshot usa più
+	for(i = 0; i < bytes; i++) {
+		if((snapshots->released.entries[i] & ~snapshots->frozen.entries[i]) == 0) continue;
+		for(j = i * 8; j < i * 8 + 8; j++) {
+			if(DiskDriver_testBit(&snapshots->released, j) && !DiskDriver_testBit(&snapshots->frozen, j)) DiskDriver_markRange(disk, j, 1, 0);
+		}
+		snapshots->released.entries[i] &= snapshots->frozen.entries[i];
+	}
+
+	// Senza snapshot la regione non serve più
+	if(remaining == 0) {
+		DiskDriver_markRange(disk, disk->header->snapshot_block, disk->header->snapshot_blocks, 0);
+		DiskDriver_freeSnapshots(disk);
+		disk->header->snapshot_block = 0;
+		disk->header->snapshot_blocks = 0;
+	}else{
+		BitMap_setRange(&snapshots->dirty, 0, snapshots->dirty.num_bits);
+	}
+	DiskDriver_markDirtyRange(disk, disk->header, sizeof(DiskHeader));
+	return DiskDriver_flush(disk);
+}
+
+// Un blocco congelato non può essere cambiato al suo posto
+// Returns 1 if a snapshot uses the block
+int DiskDriver_inSnapshot(DiskDriver* disk, int block_num) {
+	return disk->snapshots != NULL && DiskDriver_testBit(&disk->snapshots->frozen, block_num);
+}
+
+// Passa al backend il consiglio su come verranno letti gli "n" blocchi a partire da "block_num" (limitati alla fine del disco)
+// Tells the backend how the blocks will be accessed
+int DiskDriver_advise(DiskDriver* disk, int block_num, int n, int advice) {
+	if(advice < DISK_ADVISE_NORMAL || advice > DISK_ADVISE_DONTNEED) return -1;
+	if(block_num < 0 || block_num >= disk->header->num_blocks || n < 0) return -1;
+	if(n > disk->header->num_blocks - block_num) n = disk->header->num_blocks - block_num;
+	if(n > 0) disk->backend->advise(disk, block_num, n, advice);
+	return 0;
+}
+
+// Chiude il disco: aspetta le richieste asincrone, ferma il thread della modalità periodica e sincronizza tutto, poi salva
+// il riassunto dell'allocatore e segna il disco come pulito. Alla fine libera la memoria e chiude il file, anche in caso di errore
+// Closes the disk, saving the allocator summary so that the next mount does not scan the bitmap
+int DiskDriver_unmount(DiskDriver* disk) {
+	int ret = 0, i, n;
+
+	// Fermo il thread della modalità periodica, se c'è
+	if(disk->flusher_running && DiskDriver_setDurability(disk, DISK_SYNC_FLUSH, 0) == -1) ret = -1;
+
+	// Invio le richieste accodate e raccolgo i completamenti di tutte quelle ancora in corso
+	DiskIOCompletion completions[DISK_IO_DEPTH];
+	while(DiskIO_pending(disk->io) > 0) {
+		n = DiskDriver_poll(disk, completions, DISK_IO_DEPTH, 1);
+		if(n == -1) {
+			ret = -1;
+			break;
+		}
+		for(i = 0; i < n; i++) {
+			if(completions[i].result == -1) ret = -1;
+		}
+	}
+	DiskIO_destroy(disk->io);
+	disk->io = NULL;
+
+	// Il riassunto si salva solo se tutto il resto è già sul disco; un disco in sola lettura resta com'era
+	if(DiskDriver_flush(disk) == -1) ret = -1;
+	if(ret == 0 && !disk->read_only) ret = DiskDriver_writeSummary(disk);
+
+	DiskDriver_freeChecksums(disk);
+	DiskDriver_freeDedup(disk);
+	DiskDriver_freeSnapshots(disk);
+	disk->backend->close(disk);
+	disk->header = NULL;
+	disk->bitmap_data = NULL;
+	BitMap_freeSummary(&disk->bitmap);
+	disk->bitmap.entries = NULL;
+	for(i = 0; i < disk->num_groups; i++) pthread_mutex_destroy(&disk->groups[i].lock);
+	free(disk->groups);
+	disk->groups = NULL;
+	free(disk->dirty_pages.entries);
+	disk->dirty_pages.entries = NULL;
+	pthread_mutex_destroy(&disk->dirty_lock);
+	if(close(disk->fd) == -1) ret = -1;
+	disk->fd = -1;
+	return ret;
+}
+
+// Sincronizza solo le pagine della mmap (o i frame della cache) segnati come modificati. Le pagine vicine vengono unite in un unico intervallo,
+// per ogni intervallo si avvia la scrittura su disco, e alla fine si aspetta la fine di tutte le scritture con una sola fdatasync.
+// Prima i blocchi modificati delle tabelle di deduplicazione e dei checksum e della regione degli snapshot vengono copiati al loro posto,
+// così vengono sincronizzati insieme agli altri (la tabella dei checksum per ultima, perché gli altri blocchi cambiano il loro checksum)
+// writes the data (flushing the mmaps), writing back only the dirty ranges and waiting for them once
 int DiskDriver_flush(DiskDriver* disk) {
-	
-	// Calcolo la lunghezza della memoria da sincronizzare
-	int disk_size = sizeof(DiskHeader) + disk->header->bitmap_entries + (disk->header->num_blocks*BLOCK_SIZE) ;
+	if(disk->read_only) return 0;
+	DiskDriver_updateHeader(disk);
+	int ret = disk->dedup != NULL ? DiskDriver_dedupFlush(disk) : 0;
+	if(disk->snapshots != NULL && DiskDriver_snapshotFlush(disk) == -1) ret = -1;
+	if(disk->checksums != NULL && DiskDriver_checksumFlush(disk) == -1) ret = -1;
+	if(disk->backend->sync(disk) == -1) ret = -1;
+	return ret;
+}
+
+// Accoda la lettura asincrona del blocco "block_num" in "dest"
+// Queues an asynchronous read of block block_num
+int DiskDriver_submitRead(DiskDriver* disk, void* dest, int block_num, void* tag) {
+
+	// Come per la readBlock, il blocco deve far parte del disco ed essere occupato
+	if(block_num < 0 || block_num >= disk->header->num_blocks) return -1;
+	if(BitMap_get(&disk->bitmap, block_num, 0) == block_num) return -1;
+
+	// Controllo che ci sia posto nella coda prima di accodare la richiesta
+	if(DiskIO_pending(disk->io) == DISK_IO_DEPTH) return -1;
+	return disk->backend->submitBlock(disk, DISK_IO_READ, dest, block_num, tag);
+}
+
+// Accoda la scrittura asincrona di "src" nel blocco "block_num", segnandolo subito come occupato nella bitmap
+// Queues an asynchronous write of block block_num, marking it as used
+int DiskDriver_submitWrite(DiskDriver* disk, const void* src, int block_num, void* tag) {
+	if(block_num < 0 || block_num >= disk->header->num_blocks || disk->read_only) return -1;
+	if(DiskIO_pending(disk->io) == DISK_IO_DEPTH) return -1;
+	if(disk->backend->submitBlock(disk, DISK_IO_WRITE, (void *) src, block_num, tag) == -1) return -1;
+	DiskDriver_markRange(disk, block_num, 1, 1);
+	DiskDriver_checksumUpdate(disk, block_num, src);
+	return 0;
+}
+
+// Invia al disco tutte le richieste accodate, con una sola chiamata di sistema
+// Sends all the queued requests with a single system call
+int DiskDriver_submit(DiskDriver* disk) {
+	return DiskIO_submit(disk->io);
+}
+
+// Restituisce le richieste completate (con risultato 0 o -1). Con DISK_SYNC_WRITE, se tra queste c'è almeno una scrittura,
+// il disco viene sincronizzato una volta sola per tutto il gruppo
+// Returns the completed requests, syncing once for the whole batch of writes with DISK_SYNC_WRITE
+int DiskDriver_poll(DiskDriver* disk, DiskIOCompletion* completions, int max, int min_wait) {
+	int n = DiskIO_poll(disk->io, completions, max, min_wait);
+	if(n <= 0) return n;
 
-	// Sincronizzo la memoria modificata ed il file collegato dalla mmap()
-	return msync(disk->header, disk_size, MS_SYNC);
+	int i, writes = 0;
+	for(i = 0; i < n; i++) {
+		completions[i].result = completions[i].result == BLOCK_SIZE ? 0 : -1;
+		if(completions[i].op == DISK_IO_WRITE) writes++;
+
+		// Le letture vengono sempre verificate: non passano (necessariamente) dalla cache
+		if(completions[i].op == DISK_IO_READ && completions[i].result == 0 && completions[i].dest != NULL) {
+			int block_num = (completions[i].offset - disk->data_offset) / BLOCK_SIZE;
+			if(DiskDriver_checksumVerify(disk, block_num, completions[i].dest, 1) == -1) completions[i].result = -1;
+		}
+	}
+	if(writes > 0 && disk->durability == DISK_SYNC_WRITE && DiskDriver_flush(disk) == -1) {
+		for(i = 0; i < n; i++) {
+			if(completions[i].op == DISK_IO_WRITE) completions[i].result = -1;
+		}
+	}
+	return n;
+}
+
+// Thread che, in modalità DISK_SYNC_PERIODIC, sincronizza le pagine modificate ogni flush_interval_ms millisecondi
+// Background flusher used by DISK_SYNC_PERIODIC
+static void* DiskDriver_flusher(void* arg) {
+	DiskDriver* disk = (DiskDriver *) arg;
+	while(__atomic_load_n(&disk->flusher_running, __ATOMIC_ACQUIRE)) {
+		usleep(disk->flush_interval_ms * 1000);
+		DiskDriver_flush(disk);
+	}
+	return NULL;
+}
+
+// Sceglie quando vengono sincronizzate le pagine modificate. Se si esce dalla modalità periodica, il thread viene fermato
+// (dopo un'ultima sincronizzazione); se ci si entra, viene avviato
+// Chooses when the dirty pages are synced, starting or stopping the background flusher
+int DiskDriver_setDurability(DiskDriver* disk, int mode, int interval_ms) {
+
+	// Controllo che la modalità sia valida
+	if(mode != DISK_SYNC_WRITE && mode != DISK_SYNC_FLUSH && mode != DISK_SYNC_PERIODIC) return -1;
+	if(mode == DISK_SYNC_PERIODIC && interval_ms <= 0) return -1;
+
+	// Fermo il thread della modalità periodica, se c'era
+	if(disk->flusher_running) {
+		__atomic_store_n(&disk->flusher_running, 0, __ATOMIC_RELEASE);
+		pthread_join(disk->flusher, NULL);
+	}
+
+	disk->durability = mode;
+	disk->flush_interval_ms = interval_ms;
+	if(mode == DISK_SYNC_PERIODIC) {
+		disk->flusher_running = 1;
+		if(pthread_create(&disk->flusher, NULL, DiskDriver_flusher, disk) != 0) {
+			disk->flusher_running = 0;
+			disk->durability = DISK_SYNC_FLUSH;
+			return -1;
+		}
+	}
 
+	// Quello che era già stato scritto viene sincronizzato subito
+	return DiskDriver_flush(disk);
 }
@@ -1,21 +1,288 @@
 #pragma once
 #include "bitmap.h"
+#include "block_cache.h"
+#include "crc32c.h"
+#include "disk_io.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #define BLOCK_SIZE 512
-// this is stored in the 1st block of the disk
+
+// policies used by DiskDriver_allocRun to choose a run of free blocks
+#define DISK_FIRST_FIT 0
+#define DISK_BEST_FIT 1
+
+// policies used by DiskDriver_allocBlock when no cursor is given, chosen with DiskDriver_setAllocPolicy
+#define DISK_ALLOC_GROUPS 0    // the cursor of the calling thread, in its allocation group (default)
+#define DISK_ALLOC_NEXT_FIT 1  // the cursor stored in the DiskHeader: every allocation continues
+                               // where the previous one ended, wrapping around at the end of the disk
+#define DISK_ALLOC_FIRST_FIT 2 // the first free block of the disk
+
+// durability modes, chosen with DiskDriver_setDurability
+#define DISK_SYNC_WRITE 0    // every write/free syncs the dirty pages before returning (default)
+#define DISK_SYNC_FLUSH 1    // dirty pages are synced only by an explicit DiskDriver_flush
+#define DISK_SYNC_PERIODIC 2 // a background thread calls DiskDriver_flush every flush_interval_ms
+
+// DiskDriver_flush writes back as a single range two dirty ranges separated
+// by at most this number of clean pages
+#define DISK_FLUSH_MERGE_GAP 16
+
+// number of blocks in an allocation group
+#define DISK_GROUP_BLOCKS 4096
+
+// backends, chosen with DiskDriver_initConfig
+#define DISK_BACKEND_MMAP 0  // the whole disk is mapped in memory (default)
+#define DISK_BACKEND_PREAD 1 // header and bitmap are kept in memory, blocks go through pread/pwrite and a block cache
+#define DISK_BACKEND_WINDOWS 2 // header and bitmap stay mapped, blocks are reached through a few mapping windows,
+                               // mapped on first use and unmapped when least recently used
+
+// memory budget of the block cache when the configuration does not give one
+#define DISK_CACHE_DEFAULT_BYTES (4 << 20)
+
+// size and number of the mapping windows when the configuration does not give them
+#define DISK_WINDOW_DEFAULT_BYTES (64 << 20)
+#define DISK_WINDOW_DEFAULT_COUNT 16
+
+// access patterns passed to DiskDriver_advise
+#define DISK_ADVISE_NORMAL 0     // no special treatment
+#define DISK_ADVISE_SEQUENTIAL 1 // the blocks will be read in order: read ahead aggressively
+#define DISK_ADVISE_RANDOM 2     // the blocks will be read in random order: don't read ahead
+#define DISK_ADVISE_WILLNEED 3   // the blocks will be read soon: start reading them now, without waiting
+#define DISK_ADVISE_DONTNEED 4   // the blocks won't be read soon: their pages can be dropped from memory
+
+// first bytes of every disk, and version of the on-disk format
+// (disks written before the format had a version are converted when they are opened,
+// disks of versions 2 to 6 are upgraded: their header had no journal fields, no clean flag, no checksum table,
+// no dedup table or no snapshots)
+#define DISK_MAGIC 0x32534653 // "SFS2"
+#define DISK_VERSION 7
+
+// first bytes of the allocator summary written by DiskDriver_unmount
+#define DISK_SUMMARY_MAGIC 0x4d4d5553 // "SUMM"
+
+// threads used to scan the bitmap when a disk that was not unmounted cleanly is opened
+#define DISK_SCAN_THREADS 8
+
+// CRC32C stored in every block of the checksum table
+#define DISK_CHECKSUMS_PER_BLOCK (BLOCK_SIZE / sizeof(uint32_t))
+
+// the first block starts at a multiple of this position in the file
+// (so that blocks can be read and written with O_DIRECT)
+#define DISK_DATA_ALIGN 4096
+
+// blocks are numbered with int in memory: at most INT_MAX blocks (1 TiB with 512-byte blocks)
+#define DISK_MAX_BLOCKS INT_MAX
+
+// this is stored at the beginning of the file, followed by the bitmap and by the blocks
+// counters and positions are 64-bit, so the format does not limit the size of the disk
 typedef struct {
-  int num_blocks;
-  int bitmap_blocks;   // how many blocks in the bitmap
-  int bitmap_entries;  // how many bytes are needed to store the bitmap
+  uint32_t magic;           // DISK_MAGIC
+  uint32_t version;         // DISK_VERSION
+  int64_t num_blocks;
+  int64_t bitmap_blocks;    // how many blocks in the bitmap
+  int64_t bitmap_entries;   // how many bytes are needed to store the bitmap
+  int64_t bitmap_offset;    // position of the bitmap in the file: right after the header or,
+                            // once DiskDriver_grow has moved it, after the blocks
+  int64_t data_offset;      // position of the first block in the file (multiple of DISK_DATA_ALIGN)
 
-  int free_blocks;     // free blocks
-  int first_free_block;// first block index
+  int64_t free_blocks;      // free blocks (stored by DiskDriver_flush: see DiskDriver_freeCount)
+  int64_t first_free_block; // first block index (stored by DiskDriver_flush)
+  int32_t alloc_policy;     // DISK_ALLOC_GROUPS, DISK_ALLOC_NEXT_FIT or DISK_ALLOC_FIRST_FIT
+  int32_t fs_version;       // version of the structures stored in the blocks (managed by the file system)
+  int64_t alloc_cursor;     // DISK_ALLOC_NEXT_FIT: block from which the next search starts
+  int64_t journal_block;    // first block of the journal region of the file system
+  int64_t journal_blocks;   // blocks of the journal region (0 if the disk has no journal)
+  int32_t clean;            // 1 if the disk was closed by DiskDriver_unmount and not modified since:
+                            // the allocator summary at summary_offset can be trusted
+  uint32_t summary_checksum; // checksum of the summary_bytes bytes of the allocator summary
+  int64_t summary_offset;   // position of the allocator summary in the file, after the disk
+  int64_t summary_bytes;
+  int64_t checksum_block;   // first block of the checksum table: the CRC32C of every block of the disk,
+                            // DISK_CHECKSUMS_PER_BLOCK per block of the table
+  int64_t checksum_blocks;  // blocks of the checksum table (0 if the disk has no checksums)
+  int64_t dedup_block;      // first block of the dedup table, DISK_DEDUP_PER_BLOCK DiskDedupEntry per block
+  int64_t dedup_blocks;     // blocks of the dedup table (0 if the disk has no dedup)
+  int64_t snapshot_block;   // first block of the snapshot region: the DiskSnapshot table, then the released bitmap
+  int64_t snapshot_blocks;  // blocks of the snapshot region (0 if the disk has no snapshots)
 } DiskHeader;
 
+// an entry of the dedup table: a run of blocks shared by all the writes of the same content
+typedef struct {
+  uint64_t fingerprint;     // of the content of the run
+  int32_t block;            // first block of the run
+  int32_t num_blocks;
+  int32_t refs;             // references to the run (0: the entry is free)
+  int32_t unused;
+} DiskDedupEntry;
+
+// entries of the dedup table in a block
+#define DISK_DEDUP_PER_BLOCK ((int) (BLOCK_SIZE / sizeof(DiskDedupEntry)))
+
+// a snapshot of the file system: the copy of its root, and the bitmap of all the blocks it uses
+// (one bit per block, like the bitmap of the disk, in its own run of blocks)
 typedef struct {
-  DiskHeader* header; // mmapped
-  char* bitmap_data;  // mmapped (bitmap)
+  char name[40];
+  int64_t root;             // first block of the root directory of the snapshot
+  int64_t bitmap_block;     // first block of the bitmap of the snapshot
+  int64_t num_blocks;       // blocks of the disk (bits of the bitmap) when the snapshot was taken, 0: free entry
+} DiskSnapshot;
+
+// snapshots in the first block of the snapshot region
+#define DISK_MAX_SNAPSHOTS ((int) (BLOCK_SIZE / sizeof(DiskSnapshot)))
+
+// the snapshots in memory (DiskDriver_snapshot): a block used by a snapshot is frozen, it is never freed
+// while the snapshot exists; if the live file system frees it, it is only marked as released
+typedef struct {
+  DiskSnapshot table[DISK_MAX_SNAPSHOTS]; // copy of the first block of the region
+  BitMap frozen;            // union of the bitmaps of the snapshots
+  BitMap released;          // frozen blocks no longer used by the live file system (written after the table)
+  BitMap dirty;             // one bit per block of the region: 1 if DiskDriver_flush has to write it
+  pthread_mutex_t lock;
+} DiskSnapshots;
+
+// the dedup table in memory (DiskDriver_enableDedup), with two hashes over its entries
+typedef struct {
+  DiskDedupEntry* entries;  // copy of the whole table
+  int num_entries;
+  int* by_fingerprint;      // first entry of each bucket of the fingerprints (-1: none), num_entries buckets
+  int* by_block;            // first entry of each bucket of the first blocks of the runs
+  int* next_fingerprint;    // next entry of the same bucket (for free entries: next free entry)
+  int* next_block;
+  int first_free;           // first free entry (-1: the table is full)
+  int used;                 // entries in use
+  BitMap dirty;             // one bit per block of the table: 1 if DiskDriver_flush has to write it
+  pthread_mutex_t lock;
+  uint64_t lookups;         // statistics: DiskDriver_dedupLookup calls
+  uint64_t hits;            // statistics: lookups that found a run with the same content
+} DiskDedup;
+
+// an allocation group: a slice of DISK_GROUP_BLOCKS blocks (and of the bitmap)
+// with its own free counter and lock; it is padded to a cache line, so that
+// threads allocating in different groups do not touch the same line
+// the bitmap bytes of the group, its word of the bitmap summary and free_blocks
+// are changed only while holding lock; the free_blocks of the DiskHeader is
+// the sum of the groups, stored when the disk is flushed
+typedef struct {
+  int first_block;     // first block of the group
+  int num_blocks;      // blocks in the group (the last group can be smaller)
+  int free_blocks;     // free blocks in the group
+  pthread_mutex_t lock;
+  char padding[64 - 3 * sizeof(int) - sizeof(pthread_mutex_t)];
+} DiskGroup;
+
+// allocation cursor, owned by a thread or by an open file
+// allocations through a cursor stay in its group while the group has free blocks
+typedef struct {
+  int group;           // current allocation group, -1 if not chosen yet
+  int next;            // block from which the next search starts
+} DiskCursor;
+
+// configuration of a disk, passed to DiskDriver_initConfig
+typedef struct {
+  int backend;         // DISK_BACKEND_MMAP or DISK_BACKEND_PREAD
+  size_t cache_bytes;  // DISK_BACKEND_PREAD: memory budget of the block cache (0 for the default)
+  int direct_io;       // DISK_BACKEND_PREAD: bypass the page cache with O_DIRECT
+                       // (only if the blocks are aligned on the disk, otherwise it is ignored)
+  int io_engine;       // DISK_BACKEND_PREAD: engine of the asynchronous I/O (DISK_IO_AUTO or DISK_IO_THREADS)
+  size_t window_bytes; // DISK_BACKEND_WINDOWS: size of a window, rounded to a multiple of the page size (0 for the default)
+  int max_windows;     // DISK_BACKEND_WINDOWS: windows mapped at the same time (0 for the default)
+} DiskConfig;
+
+// a mapping window of the DISK_BACKEND_WINDOWS backend
+typedef struct {
+  char* addr;          // start of the mapping, NULL if the slot is unused
+  size_t len;          // length of the mapping (the last window can be shorter)
+  int window;          // index of the window in the data region
+  int pins;            // blocks of the window in use
+  uint64_t last_use;   // for the LRU replacement
+} DiskWindow;
+
+struct DiskDriver;
+
+// operations of a backend: how the disk reaches the header, the bitmap and the blocks
+typedef struct {
+  const char* name;
+  // makes header and bitmap of a disk of num_blocks blocks available at disk->header and
+  // disk->bitmap_data (the blocks start at disk->data_offset), sets disk->map_size; -1 on error
+  int (*open)(struct DiskDriver* disk, int num_blocks, const DiskConfig* config);
+  // returns the (pinned) address of a block, reading it if load is 1; NULL on error
+  char* (*getBlock)(struct DiskDriver* disk, int block_num, int load);
+  // marks a block as modified
+  void (*markBlock)(struct DiskDriver* disk, int block_num);
+  // unpins a block returned by getBlock
+  void (*releaseBlock)(struct DiskDriver* disk, int block_num);
+  // queues an asynchronous read or write (DISK_IO_READ, DISK_IO_WRITE) of a block; -1 on error
+  int (*submitBlock)(struct DiskDriver* disk, int op, void* buffer, int block_num, void* tag);
+  // writes back what was modified and waits for it; -1 on error
+  int (*sync)(struct DiskDriver* disk);
+  // called by DiskDriver_grow once the file is disk->file_size bytes long: makes the blocks up to
+  // num_blocks and the bitmap of bitmap_entries bytes at bitmap_offset available (copying the old
+  // bitmap there, if it moves, and clearing the new bytes); the header still has the old values; -1 on error
+  int (*grow)(struct DiskDriver* disk, int num_blocks, off_t bitmap_offset, size_t bitmap_entries);
+  // tells the kernel how the n blocks from block_num will be accessed (DISK_ADVISE_*)
+  void (*advise)(struct DiskDriver* disk, int block_num, int n, int advice);
+  // releases what open and grow made available (mappings, buffers, block cache); the disk is already synced
+  void (*close)(struct DiskDriver* disk);
+} DiskBackend;
+
+typedef struct DiskDriver {
+  DiskHeader* header; // mmapped (or read in memory by the pread backend)
+  char* bitmap_data;  // mmapped (bitmap), at header->bitmap_offset
+  off_t data_offset;  // position of the first block in the file (copied from the header)
+  size_t file_size;   // size of the disk in the file (header, bitmap and blocks)
+  BitMap bitmap;      // bitmap over bitmap_data (one bit per block), with its in-memory summary
   int fd; // for us
+  int run_policy;     // DISK_FIRST_FIT or DISK_BEST_FIT, used by DiskDriver_allocRun
+  DiskGroup* groups;  // allocation groups, rebuilt when the disk is opened
+  int num_groups;
+
+  const DiskBackend* backend;
+  BlockCache* cache;  // block cache (DISK_BACKEND_PREAD only, NULL otherwise)
+  int direct_io;      // 1 if the file was opened with O_DIRECT
+  DiskIO* io;         // asynchronous block I/O (io_uring or thread pool; in memory for the mmap backend)
+
+  // DISK_BACKEND_WINDOWS only
+  DiskWindow* windows; // max_windows slots
+  int max_windows;
+  int* window_slots;   // for every window of the data region, its slot (-1 if not mapped)
+  int num_windows;     // windows in the data region
+  size_t window_size;
+  uint64_t window_clock;
+  uint64_t window_maps;   // statistics: windows mapped
+  uint64_t window_unmaps; // statistics: windows unmapped to make room
+  pthread_mutex_t window_lock;
+
+  size_t map_size;    // size of the mapping (the whole file; only up to data_offset for the pread and windows backends)
+  size_t page_size;
+  BitMap dirty_pages; // one bit per page of the file, 1 if the page has to be synced
+  pthread_mutex_t dirty_lock;
+  int durability;     // DISK_SYNC_WRITE, DISK_SYNC_FLUSH or DISK_SYNC_PERIODIC
+  int flush_interval_ms;
+  int flusher_running;
+  pthread_t flusher;  // background flusher (DISK_SYNC_PERIODIC only)
+  uint64_t syncs;     // statistics: fdatasync calls made by DiskDriver_flush
+  int clean_mount;    // 1 if the disk was opened from the summary saved by DiskDriver_unmount,
+                      // 0 if the bitmap was scanned to rebuild free counters and summary
+
+  // checksums of the blocks (DiskDriver_enableChecksums)
+  uint32_t* checksums;          // CRC32C of every block, NULL if the disk has no checksum table;
+                                // the table is read lazily, one block of the table at a time
+  BitMap checksum_loaded;       // one bit per block of the table: 1 if it was read in checksums
+  BitMap checksum_dirty;        // one bit per block of the table: 1 if DiskDriver_flush has to write it
+  unsigned char* checksum_verified; // one bit per block: 1 if the block was verified (or written) since
+                                // it was last read from the file; updated with atomic operations
+  pthread_mutex_t checksum_lock;
+  uint64_t checksum_verifies;   // statistics: blocks verified
+  uint64_t checksum_errors;     // statistics: blocks whose content did not match their checksum
+
+  DiskDedup* dedup;             // dedup table (DiskDriver_enableDedup), NULL if the disk has none
+  DiskSnapshots* snapshots;     // snapshots (DiskDriver_snapshot), NULL if the disk has none
+  int read_only;                // 1 if the disk was mounted read only, because a table needed to free blocks
+                                // (dedup, snapshots) could not be read: blocks cannot be written, reserved or freed,
+                                // the disk cannot grow and its tables cannot change; flush and unmount write nothing
 } DiskDriver;
 
 /**
@@ -29,23 +296,234 @@ typedef struct {
 // if the file was new
 // compiles a disk header, and fills in the bitmap of appropriate size
 // with all 0 (to denote the free space);
+// if the disk was closed by DiskDriver_unmount, the counters of the groups and the summary
+// of the bitmap are read from the allocator summary saved there, without scanning the bitmap;
+// otherwise (new disk, crash) they are rebuilt by scanning the bitmap with DISK_SCAN_THREADS threads
+// if the file exists, num_blocks is ignored (the size is read from the header),
+// and a disk without a version is converted to the current format
+// if the dedup table or the snapshots cannot be read, the disk is mounted read only (read_only is 1)
+// the disk uses the mmap backend
 void DiskDriver_init(DiskDriver* disk, const char* filename, int num_blocks);
 
+// same as DiskDriver_init, with the backend chosen by config (NULL for the mmap backend)
+void DiskDriver_initConfig(DiskDriver* disk, const char* filename, int num_blocks, const DiskConfig* config);
+
 // reads the block in position block_num
 // returns -1 if the block is free accrding to the bitmap
+// (or if the disk has checksums and the block does not match its checksum)
 // 0 otherwise
 int DiskDriver_readBlock(DiskDriver* disk, void* dest, int block_num);
 
+// returns a read-only pointer to the block in position block_num, directly
+// inside the mapping or the block cache (no copy), or NULL if the block is free,
+// not on the disk, can't be read or does not match its checksum
+// the pointer stays valid until DiskDriver_releaseBlockPtr is called
+const void* DiskDriver_getBlockPtr(DiskDriver* disk, int block_num);
+
+// releases a pointer returned by DiskDriver_getBlockPtr or DiskDriver_getBlockPtrMut
+// (with the pread backend the frame can be evicted again)
+void DiskDriver_releaseBlockPtr(DiskDriver* disk, int block_num);
+
+// same as DiskDriver_getBlockPtr, but the block can be modified in place
+// after modifying it, call DiskDriver_markDirty
+void* DiskDriver_getBlockPtrMut(DiskDriver* disk, int block_num);
+
+// marks as modified the block in position block_num (written through DiskDriver_getBlockPtrMut)
+// with DISK_SYNC_WRITE the block is synced before returning
+// returns -1 if the block is not on the disk
+int DiskDriver_markDirty(DiskDriver* disk, int block_num);
+
 // writes a block in position block_num, and alters the bitmap accordingly
 // returns -1 if operation not possible
 int DiskDriver_writeBlock(DiskDriver* disk, void* src, int block_num);
 
+// same as DiskDriver_writeBlock, but the block is never synced here, whatever the durability
+// mode: it is written by the next DiskDriver_flush (used by the journal, which orders the syncs itself)
+// returns -1 if the block is not on the disk
+int DiskDriver_stageBlock(DiskDriver* disk, const void* src, int block_num);
+
 // frees a block in position block_num, and alters the bitmap accordingly
+// if the block is the first block of a run of the dedup table, the run loses a reference,
+// and its blocks are freed only with the last one; a block used by a snapshot is only released
+// (it is freed when no snapshot uses it any more)
 // returns -1 if operation not possible
 int DiskDriver_freeBlock(DiskDriver* disk, int block_num);
 
+// frees the n blocks listed in blocks, and alters the bitmap accordingly
+// consecutive block numbers are freed as a single range; the free counters are updated
+// and the disk is flushed only once for the whole batch
+// as with DiskDriver_freeBlock, a shared run listed with its first block loses a reference,
+// and its blocks stay in use while it has others; blocks used by a snapshot are only released
+// returns -1 if one of the blocks is not on the disk (nothing is freed), 0 otherwise
+int DiskDriver_freeBlocks(DiskDriver* disk, int* blocks, int n);
+
+// frees the n consecutive blocks starting from start, as a single range
+// (references of the dedup table and snapshots are not checked: used for regions that are never shared)
+// returns -1 if the range is not on the disk, 0 otherwise
+int DiskDriver_freeRange(DiskDriver* disk, int start, int n);
+
+// returns the free blocks of the disk, summing the counters of the groups
+// (the free_blocks of the DiskHeader is only updated by DiskDriver_flush)
+int DiskDriver_freeCount(DiskDriver* disk);
+
 // returns the first free blockin the disk from position (checking the bitmap)
+// uses the summary of the bitmap, so it costs O(levels) and not O(num_blocks)
 int DiskDriver_getFreeBlock(DiskDriver* disk, int start);
 
-// writes the data (flushing the mmaps)
+// finds n contiguous free blocks and reserves them (marking them as used in the bitmap)
+// using the run_policy of the disk; with DISK_FIRST_FIT the search starts from hint
+// (or from the cursor of the DiskHeader, if hint is not on the disk and the disk uses DISK_ALLOC_NEXT_FIT)
+// returns the first block of the run, -1 if there is no such run
+int DiskDriver_allocRun(DiskDriver* disk, int n, int hint);
+
+// finds a free block using the allocation cursor and reserves it
+// the block is searched in the group of the cursor, starting from cursor->next;
+// if the group is full the cursor moves to the next group with free blocks
+// if cursor is NULL, the alloc_policy of the disk decides: the cursor of the calling
+// thread (DISK_ALLOC_GROUPS, threads start from different groups), the cursor stored
+// in the DiskHeader (DISK_ALLOC_NEXT_FIT) or the first free block (DISK_ALLOC_FIRST_FIT)
+// returns the block, -1 if the disk is full
+int DiskDriver_allocBlock(DiskDriver* disk, DiskCursor* cursor);
+
+// initializes a cursor so that it allocates near block_num
+void DiskDriver_initCursor(DiskDriver* disk, DiskCursor* cursor, int block_num);
+
+// grows the disk to new_num_blocks blocks, without closing it: the file is extended,
+// the mapping is extended (and moved, if needed) and the bitmap is extended in place or,
+// if there is no room before the blocks, moved after them
+// open FileHandles and DirectoryHandles stay valid, but pointers returned by
+// DiskDriver_getBlockPtr must be released before (the mapping can move)
+// it must not run together with other operations on the same disk
+// returns -1 if new_num_blocks is smaller than the disk or the disk can't grow, 0 otherwise
+int DiskDriver_grow(DiskDriver* disk, int new_num_blocks);
+
+// chooses the policy of DiskDriver_allocBlock without cursor (DISK_ALLOC_GROUPS,
+// DISK_ALLOC_NEXT_FIT or DISK_ALLOC_FIRST_FIT); the policy is stored in the DiskHeader
+// returns -1 if the policy is not valid, 0 otherwise
+int DiskDriver_setAllocPolicy(DiskDriver* disk, int policy);
+
+// stores in the DiskHeader the journal region of the file system: num_blocks blocks starting
+// at start (0 blocks: no journal); the blocks must already be reserved in the bitmap
+// returns -1 if the region is not on the disk, 0 otherwise
+int DiskDriver_setJournal(DiskDriver* disk, int start, int num_blocks);
+
+// stores in the DiskHeader the version of the structures of the file system
+int DiskDriver_setFsVersion(DiskDriver* disk, int version);
+
+// reserves a checksum table (one block every DISK_CHECKSUMS_PER_BLOCK blocks of the disk) and stores
+// in it the CRC32C of every block in use; from then on the checksum of a block is updated when the
+// block is written and verified when it is read, once until the block is read again from the file
+// (evicted from the block cache or from the mapping windows; with the mmap backend, dropped with
+// DISK_ADVISE_DONTNEED), so blocks that stay in memory are not verified at every read
+// it must not run together with other operations on the same disk
+// returns -1 if there is no room for the table, 0 otherwise (also if the disk already has checksums)
+int DiskDriver_enableChecksums(DiskDriver* disk);
+
+// frees the checksum table: blocks are no longer verified
+// returns -1 if the disk can't be synced, 0 otherwise
+int DiskDriver_disableChecksums(DiskDriver* disk);
+
+// reserves a dedup table of at least num_entries entries (whole blocks of DISK_DEDUP_PER_BLOCK entries):
+// runs of blocks registered with DiskDriver_dedupInsert can then be shared by DiskDriver_dedupLookup
+// it must not run together with other operations on the same disk
+// returns -1 if there is no room for the table, 0 otherwise (also if the disk already has one)
+int DiskDriver_enableDedup(DiskDriver* disk, int num_entries);
+
+// frees the dedup table; runs still shared are no longer counted, so it must be called only when
+// no run is shared (DiskDriver_dedupSaved returns 0) or when all the blocks are going to be freed
+// returns -1 if the disk can't be synced, 0 otherwise
+int DiskDriver_disableDedup(DiskDriver* disk);
+
+// looks for a run of n blocks registered with fingerprint whose blocks hold the same n * BLOCK_SIZE
+// bytes as data; if there is one, it gets a new reference (freed with DiskDriver_freeBlock/s)
+// returns the first block of the run, -1 if there is none (or the disk has no dedup table)
+int DiskDriver_dedupLookup(DiskDriver* disk, uint64_t fingerprint, const void* data, int n);
+
+// registers the n blocks from block_num, already written with content of that fingerprint,
+// as a run with one reference, that later writes of the same content can share
+// returns -1 if the table is full (or the disk has none), 0 otherwise
+int DiskDriver_dedupInsert(DiskDriver* disk, uint64_t fingerprint, int block_num, int n);
+
+// returns the blocks saved by sharing: for every run, its blocks times its references but one
+int64_t DiskDriver_dedupSaved(DiskDriver* disk);
+
+// copies into used (a bitmap with a bit per block of the disk) the blocks used by the file system: the blocks
+// reserved in the bitmap of the disk, without the journal, the checksum and dedup tables, the snapshot region,
+// the bitmaps of the snapshots and the released blocks. It costs O(num_blocks / 8), whatever is stored
+// returns -1 if used does not have a bit per block, 0 otherwise
+int DiskDriver_usedBlocks(DiskDriver* disk, BitMap* used);
+
+// records a snapshot named name whose root directory starts at root; it uses the blocks set in shared
+// (still used by the live file system too) and in copies (written for the snapshot only, they are released
+// at once). From now on these blocks are frozen: they are never freed while the snapshot exists, so the
+// file system must never write them in place (DiskDriver_inSnapshot). Only the bitmaps are written
+// it must not run together with other operations on the same disk
+// returns -1 if the name is too long or already taken, there are already DISK_MAX_SNAPSHOTS snapshots,
+// there is no room for the bitmap or it cannot be written (nothing is changed then), 0 otherwise
+int DiskDriver_snapshot(DiskDriver* disk, const char* name, int root, const BitMap* shared, const BitMap* copies);
+
+// returns the first block of the root directory of the snapshot named name, -1 if there is none
+int DiskDriver_findSnapshot(DiskDriver* disk, const char* name);
+
+// deletes the snapshot named name, freeing the released blocks that no other snapshot uses
+// it must not run together with other operations on the same disk
+// returns -1 if there is no such snapshot or the bitmap of another snapshot cannot be read (nothing is
+// changed then), 0 otherwise
+int DiskDriver_deleteSnapshot(DiskDriver* disk, const char* name);
+
+// returns 1 if the block is used by a snapshot (it must be copied before being changed), 0 otherwise
+int DiskDriver_inSnapshot(DiskDriver* disk, int block_num);
+
+// tells the kernel how the n blocks starting at block_num will be accessed (DISK_ADVISE_*):
+// madvise on the mapping for the mmap backend, posix_fadvise on the file for the others
+// (DISK_ADVISE_WILLNEED starts reading the blocks in the background; with O_DIRECT the page
+// cache is bypassed, so the hints have no effect); blocks past the end of the disk are ignored
+// returns -1 if the advice is not valid or block_num is not on the disk, 0 otherwise
+int DiskDriver_advise(DiskDriver* disk, int block_num, int n, int advice);
+
+// closes the disk: the queued requests are sent and waited for, the flusher is stopped and
+// everything is synced, then the allocator summary (free counters of the disk and of the groups,
+// summary of the bitmap, cursor) is written after the disk with its checksum, and the disk is
+// marked clean, so that the next DiskDriver_init does not have to scan the bitmap
+// the memory of the disk is freed and the file is closed, even on error
+// returns -1 if something could not be written (the disk is then not marked clean), 0 otherwise
+int DiskDriver_unmount(DiskDriver* disk);
+
+// writes the data (flushing the mmaps, or the dirty frames of the block cache, and the blocks
+// of the checksum and dedup tables and of the snapshot region that changed)
+// free_blocks and first_free_block of the DiskHeader are updated first
+// on a read only disk nothing is written
+// only the dirty pages are written back, merging nearby pages in a single range,
+// and the whole batch is waited for with a single fdatasync
 int DiskDriver_flush(DiskDriver* disk);
+
+// queues an asynchronous read of the block in position block_num in dest
+// dest is filled when the completion is returned by DiskDriver_poll; the request
+// is sent to the disk only by DiskDriver_submit (or DiskDriver_poll), together
+// with the other queued ones
+// returns -1 if the block is free or not on the disk, or if DISK_IO_DEPTH requests
+// are already queued or in flight (poll some completions first), 0 otherwise
+int DiskDriver_submitRead(DiskDriver* disk, void* dest, int block_num, void* tag);
+
+// queues an asynchronous write of src in the block in position block_num, and alters
+// the bitmap accordingly; src is copied, so it can be reused at once
+// the new content is on the disk when the completion is returned by DiskDriver_poll
+// (reading the block before that can return the old content)
+// returns -1 if the block is not on the disk or the queue is full, 0 otherwise
+int DiskDriver_submitWrite(DiskDriver* disk, const void* src, int block_num, void* tag);
+
+// sends all the queued requests to the disk with a single system call
+// returns the number of requests sent, -1 on error
+int DiskDriver_submit(DiskDriver* disk);
+
+// returns in completions up to max completed requests (result 0 on success, -1 on error,
+// also for reads of blocks that do not match their checksum),
+// waiting until at least min_wait are completed; with DISK_SYNC_WRITE, completed
+// writes are synced (once for the whole batch) before returning
+// returns the number of completions, -1 on error
+int DiskDriver_poll(DiskDriver* disk, DiskIOCompletion* completions, int max, int min_wait);
+
+// chooses when the dirty pages are synced (DISK_SYNC_WRITE, DISK_SYNC_FLUSH
+// or DISK_SYNC_PERIODIC, which starts a flusher thread every interval_ms)
+// returns -1 if the mode is not valid or the thread can't be started, 0 otherwise
+int DiskDriver_setDurability(DiskDriver* disk, int mode, int interval_ms);
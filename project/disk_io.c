@@ -0,0 +1,388 @@
+#include "disk_io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+// linux/io_uring.h include linux/fs.h, che definisce un BLOCK_SIZE diverso da quello del disco
+#pragma push_macro("BLOCK_SIZE")
+#include <linux/io_uring.h>
+#pragma pop_macro("BLOCK_SIZE")
+#define DISK_IO_HAVE_URING 1
+#endif
+#endif
+
+
+// Aggiunge lo slot "slot" a quelli completati, che verranno restituiti da DiskIO_poll (va chiamata con il lock preso)
+// Appends slot to the ring of completed requests (with the lock held)
+static void DiskIO_pushReady(DiskIO* io, int slot) {
+	io->ready[(io->ready_head + io->ready_count) % DISK_IO_DEPTH] = slot;
+	io->ready_count++;
+	pthread_cond_signal(&io->ready_cond);
+}
+
+// Prende uno slot libero e lo prepara per una richiesta. Restituisce l'indice dello slot, oppure -1 se la coda è piena
+// Takes a free slot for a request, -1 if the queue is full
+static int DiskIO_takeSlot(DiskIO* io, int op, int fd, off_t offset, void* dest, void* tag) {
+	if(io->num_free == 0) return -1;
+	int slot = io->free_slots[--io->num_free];
+	DiskIORequest* request = &io->requests[slot];
+	request->op = op;
+	request->in_memory = 0;
+	request->fd = fd;
+	request->offset = offset;
+	request->dest = dest;
+	request->tag = tag;
+	request->result = -1;
+	return slot;
+}
+
+
+/* io_uring: le richieste vengono scritte direttamente nella coda di sottomissione condivisa con il kernel,
+   e con una sola chiamata a io_uring_enter si inviano tutte quelle preparate */
+
+#ifdef DISK_IO_HAVE_URING
+
+// Crea l'io_uring e mappa in memoria le sue code. Restituisce -1 se il kernel non lo permette
+// Sets up the io_uring and maps its rings, -1 if the kernel does not allow it
+static int DiskIO_uringSetup(DiskIO* io) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	io->ring_fd = syscall(__NR_io_uring_setup, DISK_IO_DEPTH, &params);
+	if(io->ring_fd < 0) {
+		io->ring_fd = -1;
+		return -1;
+	}
+
+	// Con IORING_FEAT_SINGLE_MMAP le due code stanno in un'unica mappa
+	io->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	io->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP) {
+		if(io->cq_ring_size > io->sq_ring_size) io->sq_ring_size = io->cq_ring_size;
+		io->cq_ring_size = io->sq_ring_size;
+	}
+	io->sq_ring = mmap(0, io->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_SQ_RING);
+	io->cq_ring = MAP_FAILED;
+	io->sqes = MAP_FAILED;
+	if(io->sq_ring != MAP_FAILED) {
+		io->cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? io->sq_ring
+			: mmap(0, io->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_CQ_RING);
+		io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+		io->sqes = mmap(0, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_SQES);
+	}
+	if(io->sq_ring == MAP_FAILED || io->cq_ring == MAP_FAILED || io->sqes == MAP_FAILED) {
+		if(io->sqes != MAP_FAILED) munmap(io->sqes, io->sqes_size);
+		if(io->cq_ring != MAP_FAILED && io->cq_ring != io->sq_ring) munmap(io->cq_ring, io->cq_ring_size);
+		if(io->sq_ring != MAP_FAILED) munmap(io->sq_ring, io->sq_ring_size);
+		close(io->ring_fd);
+		io->ring_fd = -1;
+		return -1;
+	}
+
+	char* sq = (char *) io->sq_ring;
+	char* cq = (char *) io->cq_ring;
+	io->sq_head = (unsigned *) (sq + params.sq_off.head);
+	io->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+	io->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+	io->sq_array = (unsigned *) (sq + params.sq_off.array);
+	io->cq_head = (unsigned *) (cq + params.cq_off.head);
+	io->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+	io->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+	io->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+	io->sq_local_tail = *io->sq_tail;
+	return 0;
+}
+
+// Scrive la richiesta dello slot nella coda di sottomissione (il kernel la vedrà solo con DiskIO_submit)
+// Fills a submission queue entry for slot
+static void DiskIO_uringPrepare(DiskIO* io, int slot) {
+	DiskIORequest* request = &io->requests[slot];
+	unsigned index = io->sq_local_tail & *io->sq_mask;
+	struct io_uring_sqe* sqe = &io->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = request->op == DISK_IO_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+	sqe->fd = request->fd;
+	sqe->off = request->offset;
+	sqe->addr = (unsigned long) &request->iov;
+	sqe->len = 1;
+	sqe->user_data = slot;
+	io->sq_array[index] = index;
+	io->sq_local_tail++;
+}
+
+// Pubblica la nuova coda al kernel e invia tutte le richieste preparate con una sola chiamata
+// Publishes the new tail and submits every prepared request with a single io_uring_enter
+static int DiskIO_uringSubmit(DiskIO* io) {
+	__atomic_store_n(io->sq_tail, io->sq_local_tail, __ATOMIC_RELEASE);
+	int ret;
+	do {
+		ret = syscall(__NR_io_uring_enter, io->ring_fd, io->queued, 0, 0, NULL, 0);
+	} while(ret < 0 && errno == EINTR);
+	return ret;
+}
+
+// Sposta tra le richieste completate quelle presenti nella coda dei completamenti
+// Moves the entries of the completion queue to the ready ring
+static void DiskIO_uringReap(DiskIO* io) {
+	unsigned head = *io->cq_head, tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+	if(head == tail) return;
+	pthread_mutex_lock(&io->lock);
+	while(head != tail) {
+		struct io_uring_cqe* cqe = &io->cqes[head & *io->cq_mask];
+		int slot = (int) cqe->user_data;
+		io->requests[slot].result = cqe->res < 0 ? -1 : cqe->res;
+		DiskIO_pushReady(io, slot);
+		head++;
+	}
+	pthread_mutex_unlock(&io->lock);
+	__atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Aspetta che il kernel completi almeno "n" richieste
+// Waits for at least n completions
+static int DiskIO_uringWait(DiskIO* io, int n) {
+	int ret = syscall(__NR_io_uring_enter, io->ring_fd, 0, n, IORING_ENTER_GETEVENTS, NULL, 0);
+	return ret < 0 && errno != EINTR ? -1 : 0;
+}
+
+// Chiude l'io_uring
+// Unmaps the rings and closes the io_uring
+static void DiskIO_uringClose(DiskIO* io) {
+	munmap(io->sqes, io->sqes_size);
+	if(io->cq_ring != io->sq_ring) munmap(io->cq_ring, io->cq_ring_size);
+	munmap(io->sq_ring, io->sq_ring_size);
+	close(io->ring_fd);
+}
+
+#else
+
+static int DiskIO_uringSetup(DiskIO* io) { return -1; }
+static void DiskIO_uringPrepare(DiskIO* io, int slot) {}
+static int DiskIO_uringSubmit(DiskIO* io) { return -1; }
+static void DiskIO_uringReap(DiskIO* io) {}
+static int DiskIO_uringWait(DiskIO* io, int n) { return -1; }
+static void DiskIO_uringClose(DiskIO* io) {}
+
+#endif
+
+
+/* Pool di thread: se io_uring non è disponibile, le richieste vengono eseguite con pread/pwrite da DISK_IO_POOL_THREADS thread */
+
+// Thread del pool: prende le richieste inviate e le esegue, finché l'engine non viene fermato
+// Worker of the pool: runs the submitted requests until the engine is stopped
+static void* DiskIO_worker(void* arg) {
+	DiskIO* io = (DiskIO *) arg;
+	pthread_mutex_lock(&io->lock);
+	while(1) {
+		while(io->work_count == 0 && !io->stop) pthread_cond_wait(&io->work_cond, &io->lock);
+		if(io->work_count == 0) break;
+		int slot = io->work[io->work_head];
+		io->work_head = (io->work_head + 1) % DISK_IO_DEPTH;
+		io->work_count--;
+		pthread_mutex_unlock(&io->lock);
+
+		DiskIORequest* request = &io->requests[slot];
+		ssize_t ret = request->op == DISK_IO_READ
+			? pread(request->fd, request->iov.iov_base, request->iov.iov_len, request->offset)
+			: pwrite(request->fd, request->iov.iov_base, request->iov.iov_len, request->offset);
+		request->result = ret < 0 ? -1 : (int) ret;
+
+		pthread_mutex_lock(&io->lock);
+		DiskIO_pushReady(io, slot);
+	}
+	pthread_mutex_unlock(&io->lock);
+	return NULL;
+}
+
+// Ferma i primi "n" thread del pool
+// Stops the first n threads of the pool
+static void DiskIO_stopThreads(DiskIO* io, int n) {
+	pthread_mutex_lock(&io->lock);
+	io->stop = 1;
+	pthread_cond_broadcast(&io->work_cond);
+	pthread_mutex_unlock(&io->lock);
+	int i;
+	for(i = 0; i < n; i++) pthread_join(io->threads[i], NULL);
+}
+
+
+// Crea l'engine: con DISK_IO_AUTO prova prima io_uring e, se il kernel non lo permette (o è bloccato), usa il pool di thread.
+// Ogni slot ha un buffer allineato alla pagina, così le richieste funzionano anche su file aperti con O_DIRECT
+// Creates the engine, trying io_uring first with DISK_IO_AUTO; the buffers of the slots are aligned for O_DIRECT
+DiskIO* DiskIO_create(int engine, int block_size) {
+	if(block_size <= 0 || engine < DISK_IO_AUTO || engine > DISK_IO_MEMORY) return NULL;
+
+	DiskIO* io = calloc(1, sizeof(DiskIO));
+	if(io == NULL) return NULL;
+	if(posix_memalign((void **) &io->buffers, 4096, (size_t) DISK_IO_DEPTH * block_size) != 0) {
+		free(io);
+		return NULL;
+	}
+	io->block_size = block_size;
+	int i;
+	for(i = 0; i < DISK_IO_DEPTH; i++) {
+		io->free_slots[i] = DISK_IO_DEPTH - 1 - i;
+		io->requests[i].iov.iov_base = io->buffers + (size_t) i * block_size;
+		io->requests[i].iov.iov_len = block_size;
+	}
+	io->num_free = DISK_IO_DEPTH;
+	io->ring_fd = -1;
+	pthread_mutex_init(&io->lock, NULL);
+	pthread_cond_init(&io->work_cond, NULL);
+	pthread_cond_init(&io->ready_cond, NULL);
+
+	// Scelgo l'engine
+	if(engine == DISK_IO_AUTO || engine == DISK_IO_URING) {
+		if(DiskIO_uringSetup(io) == 0) engine = DISK_IO_URING;
+		else if(engine == DISK_IO_AUTO) engine = DISK_IO_THREADS;
+		else engine = -1;
+	}
+	if(engine == DISK_IO_THREADS) {
+		for(i = 0; i < DISK_IO_POOL_THREADS; i++) {
+			if(pthread_create(&io->threads[i], NULL, DiskIO_worker, io) != 0) {
+				DiskIO_stopThreads(io, i);
+				engine = -1;
+				break;
+			}
+		}
+	}
+	if(engine == -1) {
+		free(io->buffers);
+		free(io);
+		return NULL;
+	}
+	io->engine = engine;
+	return io;
+}
+
+// Accoda una lettura: il risultato viene copiato in "dest" quando la richiesta viene restituita da DiskIO_poll
+// Queues a read, copied to dest when its completion is polled
+int DiskIO_prepareRead(DiskIO* io, int fd, off_t offset, void* dest, void* tag) {
+	if(io->engine == DISK_IO_MEMORY) return -1;
+	int slot = DiskIO_takeSlot(io, DISK_IO_READ, fd, offset, dest, tag);
+	if(slot == -1) return -1;
+	if(io->engine == DISK_IO_URING) DiskIO_uringPrepare(io, slot);
+	else io->pending[io->queued] = slot;
+	io->queued++;
+	return 0;
+}
+
+// Accoda una scrittura, copiando subito "src" nel buffer dello slot
+// Queues a write, copying src in the buffer of the slot
+int DiskIO_prepareWrite(DiskIO* io, int fd, off_t offset, const void* src, void* tag) {
+	if(io->engine == DISK_IO_MEMORY) return -1;
+	int slot = DiskIO_takeSlot(io, DISK_IO_WRITE, fd, offset, NULL, tag);
+	if(slot == -1) return -1;
+	memcpy(io->requests[slot].iov.iov_base, src, io->block_size);
+	if(io->engine == DISK_IO_URING) DiskIO_uringPrepare(io, slot);
+	else io->pending[io->queued] = slot;
+	io->queued++;
+	return 0;
+}
+
+// Accoda una richiesta già eseguita in memoria, che verrà restituita da DiskIO_poll insieme alle altre
+// Queues a request already served in memory
+int DiskIO_complete(DiskIO* io, int op, off_t offset, void* dest, void* tag, int result) {
+	int slot = DiskIO_takeSlot(io, op, -1, offset, dest, tag);
+	if(slot == -1) return -1;
+	io->requests[slot].in_memory = 1;
+	io->requests[slot].result = result;
+	pthread_mutex_lock(&io->lock);
+	DiskIO_pushReady(io, slot);
+	pthread_mutex_unlock(&io->lock);
+	return 0;
+}
+
+// Invia tutte le richieste accodate: con io_uring con una sola chiamata di sistema, con il pool svegliando i thread una sola volta
+// Submits every queued request at once
+int DiskIO_submit(DiskIO* io) {
+	int submitted = io->queued;
+	if(submitted == 0) return 0;
+
+	if(io->engine == DISK_IO_URING) {
+		submitted = DiskIO_uringSubmit(io);
+		if(submitted < 0) return -1;
+	}else{
+		pthread_mutex_lock(&io->lock);
+		int i;
+		for(i = 0; i < submitted; i++) {
+			io->work[(io->work_head + io->work_count) % DISK_IO_DEPTH] = io->pending[i];
+			io->work_count++;
+		}
+		pthread_cond_broadcast(&io->work_cond);
+		pthread_mutex_unlock(&io->lock);
+	}
+	io->queued -= submitted;
+	return submitted;
+}
+
+// Restituisce fino a "max" richieste completate, aspettando che ce ne siano almeno "min_wait" (ma non più di quelle in corso).
+// Le letture vengono copiate nella loro destinazione e gli slot tornano liberi
+// Returns up to max completions, waiting for at least min_wait of them; read data is copied to its destination
+int DiskIO_poll(DiskIO* io, DiskIOCompletion* completions, int max, int min_wait) {
+
+	// Le richieste ancora da inviare vengono inviate adesso, altrimenti non si completerebbero mai
+	if(io->queued > 0 && DiskIO_submit(io) == -1) return -1;
+
+	int in_flight = DISK_IO_DEPTH - io->num_free;
+	if(min_wait > in_flight) min_wait = in_flight;
+	if(min_wait > max) min_wait = max;
+
+	int n = 0;
+	while(1) {
+		if(io->engine == DISK_IO_URING) DiskIO_uringReap(io);
+
+		pthread_mutex_lock(&io->lock);
+		if(io->engine == DISK_IO_THREADS) {
+			while(io->ready_count < min_wait - n) pthread_cond_wait(&io->ready_cond, &io->lock);
+		}
+		while(n < max && io->ready_count > 0) {
+			int slot = io->ready[io->ready_head];
+			io->ready_head = (io->ready_head + 1) % DISK_IO_DEPTH;
+			io->ready_count--;
+
+			DiskIORequest* request = &io->requests[slot];
+			if(request->op == DISK_IO_READ && !request->in_memory && request->result == io->block_size) {
+				memcpy(request->dest, request->iov.iov_base, io->block_size);
+			}
+			completions[n].tag = request->tag;
+			completions[n].op = request->op;
+			completions[n].result = request->result;
+			completions[n].offset = request->offset;
+			completions[n].dest = request->op == DISK_IO_READ ? request->dest : NULL;
+			n++;
+			io->free_slots[io->num_free++] = slot;
+		}
+		pthread_mutex_unlock(&io->lock);
+		if(n >= min_wait) break;
+
+		// Con io_uring aspetto nel kernel le richieste che mancano
+		if(DiskIO_uringWait(io, min_wait - n) == -1) return -1;
+	}
+	return n;
+}
+
+// Numero di richieste accodate o in corso
+// Number of requests queued or in flight
+int DiskIO_pending(DiskIO* io) {
+	return DISK_IO_DEPTH - io->num_free;
+}
+
+// Aspetta le richieste in corso, ferma l'engine e libera la memoria
+// Waits for the requests in flight, then stops the engine and frees it
+void DiskIO_destroy(DiskIO* io) {
+	if(io == NULL) return;
+	DiskIOCompletion completions[DISK_IO_DEPTH];
+	while(DiskIO_pending(io) > 0 && DiskIO_poll(io, completions, DISK_IO_DEPTH, DiskIO_pending(io)) > 0);
+
+	if(io->engine == DISK_IO_URING) DiskIO_uringClose(io);
+	if(io->engine == DISK_IO_THREADS) DiskIO_stopThreads(io, DISK_IO_POOL_THREADS);
+	pthread_mutex_destroy(&io->lock);
+	pthread_cond_destroy(&io->work_cond);
+	pthread_cond_destroy(&io->ready_cond);
+	free(io->buffers);
+	free(io);
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// engines of the asynchronous I/O
+#define DISK_IO_AUTO 0    // io_uring if the kernel allows it, the thread pool otherwise
+#define DISK_IO_URING 1   // io_uring, through the raw system calls
+#define DISK_IO_THREADS 2 // a pool of threads doing pread/pwrite
+#define DISK_IO_MEMORY 3  // no engine: requests are completed in memory (mmap backend)
+
+// maximum number of requests queued or in flight
+#define DISK_IO_DEPTH 64
+
+// threads of the pool used by DISK_IO_THREADS
+#define DISK_IO_POOL_THREADS 4
+
+// operations of a request
+#define DISK_IO_READ 0
+#define DISK_IO_WRITE 1
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// a request: the data goes through the buffer of its slot, which is aligned for O_DIRECT
+typedef struct {
+  int op;              // DISK_IO_READ or DISK_IO_WRITE
+  int in_memory;       // 1 if it was completed in memory (DiskIO_complete)
+  int fd;
+  off_t offset;
+  void* dest;          // reads: where the buffer is copied when the request completes
+  void* tag;           // returned with the completion
+  int result;          // bytes transferred, -1 on error
+  struct iovec iov;    // buffer of the slot
+} DiskIORequest;
+
+// a completed request, returned by DiskIO_poll
+typedef struct {
+  void* tag;
+  int op;              // DISK_IO_READ or DISK_IO_WRITE
+  int result;          // bytes transferred, -1 on error
+  off_t offset;        // position of the request in the file
+  void* dest;          // reads: where the data was copied (NULL for writes)
+} DiskIOCompletion;
+
+typedef struct {
+  int engine;          // DISK_IO_URING, DISK_IO_THREADS or DISK_IO_MEMORY
+  int block_size;      // size of every request
+  char* buffers;       // DISK_IO_DEPTH * block_size bytes, one buffer per slot
+  DiskIORequest requests[DISK_IO_DEPTH];
+  int free_slots[DISK_IO_DEPTH];
+  int num_free;
+  int queued;          // requests prepared but not submitted yet
+
+  // completed requests not returned yet (ring of slots), protected by lock
+  int ready[DISK_IO_DEPTH];
+  int ready_head, ready_count;
+  pthread_mutex_t lock;
+
+  // io_uring
+  int ring_fd;
+  void* sq_ring;
+  void* cq_ring;
+  size_t sq_ring_size, cq_ring_size;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  size_t sqes_size;
+  unsigned sq_local_tail;
+
+  // thread pool: requests submitted and not taken by a thread yet (ring of slots)
+  pthread_t threads[DISK_IO_POOL_THREADS];
+  int work[DISK_IO_DEPTH];
+  int work_head, work_count;
+  int pending[DISK_IO_DEPTH]; // prepared, waiting for DiskIO_submit
+  pthread_cond_t work_cond, ready_cond;
+  int stop;
+} DiskIO;
+
+// creates an engine for requests of block_size bytes
+// with DISK_IO_AUTO io_uring is tried first, then the thread pool
+// returns NULL if the memory can't be allocated or no engine can be started
+DiskIO* DiskIO_create(int engine, int block_size);
+
+// queues a read of block_size bytes at offset of fd; dest is filled when the request completes
+// returns -1 if the queue is full (poll some completions first), 0 otherwise
+int DiskIO_prepareRead(DiskIO* io, int fd, off_t offset, void* dest, void* tag);
+
+// queues a write of block_size bytes at offset of fd; src is copied, so it can be reused at once
+// returns -1 if the queue is full, 0 otherwise
+int DiskIO_prepareWrite(DiskIO* io, int fd, off_t offset, const void* src, void* tag);
+
+// queues a request (at offset in the file, read in dest) that was already served in memory:
+// its completion is returned by DiskIO_poll
+// returns -1 if the queue is full, 0 otherwise
+int DiskIO_complete(DiskIO* io, int op, off_t offset, void* dest, void* tag, int result);
+
+// submits all the queued requests at once (a single io_uring_enter, or a single wakeup of the pool)
+// returns the number of requests submitted, -1 on error
+int DiskIO_submit(DiskIO* io);
+
+// returns in completions up to max completed requests, waiting until at least min_wait
+// are available (queued requests are submitted first); returns their number, -1 on error
+int DiskIO_poll(DiskIO* io, DiskIOCompletion* completions, int max, int min_wait);
+
+// number of requests queued or in flight
+int DiskIO_pending(DiskIO* io);
+
+// waits for the requests in flight, then stops the engine and frees it
+void DiskIO_destroy(DiskIO* io);
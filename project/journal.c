@@ -0,0 +1,437 @@
+#include "journal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Valore iniziale del checksum di una transazione
+#define JOURNAL_CHECKSUM_SEED 2166136261u
+
+
+// Aggiunge al checksum "hash" i "len" byte di "data" (FNV-1a a 32 bit)
+// Adds len bytes to the checksum of a transaction (32-bit FNV-1a)
+static uint32_t Journal_checksum(uint32_t hash, const void* data, size_t len) {
+	const uint8_t* bytes = data;
+	size_t i;
+	for(i = 0; i < len; i++) hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+// Posizione successiva a "pos" nella regione: la posizione 0 è del JournalSuper, quindi dopo l'ultima si riparte da 1
+// Returns the position after pos, wrapping around (position 0 is the super block)
+static inline int Journal_next(const Journal* journal, int pos) {
+	return pos + 1 < journal->num_blocks ? pos + 1 : 1;
+}
+
+// Blocchi del journal occupati da una transazione di "n" blocchi: i descrittori, i blocchi e il commit
+// Blocks of the journal taken by a transaction of n blocks
+static inline int Journal_space(int n) {
+	return (n + (int) JOURNAL_DESCRIPTOR_BLOCKS - 1) / (int) JOURNAL_DESCRIPTOR_BLOCKS + n + 1;
+}
+
+// Compila l'intestazione di un record del journal
+// Fills in the header of a record
+static void Journal_initRecord(const Journal* journal, JournalRecord* record, int type, int count) {
+	record->magic = JOURNAL_MAGIC;
+	record->type = type;
+	record->id = journal->id;
+	record->count = count;
+	record->sequence = journal->sequence;
+}
+
+// Scrive il JournalSuper con la posizione e la sequenza da cui partirà il replay (verrà sincronizzato dalla prossima flush)
+// Writes the super block of the journal, without syncing it
+static int Journal_writeSuper(Journal* journal) {
+	char buffer[BLOCK_SIZE];
+	JournalSuper* super = (JournalSuper *) buffer;
+	memset(buffer, 0, BLOCK_SIZE);
+	Journal_initRecord(journal, &super->record, JOURNAL_SUPER, 0);
+	super->head = journal->head;
+	super->num_blocks = journal->num_blocks;
+	return DiskDriver_stageBlock(journal->disk, buffer, journal->start);
+}
+
+// Crea la struttura in memoria di un journal di "num_blocks" blocchi a partire da "start"
+// Allocates the in-memory journal
+static Journal* Journal_alloc(DiskDriver* disk, int start, int num_blocks) {
+	Journal* journal = calloc(1, sizeof(Journal));
+	if(journal == NULL) return NULL;
+	journal->disk = disk;
+	journal->start = start;
+	journal->num_blocks = num_blocks;
+	pthread_mutex_init(&journal->lock, NULL);
+	pthread_cond_init(&journal->cond, NULL);
+	return journal;
+}
+
+// Libera la struttura in memoria del journal
+// Frees the in-memory journal
+static void Journal_free(Journal* journal) {
+	pthread_mutex_destroy(&journal->lock);
+	pthread_cond_destroy(&journal->cond);
+	free(journal->window);
+	free(journal);
+}
+
+// Sincronizza i blocchi riportati al loro posto, poi sposta l'inizio del replay alla fine del journal: da qui in poi lo spazio
+// è di nuovo tutto libero. Il JournalSuper viene scritto solo dopo la prima sincronizzazione, altrimenti il replay potrebbe
+// saltare transazioni i cui blocchi non sono ancora sul disco. Va chiamata da chi ha il journal (busy)
+// Syncs the blocks written in place, then moves the start of replay to the tail
+static int Journal_writeCheckpoint(Journal* journal) {
+	if(DiskDriver_flush(journal->disk) == -1) return -1;
+	journal->head = journal->tail;
+	journal->used = 0;
+	journal->window_size = 0;
+	journal->checkpoints++;
+	if(Journal_writeSuper(journal) == -1) return -1;
+	return DiskDriver_flush(journal->disk);
+}
+
+// Aspetta che nessun altro thread stia scrivendo nel journal e lo riserva
+// Waits until the journal is not busy and takes it
+static void Journal_acquire(Journal* journal) {
+	pthread_mutex_lock(&journal->lock);
+	while(journal->busy) pthread_cond_wait(&journal->cond, &journal->lock);
+	journal->busy = 1;
+	pthread_mutex_unlock(&journal->lock);
+}
+
+// Rilascia il journal, svegliando i thread che aspettano
+// Releases the journal
+static void Journal_release(Journal* journal) {
+	pthread_mutex_lock(&journal->lock);
+	journal->busy = 0;
+	pthread_cond_broadcast(&journal->cond);
+	pthread_mutex_unlock(&journal->lock);
+}
+
+// Legge la transazione che inizia alla posizione "pos": i blocchi che contiene finiscono in "homes" (dove vanno riportati)
+// e "positions" (dove si trovano nel journal), e in "end" la posizione del suo commit. Restituisce il numero di blocchi,
+// -1 se la transazione non è completa (manca il commit, un record non è della sequenza attesa o il checksum non corrisponde)
+// Reads the transaction starting at pos, returns its number of blocks or -1 if it is not complete
+static int Journal_readTransaction(Journal* journal, int pos, int* homes, int* positions, int* end) {
+	char buffer[BLOCK_SIZE];
+	JournalRecord* record = (JournalRecord *) buffer;
+	uint32_t checksum = JOURNAL_CHECKSUM_SEED;
+	int n = 0, length = 0, i;
+
+	while(length < journal->num_blocks - 1 && DiskDriver_readBlock(journal->disk, buffer, journal->start + pos) == 0) {
+		if(record->magic != JOURNAL_MAGIC || record->id != journal->id || record->sequence != journal->sequence) return -1;
+		if(record->type == JOURNAL_COMMIT) {
+			*end = pos;
+			return record->count == n && ((JournalCommit *) buffer)->checksum == checksum ? n : -1;
+		}
+		if(record->type != JOURNAL_DESCRIPTOR || record->count > JOURNAL_DESCRIPTOR_BLOCKS) return -1;
+
+		// Un descrittore: prendo i blocchi che elenca e aggiungo al checksum lui e i blocchi che lo seguono
+		int count = record->count;
+		if(length + count + 2 > journal->num_blocks - 1) return -1;
+		memcpy(homes + n, ((JournalDescriptor *) buffer)->blocks, count * sizeof(int));
+		checksum = Journal_checksum(checksum, buffer, BLOCK_SIZE);
+		for(i = 0; i < count; i++) {
+			pos = Journal_next(journal, pos);
+			positions[n + i] = pos;
+			if(DiskDriver_readBlock(journal->disk, buffer, journal->start + pos) == -1) return -1;
+			checksum = Journal_checksum(checksum, buffer, BLOCK_SIZE);
+		}
+		n += count;
+		length += 1 + count;
+		pos = Journal_next(journal, pos);
+	}
+	return -1;
+}
+
+// Riporta al loro posto i blocchi di tutte le transazioni complete, a partire da quella indicata dal JournalSuper;
+// si ferma alla prima transazione incompleta (scritta solo in parte prima di un crash). Poi svuota il journal
+// Replays the complete transactions starting from the super block, then empties the journal
+static void Journal_replay(Journal* journal) {
+	int* homes = malloc((journal->num_blocks - 1) * sizeof(int));
+	int* positions = malloc((journal->num_blocks - 1) * sizeof(int));
+	char buffer[BLOCK_SIZE];
+	int pos = journal->head, scanned = 0, end, n, i;
+
+	while(scanned < journal->num_blocks - 1 && (n = Journal_readTransaction(journal, pos, homes, positions, &end)) != -1) {
+		for(i = 0; i < n; i++) {
+			if(DiskDriver_readBlock(journal->disk, buffer, journal->start + positions[i]) == 0) DiskDriver_stageBlock(journal->disk, buffer, homes[i]);
+		}
+		scanned += Journal_space(n);
+		journal->sequence++;
+		journal->replayed++;
+		pos = Journal_next(journal, end);
+	}
+	free(homes);
+	free(positions);
+
+	// Se ho riportato qualcosa, lo sincronizzo e sposto l'inizio del replay dopo l'ultima transazione
+	journal->tail = pos;
+	if(journal->replayed > 0) Journal_writeCheckpoint(journal);
+	journal->head = pos;
+	journal->used = 0;
+}
+
+// Crea un journal vuoto nei "num_blocks" blocchi a partire da "start" (già riservati nella bitmap) e ne salva la posizione nel DiskHeader
+// Creates an empty journal in the region and stores its position in the DiskHeader
+Journal* Journal_create(DiskDriver* disk, int start, int num_blocks) {
+	if(num_blocks < JOURNAL_MIN_BLOCKS || start < 0 || start > disk->header->num_blocks - num_blocks) return NULL;
+	Journal* journal = Journal_alloc(disk, start, num_blocks);
+	if(journal == NULL) return NULL;
+
+	// L'id distingue i record di questo journal da quelli lasciati nella regione da un journal precedente
+	journal->id = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16) ^ (uint32_t) start;
+	journal->sequence = 1;
+	journal->head = journal->tail = 1;
+	if(Journal_writeSuper(journal) == -1 || DiskDriver_setJournal(disk, start, num_blocks) == -1 || DiskDriver_flush(disk) == -1) {
+		Journal_free(journal);
+		return NULL;
+	}
+	return journal;
+}
+
+// Apre il journal del disco, riportando al loro posto i blocchi delle transazioni completate ma forse non ancora scritte (dopo un crash)
+// Opens the journal of the disk, replaying the committed transactions
+Journal* Journal_open(DiskDriver* disk) {
+	int start = disk->header->journal_block, num_blocks = disk->header->journal_blocks;
+	if(num_blocks < JOURNAL_MIN_BLOCKS || start < 0 || start > disk->header->num_blocks - num_blocks) return NULL;
+
+	// Controllo il JournalSuper
+	char buffer[BLOCK_SIZE];
+	JournalSuper* super = (JournalSuper *) buffer;
+	if(DiskDriver_readBlock(disk, buffer, start) == -1) return NULL;
+	if(super->record.magic != JOURNAL_MAGIC || super->record.type != JOURNAL_SUPER || super->num_blocks != num_blocks) return NULL;
+	if(super->head < 1 || super->head >= num_blocks) return NULL;
+
+	Journal* journal = Journal_alloc(disk, start, num_blocks);
+	if(journal == NULL) return NULL;
+	journal->id = super->record.id;
+	journal->sequence = super->record.sequence;
+	journal->head = super->head;
+	Journal_replay(journal);
+	return journal;
+}
+
+// Fa un checkpoint del journal e libera la sua struttura in memoria
+// Writes everything in place, empties the journal and frees it
+void Journal_close(Journal* journal) {
+	if(journal == NULL) return;
+	Journal_acquire(journal);
+	Journal_writeCheckpoint(journal);
+	Journal_free(journal);
+}
+
+// Inizia una transazione: finché non viene fatto il commit, i blocchi che scrive restano in memoria
+// Starts a transaction
+JournalTx* Journal_begin(Journal* journal) {
+	JournalTx* tx = calloc(1, sizeof(JournalTx));
+	if(tx == NULL) return NULL;
+	tx->journal = journal;
+	return tx;
+}
+
+// Restituisce la posizione del blocco "block_num" nella transazione, -1 se la transazione non lo ha scritto
+// Returns the index of block_num in the transaction, -1 if it is not there
+static int Journal_find(const JournalTx* tx, int block_num) {
+	int i;
+	for(i = 0; i < tx->num_blocks; i++) {
+		if(tx->blocks[i] == block_num) return i;
+	}
+	return -1;
+}
+
+// Scrive "src" come nuovo contenuto del blocco "block_num" nella transazione, senza scrivere nulla sul disco
+// Writes the new content of a block in the transaction
+int Journal_write(JournalTx* tx, const void* src, int block_num) {
+	if(block_num < 0 || block_num >= tx->journal->disk->header->num_blocks) return -1;
+
+	// Un blocco già scritto nella transazione viene sovrascritto, uno nuovo viene aggiunto (se la transazione ci sta ancora nel journal)
+	int i = Journal_find(tx, block_num);
+	if(i == -1) {
+		if(Journal_space(tx->num_blocks + 1) > tx->journal->num_blocks - 1) return -1;
+		if(tx->num_blocks == tx->capacity) {
+			int capacity = tx->capacity ? 2 * tx->capacity : 4;
+			int* blocks = realloc(tx->blocks, capacity * sizeof(int));
+			if(blocks == NULL) return -1;
+			tx->blocks = blocks;
+			char* images = realloc(tx->images, (size_t) capacity * BLOCK_SIZE);
+			if(images == NULL) return -1;
+			tx->images = images;
+			tx->capacity = capacity;
+		}
+		i = tx->num_blocks++;
+		tx->blocks[i] = block_num;
+	}
+	memcpy(tx->images + (size_t) i * BLOCK_SIZE, src, BLOCK_SIZE);
+	return 0;
+}
+
+// Legge il blocco "block_num" come lo vede la transazione: il nuovo contenuto se l'ha scritto, altrimenti quello sul disco
+// Reads a block as the transaction sees it
+int Journal_read(JournalTx* tx, void* dest, int block_num) {
+	int i = Journal_find(tx, block_num);
+	if(i == -1) return DiskDriver_readBlock(tx->journal->disk, dest, block_num);
+	memcpy(dest, tx->images + (size_t) i * BLOCK_SIZE, BLOCK_SIZE);
+	return 0;
+}
+
+// Libera la transazione senza scrivere nulla
+// Frees the transaction without writing it
+void Journal_abort(JournalTx* tx) {
+	if(tx == NULL) return;
+	free(tx->blocks);
+	free(tx->images);
+	free(tx);
+}
+
+// Toglie dalla coda le transazioni che formeranno il prossimo gruppo: tutte quelle in attesa, finché il gruppo ci sta nel journal
+// (almeno la prima ci sta sempre, visto che Journal_write non lascia crescere una transazione oltre). Va chiamata con il lock
+// Takes from the queue the transactions of the next group
+static JournalTx* Journal_takeGroup(Journal* journal) {
+	JournalTx* group = journal->queue, *last = group;
+	int n = group->num_blocks;
+	while(last->next != NULL && Journal_space(n + last->next->num_blocks) <= journal->num_blocks - 1) {
+		last = last->next;
+		n += last->num_blocks;
+	}
+	journal->queue = last->next;
+	if(journal->queue == NULL) journal->queue_tail = NULL;
+	last->next = NULL;
+	return group;
+}
+
+// Scrive nel journal le transazioni del gruppo come un'unica transazione: descrittori e blocchi, poi il commit, e una sola
+// sincronizzazione. Solo quando il commit è sul disco i blocchi vengono riportati al loro posto, senza sincronizzarli: ci penserà
+// la prossima flush, e fino al prossimo checkpoint il replay li riscriverebbe. Se lo spazio non basta, prima fa un checkpoint
+// Writes a group of transactions with a single sync, then writes their blocks in place
+static int Journal_writeGroup(Journal* journal, JournalTx* group) {
+	DiskDriver* disk = journal->disk;
+	JournalTx* tx;
+	int n = 0, transactions = 0, i, k;
+	for(tx = group; tx != NULL; tx = tx->next) {
+		n += tx->num_blocks;
+		transactions++;
+	}
+	if(n == 0) return 0;
+
+	// Metto in fila i blocchi di tutte le transazioni, nell'ordine in cui sono state chiuse
+	int* homes = malloc(n * sizeof(int));
+	const char** images = malloc(n * sizeof(char *));
+	for(tx = group, k = 0; tx != NULL; tx = tx->next) {
+		for(i = 0; i < tx->num_blocks; i++, k++) {
+			homes[k] = tx->blocks[i];
+			images[k] = tx->images + (size_t) i * BLOCK_SIZE;
+		}
+	}
+
+	int space = Journal_space(n), ret = 0;
+	if(space > journal->num_blocks - 1 - journal->used) ret = Journal_writeCheckpoint(journal);
+
+	// Ogni descrittore elenca i blocchi che lo seguono; il checksum del commit copre descrittori e blocchi
+	JournalDescriptor descriptor;
+	uint32_t checksum = JOURNAL_CHECKSUM_SEED;
+	int pos = journal->tail, count;
+	for(k = 0; k < n && ret == 0; k += count) {
+		count = n - k < (int) JOURNAL_DESCRIPTOR_BLOCKS ? n - k : (int) JOURNAL_DESCRIPTOR_BLOCKS;
+		memset(&descriptor, 0, sizeof(descriptor));
+		Journal_initRecord(journal, &descriptor.record, JOURNAL_DESCRIPTOR, count);
+		memcpy(descriptor.blocks, homes + k, count * sizeof(int));
+		if(DiskDriver_stageBlock(disk, &descriptor, journal->start + pos) == -1) ret = -1;
+		checksum = Journal_checksum(checksum, &descriptor, BLOCK_SIZE);
+		pos = Journal_next(journal, pos);
+		for(i = k; i < k + count; i++) {
+			if(DiskDriver_stageBlock(disk, images[i], journal->start + pos) == -1) ret = -1;
+			checksum = Journal_checksum(checksum, images[i], BLOCK_SIZE);
+			pos = Journal_next(journal, pos);
+		}
+	}
+
+	char buffer[BLOCK_SIZE];
+	JournalCommit* commit = (JournalCommit *) buffer;
+	memset(buffer, 0, BLOCK_SIZE);
+	Journal_initRecord(journal, &commit->record, JOURNAL_COMMIT, n);
+	commit->checksum = checksum;
+	if(ret == 0 && DiskDriver_stageBlock(disk, buffer, journal->start + pos) == -1) ret = -1;
+	pos = Journal_next(journal, pos);
+
+	// Una sola sincronizzazione per tutto il gruppo
+	if(ret == 0) ret = DiskDriver_flush(disk);
+
+	// Il gruppo è sul disco: riporto i blocchi al loro posto e li ricordo, perché il replay li riscriverebbe
+	if(ret == 0) {
+		if(journal->window_size + n > journal->window_capacity) {
+			journal->window_capacity = 2 * (journal->window_size + n);
+			journal->window = realloc(journal->window, journal->window_capacity * sizeof(int));
+		}
+		for(i = 0; i < n; i++) {
+			DiskDriver_stageBlock(disk, images[i], homes[i]);
+			journal->window[journal->window_size++] = homes[i];
+		}
+		journal->tail = pos;
+		journal->used += space;
+		journal->sequence++;
+		journal->groups++;
+		journal->transactions += transactions;
+	}
+	free(homes);
+	free(images);
+	return ret;
+}
+
+// Fa il commit della transazione e la libera: le transazioni di più thread che arrivano mentre un gruppo viene scritto formano
+// il gruppo successivo, scritto da uno solo di loro con una sola sincronizzazione
+// Commits a transaction, grouping it with the ones committed at the same time by other threads
+int Journal_commit(JournalTx* tx) {
+	Journal* journal = tx->journal;
+	pthread_mutex_lock(&journal->lock);
+
+	// Accodo la transazione
+	tx->next = NULL;
+	tx->done = 0;
+	if(journal->queue_tail != NULL) journal->queue_tail->next = tx;
+	else journal->queue = tx;
+	journal->queue_tail = tx;
+
+	// Finché la transazione non è sul disco: se un altro thread sta scrivendo un gruppo aspetto (intanto la coda si allunga,
+	// e le transazioni arrivate verranno scritte tutte insieme), altrimenti scrivo io il gruppo delle transazioni in coda
+	while(!tx->done) {
+		if(journal->busy) {
+			pthread_cond_wait(&journal->cond, &journal->lock);
+			continue;
+		}
+		JournalTx* group = Journal_takeGroup(journal), *member;
+		journal->busy = 1;
+		pthread_mutex_unlock(&journal->lock);
+		int result = Journal_writeGroup(journal, group);
+		pthread_mutex_lock(&journal->lock);
+		for(member = group; member != NULL; member = member->next) {
+			member->result = result;
+			member->done = 1;
+		}
+		journal->busy = 0;
+		pthread_cond_broadcast(&journal->cond);
+	}
+
+	int result = tx->result;
+	pthread_mutex_unlock(&journal->lock);
+	Journal_abort(tx);
+	return result;
+}
+
+// Da chiamare prima di scrivere "block_num" fuori dal journal: se il replay potrebbe sovrascriverlo con un contenuto più vecchio,
+// prima fa un checkpoint
+// Checkpoints the journal if replay could overwrite block_num
+int Journal_revoke(Journal* journal, int block_num) {
+	int i, found = 0, ret = 0;
+	Journal_acquire(journal);
+	for(i = 0; i < journal->window_size && !found; i++) found = journal->window[i] == block_num;
+	if(found) ret = Journal_writeCheckpoint(journal);
+	Journal_release(journal);
+	return ret;
+}
+
+// Sincronizza i blocchi riportati al loro posto e svuota il journal
+// Syncs the blocks written in place and empties the journal
+int Journal_checkpoint(Journal* journal) {
+	Journal_acquire(journal);
+	int ret = Journal_writeCheckpoint(journal);
+	Journal_release(journal);
+	return ret;
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include "disk_driver.h"
+#include <pthread.h>
+#include <stdint.h>
+
+// size of the journal reserved by the file system: one block every JOURNAL_RATIO blocks of the disk,
+// at most JOURNAL_MAX_BLOCKS; disks that would get fewer than JOURNAL_MIN_BLOCKS have no journal
+#define JOURNAL_RATIO 16
+#define JOURNAL_MIN_BLOCKS 8
+#define JOURNAL_MAX_BLOCKS 256
+
+#define JOURNAL_MAGIC 0x4c4e524a // "JRNL"
+
+// types of the records
+#define JOURNAL_SUPER 0      // first block of the region: where replay starts
+#define JOURNAL_DESCRIPTOR 1 // lists the home blocks of the data blocks that follow it
+#define JOURNAL_COMMIT 2     // closes a transaction
+
+// header of every record (the data blocks, copies of the home blocks, have none)
+typedef struct {
+  uint32_t magic;      // JOURNAL_MAGIC
+  uint32_t type;       // JOURNAL_SUPER, JOURNAL_DESCRIPTOR or JOURNAL_COMMIT
+  uint32_t id;         // id of the journal, chosen when it is created: records left
+                       // in the region by an older journal are never replayed
+  uint32_t count;      // descriptor: blocks listed; commit: data blocks of the transaction
+  uint64_t sequence;   // transaction of the record (super: first transaction to replay)
+} JournalRecord;
+
+typedef struct {
+  JournalRecord record;
+  int32_t head;        // position in the region of the first transaction to replay (1 ... num_blocks - 1)
+  int32_t num_blocks;  // blocks of the region, this one included
+} JournalSuper;
+
+#define JOURNAL_DESCRIPTOR_BLOCKS ((BLOCK_SIZE - sizeof(JournalRecord)) / sizeof(int32_t))
+
+typedef struct {
+  JournalRecord record;
+  int32_t blocks[JOURNAL_DESCRIPTOR_BLOCKS];
+} JournalDescriptor;
+
+typedef struct {
+  JournalRecord record;
+  uint32_t checksum;   // of the descriptors and of the data blocks of the transaction
+} JournalCommit;
+
+struct Journal;
+
+// a transaction: the new content of some blocks, kept in memory until the commit
+typedef struct JournalTx {
+  struct Journal* journal;
+  int num_blocks;
+  int capacity;
+  int* blocks;         // home blocks, each at most once
+  char* images;        // their new content, BLOCK_SIZE bytes each
+  struct JournalTx* next; // queue of the group commit
+  int done;            // 1 once the group of the transaction has been written
+  int result;          // result of the commit of the group
+} JournalTx;
+
+// the journal: a circular region of blocks where transactions are logged before their blocks
+// are written in place; transactions committed together are written as a single group, with a single sync
+typedef struct Journal {
+  DiskDriver* disk;
+  int start;           // first block of the region (the JournalSuper)
+  int num_blocks;
+  uint32_t id;
+  int head;            // position of the first transaction that replay would apply
+  int tail;            // position of the next record
+  int used;            // blocks between head and tail
+  uint64_t sequence;   // sequence of the next group
+
+  int* window;         // home blocks written since head: replay would write them again
+  int window_size;
+  int window_capacity;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  JournalTx* queue;    // transactions waiting for the next group (oldest first)
+  JournalTx* queue_tail;
+  int busy;            // 1 while a thread is writing a group or a checkpoint
+
+  // statistics
+  uint64_t transactions; // transactions committed
+  uint64_t groups;       // groups written, one sync each
+  uint64_t checkpoints;
+  uint64_t replayed;     // transactions applied when the journal was opened
+} Journal;
+
+// creates an empty journal in the num_blocks blocks starting at start (already reserved
+// in the bitmap), stores its position in the DiskHeader and opens it
+// returns NULL if the region is too small or can't be written
+Journal* Journal_create(DiskDriver* disk, int start, int num_blocks);
+
+// opens the journal of the disk, replaying the transactions committed but maybe not written
+// in place (after a crash); returns NULL if the disk has no journal
+Journal* Journal_open(DiskDriver* disk);
+
+// writes all the blocks in place, empties the journal and frees it
+void Journal_close(Journal* journal);
+
+// starts a transaction; returns NULL if the memory can't be allocated
+JournalTx* Journal_begin(Journal* journal);
+
+// writes src as the new content of block_num in the transaction (nothing is written on the disk)
+// returns -1 if the transaction can't grow (the group would not fit in the journal), 0 otherwise
+int Journal_write(JournalTx* tx, const void* src, int block_num);
+
+// reads block_num as the transaction sees it: its new content if the transaction wrote it,
+// the content on the disk otherwise; returns -1 on error
+int Journal_read(JournalTx* tx, void* dest, int block_num);
+
+// commits the transaction and frees it: when it returns 0 the transaction is on the disk
+// transactions committed by several threads at the same time are written as a single group,
+// with a single sync; the blocks are then written in place, without syncing them
+// returns -1 if the group could not be written
+int Journal_commit(JournalTx* tx);
+
+// frees the transaction without writing anything
+void Journal_abort(JournalTx* tx);
+
+// to be called before writing block_num outside of the journal: if replay could overwrite
+// the block with an older content, the journal is checkpointed first
+// returns -1 if the checkpoint fails
+int Journal_revoke(Journal* journal, int block_num);
+
+// syncs the blocks written in place and moves the start of replay to the end of the journal
+// returns -1 on error
+int Journal_checkpoint(Journal* journal);
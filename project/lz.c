@@ -0,0 +1,168 @@
+#include "lz.h"
+#include <string.h>
+
+// Ogni sequenza inizia con un token: i 4 bit alti sono il numero di letterali, i 4 bassi la lunghezza del match meno LZ_MIN_MATCH.
+// Il valore 15 indica che la lunghezza continua nei byte successivi (tanti 255 e un byte minore da sommare). Dopo i letterali
+// vengono i 2 byte dell'offset del match; l'ultima sequenza ha solo i letterali
+
+// Legge 4 byte senza preoccuparsi dell'allineamento
+// Reads 4 unaligned bytes
+static inline uint32_t LZ_read32(const unsigned char* p) {
+	uint32_t value;
+	memcpy(&value, p, 4);
+	return value;
+}
+
+// Posizione nella tabella dei 4 byte "value"
+// Hash of 4 bytes
+static inline int LZ_hash(uint32_t value) {
+	return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Scrive il resto "n" di una lunghezza che non entra nel token
+// Writes the part of a length that does not fit in the token
+static inline unsigned char* LZ_writeLength(unsigned char* op, int n) {
+	while(n >= 255) {
+		*op++ = 255;
+		n -= 255;
+	}
+	*op++ = n;
+	return op;
+}
+
+// Legge il resto di una lunghezza e lo somma a "*n"; restituisce -1 se i dati finiscono prima
+// Reads the part of a length that does not fit in the token
+static inline int LZ_readLength(const unsigned char** ip, const unsigned char* iend, int* n) {
+	unsigned char byte;
+	do {
+		if(*ip >= iend || *n > (1 << 30)) return -1;
+		byte = *(*ip)++;
+		*n += byte;
+	} while(byte == 255);
+	return 0;
+}
+
+// Scrive una sequenza: "num_literals" letterali e, se "match_len" non è 0, il match all'indietro di "offset" byte.
+// Restituisce -1 se la sequenza non entra prima di "oend"
+// Writes a sequence, returns -1 if it does not fit in the output
+static int LZ_sequence(unsigned char** out, unsigned char* oend, const unsigned char* literals, int num_literals, int offset, int match_len) {
+	unsigned char* op = *out;
+	int extra = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+	if(oend - op < 2 + num_literals + num_literals / 255 + (match_len > 0 ? 3 + extra / 255 : 0)) return -1;
+
+	unsigned char* token = op++;
+	*token = (num_literals >= 15 ? 15 : num_literals) << 4;
+	if(num_literals >= 15) op = LZ_writeLength(op, num_literals - 15);
+	memcpy(op, literals, num_literals);
+	op += num_literals;
+	if(match_len > 0) {
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		*token |= extra >= 15 ? 15 : extra;
+		if(extra >= 15) op = LZ_writeLength(op, extra - 15);
+	}
+	*out = op;
+	return 0;
+}
+
+// Inserisce nelle catene le posizioni da "*next" a "pos": "head" ha l'ultima posizione di ogni hash, "chain" la distanza di ogni
+// posizione dalla precedente con lo stesso hash (0 se non c'è, o è più lontana di LZ_MAX_OFFSET)
+// Adds the positions up to pos to the hash chains
+static inline void LZ_insert(const unsigned char* base, int* head, uint16_t* chain, int* next, int pos) {
+	for(; *next <= pos; (*next)++) {
+		int h = LZ_hash(LZ_read32(base + *next)), previous = head[h];
+		chain[*next & LZ_MAX_OFFSET] = previous >= 0 && *next - previous <= LZ_MAX_OFFSET ? *next - previous : 0;
+		head[h] = *next;
+	}
+}
+
+// Per ogni posizione prova al massimo LZ_DEPTH posizioni precedenti con lo stesso hash e tiene il match più lungo: la compressione
+// è più lenta che con un solo candidato, ma i dati si rimpiccioliscono di più e la decompressione resta veloce uguale
+// Greedy compression, with hash chains searched up to LZ_DEPTH candidates
+int LZ_compress(const void* src, int len, void* dst, int capacity) {
+	const unsigned char * base = src, * ip = base, * anchor = base, * end = base + len;
+	const unsigned char * limit = end - LZ_LAST_LITERALS;
+	unsigned char * op = dst, * oend = op + capacity;
+	int head[LZ_HASH_SIZE], next = 0, i;
+	uint16_t chain[LZ_MAX_OFFSET + 1];
+	if(len < 0 || capacity < 0) return -1;
+	for(i = 0; i < LZ_HASH_SIZE; i++) head[i] = -1;
+
+	// Gli ultimi LZ_LAST_LITERALS byte restano sempre letterali: i match finiscono prima
+	while(len > LZ_LAST_LITERALS + LZ_MIN_MATCH && ip + LZ_MIN_MATCH <= limit) {
+		int pos = ip - base, best_len = 0, best_pos = 0, depth = LZ_DEPTH;
+		LZ_insert(base, head, chain, &next, pos);
+
+		// Seguo la catena delle posizioni precedenti con lo stesso hash, allungando in avanti ogni match
+		uint32_t sequence = LZ_read32(ip);
+		int candidate = pos - chain[pos & LZ_MAX_OFFSET];
+		while(candidate < pos && depth-- > 0) {
+			if(LZ_read32(base + candidate) == sequence && base[candidate + best_len] == ip[best_len]) {
+				const unsigned char * mp = ip + LZ_MIN_MATCH, * mm = base + candidate + LZ_MIN_MATCH;
+				while(mp < limit && *mp == *mm) {
+					mp++;
+					mm++;
+				}
+				if(mp - ip > best_len) {
+					best_len = mp - ip;
+					best_pos = candidate;
+				}
+			}
+			int step = chain[candidate & LZ_MAX_OFFSET];
+			if(step == 0 || pos - (candidate - step) > LZ_MAX_OFFSET) break;
+			candidate -= step;
+		}
+		if(best_len < LZ_MIN_MATCH) {
+			ip++;
+			continue;
+		}
+		if(LZ_sequence(&op, oend, anchor, ip - anchor, pos - best_pos, best_len) == -1) return -1;
+		ip = anchor = ip + best_len;
+	}
+
+	// L'ultima sequenza ha solo i letterali rimasti
+	if(LZ_sequence(&op, oend, anchor, end - anchor, 0, 0) == -1) return -1;
+	return op - (unsigned char *) dst;
+}
+
+// Ogni lunghezza e ogni offset viene controllato prima della copia, quindi dei dati rovinati non fanno scrivere fuori da "dst"
+// Decompresses, checking every length and offset
+int LZ_decompress(const void* src, int len, void* dst, int capacity) {
+	const unsigned char * ip = src, * iend = ip + len;
+	unsigned char * base = dst, * op = base, * oend = base + capacity;
+	while(ip < iend) {
+		int token = *ip++, num_literals = token >> 4;
+		if(num_literals == 15 && LZ_readLength(&ip, iend, &num_literals) == -1) return -1;
+		if(num_literals > iend - ip || num_literals > oend - op) return -1;
+
+		// Pochi letterali (i più comuni) vengono copiati 16 byte alla volta, se c'è spazio prima della fine dei due buffer
+		if(num_literals <= 16 && iend - ip >= 16 && oend - op >= 16) {
+			memcpy(op, ip, 16);
+		}else{
+			memcpy(op, ip, num_literals);
+		}
+		op += num_literals;
+		ip += num_literals;
+
+		// L'ultima sequenza finisce con i letterali
+		if(ip == iend) break;
+		if(iend - ip < 2) return -1;
+		int offset = ip[0] | ip[1] << 8, match_len = token & 15;
+		ip += 2;
+		if(match_len == 15 && LZ_readLength(&ip, iend, &match_len) == -1) return -1;
+		match_len += LZ_MIN_MATCH;
+		if(offset == 0 || offset > op - base || match_len > oend - op) return -1;
+
+		// Il match viene copiato 8 byte alla volta (anche oltre la sua fine, se c'è spazio): ogni gruppo di 8 byte legge solo byte già
+		// scritti se l'offset è almeno 8. Con un offset più piccolo (una ripetizione corta) va copiato un byte alla volta
+		const unsigned char * match = op - offset;
+		int i;
+		if(offset >= 8 && oend - op >= match_len + 8) {
+			for(i = 0; i < match_len; i += 8) memcpy(op + i, match + i, 8);
+		}else{
+			for(i = 0; i < match_len; i++) op[i] = match[i];
+		}
+		op += match_len;
+	}
+	return op - base;
+}
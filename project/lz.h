@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+
+// LZ compression of the chunks of the compressed files, in the format of LZ4 blocks: sequences of
+// literals each followed by a match (offset and length) in the last 64 KiB; no entropy coding,
+// so decompression is fast and there are no dependencies
+
+// smallest match encoded, and bytes at the end of the input that are always literals
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+
+// largest offset of a match
+#define LZ_MAX_OFFSET 65535
+
+// bits of the hash table of the compressor, and previous positions with the same hash tried for each match
+// (the hash table and the chains, LZ_HASH_SIZE ints and LZ_MAX_OFFSET + 1 shorts, are on the stack)
+#define LZ_HASH_BITS 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+#define LZ_DEPTH 16
+
+// compresses the len bytes of src in dst, which can hold capacity bytes
+// returns the size of the compressed data, -1 if it does not fit in capacity
+// (with capacity len - 1 the data is compressed only if it gets smaller)
+int LZ_compress(const void* src, int len, void* dst, int capacity);
+
+// decompresses the len bytes of src in dst, which can hold capacity bytes
+// returns the size of the decompressed data, -1 if src is not valid or does not fit in capacity
+int LZ_decompress(const void* src, int len, void* dst, int capacity);
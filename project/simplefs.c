@@ -6,6 +6,115 @@
 #include <unistd.h> 
 #include <stdlib.h>
 
+// Converte il primo blocco "block" di un file o di una cartella scritto con la versione "version". Nella versione 0 size_in_bytes era
+// a 32 bit ed era seguito da size_in_blocks: ora al suo posto c'è la parte alta di size_in_bytes, che va azzerata. Fino alla versione 2
+// i flag erano gli ultimi byte del nome, quindi vengono azzerati. Per le cartelle, converte ricorsivamente anche tutti i file e le
+// cartelle contenuti ("parent" è il primo blocco della cartella che contiene "block", -1 per la radice)
+// Converts the first block of a file or directory written by an older version, and recursively the contents of a directory
+static void SimpleFS_migrateBlock(DiskDriver* disk, int block, int parent, int version) {
+	FirstDirectoryBlock * fdb = DiskDriver_getBlockPtrMut(disk, block);
+	if(fdb == NULL) return;
+
+	// Un indice che non punta al primo blocco di un file di questa cartella (una posizione mai usata) viene ignorato
+	if(fdb->fcb.block_in_disk != block || (parent != -1 && fdb->fcb.directory_block != parent)) {
+		DiskDriver_releaseBlockPtr(disk, block);
+		return;
+	}
+
+	// Tengo solo i 32 bit bassi di size_in_bytes, quelli che contenevano la dimensione
+	if(version < 1) fdb->fcb.size_in_bytes = (uint32_t) fdb->fcb.size_in_bytes;
+	fdb->fcb.flags = 0;
+	DiskDriver_markDirty(disk, block);
+	if(!fdb->fcb.is_dir) {
+		DiskDriver_releaseBlockPtr(disk, block);
+		return;
+	}
+
+	// Copio gli indici dei blocchi contenuti (dal primo blocco e dai blocchi successivi della cartella) prima di visitarli,
+	// in modo da non tenere bloccati i blocchi della cartella durante la ricorsione; le posizioni vuote valgono 0
+	int per_first = sizeof(fdb->file_blocks) / sizeof(int), per_block = sizeof(((DirectoryBlock *) 0)->file_blocks) / sizeof(int);
+	int capacity = per_first, found = 0, i;
+	int * entries = malloc(capacity * sizeof(int));
+	for(i = 0; i < per_first; i++) {
+		if(fdb->file_blocks[i] > 0) entries[found++] = fdb->file_blocks[i];
+	}
+	int next_block = fdb->header.next_block;
+	DiskDriver_releaseBlockPtr(disk, block);
+
+	const DirectoryBlock * db;
+	while(next_block != -1 && (db = DiskDriver_getBlockPtr(disk, next_block)) != NULL) {
+		if(found + per_block > capacity) {
+			capacity = 2 * capacity + per_block;
+			entries = realloc(entries, capacity * sizeof(int));
+		}
+		for(i = 0; i < per_block; i++) {
+			if(db->file_blocks[i] > 0) entries[found++] = db->file_blocks[i];
+		}
+		int current = next_block;
+		next_block = db->header.next_block;
+		DiskDriver_releaseBlockPtr(disk, current);
+	}
+
+	for(i = 0; i < found; i++) SimpleFS_migrateBlock(disk, entries[i], block, version);
+	free(entries);
+}
+
+// Inizia una transazione del journal per modificare i metadati; senza journal restituisce NULL, e i blocchi vengono scritti direttamente
+// Starts a transaction on the journal of the file system (NULL if there is no journal)
+static JournalTx* SimpleFS_begin(SimpleFS* fs) {
+	return fs->journal != NULL ? Journal_begin(fs->journal) : NULL;
+}
+
+// Scrive il blocco "block_num" nella transazione "tx" o, se non c'è, direttamente sul disco. Prima di una scrittura diretta il
+// journal viene avvisato: se il blocco era stato scritto da una transazione, il replay non deve sovrascriverlo con quel contenuto
+// Writes a block in the transaction, or directly on the disk (revoking it from the journal)
+static int SimpleFS_writeBlock(SimpleFS* fs, JournalTx* tx, void* src, int block_num) {
+	if(tx != NULL) return Journal_write(tx, src, block_num);
+	if(fs->journal != NULL && Journal_revoke(fs->journal, block_num) == -1) return -1;
+	return DiskDriver_writeBlock(fs->disk, src, block_num);
+}
+
+// Legge il blocco "block_num" come lo vede la transazione "tx" (direttamente dal disco se non c'è)
+// Reads a block as the transaction sees it
+static int SimpleFS_readBlock(SimpleFS* fs, JournalTx* tx, void* dest, int block_num) {
+	return tx != NULL ? Journal_read(tx, dest, block_num) : DiskDriver_readBlock(fs->disk, dest, block_num);
+}
+
+// Fa il commit della transazione "tx": i blocchi vengono scritti con una sola sincronizzazione del disco (insieme alle transazioni
+// degli altri thread). Senza journal, sincronizza i blocchi scritti direttamente
+// Commits the transaction, or flushes the disk if there is no journal
+static int SimpleFS_commit(SimpleFS* fs, JournalTx* tx) {
+	return tx != NULL ? Journal_commit(tx) : DiskDriver_flush(fs->disk);
+}
+
+// Chiude la transazione "tx" dopo le sue scritture: se "ret" è -1 (un blocco non è entrato nella transazione, ad esempio perché non ci
+// sta più nel journal) la scarta senza scrivere nulla e restituisce -1, altrimenti ne fa il commit. Senza journal i blocchi sono già
+// stati scritti al loro posto, e non si può annullare nulla
+// Commits the transaction, or aborts it if one of its writes failed
+static int SimpleFS_finish(SimpleFS* fs, JournalTx* tx, int ret) {
+	if(ret == -1) {
+		if(tx != NULL) Journal_abort(tx);
+		else DiskDriver_flush(fs->disk);
+		return -1;
+	}
+	return SimpleFS_commit(fs, tx);
+}
+
+// Riserva alla fine del disco la regione del journal (un blocco ogni JOURNAL_RATIO, al massimo JOURNAL_MAX_BLOCKS) e crea il journal;
+// i dischi troppo piccoli restano senza journal
+// Reserves the journal region at the end of the disk and creates the journal (small disks get none)
+static void SimpleFS_createJournal(SimpleFS* fs) {
+	int num_blocks = fs->disk->header->num_blocks / JOURNAL_RATIO;
+	if(num_blocks > JOURNAL_MAX_BLOCKS) num_blocks = JOURNAL_MAX_BLOCKS;
+	fs->journal = NULL;
+	if(num_blocks < JOURNAL_MIN_BLOCKS) return;
+
+	int start = DiskDriver_allocRun(fs->disk, num_blocks, fs->disk->header->num_blocks - num_blocks);
+	if(start == -1) return;
+	fs->journal = Journal_create(fs->disk, start, num_blocks);
+	if(fs->journal == NULL) DiskDriver_freeRange(fs->disk, start, num_blocks);
+}
+
 // initializes a file system on an already made disk
 // returns a handle to the top level directory stored in the first block
 DirectoryHandle* SimpleFS_init(SimpleFS* fs, DiskDriver* disk) {
@@ -15,11 +124,29 @@ DirectoryHandle* SimpleFS_init(SimpleFS* fs, DiskDriver* disk) {
 
 	// Interpreto il disco passato in parametro come disco principale del FileSystem
 	fs->disk = disk;
+	fs->journal = NULL;
+	fs->read_only = disk->read_only;
+	fs->snapshot = 0;
 	DirectoryHandle * directory_handle = malloc(sizeof(DirectoryHandle));	
 	directory_handle->sfs = fs;
+	directory_handle->names = NULL;
 
 	// Inserirò la radice sempre al primo posto della bitmap, nel caso già esiste la leggo solamente		
 	if(fs->disk->header->first_free_block != 0){
+
+		// Apro il journal: le transazioni completate prima di un crash vengono riportate sul disco prima di leggere qualunque blocco
+		// (un disco in sola lettura non può essere cambiato, quindi resta com'è)
+		if(!fs->read_only) fs->journal = Journal_open(disk);
+
+		// Se il file system è stato scritto da una versione precedente, converto prima i suoi blocchi
+		// (la versione 0 aveva le dimensioni a 32 bit, la versione 1 non aveva il journal, la 2 non aveva i flag)
+		if(!fs->read_only && fs->disk->header->fs_version < SIMPLEFS_VERSION) {
+			SimpleFS_migrateBlock(disk, 0, -1, fs->disk->header->fs_version);
+			if(fs->journal == NULL) SimpleFS_createJournal(fs);
+			DiskDriver_setFsVersion(disk, SIMPLEFS_VERSION);
+			DiskDriver_flush(disk);
+		}
+
 		FirstDirectoryBlock * first_directory_block = malloc(sizeof(FirstDirectoryBlock));
 		DiskDriver_readBlock(disk, first_directory_block, 0);
 		directory_handle->dcb = first_directory_block;
@@ -58,22 +185,31 @@ DirectoryHandle* SimpleFS_init(SimpleFS* fs, DiskDriver* disk) {
 // and set to the top level directory
 void SimpleFS_format(SimpleFS* fs) {
 
-	// Nel caso in cui il file system sia nullo, termino la funzione
-	if(fs == NULL) return;
+	// Nel caso in cui il file system sia nullo (o sia uno snapshot), termino la funzione
+	if(fs == NULL || fs->read_only) return;
 
-	// Azzero la BitMap di tutto il disco
-	int i;
-	BitMap bitmap;
-	bitmap.num_bits = fs->disk->header->bitmap_entries * 8;
-	bitmap.entries = fs->disk->bitmap_data;
+	// Il journal del vecchio file system viene svuotato (i suoi blocchi stanno per essere liberati), e così le tabelle dei checksum
+	// e di deduplicazione, che vengono riservate di nuovo dopo aver creato la radice
+	Journal_close(fs->journal);
+	fs->journal = NULL;
+	int checksums = fs->disk->checksums != NULL, dedup_entries = fs->disk->dedup != NULL ? fs->disk->dedup->num_entries : 0;
+	DiskDriver_disableChecksums(fs->disk);
+	DiskDriver_disableDedup(fs->disk);
 
-	// Setto ogni elemento della bitmap a zero
-	for(i = 0; i < bitmap.num_bits; i++) {
-		BitMap_set(&bitmap, i, 0);
+	// Anche gli snapshot vengono cancellati: i loro blocchi stanno per essere liberati
+	int i;
+	for(i = 0; fs->disk->snapshots != NULL && i < DISK_MAX_SNAPSHOTS; i++) {
+		if(fs->disk->snapshots->table[i].num_blocks > 0) DiskDriver_deleteSnapshot(fs->disk, fs->disk->snapshots->table[i].name);
 	}
 
-	// Memorizzo le entries della bitmap nel disk
-	fs->disk->bitmap_data = bitmap.entries;
+	// Azzero la BitMap di tutto il disco
+	// Setto ogni elemento della bitmap a zero con un'unica operazione, e aggiorno di conseguenza il DiskHeader
+	DiskDriver_freeRange(fs->disk, 0, fs->disk->header->num_blocks);
+	fs->disk->header->free_blocks = fs->disk->header->num_blocks;
+	fs->disk->header->first_free_block = 0;
+	fs->disk->header->alloc_cursor = 0;
+	fs->disk->header->fs_version = SIMPLEFS_VERSION;
+	fs->disk->header->journal_blocks = 0;
 	
 	// Creo il primo blocco della cartella "base"
 	FirstDirectoryBlock * first_directory_block = malloc(sizeof(FirstDirectoryBlock));
@@ -87,8 +223,8 @@ void SimpleFS_format(SimpleFS* fs) {
 	first_directory_block->fcb.directory_block = -1;
 	first_directory_block->fcb.block_in_disk = fs->disk->header->first_free_block;
   strcpy(first_directory_block->fcb.name,"/");
+  first_directory_block->fcb.flags = 0;
   first_directory_block->fcb.size_in_bytes = sizeof(FirstDirectoryBlock);
-  first_directory_block->fcb.size_in_blocks = count_blocks(first_directory_block->fcb.size_in_bytes);
   first_directory_block->fcb.is_dir = 1;
 	first_directory_block->num_entries = 0;
 
@@ -99,22 +235,60 @@ void SimpleFS_format(SimpleFS* fs) {
 	DiskDriver_writeBlock(fs->disk, first_directory_block, fs->disk->header->first_free_block);
 	DiskDriver_flush(fs->disk);	
 
+	// Riservo la regione del journal dei metadati
+	SimpleFS_createJournal(fs);
+	if(dedup_entries > 0) DiskDriver_enableDedup(fs->disk, dedup_entries);
+	if(checksums) DiskDriver_enableChecksums(fs->disk);
 	return;
 }
 
+// Smonta il file system: il journal viene svuotato (i suoi blocchi sono già al loro posto) e chiuso, poi il disco
+// viene chiuso salvando il riassunto dell'allocatore, così il prossimo montaggio non deve leggere tutta la bitmap
+// Uno snapshot montato viene solo staccato dal disco, che resta montato dal file system
+// Unmounts the file system: empties the journal, then closes the disk cleanly
+int SimpleFS_unmount(SimpleFS* fs) {
+	if(fs == NULL || fs->disk == NULL) return -1;
+	if(fs->snapshot) {
+		fs->disk = NULL;
+		return 0;
+	}
+	Journal_close(fs->journal);
+	fs->journal = NULL;
+	int ret = DiskDriver_unmount(fs->disk);
+	fs->disk = NULL;
+	return ret;
+}
+
+// Imposta il modo di accesso "advice" del file e ricomincia il readahead: con SEQUENTIAL la prima finestra è già la più grande,
+// con RANDOM non viene anticipato nessun blocco
+// Sets the access pattern of the handle and restarts its readahead window
+static void SimpleFS_setAdvice(FileHandle* f, int advice) {
+	f->advice = advice;
+	f->readahead = advice == SIMPLEFS_ADVISE_RANDOM ? 0 : advice == SIMPLEFS_ADVISE_SEQUENTIAL ? SIMPLEFS_READAHEAD_MAX : SIMPLEFS_READAHEAD_MIN;
+	f->readahead_start = f->readahead_end = f->readahead_mark = -1;
+}
+
 // creates an empty file in the directory d
 // returns null on error (file existing, no free blocks)
 // an empty file consists only of a block of type FirstBlock
 FileHandle* SimpleFS_createFile(DirectoryHandle* d, const char* filename) {
 
-	// Se uno dei parametri è vuoto, esco senza fare nulla
-	if(d == NULL || filename == NULL) return NULL;
+	// Se uno dei parametri è vuoto (o il file system è uno snapshot), esco senza fare nulla
+	if(d == NULL || filename == NULL || d->sfs->read_only) return NULL;
+
+	// Il nome deve stare nel FileControlBlock, terminatore compreso: subito dopo ci sono i flag
+	if(strlen(filename) >= sizeof(((FileControlBlock *) 0)->name)) return NULL;
 
 	// Se esiste già un file con lo stesso nome, restituisco errore
 	if(SimpleFS_openFile(d, filename) != NULL) return NULL;
 
 	// Se non ci sono blocchi liberi per creare il file, restituisco errore
-	if(d->sfs->disk->header->free_blocks < 1) return NULL; 
+	if(DiskDriver_freeCount(d->sfs->disk) < 1) return NULL; 
+
+	// Il primo blocco del file e i blocchi della cartella vengono scritti in un'unica transazione del journal: se non riesce, vengono
+	// liberati i blocchi riservati in "new_blocks"
+	JournalTx * tx = SimpleFS_begin(d->sfs);
+	int new_blocks[3], num_new = 0, ret = 0;
 
 	// Creo il FileHandle e inserisco le informazioni relative
 	FileHandle * file_handle = malloc(sizeof(FileHandle));
@@ -124,20 +298,29 @@ FileHandle* SimpleFS_createFile(DirectoryHandle* d, const char* filename) {
 	first_file_block->header.next_block = -1;
 	first_file_block->header.block_in_file = 0;
 	first_file_block->fcb.directory_block = d->dcb->fcb.block_in_disk;
-	first_file_block->fcb.block_in_disk = DiskDriver_getFreeBlock(d->sfs->disk, 0);
+	first_file_block->fcb.block_in_disk = DiskDriver_allocBlock(d->sfs->disk, NULL);
 	strcpy(first_file_block->fcb.name, filename);
+	first_file_block->fcb.flags = 0;
 	first_file_block->fcb.size_in_bytes = 0;
-	first_file_block->fcb.size_in_blocks = count_blocks(first_file_block->fcb.size_in_bytes);
   first_file_block->fcb.is_dir = 0;
 	file_handle->directory = d->dcb;
 	file_handle->current_block = &(first_file_block->header);
 	file_handle->pos_in_file = 0;
+	file_handle->block_num = first_file_block->fcb.block_in_disk;
+	file_handle->block_index = 0;
+	file_handle->chunks = NULL;
+	file_handle->extents = NULL;
+	SimpleFS_setAdvice(file_handle, SIMPLEFS_ADVISE_NORMAL);
+
+	// I blocchi del file verranno allocati vicino al suo primo blocco
+	DiskDriver_initCursor(d->sfs->disk, &file_handle->cursor, first_file_block->fcb.block_in_disk);
 
 	// Imposto tutta la memoria con dei caratteri nulli
 	memset(first_file_block->data, '\0', sizeof(first_file_block->data));
 
 	// Scrivo il blocco con le informazioni del file sul disco
-	DiskDriver_writeBlock(d->sfs->disk, first_file_block, first_file_block->fcb.block_in_disk);
+	if(first_file_block->fcb.block_in_disk != -1) new_blocks[num_new++] = first_file_block->fcb.block_in_disk;
+	if(SimpleFS_writeBlock(d->sfs, tx, first_file_block, first_file_block->fcb.block_in_disk) == -1) ret = -1;
 
 	// Memorizzo le informazioni del FirstFileBlock anche nel FileHandle da restituire
 	file_handle->fcb = first_file_block;
@@ -173,7 +356,7 @@ FileHandle* SimpleFS_createFile(DirectoryHandle* d, const char* filename) {
 		d->dcb->num_entries++;
 
 		// Sovrascrivo le nuove informazioni della cartella
-		DiskDriver_writeBlock(d->sfs->disk, d->dcb, d->dcb->fcb.block_in_disk);
+		if(SimpleFS_writeBlock(d->sfs, tx, d->dcb, d->dcb->fcb.block_in_disk) == -1) ret = -1;
 
 	}else{
 		
@@ -190,18 +373,19 @@ FileHandle* SimpleFS_createFile(DirectoryHandle* d, const char* filename) {
 			// Leggo il contenuto e lo memorizzo in "db"
 			db_block = d->dcb->header.next_block;
 			db = malloc(sizeof(DirectoryBlock));
-			DiskDriver_readBlock(d->sfs->disk, db, d->dcb->header.next_block);
+			SimpleFS_readBlock(d->sfs, tx, db, d->dcb->header.next_block);
 
 			// Continuo finché i successivi hanno a loro volta dei blocchi successivi
 			while(db->header.next_block != -1){
 				db_block = db->header.next_block;
-				DiskDriver_readBlock(d->sfs->disk, db, db_block);
+				SimpleFS_readBlock(d->sfs, tx, db, db_block);
 			}
 
 		}else{
 
 			// Se non ha blocchi successivi, mi creo un blocco successivo
-			new_db_block = DiskDriver_getFreeBlock(d->sfs->disk, 0);
+			new_db_block = DiskDriver_allocBlock(d->sfs->disk, NULL);
+			if(new_db_block != -1) new_blocks[num_new++] = new_db_block;
 			DirectoryBlock * directory_block = malloc(sizeof(DirectoryBlock));
 			directory_block->header.next_block = -1;
 			directory_block->header.previous_block = db_block; 
@@ -209,7 +393,7 @@ FileHandle* SimpleFS_createFile(DirectoryHandle* d, const char* filename) {
 
 			// Aggiorno il next_block del FirstDirectoryBlock e lo sovrascrivo/aggiorno sul suo blocco
 			d->dcb->header.next_block = new_db_block;
-			DiskDriver_writeBlock(d->sfs->disk, db, db_block);
+			if(SimpleFS_writeBlock(d->sfs, tx, db, db_block) == -1) ret = -1;
 
 			// Adatto i puntatori e i valori in modo che possano funzionare all'esterno
 			db = directory_block;
@@ -218,7 +402,8 @@ FileHandle* SimpleFS_createFile(DirectoryHandle* d, const char* filename) {
 
 		// Se nell'ultimo blocco trovato non c'è abbastanza spazio, creo un blocco successivo
 		if(!space_in_dir(db->file_blocks, sizeof(d->dcb->file_blocks))){
-			new_db_block = DiskDriver_getFreeBlock(d->sfs->disk, 0);
+			new_db_block = DiskDriver_allocBlock(d->sfs->disk, NULL);
+			if(new_db_block != -1) new_blocks[num_new++] = new_db_block;
 			DirectoryBlock * directory_block = malloc(sizeof(DirectoryBlock));
 			directory_block->header.next_block = -1;
 			directory_block->header.previous_block = db_block; 
@@ -226,7 +411,7 @@ FileHandle* SimpleFS_createFile(DirectoryHandle* d, const char* filename) {
 
 			// Aggiorno il next_block del vecchio DirectoryBlock e lo sovrascrivo/aggiorno sul suo blocco
 			db->header.next_block = new_db_block;
-			DiskDriver_writeBlock(d->sfs->disk, db, db_block);
+			if(SimpleFS_writeBlock(d->sfs, tx, db, db_block) == -1) ret = -1;
 
 			// Adatto i puntatori e i valori in modo che possano funzionare all'esterno
 			db = directory_block;
@@ -240,52 +425,76 @@ FileHandle* SimpleFS_createFile(DirectoryHandle* d, const char* filename) {
 		d->dcb->num_entries++;
 
 		// Scrivo, su un nuovo blocco (libero) la DirectoryBlock appena creata
-		DiskDriver_writeBlock(d->sfs->disk, db, db_block);
+		if(SimpleFS_writeBlock(d->sfs, tx, db, db_block) == -1) ret = -1;
 	}
 
-	// Flusho tutte le informazioni sul disco e restituisco il FileHandle realizzato in precedenza
-	DiskDriver_flush(d->sfs->disk);
+	// Faccio il commit della transazione (una sola sincronizzazione del disco) e restituisco il FileHandle realizzato in precedenza.
+	// Se la transazione viene scartata (o il commit non riesce) il file non viene creato: libero i blocchi riservati e rileggo la
+	// cartella dal disco, dove non è cambiato nulla; senza journal i blocchi sono già stati scritti, e restano dove sono
+	int journaled = tx != NULL;
+	if(SimpleFS_finish(d->sfs, tx, ret) == -1) {
+		if(journaled) {
+			DiskDriver_freeBlocks(d->sfs->disk, new_blocks, num_new);
+			DiskDriver_readBlock(d->sfs->disk, d->dcb, d->dcb->fcb.block_in_disk);
+		}
+		free(first_file_block);
+		free(file_handle);
+		return NULL;
+	}
 	return file_handle;
 }
 
+// Restituisce l'indice del blocco in cui è memorizzata la i-esima entry della cartella "dcb". Le prime entry si trovano nel
+// FirstDirectoryBlock, le successive nei DirectoryBlock collegati, che vengono letti direttamente dalla mmap (o dalla cache) senza copiarli
+// Returns the block of the i-th entry of the directory, reading the next DirectoryBlocks in place (-1 if there is none)
+static int SimpleFS_dirEntry(DiskDriver* disk, const FirstDirectoryBlock* dcb, int i) {
+	int first_entries = sizeof(dcb->file_blocks) / sizeof(int);
+	if(i < first_entries) return dcb->file_blocks[i];
+
+	// Salto i DirectoryBlock precedenti a quello che contiene l'entry
+	const DirectoryBlock * db = NULL;
+	int next_block = dcb->header.next_block;
+	i -= first_entries;
+	while(next_block != -1 && (db = DiskDriver_getBlockPtr(disk, next_block)) != NULL) {
+		int block = next_block, entry = -1;
+		if(i < sizeof(db->file_blocks) / sizeof(int)) entry = db->file_blocks[i];
+		i -= sizeof(db->file_blocks) / sizeof(int);
+		next_block = db->header.next_block;
+		DiskDriver_releaseBlockPtr(disk, block);
+		if(entry != -1) return entry;
+	}
+	return -1;
+}
+
 // reads in the (preallocated) blocks array, the name of all files in a directory
+// the names are copied in a buffer owned by the handle, valid until the next readDir on it
 int SimpleFS_readDir(char** names, DirectoryHandle* d) {
 
 	// Se uno dei parametri è vuoto, esco senza fare nulla
 	if(names == NULL || d == NULL) return -1;
 
-	// Creo un FirstDirectoryBlock in cui memorizzo le informazioni ottenute dal parametro
-	FirstDirectoryBlock * db = malloc(sizeof(FirstDirectoryBlock));
-	db = d->dcb;
-
-	// Per ogni file
-	//    Se è presente nel blocco corrente
-	//       Memorizzo il nome nell'array
-	//    Se non è presente nel blocco corrente
-	//       Entro nel blocco successivo
-	//       Memorizzo il nome nell'array
+	// I nomi vengono copiati in un buffer della cartella: i blocchi letti dalla cache non restano in memoria dopo il rilascio
+	int name_size = sizeof(((FileControlBlock *) 0)->name);
+	char * buffer = realloc(d->names, (size_t) (d->dcb->num_entries > 0 ? d->dcb->num_entries : 1) * name_size);
+	if(buffer == NULL) return -1;
+	d->names = buffer;
 
-	int i, j = 0;
 	// Per ogni elemento nella cartella
-	for(i = 0; i < d->dcb->num_entries; i++, j++) {
-
-		// Se l'indice dell'elemento è maggiore del numero di elementi contenuti
-		if(j >= sizeof(db->file_blocks)) {
-			DirectoryBlock * db;
-
-			// Aggiorno l'indice relativo del blocco
-			j = j - sizeof(db->file_blocks);
-
-			// Leggo il blocco successivo
-			DiskDriver_readBlock(d->sfs->disk, db, db->header.next_block);
-		}
-
-		// Leggo il nome del file contenuto in questa posizione
-		FirstFileBlock * first_file_block = malloc(sizeof(FirstFileBlock));
-		DiskDriver_readBlock(d->sfs->disk, first_file_block, db->file_blocks[j]);
-
-		// Lo inserisco nell'array preso come parametro
-		names[j] = first_file_block->fcb.name;
+	//    Cerco il blocco in cui è memorizzato (nel blocco corrente o in uno dei successivi)
+	//    Copio il nome nel buffer e memorizzo nell'array il puntatore alla copia
+	int i;
+	for(i = 0; i < d->dcb->num_entries; i++) {
+
+		// Leggo il primo blocco del file contenuto in questa posizione, senza copiarlo
+		int block = SimpleFS_dirEntry(d->sfs->disk, d->dcb, i);
+		const FirstFileBlock * first_file_block = DiskDriver_getBlockPtr(d->sfs->disk, block);
+		if(first_file_block == NULL) continue;
+
+		// Copio solo il nome e lo inserisco nell'array preso come parametro
+		names[i] = buffer + (size_t) i * name_size;
+		strncpy(names[i], first_file_block->fcb.name, name_size - 1);
+		names[i][name_size - 1] = '\0';
+		DiskDriver_releaseBlockPtr(d->sfs->disk, block);
 	}
 	return 0;
 }
@@ -296,249 +505,1555 @@ FileHandle* SimpleFS_openFile(DirectoryHandle* d, const char* filename) {
 	// Se uno dei parametri è vuoto, esco senza fare nulla
 	if(d == NULL || filename == NULL) return NULL;
 
-	// Memorizzo le informazioni della cartella
-	FileHandle * file_handle = malloc(sizeof(FileHandle));
-	FirstDirectoryBlock * db = malloc(sizeof(FirstDirectoryBlock));
-	db = d->dcb;
-
 	// Per ogni file
-	//    Se ho superato la dimensione del blocco corrente
-	//       Memorizzo le informazioni del blocco successivo
-	//    Memorizzo le informazioni del primo blocco del file
+	//    Leggo direttamente dalla mmap il primo blocco del file
 	//    Se il nome corrisponde a quello da aprire, e non è una cartella
-	//       Memorizzo nel file_handle le informazioni di questo file
+	//       Copio il primo blocco e memorizzo nel file_handle le informazioni di questo file
 	//       Restituisco il file
 	//    Altrimenti
 	//       Restituisco NULL
-	int i, j = 0;
+	int i;
 
 	// Per ogni elemento contenuto nella cartella
-	for(i = 0; i < d->dcb->num_entries; i++, j++) {
-		
-		// Se l'indice relativo al blocco è maggiore della dimensione del blocco
-		if(j >= sizeof(db->file_blocks)) { 
-			DirectoryBlock * db;
-
-			// Aggiorno l'indice relativo
-			j = j - sizeof(db->file_blocks);
-
-			// Leggo il blocco successivo
-			DiskDriver_readBlock(d->sfs->disk, db, db->header.next_block);
-		}
+	for(i = 0; i < d->dcb->num_entries; i++) {
 
-		// Leggo il primo blocco del file memorizzato in questa posizione
-		FirstFileBlock * first_file_block = malloc(sizeof(FirstFileBlock));
-		DiskDriver_readBlock(d->sfs->disk, first_file_block, db->file_blocks[j]);
+		// Leggo il primo blocco del file memorizzato in questa posizione, senza copiarlo
+		int block = SimpleFS_dirEntry(d->sfs->disk, d->dcb, i);
+		const FirstFileBlock * first_file_block = DiskDriver_getBlockPtr(d->sfs->disk, block);
+		if(first_file_block == NULL) continue;
 
 		// Se il nome appena letto corrisponde a quello preso come parametro e non si tratta di una cartella
 		if(strcmp(first_file_block->fcb.name, filename) == 0 && first_file_block->fcb.is_dir == 0){
 
+			// Solo adesso copio il primo blocco, che il file handle potrà modificare
+			FileHandle * file_handle = malloc(sizeof(FileHandle));
+			FirstFileBlock * fcb = malloc(sizeof(FirstFileBlock));
+			memcpy(fcb, first_file_block, sizeof(FirstFileBlock));
+			DiskDriver_releaseBlockPtr(d->sfs->disk, block);
+
 			// Inserisco tutti i dati nel file_handle
 			file_handle->sfs = d->sfs;
-			file_handle->fcb = first_file_block;
+			file_handle->fcb = fcb;
 			file_handle->directory = d->dcb;
-			file_handle->current_block = &(first_file_block->header);
+			file_handle->current_block = &(fcb->header);
 			file_handle->pos_in_file = 0;
+			file_handle->block_num = fcb->fcb.block_in_disk;
+			file_handle->block_index = 0;
+			file_handle->chunks = NULL;
+			file_handle->extents = NULL;
+			DiskDriver_initCursor(d->sfs->disk, &file_handle->cursor, fcb->fcb.block_in_disk);
+			SimpleFS_setAdvice(file_handle, SIMPLEFS_ADVISE_NORMAL);
 
 			// Restituisco il file handle
 			return file_handle;
 		}
+		DiskDriver_releaseBlockPtr(d->sfs->disk, block);
 	}
 
 	// Se non ho restituito un file handle ed ho completato il ciclo, restituisco NULL
 	return NULL;
 }
 
+// Libera l'indice dei chunk letto dal FileHandle di un file compresso: verrà letto di nuovo quando servirà
+// Frees the chunk index cached by the handle
+static void SimpleFS_freeChunks(FileHandle* f) {
+	if(f->chunks == NULL) return;
+	free(f->chunks->entries);
+	free(f->chunks->index_blocks);
+	free(f->chunks);
+	f->chunks = NULL;
+}
+
+// Libera gli extent letti in memoria
+// Frees an extent map
+static void SimpleFS_freeExtentMap(ExtentMap* map) {
+	if(map == NULL) return;
+	free(map->extents);
+	free(map->index_blocks);
+	free(map);
+}
+
+// Libera gli extent letti dal FileHandle: verranno letti di nuovo quando serviranno
+// Frees the extents cached by the handle
+static void SimpleFS_freeExtents(FileHandle* f) {
+	SimpleFS_freeExtentMap(f->extents);
+	f->extents = NULL;
+}
+
 // closes a file handle (destroyes it)
 int SimpleFS_close(FileHandle* f) {
 
 	// Se il parametro è vuoto, esco senza fare nulla
 	if(f == NULL) return -1;
 
-	// Libero tutto lo spazio occupato dal FileHandle
+	// Libero tutto lo spazio occupato dal FileHandle (e l'indice dei chunk o gli extent, se li ha letti)
+	SimpleFS_freeChunks(f);
+	SimpleFS_freeExtents(f);
 	free(f);
 
 	// Esco dalla funzione
 	return 0;
 }
 
-// writes in the file, at current position for size bytes stored in data
-// overwriting and allocating new space if necessary
-// returns the number of bytes written
+// Accoda la scrittura asincrona del blocco "block_num"; se la coda è piena, prima aspetta che qualche scrittura sia completata
+// (se non è possibile, scrive il blocco in modo sincrono). Restituisce -1 se la scrittura sincrona, o una delle scritture
+// completate nel frattempo, non è riuscita
+// Queues an asynchronous write of block_num, polling some completions when the queue is full
+static int SimpleFS_queueWrite(SimpleFS* fs, const void* block, int block_num, int* in_flight) {
+	DiskIOCompletion completions[DISK_IO_DEPTH];
+	int ret = 0, i;
+	if(fs->journal != NULL && Journal_revoke(fs->journal, block_num) == -1) ret = -1;
+	while(DiskDriver_submitWrite(fs->disk, block, block_num, NULL) == -1) {
+		int n = *in_flight > 0 ? DiskDriver_poll(fs->disk, completions, DISK_IO_DEPTH, 1) : -1;
+		if(n <= 0) return DiskDriver_writeBlock(fs->disk, (void *) block, block_num) == -1 ? -1 : ret;
+		for(i = 0; i < n; i++) {
+			if(completions[i].result == -1) ret = -1;
+		}
+		*in_flight -= n;
+	}
+	(*in_flight)++;
+	return ret;
+}
 
-// TODO: Nell'else, fare in modo che la scrittura inizi da pos, e non dall'inizio
-// !!!!! RICORDA CHE "pos" può trovarsi anche in un blocco successivo
-int SimpleFS_write(FileHandle* f, void* data, int size) {
+// Aspetta il completamento delle "in_flight" scritture accodate (inviandole al disco, se non lo sono già).
+// Restituisce -1 se una di loro non è riuscita (o non si può più aspettarle), 0 altrimenti
+// Waits for the in_flight queued writes
+static int SimpleFS_waitWrites(DiskDriver* disk, int in_flight) {
+	DiskIOCompletion completions[DISK_IO_DEPTH];
+	int ret = 0, i;
+	while(in_flight > 0) {
+		int n = DiskDriver_poll(disk, completions, DISK_IO_DEPTH, in_flight);
+		if(n <= 0) return -1;
+		for(i = 0; i < n; i++) {
+			if(completions[i].result == -1) ret = -1;
+		}
+		in_flight -= n;
+	}
+	return ret;
+}
 
-	// Se uno dei parametri è vuoto, esco senza fare nulla
-	if(f == NULL || data == NULL || size < 0) return -1;
+/* File compressi: i dati sono divisi in chunk di SIMPLEFS_CHUNK_SIZE byte, compressi ognuno per conto suo con LZ_compress e scritti
+   in blocchi consecutivi senza BlockHeader. L'indice dei chunk inizia nel primo blocco del file e continua nei ChunkIndexBlock
+   collegati dal suo next_block; il FileHandle lo tiene in memoria, così una lettura in qualunque punto del file decomprime
+   solo i chunk che contengono i byte richiesti */
 
-	// Inizializzo le variabili che conteranno il numero di byte e blocchi scritti
-	int written_bytes = 0, written_blocks = 0;
+// Numero di blocchi occupati da "bytes" byte di un chunk
+// Blocks used by a chunk stored in bytes bytes
+static inline int SimpleFS_chunkBlocks(int bytes) {
+	return (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+// Numero di chunk di un file compresso di "size" byte
+// Chunks of a compressed file of size bytes
+static inline int SimpleFS_numChunks(int64_t size) {
+	return (int) ((size + SIMPLEFS_CHUNK_SIZE - 1) / SIMPLEFS_CHUNK_SIZE);
+}
 
-	// Memorizzo in "pos" la posizione in cui si trova attualmente il cursore
-	int pos = f->pos_in_file;
+// Si assicura che l'indice possa contenere "n" chunk; i nuovi chunk non sono mai stati scritti (valgono tutti 0)
+// Grows the chunk index to n entries
+static int SimpleFS_growChunks(ChunkCache* cache, int n) {
+	if(n > cache->capacity) {
+		int capacity = 2 * cache->capacity > n ? 2 * cache->capacity : n;
+		ChunkEntry * entries = realloc(cache->entries, capacity * sizeof(ChunkEntry));
+		if(entries == NULL) return -1;
+		cache->entries = entries;
+		cache->capacity = capacity;
+	}
+	for(; cache->num_entries < n; cache->num_entries++) {
+		cache->entries[cache->num_entries].first_block = -1;
+		cache->entries[cache->num_entries].bytes = 0;
+		cache->entries[cache->num_entries].compressed = 0;
+	}
+	return 0;
+}
 
-	// Aggiorno la posizione del cursore, in modo che si trovi nel punto in cui si finisce di scrivere la stringa
-	f->pos_in_file = (int) (f->pos_in_file + strlen(data));
+// Si assicura che la lista dei blocchi dell'indice (ChunkIndexBlock o ExtentBlock) di un file, che ne contiene "num_index_blocks",
+// abbia posto per "needed" blocchi
+// Grows the list of the index blocks of a file to needed entries
+static int SimpleFS_growIndexBlocks(int** index_blocks, int num_index_blocks, int needed) {
+	if(needed <= num_index_blocks) return 0;
+	int * grown = realloc(*index_blocks, needed * sizeof(int));
+	if(grown == NULL) return -1;
+	*index_blocks = grown;
+	return 0;
+}
 
-	// Se la posizione finale del cursore rientra nel blocco attuale
-	if(size + pos < sizeof(f->fcb->data)) {
-		
-		// Copio tutta la stringa all'interno di questo blocco, partendo da "pos"
-		memcpy(f->fcb->data+pos, data, strlen(data));
-		DiskDriver_writeBlock(f->sfs->disk, f->fcb, f->fcb->fcb.block_in_disk);
-		written_bytes = strlen(data);
-		written_blocks++;
+// Numero di ChunkIndexBlock che servono ad un indice di "num_entries" chunk, oltre alle entry del primo blocco
+// Number of ChunkIndexBlocks needed by num_entries chunks
+static inline int SimpleFS_chunkIndexBlocks(int num_entries) {
+	int per_first = sizeof(((FirstCompressedBlock *) 0)->chunks) / sizeof(ChunkEntry), per_block = sizeof(((ChunkIndexBlock *) 0)->chunks) / sizeof(ChunkEntry);
+	return num_entries > per_first ? (num_entries - per_first + per_block - 1) / per_block : 0;
+}
 
-	}else{
+// Legge l'indice dei chunk del file (dal primo blocco e dai ChunkIndexBlock), se il FileHandle non lo ha già
+// Loads the chunk index of a compressed file in the handle
+static ChunkCache* SimpleFS_loadChunks(FileHandle* f) {
+	if(f->chunks != NULL) return f->chunks;
+	ChunkCache * cache = calloc(1, sizeof(ChunkCache));
+	if(cache == NULL) return NULL;
+	cache->cached = -1;
+	f->chunks = cache;
+
+	// Le prime entry sono nel primo blocco del file (la copia del FileHandle è sempre aggiornata)
+	int num_chunks = SimpleFS_numChunks(f->fcb->fcb.size_in_bytes), per_first = sizeof(((FirstCompressedBlock *) 0)->chunks) / sizeof(ChunkEntry);
+	int per_block = sizeof(((ChunkIndexBlock *) 0)->chunks) / sizeof(ChunkEntry), capacity = 0, i;
+	if(SimpleFS_growChunks(cache, num_chunks) == -1) {
+		SimpleFS_freeChunks(f);
+		return NULL;
+	}
+	const FirstCompressedBlock * first = (const FirstCompressedBlock *) f->fcb;
+	for(i = 0; i < num_chunks && i < per_first; i++) cache->entries[i] = first->chunks[i];
 
-		// Inizializzo le variabili relative al numero di byte da scrivere e l'indice del blocco corrente
-		int dim = 0, current_block;
+	// Le altre nei ChunkIndexBlock, di cui tengo anche la posizione per poterli riscrivere
+	int next_block = f->fcb->header.next_block;
+	const ChunkIndexBlock * index;
+	while(next_block != -1 && (index = DiskDriver_getBlockPtr(f->sfs->disk, next_block)) != NULL) {
+		if(cache->num_index_blocks == capacity) {
+			capacity = 2 * capacity + 4;
+			int * index_blocks = realloc(cache->index_blocks, capacity * sizeof(int));
+			if(index_blocks == NULL) {
+				DiskDriver_releaseBlockPtr(f->sfs->disk, next_block);
+				SimpleFS_freeChunks(f);
+				return NULL;
+			}
+			cache->index_blocks = index_blocks;
+		}
+		int base = per_first + cache->num_index_blocks * per_block;
+		for(i = 0; i < per_block && base + i < num_chunks; i++) cache->entries[base + i] = index->chunks[i];
+		cache->index_blocks[cache->num_index_blocks++] = next_block;
+		int block = next_block;
+		next_block = index->header.next_block;
+		DiskDriver_releaseBlockPtr(f->sfs->disk, block);
+	}
+	return cache;
+}
 
-		// Faccio una copia della stringa da scrivere, in modo da poterla modificare senza compromettere la variabile all'esterno
-		char * copy = malloc(strlen(data));
-		strcpy(copy, data);
+// Porta in cache->data il contenuto del chunk "chunk", seguito da zeri fino a SIMPLEFS_CHUNK_SIZE. I suoi blocchi vengono letti
+// dalla mmap (o dalla cache) e, se non è una lettura casuale, vengono anticipati i blocchi del chunk successivo
+// Decompresses a chunk in the cache of the handle
+static int SimpleFS_readChunk(FileHandle* f, int chunk) {
+	ChunkCache * cache = f->chunks;
+	if(cache->cached == chunk) return 0;
+	cache->cached = -1;
+	ChunkEntry entry = cache->entries[chunk];
+	int len = 0, i;
+	if(entry.first_block != -1) {
+		if(f->advice != SIMPLEFS_ADVISE_RANDOM && chunk + 1 < cache->num_entries && cache->entries[chunk + 1].first_block != -1) {
+			DiskDriver_advise(f->sfs->disk, cache->entries[chunk + 1].first_block, SimpleFS_chunkBlocks(cache->entries[chunk + 1].bytes), DISK_ADVISE_WILLNEED);
+		}
 
-		// Memorizzo gli indici del blocco precedente, successivo e dell'indice precedente
-		int previous_block = f->fcb->fcb.block_in_disk;
-		int next_block = f->fcb->header.next_block;
-		int previous_index = f->fcb->header.block_in_file;
+		// Copio i byte del chunk dai suoi blocchi (direttamente nei dati, se non è compresso)
+		char * dest = entry.compressed ? cache->compressed : cache->data;
+		for(i = 0; i < SimpleFS_chunkBlocks(entry.bytes); i++) {
+			const char * block = DiskDriver_getBlockPtr(f->sfs->disk, entry.first_block + i);
+			if(block == NULL) return -1;
+			memcpy(dest + i * BLOCK_SIZE, block, entry.bytes - i * BLOCK_SIZE < BLOCK_SIZE ? entry.bytes - i * BLOCK_SIZE : BLOCK_SIZE);
+			DiskDriver_releaseBlockPtr(f->sfs->disk, entry.first_block + i);
+		}
+		len = entry.bytes;
+		if(entry.compressed) len = LZ_decompress(cache->compressed, entry.bytes, cache->data, SIMPLEFS_CHUNK_SIZE);
+		if(len == -1) return -1;
+	}
+	memset(cache->data + len, 0, SIMPLEFS_CHUNK_SIZE - len);
+	cache->cached = chunk;
+	return 0;
+}
 
-		FileBlock * file = malloc(sizeof(FileBlock));
+// Scrive nella transazione "tx" i blocchi dell'indice che contengono le entry da "first_entry" in poi, riservando i ChunkIndexBlock
+// che mancano (la loro lista è già stata allungata da SimpleFS_growIndexBlocks); le entry del primo blocco vengono solo copiate
+// nel FileHandle, che lo scriverà. Restituisce -1 se manca un blocco o se un blocco non entra nella transazione
+// Stores the chunk index from first_entry on
+static int SimpleFS_storeChunks(FileHandle* f, JournalTx* tx, int first_entry) {
+	ChunkCache * cache = f->chunks;
+	FirstCompressedBlock * first = (FirstCompressedBlock *) f->fcb;
+	int per_first = sizeof(first->chunks) / sizeof(ChunkEntry), per_block = sizeof(((ChunkIndexBlock *) 0)->chunks) / sizeof(ChunkEntry), ret = 0, i;
+	for(i = first_entry; i < cache->num_entries && i < per_first; i++) first->chunks[i] = cache->entries[i];
+
+	// Riservo i ChunkIndexBlock che mancano: anche l'ultimo già esistente va riscritto, per collegarlo al nuovo
+	int needed = SimpleFS_chunkIndexBlocks(cache->num_entries);
+	int from = first_entry > per_first ? (first_entry - per_first) / per_block : 0;
+	if(needed > cache->num_index_blocks) {
+		if(cache->num_index_blocks > 0 && cache->num_index_blocks - 1 < from) from = cache->num_index_blocks - 1;
+		while(cache->num_index_blocks < needed) {
+			int block = DiskDriver_allocBlock(f->sfs->disk, &f->cursor);
+			if(block == -1) {
+				ret = -1;
+				break;
+			}
+			cache->index_blocks[cache->num_index_blocks++] = block;
+		}
+	}
+	f->fcb->header.next_block = cache->num_index_blocks > 0 ? cache->index_blocks[0] : -1;
+
+	ChunkIndexBlock index;
+	for(i = from; i < cache->num_index_blocks; i++) {
+		int j, base = per_first + i * per_block;
+		index.header.previous_block = i > 0 ? cache->index_blocks[i - 1] : f->fcb->fcb.block_in_disk;
+		index.header.next_block = i + 1 < cache->num_index_blocks ? cache->index_blocks[i + 1] : -1;
+		index.header.block_in_file = i + 1;
+		for(j = 0; j < per_block; j++) {
+			if(base + j < cache->num_entries) {
+				index.chunks[j] = cache->entries[base + j];
+			}else{
+				index.chunks[j].first_block = -1;
+				index.chunks[j].bytes = index.chunks[j].compressed = 0;
+			}
+		}
+		if(SimpleFS_writeBlock(f->sfs, tx, &index, cache->index_blocks[i]) == -1) ret = -1;
+	}
+	return ret;
+}
 
-		// Se devo iniziare a scrivere da una posizione che non rientra in questo blocco
-		if(pos > sizeof(f->fcb->data)) {
+// Annulla una scrittura del file compresso non riuscita: libera i blocchi dei chunk nuovi, rilegge dal disco il primo blocco e scarta
+// l'indice in memoria, che verrà riletto, riportando la posizione corrente a "pos"
+// Rolls back a failed write in a compressed file
+static void SimpleFS_discardChunks(FileHandle* f, int64_t pos, int* new_blocks, int num_new) {
+	if(num_new > 0) DiskDriver_freeBlocks(f->sfs->disk, new_blocks, num_new);
+	DiskDriver_readBlock(f->sfs->disk, f->fcb, f->fcb->fcb.block_in_disk);
+	SimpleFS_freeChunks(f);
+	f->pos_in_file = pos;
+}
 
-			// Decremento la posizione da cui iniziare a scrivere, in base alla dimensione del blocco che sto saltando
-			pos = pos - sizeof(f->fcb->data);
+// Scrive "size" byte di "data" nel file compresso dalla posizione corrente. Ogni chunk toccato viene decompresso (se la scrittura non lo
+// copre tutto), modificato, compresso e scritto in nuovi blocchi consecutivi, vicini a quelli del chunk precedente; se non si comprime,
+// viene scritto così com'è. L'indice e il primo blocco vengono scritti con una transazione del journal, e solo dopo il commit vengono
+// liberati i blocchi che contenevano i chunk sostituiti: un crash lascia il vecchio contenuto o il nuovo. Se un blocco non viene scritto
+// o la transazione non riesce, il file resta com'era e vengono liberati invece i blocchi dei chunk nuovi.
+// Se il disco ha la tabella di deduplicazione, un chunk intero già presente viene condiviso invece di essere scritto, e quelli scritti
+// vengono registrati subito, così vengono condivisi anche i chunk uguali della stessa scrittura
+// Writes in a compressed file, replacing the chunks it touches
+static int SimpleFS_writeCompressed(FileHandle* f, const char* data, int size) {
+	ChunkCache * cache = SimpleFS_loadChunks(f);
+	if(cache == NULL) return -1;
+	if(size == 0) return 0;
+	int64_t pos = f->pos_in_file, file_size = f->fcb->fcb.size_in_bytes;
+	int first = pos / SIMPLEFS_CHUNK_SIZE, last = (pos + size - 1) / SIMPLEFS_CHUNK_SIZE, written = 0, in_flight = 0, failed = 0, chunk, i;
+
+	// Preparo la memoria prima di scrivere qualcosa: i blocchi dei chunk sostituiti, da liberare dopo il commit, quelli dei chunk nuovi,
+	// da liberare se il commit non riesce, e la lista dei ChunkIndexBlock
+	int max_blocks = (last - first + 1) * (SIMPLEFS_CHUNK_SIZE / BLOCK_SIZE + 1), num_old = 0, num_new = 0;
+	int * old_blocks = malloc((size_t) 2 * max_blocks * sizeof(int)), * new_blocks = old_blocks + max_blocks;
+	if(old_blocks == NULL) return -1;
+	if(SimpleFS_growChunks(cache, last + 1) == -1
+		|| SimpleFS_growIndexBlocks(&cache->index_blocks, cache->num_index_blocks, SimpleFS_chunkIndexBlocks(cache->num_entries)) == -1) {
+		free(old_blocks);
+		return -1;
+	}
+	char block[BLOCK_SIZE];
+	for(chunk = first; chunk <= last; chunk++) {
+		int64_t chunk_start = (int64_t) chunk * SIMPLEFS_CHUNK_SIZE;
+		int old_len = file_size - chunk_start > SIMPLEFS_CHUNK_SIZE ? SIMPLEFS_CHUNK_SIZE : file_size > chunk_start ? file_size - chunk_start : 0;
+		int offset = pos + written - chunk_start;
+		int n = size - written < SIMPLEFS_CHUNK_SIZE - offset ? size - written : SIMPLEFS_CHUNK_SIZE - offset;
+		int new_len = offset + n > old_len ? offset + n : old_len;
+
+		// Il vecchio contenuto serve solo se la scrittura non copre tutto il chunk
+		if(offset > 0 || offset + n < old_len) {
+			if(SimpleFS_readChunk(f, chunk) == -1) break;
+		}
+		memcpy(cache->data + offset, data + written, n);
+		memset(cache->data + new_len, 0, SIMPLEFS_CHUNK_SIZE - new_len);
+		cache->cached = chunk;
+
+		// Comprimo il chunk: se non diventa più piccolo lo scrivo così com'è
+		int bytes = LZ_compress(cache->data, new_len, cache->compressed, new_len - 1), compressed = bytes != -1;
+		char * stored = compressed ? cache->compressed : cache->data;
+		if(!compressed) bytes = new_len;
+		int num_blocks = SimpleFS_chunkBlocks(bytes), start = -1;
+
+		// Un chunk intero può essere condiviso: l'impronta (CRC32C dei byte scritti, con la loro lunghezza e il tipo di chunk)
+		// trova i candidati, e la tabella confronta i blocchi completi, con gli zeri che seguono i byte del chunk
+		uint64_t fingerprint = 0;
+		if(f->sfs->disk->dedup != NULL && new_len == SIMPLEFS_CHUNK_SIZE) {
+			memset(stored + bytes, 0, num_blocks * BLOCK_SIZE - bytes);
+			fingerprint = CRC32C_update(0, stored, bytes) | (uint64_t) bytes << 32 | (uint64_t) compressed << 48;
+			start = DiskDriver_dedupLookup(f->sfs->disk, fingerprint, stored, num_blocks);
+		}
 
-			// Se esiste un blocco successivo
-			if(next_block != -1) {
+		// Altrimenti riservo i blocchi del chunk subito dopo quelli del chunk precedente (o del primo blocco del file)
+		if(start == -1) {
+			int hint = f->fcb->fcb.block_in_disk + 1;
+			if(chunk > 0 && cache->entries[chunk - 1].first_block != -1) {
+				hint = cache->entries[chunk - 1].first_block + SimpleFS_chunkBlocks(cache->entries[chunk - 1].bytes);
+			}
+			start = DiskDriver_allocRun(f->sfs->disk, num_blocks, hint);
+			if(start == -1) {
+				cache->cached = -1;
+				break;
+			}
+			for(i = 0; i < num_blocks; i++) {
+				int len = bytes - i * BLOCK_SIZE < BLOCK_SIZE ? bytes - i * BLOCK_SIZE : BLOCK_SIZE;
+				memcpy(block, stored + i * BLOCK_SIZE, len);
+				memset(block + len, 0, BLOCK_SIZE - len);
+				if(SimpleFS_queueWrite(f->sfs, block, start + i, &in_flight) == -1) failed = 1;
+			}
+			if(fingerprint != 0) DiskDriver_dedupInsert(f->sfs->disk, fingerprint, start, num_blocks);
+		}
 
-				// Finché esiste un blocco successivo e la posizione da cui iniziare è maggiore della dimensione del blocco attuale
-				while(next_block != -1 && pos > sizeof(file->data)) {
-					DiskDriver_readBlock(f->sfs->disk, file, next_block);
+		// Sostituisco il chunk nell'indice
+		ChunkEntry * entry = &cache->entries[chunk];
+		for(i = 0; entry->first_block != -1 && i < SimpleFS_chunkBlocks(entry->bytes); i++) old_blocks[num_old++] = entry->first_block + i;
+		entry->first_block = start;
+		entry->bytes = bytes;
+		entry->compressed = compressed;
+		for(i = 0; i < num_blocks; i++) new_blocks[num_new++] = start + i;
+		written += n;
+	}
+	if(SimpleFS_waitWrites(f->sfs->disk, in_flight) == -1) failed = 1;
+	if(failed) {
+		SimpleFS_discardChunks(f, pos, new_blocks, num_new);
+		free(old_blocks);
+		return -1;
+	}
 
-					// Decremento la posizione da cui iniziare a scrivere della dimensione del blocco attuale
-					pos -= sizeof(file->data);
-					previous_index++;
-					previous_block = next_block;
+	// I chunk non scritti per mancanza di spazio non entrano nel file
+	f->pos_in_file += written;
+	if(f->pos_in_file > file_size) f->fcb->fcb.size_in_bytes = f->pos_in_file;
+	cache->num_entries = SimpleFS_numChunks(f->fcb->fcb.size_in_bytes);
+
+	// Se la scrittura parte oltre la fine del file vanno salvate anche le entry dei chunk in mezzo, che restano vuote
+	int old_chunks = SimpleFS_numChunks(file_size), old_index_blocks = cache->num_index_blocks;
+	JournalTx * tx = SimpleFS_begin(f->sfs);
+	int journaled = tx != NULL, ret = SimpleFS_storeChunks(f, tx, first < old_chunks ? first : old_chunks);
+	if(SimpleFS_writeBlock(f->sfs, tx, f->fcb, f->fcb->fcb.block_in_disk) == -1) ret = -1;
+	if(SimpleFS_finish(f->sfs, tx, ret) == -1) {
+		// Senza journal l'indice è già stato scritto al suo posto: non so quale versione sia sul disco, quindi non libero nulla
+		if(journaled) {
+			if(cache->num_index_blocks > old_index_blocks) {
+				DiskDriver_freeBlocks(f->sfs->disk, cache->index_blocks + old_index_blocks, cache->num_index_blocks - old_index_blocks);
+			}
+			SimpleFS_discardChunks(f, pos, new_blocks, num_new);
+		}
+		free(old_blocks);
+		return -1;
+	}
+	if(num_old > 0) DiskDriver_freeBlocks(f->sfs->disk, old_blocks, num_old);
+	free(old_blocks);
+	return written;
+}
 
-					// Il blocco successivo diventa il next_block del blocco attuale
-					next_block = file->header.next_block;
-				}
+// Legge al massimo "size" byte del file compresso dalla posizione corrente, decomprimendo solo i chunk che li contengono
+// Reads from a compressed file, decompressing only the chunks needed
+static int SimpleFS_readCompressed(FileHandle* f, char* data, int size) {
+	ChunkCache * cache = SimpleFS_loadChunks(f);
+	if(cache == NULL) return -1;
+	memset(data, '\0', size);
+	int64_t pos = f->pos_in_file, end = pos + size < f->fcb->fcb.size_in_bytes ? pos + size : f->fcb->fcb.size_in_bytes;
+	int read = 0;
+	while(pos + read < end) {
+		int64_t current = pos + read;
+		int offset = current % SIMPLEFS_CHUNK_SIZE;
+		if(SimpleFS_readChunk(f, current / SIMPLEFS_CHUNK_SIZE) == -1) break;
+		int n = end - current < SIMPLEFS_CHUNK_SIZE - offset ? end - current : SIMPLEFS_CHUNK_SIZE - offset;
+		memcpy(data + read, cache->data + offset, n);
+		read += n;
+	}
+	f->pos_in_file += read;
+	return read;
+}
 
-			}else{
-				
-				// Se invece non ci sono blocchi successivi,
-				// Finché la posizione da cui iniziare a scrivere è maggiore della dimensione del blocco attuale
-				while(pos > sizeof(file->data)) {
-					next_block = DiskDriver_getFreeBlock(f->sfs->disk, 0);
-					file->header.next_block = -1;
-					file->header.previous_block = previous_block;
-					file->header.block_in_file = previous_index;
-
-					// Decremento la posizione da cui iniziare a scrivere della dimensione del blocco attuale
-					pos -= sizeof(file->data);
-					previous_index++;
-
-					// Il blocco attuale diventa il blocco precedente
-					previous_block = next_block;
-					DiskDriver_writeBlock(f->sfs->disk, file, next_block);
-					next_block = -1;
-				}
+/* File a extent: i dati sono in sequenze di blocchi consecutivi (extent) senza BlockHeader, elencate nel primo blocco del file e nei
+   ExtentBlock collegati dal suo next_block, in ordine di posizione nel file. Il FileHandle tiene gli extent in memoria, quindi il blocco
+   di una posizione qualunque si trova con una ricerca binaria, e i blocchi consecutivi si leggono e si scrivono senza seguire una catena.
+   I blocchi che non sono in nessun extent (buchi) valgono zero */
+
+// Legge gli extent del file che inizia con "first" (dal primo blocco e dagli ExtentBlock)
+// Loads the extents of a file
+static ExtentMap* SimpleFS_loadExtentMap(DiskDriver* disk, const FirstExtentBlock* first) {
+	ExtentMap * map = calloc(1, sizeof(ExtentMap));
+	if(map == NULL) return NULL;
+	int num_extents = first->num_extents > 0 ? first->num_extents : 0, per_first = sizeof(first->extents) / sizeof(Extent);
+	int per_block = sizeof(((ExtentBlock *) 0)->extents) / sizeof(Extent), capacity = 0, i;
+	map->capacity = num_extents > 4 ? num_extents : 4;
+	map->extents = malloc(map->capacity * sizeof(Extent));
+	if(map->extents == NULL) {
+		free(map);
+		return NULL;
+	}
+	for(i = 0; i < num_extents && i < per_first; i++) map->extents[map->num_extents++] = first->extents[i];
+
+	// Gli altri negli ExtentBlock, di cui tengo anche la posizione per poterli riscrivere
+	int next_block = first->header.next_block;
+	const ExtentBlock * index;
+	while(next_block != -1 && map->num_extents < num_extents && (index = DiskDriver_getBlockPtr(disk, next_block)) != NULL) {
+		if(map->num_index_blocks == capacity) {
+			capacity = 2 * capacity + 4;
+			int * index_blocks = realloc(map->index_blocks, capacity * sizeof(int));
+			if(index_blocks == NULL) {
+				DiskDriver_releaseBlockPtr(disk, next_block);
+				SimpleFS_freeExtentMap(map);
+				return NULL;
 			}
+			map->index_blocks = index_blocks;
+		}
+		for(i = 0; i < per_block && map->num_extents < num_extents; i++) map->extents[map->num_extents++] = index->extents[i];
+		map->index_blocks[map->num_index_blocks++] = next_block;
+		int block = next_block;
+		next_block = index->header.next_block;
+		DiskDriver_releaseBlockPtr(disk, block);
+	}
+	map->dirty_from = map->num_extents;
+	return map;
+}
+
+// Extent del FileHandle, letti se non li ha già
+// Loads the extents of the file in the handle
+static ExtentMap* SimpleFS_loadExtents(FileHandle* f) {
+	if(f->extents == NULL) f->extents = SimpleFS_loadExtentMap(f->sfs->disk, (const FirstExtentBlock *) f->fcb);
+	return f->extents;
+}
 
+// Ricerca binaria del primo extent che finisce dopo il blocco "file_block" del file (num_extents se non c'è)
+// Binary search of the first extent ending after file_block
+static int SimpleFS_findExtent(const ExtentMap* map, int file_block) {
+	int low = 0, high = map->num_extents;
+	while(low < high) {
+		int middle = (low + high) / 2;
+		if(map->extents[middle].file_block + map->extents[middle].length <= file_block) {
+			low = middle + 1;
 		}else{
+			high = middle;
+		}
+	}
+	return low;
+}
+
+// Blocco del disco che contiene il blocco "file_block" del file, -1 se è in un buco
+// Returns the disk block of a block of the file (-1 for a hole)
+static int SimpleFS_extentBlock(const ExtentMap* map, int file_block) {
+	int i = SimpleFS_findExtent(map, file_block);
+	if(i == map->num_extents || map->extents[i].file_block > file_block) return -1;
+	return map->extents[i].start + file_block - map->extents[i].file_block;
+}
+
+// Fa puntare i blocchi del file da "file_block" a "file_block + n - 1" ai blocchi del disco da "start" in poi: gli extent che li
+// contenevano vengono tagliati, e il nuovo extent viene unito ai vicini se continua uno di loro sia nel file che sul disco
+// Maps n blocks of the file to n consecutive blocks of the disk
+static int SimpleFS_mapExtent(ExtentMap* map, int file_block, int start, int n) {
+	int i = SimpleFS_findExtent(map, file_block), j = i, end = file_block + n;
+	while(j < map->num_extents && map->extents[j].file_block < end) j++;
+
+	// Le parti degli extent sostituiti che restano prima e dopo i nuovi blocchi
+	Extent pieces[3];
+	int num_pieces = 0, k;
+	if(i < j && map->extents[i].file_block < file_block) {
+		pieces[num_pieces] = map->extents[i];
+		pieces[num_pieces++].length = file_block - map->extents[i].file_block;
+	}
+	pieces[num_pieces].file_block = file_block;
+	pieces[num_pieces].start = start;
+	pieces[num_pieces++].length = n;
+	if(i < j && map->extents[j - 1].file_block + map->extents[j - 1].length > end) {
+		Extent last = map->extents[j - 1];
+		pieces[num_pieces].file_block = end;
+		pieces[num_pieces].start = last.start + end - last.file_block;
+		pieces[num_pieces++].length = last.file_block + last.length - end;
+	}
+
+	// Sostituisco gli extent da i a j - 1 con i pezzi
+	if(map->num_extents - (j - i) + num_pieces > map->capacity) {
+		int capacity = 2 * map->capacity + num_pieces;
+		Extent * extents = realloc(map->extents, capacity * sizeof(Extent));
+		if(extents == NULL) return -1;
+		map->extents = extents;
+		map->capacity = capacity;
+	}
+	memmove(map->extents + i + num_pieces, map->extents + j, (map->num_extents - j) * sizeof(Extent));
+	memcpy(map->extents + i, pieces, num_pieces * sizeof(Extent));
+	map->num_extents += num_pieces - (j - i);
+
+	// Unisco gli extent contigui intorno a quelli cambiati
+	int from = i > 0 ? i - 1 : 0, to = i + num_pieces < map->num_extents ? i + num_pieces : map->num_extents - 1;
+	for(k = to; k > from; k--) {
+		Extent * previous = &map->extents[k - 1], * current = &map->extents[k];
+		if(previous->file_block + previous->length == current->file_block && previous->start + previous->length == current->start) {
+			previous->length += current->length;
+			memmove(current, current + 1, (map->num_extents - k - 1) * sizeof(Extent));
+			map->num_extents--;
+		}
+	}
+	if(from < map->dirty_from) map->dirty_from = from;
+	return 0;
+}
+
+// Numero di ExtentBlock che servono a "num_extents" extent, oltre a quelli del primo blocco
+// Number of ExtentBlocks needed by num_extents extents
+static inline int SimpleFS_extentIndexBlocks(int num_extents) {
+	int per_first = sizeof(((FirstExtentBlock *) 0)->extents) / sizeof(Extent), per_block = sizeof(((ExtentBlock *) 0)->extents) / sizeof(Extent);
+	return num_extents > per_first ? (num_extents - per_first + per_block - 1) / per_block : 0;
+}
+
+// Scrive nella transazione "tx" i blocchi degli extent cambiati, riservando gli ExtentBlock che mancano (la loro lista è già stata
+// allungata da SimpleFS_growIndexBlocks); gli extent del primo blocco vengono solo copiati nel FileHandle, che lo scriverà.
+// Restituisce -1 se manca un blocco o se un blocco non entra nella transazione
+// Stores the extents changed since the last time
+static int SimpleFS_storeExtents(FileHandle* f, JournalTx* tx) {
+	ExtentMap * map = f->extents;
+	FirstExtentBlock * first = (FirstExtentBlock *) f->fcb;
+	int per_first = sizeof(first->extents) / sizeof(Extent), per_block = sizeof(((ExtentBlock *) 0)->extents) / sizeof(Extent), ret = 0, i;
+	first->num_extents = map->num_extents;
+	for(i = map->dirty_from; i < map->num_extents && i < per_first; i++) first->extents[i] = map->extents[i];
+
+	// Riservo gli ExtentBlock che mancano: anche l'ultimo già esistente va riscritto, per collegarlo al nuovo
+	int needed = SimpleFS_extentIndexBlocks(map->num_extents);
+	int from = map->dirty_from > per_first ? (map->dirty_from - per_first) / per_block : 0;
+	if(needed > map->num_index_blocks) {
+		if(map->num_index_blocks > 0 && map->num_index_blocks - 1 < from) from = map->num_index_blocks - 1;
+		while(map->num_index_blocks < needed) {
+			int block = DiskDriver_allocBlock(f->sfs->disk, &f->cursor);
+			if(block == -1) {
+				ret = -1;
+				break;
+			}
+			map->index_blocks[map->num_index_blocks++] = block;
+		}
+	}
+	f->fcb->header.next_block = map->num_index_blocks > 0 ? map->index_blocks[0] : -1;
+
+	ExtentBlock index;
+	for(i = from; i < map->num_index_blocks; i++) {
+		int j, base = per_first + i * per_block;
+		index.header.previous_block = i > 0 ? map->index_blocks[i - 1] : f->fcb->fcb.block_in_disk;
+		index.header.next_block = i + 1 < map->num_index_blocks ? map->index_blocks[i + 1] : -1;
+		index.header.block_in_file = i + 1;
+		for(j = 0; j < per_block; j++) {
+			if(base + j < map->num_extents) {
+				index.extents[j] = map->extents[base + j];
+			}else{
+				index.extents[j].file_block = index.extents[j].start = -1;
+				index.extents[j].length = 0;
+			}
+		}
+		if(SimpleFS_writeBlock(f->sfs, tx, &index, map->index_blocks[i]) == -1) ret = -1;
+	}
+	map->dirty_from = map->num_extents;
+	return ret;
+}
 
-			// Se invece la posizione da cui iniziare a scrivere è minore della dimensione del blocco
-			// Imposto la dimensione della stringa da scrivere come lo spazio totale meno lo sfasamento dato dalla posizione
-			dim = sizeof(f->fcb->data) - pos;
+// Scrive "size" byte di "data" nel file a extent dalla posizione corrente. I blocchi dei buchi, e quelli condivisi con uno snapshot
+// (che non si possono cambiare), vengono sostituiti da blocchi nuovi, riservati a sequenze subito dopo il blocco precedente del file;
+// gli altri vengono sovrascritti al loro posto. I dati vengono scritti in modo asincrono, poi gli extent e il primo blocco con una
+// transazione del journal, e solo dopo il commit vengono rilasciati i blocchi condivisi sostituiti
+// Writes in a file with the extent layout
+static int SimpleFS_writeExtents(FileHandle* f, const char* data, int size) {
+	ExtentMap * map = SimpleFS_loadExtents(f);
+	if(map == NULL) return -1;
+	if(size == 0) return 0;
+	DiskDriver * disk = f->sfs->disk;
+	int64_t pos = f->pos_in_file, file_size = f->fcb->fcb.size_in_bytes;
+	int first = pos / BLOCK_SIZE, last = (pos + size - 1) / BLOCK_SIZE, num_blocks = last - first + 1, num_old = 0, in_flight = 0, failed = 0, i;
+
+	// Per ogni blocco, quello che contiene il vecchio contenuto (-1 per un buco) e quello in cui scriverlo (-1 se va riservato)
+	int * sources = malloc(2 * num_blocks * sizeof(int)), * targets = sources + num_blocks, * old_blocks = malloc(num_blocks * sizeof(int));
+	if(sources == NULL || old_blocks == NULL) {
+		free(sources);
+		free(old_blocks);
+		return -1;
+	}
+	for(i = 0; i < num_blocks; i++) {
+		sources[i] = SimpleFS_extentBlock(map, first + i);
+		targets[i] = sources[i] != -1 && !DiskDriver_inSnapshot(disk, sources[i]) ? sources[i] : -1;
+	}
 
-			// Copio nel blocco attuale i primi "dim" caratteri della striga copiata
-			memcpy(f->fcb->data, copy, dim);
-			DiskDriver_writeBlock(f->sfs->disk, f->fcb, f->fcb->fcb.block_in_disk);
+	// Riservo i blocchi che mancano, a sequenze subito dopo il blocco precedente: se non c'è una sequenza abbastanza lunga provo con una
+	// lunga la metà, e le sequenze successive non sono più lunghe dell'ultima trovata. Se il disco è pieno, la scrittura si ferma prima
+	// del primo blocco che manca
+	int max_run = num_blocks;
+	for(i = 0; i < num_blocks; i++) {
+		if(targets[i] != -1) continue;
+		int n = 1, start, previous = i > 0 ? targets[i - 1] : SimpleFS_extentBlock(map, first - 1);
+		int hint = previous != -1 ? previous + 1 : f->fcb->fcb.block_in_disk + 1;
+		while(i + n < num_blocks && n < max_run && targets[i + n] == -1) n++;
+		while((start = DiskDriver_allocRun(disk, n, hint)) == -1 && n > 1) n /= 2;
+		max_run = n;
+		if(start == -1 || SimpleFS_mapExtent(map, first + i, start, n) == -1) {
+			if(start != -1) DiskDriver_freeRange(disk, start, n);
+			num_blocks = i;
+			break;
+		}
+		int k;
+		for(k = 0; k < n; k++) {
+			targets[i + k] = start + k;
+			if(sources[i + k] != -1) old_blocks[num_old++] = sources[i + k];
+		}
+		i += n - 1;
+	}
 
-			// Incremento il puntatore di "copy" in modo che punti al prossimo carattere da scrivere
-			copy += dim;
-			written_bytes += dim;
-			written_blocks++;
+	// Allungo la lista degli ExtentBlock prima di scrivere i dati. Se manca la memoria libero i blocchi appena riservati e lascio
+	// che gli extent vengano riletti dal disco, dove non è ancora cambiato niente
+	if(SimpleFS_growIndexBlocks(&map->index_blocks, map->num_index_blocks, SimpleFS_extentIndexBlocks(map->num_extents)) == -1) {
+		for(i = 0; i < num_blocks; i++) {
+			if(targets[i] != sources[i]) DiskDriver_freeRange(disk, targets[i], 1);
 		}
+		SimpleFS_freeExtents(f);
+		free(sources);
+		free(old_blocks);
+		return -1;
+	}
 
-		// Se la posizione finale del puntatore è maggiore dello spazio a disposizione, scrivo la dimensione massima meno "pos", 
-		// altrimenti scrivo tutta la stringa rimanente
-		dim = strlen(copy)+pos > sizeof(file->data) ? sizeof(file->data)-pos : strlen(copy);
-
-		// Finché il numero di caratteri da scrivere è diverso da 0
-		while(dim != 0) {
-
-			// Se esiste un blocco successivo
-			if(next_block != -1) {
-				
-				// Leggo il blocco successivo, lo inizializzo con caratteri nulli e scrivo dentro "dim" caratteri, partendo da "pos"
-				current_block = next_block;
-				DiskDriver_readBlock(f->sfs->disk, file, next_block);
-				next_block = file->header.next_block;
-				memset(file->data+pos, '\0', sizeof(file->data)-pos);
-				memcpy(file->data+pos, copy, dim);
-
-				// Sposto il puntatore di "copy" in modo che escluda i caratteri già scritti
-				copy += dim;
-				written_bytes += dim;
-				DiskDriver_writeBlock(f->sfs->disk, file, current_block);
-
-				// Imposto il blocco attuale come blocco precedente
-				previous_block = current_block;
+	// Scrivo i blocchi: un blocco scritto solo in parte parte dal vecchio contenuto, fino alla vecchia fine del file (il resto è zero)
+	char block[BLOCK_SIZE];
+	int written = 0;
+	for(i = 0; i < num_blocks; i++) {
+		int64_t block_start = (int64_t) (first + i) * BLOCK_SIZE;
+		int offset = pos + written - block_start, n = size - written < BLOCK_SIZE - offset ? size - written : BLOCK_SIZE - offset;
+		const char * src = data + written;
+		if(n < BLOCK_SIZE) {
+			int old_len = file_size - block_start > BLOCK_SIZE ? BLOCK_SIZE : file_size > block_start ? file_size - block_start : 0;
+			const char * old = sources[i] != -1 && old_len > 0 ? DiskDriver_getBlockPtr(disk, sources[i]) : NULL;
+			if(old != NULL) {
+				memcpy(block, old, old_len);
+				DiskDriver_releaseBlockPtr(disk, sources[i]);
 			}else{
+				old_len = 0;
+			}
+			memset(block + old_len, 0, BLOCK_SIZE - old_len);
+			memcpy(block + offset, src, n);
+			src = block;
+		}
+		if(SimpleFS_queueWrite(f->sfs, src, targets[i], &in_flight) == -1) failed = 1;
+		written += n;
+	}
+	if(SimpleFS_waitWrites(disk, in_flight) == -1) failed = 1;
+
+	f->pos_in_file += written;
+	if(f->pos_in_file > file_size) f->fcb->fcb.size_in_bytes = f->pos_in_file;
+	int old_index_blocks = map->num_index_blocks;
+	JournalTx * tx = SimpleFS_begin(f->sfs);
+	int journaled = tx != NULL, ret = SimpleFS_storeExtents(f, tx);
+	if(SimpleFS_writeBlock(f->sfs, tx, f->fcb, f->fcb->fcb.block_in_disk) == -1) ret = -1;
+
+	// Se la transazione viene scartata (o il commit non riesce) sul disco ci sono ancora i vecchi extent: libero i blocchi riservati
+	// (per i dati e per gli ExtentBlock) invece di quelli sostituiti, e rileggo il primo blocco e gli extent. Senza journal gli extent
+	// sono già stati scritti al loro posto, quindi non libero nulla
+	if(SimpleFS_finish(f->sfs, tx, ret) == -1) {
+		if(journaled) {
+			for(i = 0; i < num_blocks; i++) {
+				if(targets[i] != sources[i]) DiskDriver_freeRange(disk, targets[i], 1);
+			}
+			if(map->num_index_blocks > old_index_blocks) {
+				DiskDriver_freeBlocks(disk, map->index_blocks + old_index_blocks, map->num_index_blocks - old_index_blocks);
+			}
+			DiskDriver_readBlock(disk, f->fcb, f->fcb->fcb.block_in_disk);
+			SimpleFS_freeExtents(f);
+			f->pos_in_file = pos;
+		}
+		free(sources);
+		free(old_blocks);
+		return -1;
+	}
+	if(num_old > 0) DiskDriver_freeBlocks(disk, old_blocks, num_old);
+	free(sources);
+	free(old_blocks);
+	return failed ? -1 : written;
+}
+
+/* File indicizzati: come negli inode, il primo blocco del file contiene i puntatori ai suoi primi blocchi e agli IndexBlock di primo,
+   secondo e terzo livello, che puntano ai blocchi successivi (o agli IndexBlock del livello sotto). Il blocco di una posizione qualunque
+   si trova leggendo al massimo un IndexBlock per livello, per quanto il file sia grande o sparso sul disco. I blocchi dei dati non hanno
+   BlockHeader, e un puntatore a 0 è un buco (che vale zero). Gli IndexBlock vengono cambiati al loro posto, come i blocchi dei dati */
+
+// Percorso nell'indice del blocco "file_block" del file: restituisce il livello (0 per i puntatori diretti, da 1 a
+// SIMPLEFS_INDIRECT_LEVELS per gli indiretti) e mette in "path" la posizione in ogni blocco attraversato; -1 se il file non arriva lì
+// Finds the path of a block of the file in the index
+static int SimpleFS_indexPath(int64_t file_block, int* path) {
+	int direct = sizeof(((FirstIndexedBlock *) 0)->direct) / sizeof(int), level, i;
+	int64_t span = 1;
+	if(file_block < direct) {
+		path[0] = file_block;
+		return 0;
+	}
+	file_block -= direct;
+	for(level = 1; level <= SIMPLEFS_INDIRECT_LEVELS; level++) {
+		span *= SIMPLEFS_INDEX_POINTERS;
+		if(file_block < span) {
+			for(i = level - 1; i >= 0; i--) {
+				path[i] = file_block % SIMPLEFS_INDEX_POINTERS;
+				file_block /= SIMPLEFS_INDEX_POINTERS;
+			}
+			return level;
+		}
+		file_block -= span;
+	}
+	return -1;
+}
 
-				// Se non esiste un blocco successivo, cerco uno spazio libero in cui memorizzare il blocco successivo
-				current_block = DiskDriver_getFreeBlock(f->sfs->disk, 0);
-				if(previous_index == 0) {
+// Blocco del disco che contiene il blocco "file_block" del file (0 se è un buco), letto dagli IndexBlock senza copiarli
+// Returns the disk block of a block of an indexed file (0 for a hole)
+static int SimpleFS_indexBlock(FileHandle* f, int64_t file_block) {
+	const FirstIndexedBlock * first = (const FirstIndexedBlock *) f->fcb;
+	int path[SIMPLEFS_INDIRECT_LEVELS], level = SimpleFS_indexPath(file_block, path), i;
+	if(level <= 0) return level == 0 ? first->direct[path[0]] : 0;
+	int block = first->indirect[level - 1];
+	for(i = 0; i < level && block > 0; i++) {
+		const IndexBlock * index = DiskDriver_getBlockPtr(f->sfs->disk, block);
+		if(index == NULL) return 0;
+		int next = index->blocks[path[i]];
+		DiskDriver_releaseBlockPtr(f->sfs->disk, block);
+		block = next;
+	}
+	return block > 0 ? block : 0;
+}
 
-					// Se il blocco precedente era un FirstFileBlock, aggiorno il blocco successivo
-					f->fcb->header.next_block = current_block;
-					DiskDriver_writeBlock(f->sfs->disk, f->fcb, f->fcb->fcb.block_in_disk);
-				}else{
+// Aggiunge l'IndexBlock "block" a quelli cambiati da una scrittura, se non è tra gli ultimi aggiunti (un blocco può comparire due volte);
+// restituisce -1 se non c'è memoria per aggiungerlo
+// Records an IndexBlock changed by a write
+static int SimpleFS_indexDirty(int** dirty, int* num_dirty, int* capacity, int block) {
+	int i;
+	for(i = *num_dirty - 1; i >= 0 && i >= *num_dirty - SIMPLEFS_INDIRECT_LEVELS; i--) {
+		if((*dirty)[i] == block) return 0;
+	}
+	if(*num_dirty == *capacity) {
+		int * grown = realloc(*dirty, 2 * *capacity * sizeof(int));
+		if(grown == NULL) return -1;
+		*dirty = grown;
+		*capacity *= 2;
+	}
+	(*dirty)[(*num_dirty)++] = block;
+	return 0;
+}
 
-					// Se il blocco precedente non è il primo della cartella, leggo il blocco precedente e aggiorno l'indice del blocco successivo
-					FileBlock * fb = malloc(sizeof(FileBlock));
-					DiskDriver_readBlock(f->sfs->disk, fb, previous_block);
-					fb->header.next_block = current_block;
-					DiskDriver_writeBlock(f->sfs->disk, fb, previous_block);
-				}
+// Fa puntare il blocco "file_block" del file a "block", riservando (vuoti) gli IndexBlock che mancano; i puntatori del primo blocco
+// vengono cambiati nella copia del FileHandle, che lo scriverà. Ogni IndexBlock viene cambiato in una copia e rimesso al suo posto con
+// DiskDriver_stageBlock, che lo segna come modificato senza sincronizzarlo (così la cache non lo scarta prima che venga scritto, e le
+// ricerche successive lo trovano già cambiato): finisce in "*dirty", e lo scrive chi fa la scrittura, una volta sola.
+// Restituisce -1 se il disco è pieno, 0 altrimenti
+// Points a block of an indexed file to block, adding the IndexBlocks needed
+static int SimpleFS_setIndexBlock(FileHandle* f, int64_t file_block, int block, int** dirty, int* num_dirty, int* capacity) {
+	DiskDriver * disk = f->sfs->disk;
+	FirstIndexedBlock * first = (FirstIndexedBlock *) f->fcb;
+	int path[SIMPLEFS_INDIRECT_LEVELS], level = SimpleFS_indexPath(file_block, path), index_block = -1, i;
+	if(level == -1) return -1;
+	if(level == 0) {
+		first->direct[path[0]] = block;
+		return 0;
+	}
+	int * slot = &first->indirect[level - 1];
+	IndexBlock index;
+	for(i = 0; i < level; i++) {
+		if(*slot <= 0) {
+			IndexBlock empty;
+			memset(&empty, 0, sizeof(IndexBlock));
+			int new_block = DiskDriver_allocBlock(disk, &f->cursor);
+			if(new_block == -1 || DiskDriver_stageBlock(disk, &empty, new_block) == -1) {
+				if(new_block != -1) DiskDriver_freeRange(disk, new_block, 1);
+				return -1;
+			}
+			*slot = new_block;
 
-				// Memorizzo tutte le informazioni del blocco attuale
-				file->header.previous_block = previous_block;
-				next_block = -1;
-				file->header.next_block = next_block;
-				previous_index += 1;
-				file->header.block_in_file = previous_index;
-
-				// Inizializzo il blocco attuale con caratteri nulli e scrivo "dim" caratteri
-				memset(file->data, '\0', sizeof(file->data));
-				memcpy(file->data, copy, dim);
-
-				// Incremento il puntatore di "copy" in modo che si sposti del numero di caratteri scritti
-				copy += dim;
-				written_bytes += dim;
-				DiskDriver_writeBlock(f->sfs->disk, file, current_block);
-				previous_block = current_block;
+			// Il puntatore al nuovo IndexBlock è nel blocco precedente (se non è il primo blocco del file), che rimetto al suo posto
+			if(index_block != -1) {
+				if(DiskDriver_stageBlock(disk, &index, index_block) == -1) return -1;
+				if(SimpleFS_indexDirty(dirty, num_dirty, capacity, index_block) == -1) return -1;
 			}
+			if(SimpleFS_indexDirty(dirty, num_dirty, capacity, new_block) == -1) return -1;
+		}
+		index_block = *slot;
+		if(DiskDriver_readBlock(disk, &index, index_block) == -1) return -1;
+		slot = &index.blocks[path[i]];
+	}
+	*slot = block;
+	if(DiskDriver_stageBlock(disk, &index, index_block) == -1) return -1;
+	return SimpleFS_indexDirty(dirty, num_dirty, capacity, index_block);
+}
+
+// Scrive "size" byte di "data" nel file indicizzato dalla posizione corrente. I buchi, e i blocchi condivisi con uno snapshot, vengono
+// scritti in blocchi nuovi riservati con il cursore del file (vicini ai precedenti), gli altri al loro posto. Gli IndexBlock cambiati
+// vengono scritti alla fine, insieme ai dati; il primo blocco viene scritto dopo con una transazione del journal, e solo dopo il commit
+// vengono rilasciati i blocchi condivisi sostituiti
+// Writes in a file with the indexed layout
+static int SimpleFS_writeIndexed(FileHandle* f, const char* data, int size) {
+	if(size == 0) return 0;
+	DiskDriver * disk = f->sfs->disk;
+	int64_t pos = f->pos_in_file, file_size = f->fcb->fcb.size_in_bytes, first = pos / BLOCK_SIZE;
+	int num_blocks = (pos + size - 1) / BLOCK_SIZE - first + 1, written = 0, num_old = 0, in_flight = 0, num_dirty = 0, capacity = 16, failed = 0, i;
+	int * old_blocks = malloc(num_blocks * sizeof(int)), * dirty = malloc(capacity * sizeof(int));
+	if(old_blocks == NULL || dirty == NULL) {
+		free(old_blocks);
+		free(dirty);
+		return -1;
+	}
+	char block[BLOCK_SIZE];
+	for(i = 0; i < num_blocks; i++) {
+		int64_t block_start = (first + i) * BLOCK_SIZE;
+		int offset = pos + written - block_start, n = size - written < BLOCK_SIZE - offset ? size - written : BLOCK_SIZE - offset;
+		int source = SimpleFS_indexBlock(f, first + i), target = source;
+		if(source == 0 || DiskDriver_inSnapshot(disk, source)) {
+			target = DiskDriver_allocBlock(disk, &f->cursor);
+			if(target == -1) break;
+			if(SimpleFS_setIndexBlock(f, first + i, target, &dirty, &num_dirty, &capacity) == -1) {
+				DiskDriver_freeRange(disk, target, 1);
+				break;
+			}
+			if(source != 0) old_blocks[num_old++] = source;
+		}
+
+		// Un blocco scritto solo in parte parte dal vecchio contenuto, fino alla vecchia fine del file (il resto è zero)
+		const char * src = data + written;
+		if(n < BLOCK_SIZE) {
+			int old_len = file_size - block_start > BLOCK_SIZE ? BLOCK_SIZE : file_size > block_start ? file_size - block_start : 0;
+			const char * old = source != 0 && old_len > 0 ? DiskDriver_getBlockPtr(disk, source) : NULL;
+			if(old != NULL) {
+				memcpy(block, old, old_len);
+				DiskDriver_releaseBlockPtr(disk, source);
+			}else{
+				old_len = 0;
+			}
+			memset(block + old_len, 0, BLOCK_SIZE - old_len);
+			memcpy(block + offset, src, n);
+			src = block;
+		}
+		if(SimpleFS_queueWrite(f->sfs, src, target, &in_flight) == -1) failed = 1;
+		written += n;
+	}
+	for(i = 0; i < num_dirty; i++) {
+		if(DiskDriver_readBlock(disk, block, dirty[i]) == -1 || SimpleFS_queueWrite(f->sfs, block, dirty[i], &in_flight) == -1) failed = 1;
+	}
+	if(SimpleFS_waitWrites(disk, in_flight) == -1) failed = 1;
+
+	f->pos_in_file += written;
+	if(f->pos_in_file > file_size) f->fcb->fcb.size_in_bytes = f->pos_in_file;
+	JournalTx * tx = SimpleFS_begin(f->sfs);
+
+	// I blocchi sostituiti vengono rilasciati solo se il primo blocco è sul disco: altrimenti potrebbe ancora puntare a loro
+	if(SimpleFS_finish(f->sfs, tx, SimpleFS_writeBlock(f->sfs, tx, f->fcb, f->fcb->fcb.block_in_disk)) == -1) failed = 1;
+	else if(num_old > 0) DiskDriver_freeBlocks(disk, old_blocks, num_old);
+	free(old_blocks);
+	free(dirty);
+	return failed ? -1 : written;
+}
+
+// Sceglie come sono memorizzati i dati di un file vuoto: "flags" sostituisce i flag della compressione e del formato
+// Sets the layout flags of an empty file
+static int SimpleFS_setFlags(FileHandle* f, int flags) {
+	if(f->sfs->read_only || f->fcb->fcb.size_in_bytes != 0 || f->fcb->header.next_block != -1) return -1;
+	f->fcb->fcb.flags = (f->fcb->fcb.flags & ~(SIMPLEFS_FILE_COMPRESSED | SIMPLEFS_FILE_EXTENTS | SIMPLEFS_FILE_INDEXED)) | flags;
+
+	// L'area dei dati del primo blocco diventa l'inizio dell'indice dei chunk, degli extent o dei blocchi (o torna a contenere i dati)
+	memset(f->fcb->data, '\0', sizeof(f->fcb->data));
+	SimpleFS_freeChunks(f);
+	SimpleFS_freeExtents(f);
+	JournalTx * tx = SimpleFS_begin(f->sfs);
+	return SimpleFS_finish(f->sfs, tx, SimpleFS_writeBlock(f->sfs, tx, f->fcb, f->fcb->fcb.block_in_disk));
+}
+
+// turns the compression of an empty file on or off
+int SimpleFS_setCompression(FileHandle* f, int compressed) {
+	if(f == NULL) return -1;
+	return SimpleFS_setFlags(f, compressed ? SIMPLEFS_FILE_COMPRESSED : 0);
+}
+
+// chooses the layout of the data of an empty file
+int SimpleFS_setLayout(FileHandle* f, int layout) {
+	if(f == NULL || layout < SIMPLEFS_LAYOUT_CHAINED || layout > SIMPLEFS_LAYOUT_INDEXED) return -1;
+	return SimpleFS_setFlags(f, layout == SIMPLEFS_LAYOUT_EXTENTS ? SIMPLEFS_FILE_EXTENTS : layout == SIMPLEFS_LAYOUT_INDEXED ? SIMPLEFS_FILE_INDEXED : 0);
+}
+
+// Attiva la deduplicazione riservando la tabella (una voce ogni SIMPLEFS_DEDUP_RATIO blocchi del disco), o la disattiva se nessun
+// chunk è condiviso: dopo, i blocchi condivisi verrebbero liberati dal primo file che li lascia
+// turns the deduplication of the disk on or off
+int SimpleFS_setDedup(SimpleFS* fs, int enabled) {
+	if(fs == NULL || fs->read_only) return -1;
+	if(enabled) return DiskDriver_enableDedup(fs->disk, fs->disk->header->num_blocks / SIMPLEFS_DEDUP_RATIO);
+	if(DiskDriver_dedupSaved(fs->disk) > 0) return -1;
+	return DiskDriver_disableDedup(fs->disk);
+}
+
+/* Snapshot: SimpleFS_snapshot copia in blocchi nuovi i metadati del file system (le cartelle, i primi blocchi dei file e gli indici
+   dei chunk), che formano l'albero dello snapshot, e condivide con il file system tutti i blocchi dei dati. I blocchi condivisi non
+   vengono visitati: sono quelli occupati nella bitmap del disco (DiskDriver_usedBlocks), tranne i metadati copiati. Il DiskDriver congela
+   i blocchi dello snapshot: i metadati del file system continuano a essere scritti al loro posto (non sono condivisi), i chunk dei
+   file compressi vengono sempre scritti in blocchi nuovi, un blocco condiviso di un file a extent viene sostituito quando viene scritto,
+   e la catena di un file non compresso viene copiata prima di essere cambiata */
+
+// Blocchi dello snapshot che si sta creando: quelli condivisi con il file system (all'inizio tutti quelli occupati, da cui vengono
+// tolti i metadati man mano che vengono copiati) e le copie scritte per lo snapshot
+typedef struct {
+	SimpleFS* fs;
+	BitMap shared;
+	BitMap copies;
+	int in_flight;
+} SimpleFSSnapshot;
+
+// Coppia (blocco originale, copia), per sostituire le entry di una cartella
+typedef struct {
+	int block;
+	int copy;
+} SimpleFSSnapshotEntry;
+
+static int SimpleFS_compareSnapshotEntries(const void* a, const void* b) {
+	int x = ((const SimpleFSSnapshotEntry *) a)->block, y = ((const SimpleFSSnapshotEntry *) b)->block;
+	return x < y ? -1 : x > y;
+}
+
+// Sostituisce con le loro copie le "n" entry di "entries" che compaiono in "map" (ordinata per blocco originale); le altre
+// vengono svuotate, perché i loro blocchi potrebbero essere riusati dal file system
+// Replaces the entries of a directory block with the blocks of their copies
+static void SimpleFS_snapshotEntries(int* entries, int n, const SimpleFSSnapshotEntry* map, int map_size) {
+	int i;
+	for(i = 0; i < n; i++) {
+		SimpleFSSnapshotEntry key = { entries[i], -1 };
+		const SimpleFSSnapshotEntry * found = entries[i] > 0 ? bsearch(&key, map, map_size, sizeof(key), SimpleFS_compareSnapshotEntries) : NULL;
+		if(entries[i] > 0) entries[i] = found != NULL ? found->copy : 0;
+	}
+}
+
+// Riserva "n" blocchi per le copie dello snapshot (non per forza consecutivi); restituisce -1 se il disco è pieno
+// Reserves n blocks for the copies of the snapshot
+static int SimpleFS_snapshotBlocks(SimpleFSSnapshot* snapshot, int* blocks, int n) {
+	int i;
+	for(i = 0; i < n; i++) {
+		blocks[i] = DiskDriver_allocBlock(snapshot->fs->disk, NULL);
+		if(blocks[i] == -1) return -1;
+		BitMap_set(&snapshot->copies, blocks[i], 1);
+	}
+	return 0;
+}
+
+// Raccoglie i blocchi della catena che inizia da "first_block", seguendo i next_block; restituisce il loro numero
+// Collects the blocks of a chain
+static int SimpleFS_collectChain(DiskDriver* disk, int first_block, int** blocks) {
+	int num_blocks = 0, capacity = 16, block = first_block;
+	*blocks = malloc(capacity * sizeof(int));
+	const BlockHeader * header;
+	while(block != -1 && (header = DiskDriver_getBlockPtr(disk, block)) != NULL) {
+		if(num_blocks == capacity) {
+			capacity *= 2;
+			*blocks = realloc(*blocks, capacity * sizeof(int));
+		}
+		(*blocks)[num_blocks++] = block;
+		int next_block = header->next_block;
+		DiskDriver_releaseBlockPtr(disk, block);
+		block = next_block;
+	}
+	return num_blocks;
+}
+
+static int SimpleFS_snapshotNode(SimpleFSSnapshot* snapshot, int block, int parent);
+
+// Copia i blocchi successivi della cartella "first" (che era nel blocco "block"), la cui copia è "copy": prima vengono copiati tutti
+// i file e le cartelle contenuti, poi le entry del primo blocco e dei DirectoryBlock (copiati anche loro) vengono fatte puntare alle
+// copie. Un'entry che non punta al primo blocco di un file di questa cartella (un file cancellato) viene ignorata
+// Copies the contents of a directory for the snapshot
+static int SimpleFS_snapshotDir(SimpleFSSnapshot* snapshot, FirstDirectoryBlock* first, int block, int copy) {
+	DiskDriver * disk = snapshot->fs->disk;
+	int n = first->num_entries > 0 ? first->num_entries : 0, map_size = 0, ret = 0, i;
+	SimpleFSSnapshotEntry * map = malloc((n > 0 ? n : 1) * sizeof(SimpleFSSnapshotEntry));
+	for(i = 0; i < n && ret == 0; i++) {
+		int child = SimpleFS_dirEntry(disk, first, i);
+		const FirstFileBlock * child_block = child > 0 ? DiskDriver_getBlockPtr(disk, child) : NULL;
+		if(child_block == NULL) continue;
+		int valid = child_block->fcb.block_in_disk == child && child_block->fcb.directory_block == block;
+		DiskDriver_releaseBlockPtr(disk, child);
+		if(!valid) continue;
+		map[map_size].block = child;
+		map[map_size].copy = SimpleFS_snapshotNode(snapshot, child, copy);
+		if(map[map_size++].copy == -1) ret = -1;
+	}
+	qsort(map, map_size, sizeof(SimpleFSSnapshotEntry), SimpleFS_compareSnapshotEntries);
+	SimpleFS_snapshotEntries(first->file_blocks, sizeof(first->file_blocks) / sizeof(int), map, map_size);
+
+	// Copio la catena dei DirectoryBlock, collegando le copie tra loro
+	int * blocks, num_blocks = SimpleFS_collectChain(disk, first->header.next_block, &blocks);
+	int * copies = malloc((num_blocks > 0 ? num_blocks : 1) * sizeof(int));
+	if(ret == 0) ret = SimpleFS_snapshotBlocks(snapshot, copies, num_blocks);
+	DirectoryBlock db;
+	for(i = 0; i < num_blocks && ret == 0; i++) {
+		if(DiskDriver_readBlock(disk, &db, blocks[i]) == -1) {
+			ret = -1;
+			break;
+		}
+		BitMap_set(&snapshot->shared, blocks[i], 0);
+		db.header.previous_block = i > 0 ? copies[i - 1] : copy;
+		db.header.next_block = i + 1 < num_blocks ? copies[i + 1] : -1;
+		SimpleFS_snapshotEntries(db.file_blocks, sizeof(db.file_blocks) / sizeof(int), map, map_size);
+		ret = SimpleFS_queueWrite(snapshot->fs, &db, copies[i], &snapshot->in_flight);
+	}
+	first->header.next_block = num_blocks > 0 ? copies[0] : -1;
+	free(map);
+	free(blocks);
+	free(copies);
+	return ret;
+}
+
+// Copia i blocchi dell'indice (ChunkIndexBlock o ExtentBlock) collegati dal primo blocco "first" del file, la cui copia è "copy",
+// collegando le copie tra loro
+// Copies the index blocks of a compressed or extent file for the snapshot
+static int SimpleFS_snapshotIndex(SimpleFSSnapshot* snapshot, FirstFileBlock* first, int copy) {
+	int * blocks, num_blocks = SimpleFS_collectChain(snapshot->fs->disk, first->header.next_block, &blocks), ret, i;
+	int * copies = malloc((num_blocks > 0 ? num_blocks : 1) * sizeof(int));
+	ret = SimpleFS_snapshotBlocks(snapshot, copies, num_blocks);
+	char block[BLOCK_SIZE];
+	for(i = 0; i < num_blocks && ret == 0; i++) {
+		if(DiskDriver_readBlock(snapshot->fs->disk, block, blocks[i]) == -1) {
+			ret = -1;
+			break;
+		}
+		BitMap_set(&snapshot->shared, blocks[i], 0);
+		((BlockHeader *) block)->previous_block = i > 0 ? copies[i - 1] : copy;
+		((BlockHeader *) block)->next_block = i + 1 < num_blocks ? copies[i + 1] : -1;
+		ret = SimpleFS_queueWrite(snapshot->fs, block, copies[i], &snapshot->in_flight);
+	}
+	first->header.next_block = num_blocks > 0 ? copies[0] : -1;
+	free(blocks);
+	free(copies);
+	return ret;
+}
+
+// Copia l'IndexBlock "block" di livello "level" (1 se punta ai dati) e quelli sotto di lui, facendo puntare ogni copia alle copie del
+// livello sotto (i blocchi dei dati restano condivisi). Restituisce la copia, -1 se non è possibile
+// Copies a subtree of the index of an indexed file for the snapshot
+static int SimpleFS_snapshotIndexTree(SimpleFSSnapshot* snapshot, int block, int level) {
+	IndexBlock index;
+	int copy, i;
+	if(DiskDriver_readBlock(snapshot->fs->disk, &index, block) == -1 || SimpleFS_snapshotBlocks(snapshot, &copy, 1) == -1) return -1;
+	BitMap_set(&snapshot->shared, block, 0);
+	for(i = 0; i < SIMPLEFS_INDEX_POINTERS && level > 1; i++) {
+		if(index.blocks[i] > 0 && (index.blocks[i] = SimpleFS_snapshotIndexTree(snapshot, index.blocks[i], level - 1)) == -1) return -1;
+	}
+	return SimpleFS_queueWrite(snapshot->fs, &index, copy, &snapshot->in_flight) == -1 ? -1 : copy;
+}
+
+// Copia gli IndexBlock del file indicizzato "first"
+// Copies the IndexBlocks of an indexed file
+static int SimpleFS_snapshotIndexed(SimpleFSSnapshot* snapshot, FirstIndexedBlock* first) {
+	int i;
+	for(i = 0; i < SIMPLEFS_INDIRECT_LEVELS; i++) {
+		if(first->indirect[i] > 0 && (first->indirect[i] = SimpleFS_snapshotIndexTree(snapshot, first->indirect[i], i + 1)) == -1) return -1;
+	}
+	return 0;
+}
+
+// Copia nello snapshot il file o la cartella che inizia da "block", contenuto nella cartella "parent" dello snapshot (-1 per la radice).
+// Dei file vengono copiati solo il primo blocco e l'indice: i dati vengono condivisi. Restituisce il primo blocco della copia
+// Copies a file or a directory for the snapshot, returns the block of the copy (-1 on error)
+static int SimpleFS_snapshotNode(SimpleFSSnapshot* snapshot, int block, int parent) {
+	DiskDriver * disk = snapshot->fs->disk;
+	FirstDirectoryBlock first;
+	int copy, ret = 0;
+	if(DiskDriver_readBlock(disk, &first, block) == -1 || SimpleFS_snapshotBlocks(snapshot, &copy, 1) == -1) return -1;
+	BitMap_set(&snapshot->shared, block, 0);
+	first.fcb.block_in_disk = copy;
+	first.fcb.directory_block = parent;
+
+	// La catena di un file non compresso contiene solo dati, e non viene neanche letta
+	if(first.fcb.is_dir) {
+		ret = SimpleFS_snapshotDir(snapshot, &first, block, copy);
+	}else if(first.fcb.flags & (SIMPLEFS_FILE_COMPRESSED | SIMPLEFS_FILE_EXTENTS)) {
+		ret = SimpleFS_snapshotIndex(snapshot, (FirstFileBlock *) &first, copy);
+	}else if(first.fcb.flags & SIMPLEFS_FILE_INDEXED) {
+		ret = SimpleFS_snapshotIndexed(snapshot, (FirstIndexedBlock *) &first);
+	}
+	if(SimpleFS_queueWrite(snapshot->fs, &first, copy, &snapshot->in_flight) == -1) ret = -1;
+	return ret == -1 ? -1 : copy;
+}
+
+// Copia l'albero dei metadati a partire dalla radice, aspetta che le copie siano scritte e registra lo snapshot nel DiskDriver, che
+// congela i blocchi condivisi e le copie. I blocchi occupati vengono presi prima di riservare le copie, che quindi non sono condivise.
+// Se non è possibile, le copie già riservate vengono liberate
+// takes a snapshot of the whole file system
+int SimpleFS_snapshot(SimpleFS* fs, const char* name) {
+	if(fs == NULL || fs->read_only || name == NULL || DiskDriver_findSnapshot(fs->disk, name) != -1) return -1;
+	int num_blocks = fs->disk->header->num_blocks, bytes = (num_blocks + 7) / 8, ret = -1, i;
+	SimpleFSSnapshot snapshot = { fs, { num_blocks, calloc(bytes, 1), NULL }, { num_blocks, calloc(bytes, 1), NULL }, 0 };
+	if(snapshot.shared.entries != NULL && snapshot.copies.entries != NULL && DiskDriver_usedBlocks(fs->disk, &snapshot.shared) == 0) {
+		int root = SimpleFS_snapshotNode(&snapshot, 0, -1);
+		if(SimpleFS_waitWrites(fs->disk, snapshot.in_flight) == -1) root = -1;
+		if(root != -1) ret = DiskDriver_snapshot(fs->disk, name, root, &snapshot.shared, &snapshot.copies);
+	}
+	if(ret == -1 && snapshot.copies.entries != NULL) {
+		for(i = 0; (i = BitMap_get(&snapshot.copies, i, 1)) != -1; i++) DiskDriver_freeBlock(fs->disk, i);
+	}
+	free(snapshot.shared.entries);
+	free(snapshot.copies.entries);
+	return ret;
+}
+
+// Monta lo snapshot in sola lettura: il SimpleFS usa lo stesso disco, senza journal, e la sua radice è la copia della radice
+// mounts a snapshot read only
+DirectoryHandle* SimpleFS_mountSnapshot(SimpleFS* fs, DiskDriver* disk, const char* name) {
+	if(fs == NULL || disk == NULL) return NULL;
+	int root = DiskDriver_findSnapshot(disk, name);
+	if(root == -1) return NULL;
+	fs->disk = disk;
+	fs->journal = NULL;
+	fs->read_only = 1;
+	fs->snapshot = 1;
+
+	DirectoryHandle * directory_handle = malloc(sizeof(DirectoryHandle));
+	FirstDirectoryBlock * first_directory_block = malloc(sizeof(FirstDirectoryBlock));
+	DiskDriver_readBlock(disk, first_directory_block, root);
+	directory_handle->sfs = fs;
+	directory_handle->names = NULL;
+	directory_handle->dcb = first_directory_block;
+	directory_handle->directory = NULL;
+	directory_handle->current_block = &(directory_handle->dcb->header);
+	directory_handle->pos_in_dir = 0;
+	directory_handle->pos_in_block = first_directory_block->fcb.block_in_disk;
+	return directory_handle;
+}
+
+// deletes a snapshot
+int SimpleFS_deleteSnapshot(SimpleFS* fs, const char* name) {
+	if(fs == NULL || fs->read_only) return -1;
+	return DiskDriver_deleteSnapshot(fs->disk, name);
+}
+
+// Prima di cambiare un file non compresso la cui catena è condivisa con uno snapshot, la copia tutta in nuovi blocchi: ogni blocco
+// contiene il collegamento al precedente e al successivo, quindi non si può copiare solo il blocco che cambia. I nuovi blocchi
+// vengono scritti prima del primo blocco del file (con una transazione), e solo dopo i vecchi vengono rilasciati
+// Copies the chain of a file shared with a snapshot before it is changed
+static int SimpleFS_unshareChain(FileHandle* f) {
+	DiskDriver * disk = f->sfs->disk;
+	int * blocks, num_blocks = SimpleFS_collectChain(disk, f->fcb->header.next_block, &blocks), in_flight = 0, i;
+	if(num_blocks == 0) {
+		free(blocks);
+		return -1;
+	}
+	int * copies = malloc(num_blocks * sizeof(int));
+	int start = DiskDriver_allocRun(disk, num_blocks, f->fcb->fcb.block_in_disk + 1);
+	for(i = 0; i < num_blocks; i++) {
+		copies[i] = start != -1 ? start + i : DiskDriver_allocBlock(disk, &f->cursor);
+		if(copies[i] == -1) break;
+	}
+	if(i < num_blocks) {
+		DiskDriver_freeBlocks(disk, copies, i);
+		free(blocks);
+		free(copies);
+		return -1;
+	}
+
+	// Se una copia non viene scritta, il file resta sulla vecchia catena e le copie vengono liberate
+	FileBlock file;
+	int failed = 0;
+	for(i = 0; i < num_blocks; i++) {
+		if(DiskDriver_readBlock(disk, &file, blocks[i]) == -1) failed = 1;
+		file.header.previous_block = i > 0 ? copies[i - 1] : f->fcb->fcb.block_in_disk;
+		file.header.next_block = i + 1 < num_blocks ? copies[i + 1] : -1;
+		if(SimpleFS_queueWrite(f->sfs, &file, copies[i], &in_flight) == -1) failed = 1;
+	}
+	if(SimpleFS_waitWrites(disk, in_flight) == -1 || failed) {
+		DiskDriver_freeBlocks(disk, copies, num_blocks);
+		free(blocks);
+		free(copies);
+		return -1;
+	}
+	if(start != -1) DiskDriver_initCursor(disk, &f->cursor, start + num_blocks);
+
+	f->fcb->header.next_block = copies[0];
+	f->block_num = f->fcb->fcb.block_in_disk;
+	f->block_index = 0;
+	JournalTx * tx = SimpleFS_begin(f->sfs);
+	int journaled = tx != NULL, ret = SimpleFS_finish(f->sfs, tx, SimpleFS_writeBlock(f->sfs, tx, f->fcb, f->fcb->fcb.block_in_disk));
+
+	// Se la transazione non riesce il primo blocco sul disco punta ancora alla vecchia catena: libero le copie invece dei blocchi condivisi
+	// (senza journal non so quale versione sia sul disco, e non libero nulla)
+	if(ret == -1) {
+		if(journaled) {
+			f->fcb->header.next_block = blocks[0];
+			DiskDriver_freeBlocks(disk, copies, num_blocks);
+		}
+		free(blocks);
+		free(copies);
+		return -1;
+	}
+	DiskDriver_freeBlocks(disk, blocks, num_blocks);
+	free(blocks);
+	free(copies);
+	return ret;
+}
+
+// Blocco della catena che contiene il byte "pos" del file (0 per il primo blocco del file), e posizione del byte nei suoi dati.
+// Il primo blocco contiene meno dati degli altri; un byte alla fine di un blocco pieno appartiene al blocco successivo
+// Returns the position in the chain of the block holding a byte of the file
+static int SimpleFS_chainIndex(FileHandle* f, int64_t pos, int* offset) {
+	int64_t first_data = sizeof(f->fcb->data), data = sizeof(((FileBlock *) 0)->data);
+	if(pos < first_data) {
+		*offset = pos;
+		return 0;
+	}
+	*offset = (pos - first_data) % data;
+	return 1 + (pos - first_data) / data;
+}
+
+// Sposta il cursore del file sul blocco "index" della catena, seguendo i collegamenti dal blocco del cursore (in avanti o indietro)
+// o dal primo blocco, se è più vicino: una lettura o una scrittura che continua dove è finita la precedente non segue la catena.
+// Restituisce il blocco, -1 se la catena finisce prima (il cursore resta sull'ultimo blocco)
+// Moves the cursor of the file to a block of the chain
+static int SimpleFS_chainBlock(FileHandle* f, int index) {
+	DiskDriver * disk = f->sfs->disk;
+	if(index < f->block_index - index) {
+		f->block_num = f->fcb->fcb.block_in_disk;
+		f->block_index = 0;
+	}
+	while(f->block_index != index) {
+		int next_block;
+		if(f->block_index == 0) {
+			next_block = f->fcb->header.next_block;
+		}else{
+			const BlockHeader * header = DiskDriver_getBlockPtr(disk, f->block_num);
+			if(header == NULL) return -1;
+			next_block = f->block_index < index ? header->next_block : header->previous_block;
+			DiskDriver_releaseBlockPtr(disk, f->block_num);
+		}
+		if(next_block == -1) return -1;
+		f->block_num = next_block;
+		f->block_index += f->block_index < index ? 1 : -1;
+	}
+	return f->block_num;
+}
+
+// writes in the file, at current position for size bytes stored in data
+// overwriting and allocating new space if necessary
+// returns the number of bytes written
+int SimpleFS_write(FileHandle* f, void* data, int size) {
+
+	// Se uno dei parametri è vuoto (o il file system è uno snapshot), esco senza fare nulla
+	if(f == NULL || data == NULL || size < 0 || f->sfs->read_only) return -1;
+	if(f->fcb->fcb.flags & SIMPLEFS_FILE_COMPRESSED) return SimpleFS_writeCompressed(f, data, size);
+	if(f->fcb->fcb.flags & SIMPLEFS_FILE_EXTENTS) return SimpleFS_writeExtents(f, data, size);
+	if(f->fcb->fcb.flags & SIMPLEFS_FILE_INDEXED) return SimpleFS_writeIndexed(f, data, size);
+
+	// Se la catena del file è condivisa con uno snapshot, la copio prima di cambiarla (i blocchi aggiunti dopo la copia non
+	// vengono mai congelati, quindi basta controllare il primo)
+	if(f->fcb->header.next_block != -1 && DiskDriver_inSnapshot(f->sfs->disk, f->fcb->header.next_block) && SimpleFS_unshareChain(f) == -1) return -1;
+
+	// Scrivo i "size" byte di "data" a partire dalla posizione del cursore, copiandoli con memcpy: possono contenere qualunque valore
+	DiskDriver * disk = f->sfs->disk;
+	const char * src = data;
+	int64_t pos = f->pos_in_file;
+	int data_size = sizeof(((FileBlock *) 0)->data), written = 0, in_flight = 0, failed = 0, offset;
+
+	// Il primo blocco del file (con la dimensione e il primo blocco successivo) viene scritto con una transazione del journal,
+	// i blocchi di dati direttamente sul disco
+	JournalTx * tx = SimpleFS_begin(f->sfs);
+	int index = SimpleFS_chainIndex(f, pos, &offset);
+	if(index == 0 && size > 0) {
+		written = size < sizeof(f->fcb->data) - offset ? size : sizeof(f->fcb->data) - offset;
+		memcpy(f->fcb->data + offset, src, written);
+	}
 
-			// Se la posizione finale del puntatore è maggiore dello spazio a disposizione, scrivo la dimensione massima meno "pos", altrimenti scrivo tutta la stringa rimanente
-			dim = strlen(copy)+pos > sizeof(file->data) ? sizeof(file->data)-pos : strlen(copy);
-			written_blocks++;
+	// Sovrascrivo i blocchi che esistono già, partendo da quello del cursore: il blocco viene copiato, cambiato e accodato per la
+	// scrittura, così un blocco cambiato solo in parte mantiene il resto dei dati
+	FileBlock file;
+	int block = 0;
+	while(written < size && (block = SimpleFS_chainBlock(f, SimpleFS_chainIndex(f, pos + written, &offset))) != -1) {
+		int n = size - written < data_size - offset ? size - written : data_size - offset;
+		if(DiskDriver_readBlock(disk, &file, block) == -1) break;
+		memcpy(file.data + offset, src + written, n);
+		if(SimpleFS_queueWrite(f->sfs, &file, block, &in_flight) == -1) failed = 1;
+		written += n;
+	}
+
+	// Aggiungo in fondo alla catena i blocchi che mancano fino a quello dell'ultimo byte (quelli che non contengono byte scritti restano a
+	// zero). La prima volta riservo in un colpo solo tutti i blocchi consecutivi che servono, subito dopo l'ultimo blocco del file; se non
+	// ci sono, uso il cursore di allocazione del file per tutti gli altri. Ogni blocco aggiunto viene accodato appena si conosce il suo
+	// successivo
+	if(written < size && block == -1) {
+		int last = SimpleFS_chainIndex(f, pos + size - 1, &offset), run_block = -1, run_left = 0, appended = 0, previous = f->block_num;
+		int first = f->block_index + 1, k;
+		for(k = first; k <= last; k++) {
+			if(run_left == 0) {
+				run_left = last - k + 1;
+				run_block = k == first ? DiskDriver_allocRun(disk, run_left, previous + 1) : -1;
+				if(run_block == -1) {
+					run_block = DiskDriver_allocBlock(disk, &f->cursor);
+					run_left = 1;
+				}else{
+					DiskDriver_initCursor(disk, &f->cursor, run_block + run_left);
+				}
+				if(run_block == -1) {
+					run_left = 0;
+					break;
+				}
+			}
+			int current = run_block++;
+			run_left--;
+
+			// Collego il blocco precedente a questo: se è stato aggiunto ora è ancora in "file", altrimenti è il primo blocco del file
+			// (scritto alla fine con la transazione) o l'ultimo blocco della catena, che rileggo
+			if(appended) {
+				file.header.next_block = current;
+				if(SimpleFS_queueWrite(f->sfs, &file, previous, &in_flight) == -1) failed = 1;
+			}else if(k == 1) {
+				f->fcb->header.next_block = current;
+			}else if(DiskDriver_readBlock(disk, &file, previous) == 0) {
+				file.header.next_block = current;
+				if(SimpleFS_queueWrite(f->sfs, &file, previous, &in_flight) == -1) failed = 1;
+			}
+			file.header.previous_block = previous;
+			file.header.next_block = -1;
+			file.header.block_in_file = k;
+			memset(file.data, '\0', sizeof(file.data));
+
+			// Copio i byte che cadono in questo blocco
+			int64_t block_start = sizeof(f->fcb->data) + (int64_t) (k - 1) * data_size;
+			if(pos + written < block_start + data_size) {
+				offset = pos + written - block_start;
+				int n = size - written < data_size - offset ? size - written : data_size - offset;
+				memcpy(file.data + offset, src + written, n);
+				written += n;
+			}
+			appended = 1;
+			previous = current;
+			f->block_num = current;
+			f->block_index = k;
+		}
+		if(appended && SimpleFS_queueWrite(f->sfs, &file, previous, &in_flight) == -1) failed = 1;
+
+		// Se ho riservato più blocchi di quelli effettivamente scritti, li libero
+		if(run_left > 0) DiskDriver_freeRange(disk, run_block, run_left);
+	}
+	if(SimpleFS_waitWrites(disk, in_flight) == -1) failed = 1;
+
+	// Aggiorno la posizione del cursore e la dimensione in byte del file
+	f->pos_in_file += written;
+	if(f->pos_in_file > f->fcb->fcb.size_in_bytes) f->fcb->fcb.size_in_bytes = f->pos_in_file;
+	int ret = SimpleFS_writeBlock(f->sfs, tx, f->fcb, f->fcb->fcb.block_in_disk);
+	if(tx != NULL) ret = SimpleFS_finish(f->sfs, tx, ret);
+	if(ret == -1) failed = 1;
+
+	// Restituisco il numero di byte scritti nel file, o -1 se un blocco non è stato scritto
+	return failed ? -1 : written;
+}
+
+// Readahead adattivo, chiamato prima di leggere il blocco "block" del file. I blocchi di un file sono quasi sempre consecutivi sul disco
+// (vengono riservati a gruppi con DiskDriver_allocRun), quindi vengono anticipati i blocchi che seguono "block" sul disco, senza
+// aspettarli. Quando la lettura arriva al segno (a metà dell'ultima finestra anticipata), viene anticipata la finestra successiva, grande
+// il doppio: così i blocchi sono già in memoria quando servono. Se invece la catena salta fuori dai blocchi anticipati, si riparte dalla
+// finestra più piccola
+// Prefetches the blocks after block on the disk, growing the window while the reads stay sequential
+static void SimpleFS_readahead(FileHandle* f, int block) {
+	if(f->readahead == 0) return;
+	int start;
+	if(block >= f->readahead_start && block < f->readahead_end) {
+		if(block < f->readahead_mark) return;
+		start = f->readahead_end;
+		f->readahead = 2 * f->readahead < SIMPLEFS_READAHEAD_MAX ? 2 * f->readahead : SIMPLEFS_READAHEAD_MAX;
+	}else{
+		start = f->readahead_start = block;
+		f->readahead = f->advice == SIMPLEFS_ADVISE_SEQUENTIAL ? SIMPLEFS_READAHEAD_MAX : SIMPLEFS_READAHEAD_MIN;
+	}
+
+	// Alla fine del disco non c'è più niente da anticipare: il segno resta oltre la finestra
+	int n = f->sfs->disk->header->num_blocks - start < f->readahead ? f->sfs->disk->header->num_blocks - start : f->readahead;
+	if(n > 0) DiskDriver_advise(f->sfs->disk, start, n, DISK_ADVISE_WILLNEED);
+	f->readahead_end = start + (n > 0 ? n : 0);
+	f->readahead_mark = n > 0 ? start + n / 2 : f->readahead_end;
+}
+
+// Legge al massimo "size" byte del file a extent dalla posizione corrente: per ogni extent trovato con la ricerca binaria, i suoi
+// blocchi vengono copiati uno dopo l'altro (con il readahead dei blocchi che seguono sul disco); i buchi valgono zero
+// Reads from a file with the extent layout
+static int SimpleFS_readExtents(FileHandle* f, char* data, int size) {
+	ExtentMap * map = SimpleFS_loadExtents(f);
+	if(map == NULL) return -1;
+	int64_t pos = f->pos_in_file, end = pos + size < f->fcb->fcb.size_in_bytes ? pos + size : f->fcb->fcb.size_in_bytes;
+	int read = 0;
+	while(pos + read < end) {
+		int64_t current = pos + read;
+		int file_block = current / BLOCK_SIZE, offset = current % BLOCK_SIZE, i = SimpleFS_findExtent(map, file_block);
+
+		// Blocchi da leggere di seguito: il resto dell'extent, o il buco fino al prossimo extent
+		int64_t run_end = i == map->num_extents ? end : (int64_t) (map->extents[i].file_block > file_block ? map->extents[i].file_block :
+			map->extents[i].file_block + map->extents[i].length) * BLOCK_SIZE;
+		int n = (run_end < end ? run_end : end) - current;
+		if(i == map->num_extents || map->extents[i].file_block > file_block) {
+			memset(data + read, 0, n);
+			read += n;
+			continue;
+		}
+		int block = map->extents[i].start + file_block - map->extents[i].file_block, copied = 0;
+		while(copied < n) {
+			int len = n - copied < BLOCK_SIZE - offset ? n - copied : BLOCK_SIZE - offset;
+			SimpleFS_readahead(f, block);
+			const char * src = DiskDriver_getBlockPtr(f->sfs->disk, block);
+			if(src == NULL) break;
+			memcpy(data + read + copied, src + offset, len);
+			DiskDriver_releaseBlockPtr(f->sfs->disk, block);
+			copied += len;
+			offset = 0;
+			block++;
+		}
+		read += copied;
+		if(copied < n) break;
+	}
+	if(read < size) memset(data + read, 0, size - read);
+	f->pos_in_file += read;
+	return read;
+}
+
+// Aggiunge a "*blocks" l'IndexBlock "block" di livello "level" (1 se punta ai dati), i blocchi a cui punta e quelli degli IndexBlock
+// sotto di lui. Restituisce -1 se manca la memoria, 0 altrimenti
+// Collects the blocks of a subtree of the index of an indexed file
+static int SimpleFS_collectIndexTree(DiskDriver* disk, int block, int level, int** blocks, int* num_blocks, int* capacity) {
+	const IndexBlock * index = DiskDriver_getBlockPtr(disk, block);
+	if(index == NULL) return 0;
+	IndexBlock copy = *index;
+	DiskDriver_releaseBlockPtr(disk, block);
+	if(*num_blocks + SIMPLEFS_INDEX_POINTERS + 1 > *capacity) {
+		int grown_capacity = 2 * *capacity + SIMPLEFS_INDEX_POINTERS + 1;
+		int * grown = realloc(*blocks, grown_capacity * sizeof(int));
+		if(grown == NULL) return -1;
+		*blocks = grown;
+		*capacity = grown_capacity;
+	}
+	(*blocks)[(*num_blocks)++] = block;
+	int i;
+	for(i = 0; i < SIMPLEFS_INDEX_POINTERS; i++) {
+		if(copy.blocks[i] <= 0) continue;
+		if(level == 1) {
+			(*blocks)[(*num_blocks)++] = copy.blocks[i];
+		}else if(SimpleFS_collectIndexTree(disk, copy.blocks[i], level - 1, blocks, num_blocks, capacity) == -1) {
+			return -1;
 		}
 	}
+	return 0;
+}
 
-	// Aggiorno la dimensione in byte e la dimensione in blocchi del file
-	f->fcb->fcb.size_in_bytes = pos + strlen(data) > f->fcb->fcb.size_in_bytes ? pos + strlen(data) : f->fcb->fcb.size_in_bytes;
-	f->fcb->fcb.size_in_blocks = written_blocks;
-	DiskDriver_writeBlock(f->sfs->disk, f->fcb, f->fcb->fcb.block_in_disk);
+// Raccoglie i blocchi dei dati e gli IndexBlock del file indicizzato "first"; restituisce il loro numero, -1 se manca la memoria
+// (in quel caso "*blocks" è NULL)
+// Collects the blocks of an indexed file
+static int SimpleFS_collectIndexed(DiskDriver* disk, const FirstIndexedBlock* first, int** blocks) {
+	int direct = sizeof(first->direct) / sizeof(int), capacity = direct + 1, num_blocks = 0, i;
+	*blocks = malloc(capacity * sizeof(int));
+	if(*blocks == NULL) return -1;
+	for(i = 0; i < direct; i++) {
+		if(first->direct[i] > 0) (*blocks)[num_blocks++] = first->direct[i];
+	}
+	for(i = 0; i < SIMPLEFS_INDIRECT_LEVELS; i++) {
+		if(first->indirect[i] > 0 && SimpleFS_collectIndexTree(disk, first->indirect[i], i + 1, blocks, &num_blocks, &capacity) == -1) {
+			free(*blocks);
+			*blocks = NULL;
+			return -1;
+		}
+	}
+	return num_blocks;
+}
 
-	// Restituisco il numero di byte scritti nel file
-	return written_bytes;
+// Legge al massimo "size" byte del file indicizzato dalla posizione corrente, trovando ogni blocco con l'indice; i buchi valgono zero
+// Reads from a file with the indexed layout
+static int SimpleFS_readIndexed(FileHandle* f, char* data, int size) {
+	int64_t pos = f->pos_in_file, end = pos + size < f->fcb->fcb.size_in_bytes ? pos + size : f->fcb->fcb.size_in_bytes;
+	int read = 0;
+	while(pos + read < end) {
+		int64_t current = pos + read;
+		int offset = current % BLOCK_SIZE, n = end - current < BLOCK_SIZE - offset ? end - current : BLOCK_SIZE - offset;
+		int block = SimpleFS_indexBlock(f, current / BLOCK_SIZE);
+		if(block == 0) {
+			memset(data + read, 0, n);
+		}else{
+			SimpleFS_readahead(f, block);
+			const char * src = DiskDriver_getBlockPtr(f->sfs->disk, block);
+			if(src == NULL) break;
+			memcpy(data + read, src + offset, n);
+			DiskDriver_releaseBlockPtr(f->sfs->disk, block);
+		}
+		read += n;
+	}
+	if(read < size) memset(data + read, 0, size - read);
+	f->pos_in_file += read;
+	return read;
 }
 
 // reads in the file, at current position size bytes stored in data
@@ -547,68 +2062,164 @@ int SimpleFS_read(FileHandle* f, char* data, int size) {
 
 	// Se uno dei parametri è vuoto, esco senza fare nulla
 	if(f == NULL || data == NULL || size < 0) return -1;
+	if(f->fcb->fcb.flags & SIMPLEFS_FILE_COMPRESSED) return SimpleFS_readCompressed(f, data, size);
+	if(f->fcb->fcb.flags & SIMPLEFS_FILE_EXTENTS) return SimpleFS_readExtents(f, data, size);
+	if(f->fcb->fcb.flags & SIMPLEFS_FILE_INDEXED) return SimpleFS_readIndexed(f, data, size);
+
+	// Leggo dalla posizione del cursore fino a "size" byte o alla fine del file, partendo dal blocco del cursore: il primo blocco è già
+	// nel FileHandle, gli altri li copio direttamente dalla mmap (o dalla cache) in "data"
+	int64_t pos = f->pos_in_file, end = pos + size < f->fcb->fcb.size_in_bytes ? pos + size : f->fcb->fcb.size_in_bytes;
+	int offset, index = SimpleFS_chainIndex(f, pos, &offset), read = 0;
+	int block = pos < end ? SimpleFS_chainBlock(f, index) : -1;
+	while(pos + read < end && block != -1) {
+		const char * src = f->fcb->data;
+		int avail = sizeof(f->fcb->data) - offset;
+		if(index > 0) {
+			SimpleFS_readahead(f, block);
+			const FileBlock * file = DiskDriver_getBlockPtr(f->sfs->disk, block);
+			if(file == NULL) break;
+			src = file->data;
+			avail = sizeof(file->data) - offset;
+		}
+		int n = end - (pos + read) < avail ? end - (pos + read) : avail;
+		memcpy(data + read, src + offset, n);
+		if(index > 0) DiskDriver_releaseBlockPtr(f->sfs->disk, block);
+		read += n;
+
+		// Passo al blocco successivo solo se devo leggere ancora
+		offset = 0;
+		block = pos + read < end ? SimpleFS_chainBlock(f, ++index) : -1;
+	}
 
-	// Memorizzo il primo blocco del file da leggere
-	FirstFileBlock * ffb = malloc(sizeof(FirstFileBlock));
-	DiskDriver_readBlock(f->sfs->disk, ffb, f->fcb->fcb.block_in_disk);
-	int next_block = f->fcb->header.next_block;
+	// Il resto di "data" vale zero, come negli altri formati
+	if(read < size) memset(data + read, 0, size - read);
 
-	// Formatto la stringa da restituire
-	memset(data, '\0', size);
+	// Sposto il cursore dopo i byte letti, e restituisco il loro numero
+	f->pos_in_file += read;
+	return read;
+}
 
-	// Se la dimensione da leggere è minore del contenuto del blocco, leggo il blocco completo
-	if(size <= strlen(ffb->data)) {
-		strcpy(data, ffb->data);
-	}else{
-		// Se invece è maggiore, leggo il primo blocco 
-		strcpy(data, ffb->data);
-		FileBlock * file = malloc(sizeof(FileBlock));
-
-		// Continuo a leggere, aggiungendo in coda, finché esistono blocchi successivi e il numero di caratteri da leggere è minore
-		// della dimensione della stringa da restituire
-		while(strlen(data) < size && next_block != -1) {
-			DiskDriver_readBlock(f->sfs->disk, file, next_block);
-			sprintf(data, "%s%s", data, file->data);
-			next_block = file->header.next_block;
+// Segue la catena dei blocchi del file e passa il consiglio "advice" al disco per quelli che contengono i byte da "offset" a
+// "offset + len" (fino alla fine del file se len vale 0), un intervallo di blocchi consecutivi alla volta. Con WILLNEED, all'inizio di
+// ogni intervallo vengono anticipati tutti i blocchi che restano, supponendo che siano consecutivi: così anche la lettura dei blocchi
+// per seguire la catena non deve aspettare il disco
+// Gives the advice to the disk for the blocks of the range, one run of consecutive blocks at a time
+int SimpleFS_advise(FileHandle* f, int64_t offset, int64_t len, int advice) {
+	if(f == NULL || offset < 0 || len < 0) return -1;
+	if(advice < SIMPLEFS_ADVISE_NORMAL || advice > SIMPLEFS_ADVISE_DONTNEED) return -1;
+	if(advice != SIMPLEFS_ADVISE_WILLNEED && advice != SIMPLEFS_ADVISE_DONTNEED) SimpleFS_setAdvice(f, advice);
+
+	// Indici (nel file) del primo e dell'ultimo blocco dell'intervallo: il primo blocco contiene meno dati degli altri
+	int64_t first_data = sizeof(f->fcb->data), data = sizeof(((FileBlock *) 0)->data);
+	int64_t end = len == 0 || offset + len > f->fcb->fcb.size_in_bytes ? f->fcb->fcb.size_in_bytes : offset + len;
+	if(end <= offset) return 0;
+	int64_t first = offset < first_data ? 0 : 1 + (offset - first_data) / data;
+	int64_t last = end <= first_data ? 0 : 1 + (end - 1 - first_data) / data;
+
+	// In un file compresso i blocchi da consigliare sono quelli dei chunk dell'intervallo
+	if(f->fcb->fcb.flags & SIMPLEFS_FILE_COMPRESSED) {
+		ChunkCache * cache = SimpleFS_loadChunks(f);
+		if(cache == NULL) return -1;
+		int chunk;
+		for(chunk = offset / SIMPLEFS_CHUNK_SIZE; chunk <= (end - 1) / SIMPLEFS_CHUNK_SIZE && chunk < cache->num_entries; chunk++) {
+			if(cache->entries[chunk].first_block == -1) continue;
+			DiskDriver_advise(f->sfs->disk, cache->entries[chunk].first_block, SimpleFS_chunkBlocks(cache->entries[chunk].bytes), advice);
 		}
+		return 0;
 	}
 
-	// Restituisco la lunghezza della stringa letta
-	return strlen(data);
-}
+	// In un file a extent i blocchi da consigliare sono le parti degli extent che cadono nell'intervallo
+	if(f->fcb->fcb.flags & SIMPLEFS_FILE_EXTENTS) {
+		ExtentMap * map = SimpleFS_loadExtents(f);
+		if(map == NULL) return -1;
+		int first_block = offset / BLOCK_SIZE, last_block = (end - 1) / BLOCK_SIZE, i;
+		for(i = SimpleFS_findExtent(map, first_block); i < map->num_extents && map->extents[i].file_block <= last_block; i++) {
+			int from = map->extents[i].file_block > first_block ? map->extents[i].file_block : first_block;
+			int to = map->extents[i].file_block + map->extents[i].length - 1 < last_block ? map->extents[i].file_block + map->extents[i].length - 1 : last_block;
+			DiskDriver_advise(f->sfs->disk, map->extents[i].start + from - map->extents[i].file_block, to - from + 1, advice);
+		}
+		return 0;
+	}
 
-// returns the number of bytes read (moving the current pointer to pos)
-// returns pos on success
-// -1 on error (file too short)
-int SimpleFS_seek(FileHandle* f, int pos) {
+	// In un file indicizzato trovo ogni blocco dell'intervallo con l'indice, e consiglio insieme quelli consecutivi sul disco
+	if(f->fcb->fcb.flags & SIMPLEFS_FILE_INDEXED) {
+		int run_start = 0, run_length = 0;
+		int64_t b;
+		for(b = offset / BLOCK_SIZE; b <= (end - 1) / BLOCK_SIZE; b++) {
+			int block = SimpleFS_indexBlock(f, b);
+			if(run_length > 0 && block == run_start + run_length) {
+				run_length++;
+				continue;
+			}
+			if(run_length > 0) DiskDriver_advise(f->sfs->disk, run_start, run_length, advice);
+			run_start = block;
+			run_length = block != 0;
+		}
+		if(run_length > 0) DiskDriver_advise(f->sfs->disk, run_start, run_length, advice);
+		return 0;
+	}
 
-	// Se uno dei parametri è vuoto, esco senza fare nulla
-	if(f == NULL || pos < 0) return -1;
-
-	// Calcolo il numero di caratteri presenti nel file
-	int dim = 0;
-	FirstFileBlock * ffb = malloc(sizeof(FirstFileBlock));
-	DiskDriver_readBlock(f->sfs->disk, ffb, f->fcb->fcb.block_in_disk);
-	dim += sizeof(ffb->data);
-	if(ffb->header.next_block != -1) {
-		FileBlock * file = malloc(sizeof(FileBlock));
-		DiskDriver_readBlock(f->sfs->disk, file, ffb->header.next_block);
-		dim += sizeof(file->data);
-		while(file->header.next_block != -1) {
-			DiskDriver_readBlock(f->sfs->disk, file, file->header.next_block);
-			dim += sizeof(file->data);
+	// Seguo la catena: "run_start" e "run_length" sono l'intervallo di blocchi consecutivi che sto raccogliendo
+	int block = f->fcb->fcb.block_in_disk, run_start = -1, run_length = 0;
+	int64_t index = 0;
+	while(block != -1 && index <= last) {
+		if(index >= first) {
+			if(run_length > 0 && block == run_start + run_length) {
+				run_length++;
+			}else{
+				if(run_length > 0 && advice != SIMPLEFS_ADVISE_WILLNEED) DiskDriver_advise(f->sfs->disk, run_start, run_length, advice);
+				run_start = block;
+				run_length = 1;
+				if(advice == SIMPLEFS_ADVISE_WILLNEED) DiskDriver_advise(f->sfs->disk, block, last - index + 1, advice);
+			}
 		}
+		if(index == last) break;
+		const BlockHeader * header = DiskDriver_getBlockPtr(f->sfs->disk, block);
+		if(header == NULL) break;
+		int next_block = header->next_block;
+		DiskDriver_releaseBlockPtr(f->sfs->disk, block);
+		block = next_block;
+		index++;
 	}
+	if(run_length > 0 && advice != SIMPLEFS_ADVISE_WILLNEED) DiskDriver_advise(f->sfs->disk, run_start, run_length, advice);
+	return 0;
+}
 
-	// Se la posizione in cui mettere il cursore è maggiore della dimensione del file, restituisco un errore
-	if(pos > dim){
-		return -1;
+// Sposta il cursore a "offset" byte dall'inizio del file, dalla posizione corrente o dalla fine (secondo "whence"), in tempo costante:
+// la dimensione è nel primo blocco del file, che è già nel FileHandle. La posizione può superare la fine del file, e la scrittura successiva
+// lascia a zero i byte in mezzo. Il blocco della catena che contiene il cursore viene cercato solo dalla lettura o scrittura successiva,
+// partendo dal blocco del cursore precedente
+// Moves the cursor without following the chain of the file
+int64_t SimpleFS_seekFrom(FileHandle* f, int64_t offset, int whence) {
+
+	// Se uno dei parametri non è valido, esco senza fare nulla
+	if(f == NULL) return -1;
+	int64_t base;
+	if(whence == SEEK_SET) {
+		base = 0;
+	}else if(whence == SEEK_CUR) {
+		base = f->pos_in_file;
+	}else if(whence == SEEK_END) {
+		base = f->fcb->fcb.size_in_bytes;
 	}else{
-		// Se invece c'è spazio per spostare il cursore, aggiorno la posizione del cursore nel file e restituisco la nuova posizione
-		f->pos_in_file = pos;
-		return pos;
+		return -1;
 	}
+	if(offset > INT64_MAX - base || base + offset < 0) return -1;
+	f->pos_in_file = base + offset;
+	return f->pos_in_file;
+}
+
+// moves the current pointer to pos
+// returns pos on success, -1 on error (negative pos)
+int64_t SimpleFS_seek(FileHandle* f, int64_t pos) {
+	return SimpleFS_seekFrom(f, pos, SEEK_SET);
+}
 
+// Restituisce la dimensione in byte del file, dal primo blocco nel FileHandle
+// Returns the size of the file
+int64_t SimpleFS_size(FileHandle* f) {
+	if(f == NULL) return -1;
+	return f->fcb->fcb.size_in_bytes;
 }
 
 // seeks for a directory in d. If dirname is equal to ".." it goes one level up
@@ -665,33 +2276,28 @@ int DirectoryExist(DirectoryHandle * d, char * dirname){
 	// Se uno dei parametri è vuoto, esco senza fare nulla
 	if(d == NULL || dirname == NULL) return -1;
 
-	// Se esiste già una cartella con lo stesso nome, restituisco -1
-	int i, j;
-	FirstDirectoryBlock * db = malloc(sizeof(FirstDirectoryBlock));
-	DiskDriver_readBlock(d->sfs->disk, db, d->dcb->fcb.block_in_disk);
+	// Leggo la cartella direttamente dalla mmap (o dalla cache)
+	int dir_block = d->dcb->fcb.block_in_disk, found = -1;
+	const FirstDirectoryBlock * db = DiskDriver_getBlockPtr(d->sfs->disk, dir_block);
+	if(db == NULL) return -1;
 
 	// Per ogni elemento contenuto nella cartella
-	for(i = 0, j = 0; i < d->dcb->num_entries; i++, j++) {
-
-		// Se l'indice relativo è maggiore della dimensione del blocco
-		if(j >= sizeof(db->file_blocks)) { 
-
-			// Leggo il blocco successivo e aggiorno l'indice relativo
-			DirectoryBlock * db;
-			j = j - sizeof(db->file_blocks);
-			DiskDriver_readBlock(d->sfs->disk, db, db->header.next_block);
-		}
+	int i;
+	for(i = 0; i < d->dcb->num_entries && found == -1; i++) {
 
-		// Leggo il primo blocco dell'elemento attuale
-		FirstDirectoryBlock * first_dir_block = malloc(sizeof(FirstDirectoryBlock));
-		DiskDriver_readBlock(d->sfs->disk, first_dir_block, db->file_blocks[j]);
+		// Leggo il primo blocco dell'elemento attuale, senza copiarlo
+		int block = SimpleFS_dirEntry(d->sfs->disk, db, i);
+		const FirstDirectoryBlock * first_dir_block = DiskDriver_getBlockPtr(d->sfs->disk, block);
+		if(first_dir_block == NULL) continue;
 
 		// Controllo se la directory esiste
 		if(strcmp(first_dir_block->fcb.name,dirname)==0 && first_dir_block->fcb.is_dir == 1){
-			return first_dir_block->fcb.block_in_disk;
+			found = first_dir_block->fcb.block_in_disk;
 		}
+		DiskDriver_releaseBlockPtr(d->sfs->disk, block);
 	}
-	return -1;
+	DiskDriver_releaseBlockPtr(d->sfs->disk, dir_block);
+	return found;
 }
 
 // creates a new directory in the current one (stored in fs->current_directory_block)
@@ -699,17 +2305,25 @@ int DirectoryExist(DirectoryHandle * d, char * dirname){
 // -1 on error
 int SimpleFS_mkDir(DirectoryHandle* d, char* dirname) {
 
-	// Se uno dei parametri è vuoto, esco senza fare nulla
-	if(d == NULL || dirname == NULL) return -1;
+	// Se uno dei parametri è vuoto (o il file system è uno snapshot), esco senza fare nulla
+	if(d == NULL || dirname == NULL || d->sfs->read_only) return -1;
+
+	// Il nome deve stare nel FileControlBlock, terminatore compreso
+	if(strlen(dirname) >= sizeof(((FileControlBlock *) 0)->name)) return -1;
 
 	// Se non ci sono blocchi liberi per creare il file, restituisco errore
-	if(d->sfs->disk->header->free_blocks < 1){
+	if(DiskDriver_freeCount(d->sfs->disk) < 1){
 		return -1; 
 	}
 
 	// Se esiste già una cartella con lo stesso nome, restituisco -1
 	if(DirectoryExist(d,dirname) != -1) return -1;
 
+	// Il primo blocco della nuova cartella e i blocchi della cartella attuale vengono scritti in un'unica transazione del journal: se non
+	// riesce, vengono liberati i blocchi riservati in "new_blocks"
+	JournalTx * tx = SimpleFS_begin(d->sfs);
+	int new_blocks[2], num_new = 0, ret = 0;
+
 	// Altrimenti, creo il primo blocco della cartella, inserendo tutti le informazioni e lo scrivo su disco
 	FirstDirectoryBlock * fdb = malloc(sizeof(FirstDirectoryBlock));
 	BlockHeader header;
@@ -718,15 +2332,16 @@ int SimpleFS_mkDir(DirectoryHandle* d, char* dirname) {
 	header.block_in_file = 0;
 	fdb->header = header;
 	fdb->fcb.directory_block = d->dcb->fcb.block_in_disk;
-	fdb->fcb.block_in_disk = DiskDriver_getFreeBlock(d->sfs->disk, 0);
+	fdb->fcb.block_in_disk = DiskDriver_allocBlock(d->sfs->disk, NULL);
 	strcpy(fdb->fcb.name, dirname);
+	fdb->fcb.flags = 0;
 	fdb->fcb.size_in_bytes = 0;
-	fdb->fcb.size_in_blocks = 0;
 	fdb->fcb.is_dir = 1;
 	fdb->num_entries = 0;
 	int i;
 	memset(fdb->file_blocks, 0, sizeof(fdb->file_blocks));
-	DiskDriver_writeBlock(d->sfs->disk, fdb, fdb->fcb.block_in_disk);
+	if(fdb->fcb.block_in_disk != -1) new_blocks[num_new++] = fdb->fcb.block_in_disk;
+	if(SimpleFS_writeBlock(d->sfs, tx, fdb, fdb->fcb.block_in_disk) == -1) ret = -1;
 
 	// Se c'è spazio nel blocco corrente della cartella attuale
 	//    Aggiungo il primo blocco della nuova cartella
@@ -755,7 +2370,7 @@ int SimpleFS_mkDir(DirectoryHandle* d, char* dirname) {
 		// Memorizzo l'indice del blocco in cui è memorizzata la cartella, nel file_blocks della cartella genitore
 		d->dcb->file_blocks[first_free_space] = fdb->fcb.block_in_disk;
 		d->dcb->num_entries++;
-		DiskDriver_writeBlock(d->sfs->disk, d->dcb, d->dcb->fcb.block_in_disk);
+		if(SimpleFS_writeBlock(d->sfs, tx, d->dcb, d->dcb->fcb.block_in_disk) == -1) ret = -1;
 	}else{
 
 		// Se invece non c'è abbastanza spazio
@@ -767,10 +2382,10 @@ int SimpleFS_mkDir(DirectoryHandle* d, char* dirname) {
 		if(d->dcb->header.next_block != -1) {
 			db_block = d->dcb->header.next_block;
 			db = malloc(sizeof(DirectoryBlock));
-			DiskDriver_readBlock(d->sfs->disk, db, d->dcb->header.next_block);
+			SimpleFS_readBlock(d->sfs, tx, db, d->dcb->header.next_block);
 			while(db->header.next_block != -1) {
 				db_block = db->header.next_block;
-				DiskDriver_readBlock(d->sfs->disk, db, db_block);
+				SimpleFS_readBlock(d->sfs, tx, db, db_block);
 			}
 		}
 
@@ -779,7 +2394,8 @@ int SimpleFS_mkDir(DirectoryHandle* d, char* dirname) {
 		if(!space_in_dir(db->file_blocks, sizeof(d->dcb->file_blocks))) {
 
 			// Creo un nuovo blocco e inserisco le sue informazioni
-			new_db_block = DiskDriver_getFreeBlock(d->sfs->disk, 0);
+			new_db_block = DiskDriver_allocBlock(d->sfs->disk, NULL);
+			if(new_db_block != -1) new_blocks[num_new++] = new_db_block;
 			DirectoryBlock * directory_block = malloc(sizeof(DirectoryBlock));
 			directory_block->header.next_block = -1;
 			directory_block->header.previous_block = db_block; 
@@ -787,7 +2403,7 @@ int SimpleFS_mkDir(DirectoryHandle* d, char* dirname) {
 
 			// Aggiorno il next_block del blocco precedente e lo sovrascrivo/aggiorno sul suo blocco
 			db->header.next_block = new_db_block;
-			DiskDriver_writeBlock(d->sfs->disk, db, db_block);
+			if(SimpleFS_writeBlock(d->sfs, tx, db, db_block) == -1) ret = -1;
 
 			// Adatto i puntatori e i valori in modo che possano funzionare all'esterno
 			db = directory_block;
@@ -808,21 +2424,123 @@ int SimpleFS_mkDir(DirectoryHandle* d, char* dirname) {
 		d->dcb->num_entries++;
 
 		// Scrivo, su un nuovo blocco (libero) la DirectoryBlock appena creata
-		DiskDriver_writeBlock(d->sfs->disk, db, db_block);
+		if(SimpleFS_writeBlock(d->sfs, tx, db, db_block) == -1) ret = -1;
 	}
-	DiskDriver_flush(d->sfs->disk);
 
+	// Se la transazione viene scartata (o il commit non riesce) la cartella non viene creata: libero i blocchi riservati e rileggo la
+	// cartella attuale dal disco, dove non è cambiato nulla; senza journal i blocchi sono già stati scritti, e restano dove sono
+	int journaled = tx != NULL;
+	if(SimpleFS_finish(d->sfs, tx, ret) == -1) {
+		if(journaled) {
+			DiskDriver_freeBlocks(d->sfs->disk, new_blocks, num_new);
+			DiskDriver_readBlock(d->sfs->disk, d->dcb, d->dcb->fcb.block_in_disk);
+		}
+		return -1;
+	}
 	return 0;
 }
 
+// Libera tutti i blocchi della catena che inizia da "first_block": prima raccoglie gli indici seguendo i next_block,
+// poi li libera tutti insieme con DiskDriver_freeBlocks (una sola sincronizzazione del disco)
+// Frees all the blocks of the chain starting at first_block with a single DiskDriver_freeBlocks
+static int SimpleFS_freeChain(DiskDriver* disk, int first_block) {
+	int num_blocks = 0, capacity = 16;
+	int * blocks = malloc(capacity * sizeof(int));
+	FileBlock * file = malloc(sizeof(FileBlock));
+
+	// Seguo la catena finché esistono blocchi successivi, ingrandendo l'array quando serve
+	int current_block = first_block;
+	while(current_block != -1 && DiskDriver_readBlock(disk, file, current_block) == 0) {
+		if(num_blocks == capacity) {
+			capacity *= 2;
+			blocks = realloc(blocks, capacity * sizeof(int));
+		}
+		blocks[num_blocks++] = current_block;
+		current_block = file->header.next_block;
+	}
+
+	int ret = DiskDriver_freeBlocks(disk, blocks, num_blocks);
+	free(blocks);
+	free(file);
+	return ret;
+}
+
+// Libera tutti i blocchi del file che inizia da "first_block": per un file compresso, a extent o indicizzato, prima i blocchi dei chunk,
+// degli extent o dei dati (con gli IndexBlock), poi (come per gli altri file) la catena del primo blocco, che comprende i
+// ChunkIndexBlock o gli ExtentBlock
+// Frees the blocks of a file, chunks and extents included
+static int SimpleFS_freeFile(DiskDriver* disk, int first_block) {
+	const FirstCompressedBlock * first = DiskDriver_getBlockPtr(disk, first_block);
+	if(first == NULL) return -1;
+	if(first->fcb.flags & SIMPLEFS_FILE_INDEXED) {
+		int * blocks, num_blocks = SimpleFS_collectIndexed(disk, (const FirstIndexedBlock *) first, &blocks);
+		DiskDriver_releaseBlockPtr(disk, first_block);
+		if(num_blocks == -1) return -1;
+		int ret = DiskDriver_freeBlocks(disk, blocks, num_blocks);
+		free(blocks);
+		return SimpleFS_freeChain(disk, first_block) == -1 ? -1 : ret;
+	}
+	if(first->fcb.flags & SIMPLEFS_FILE_EXTENTS) {
+		ExtentMap * map = SimpleFS_loadExtentMap(disk, (const FirstExtentBlock *) first);
+		DiskDriver_releaseBlockPtr(disk, first_block);
+		if(map == NULL) return -1;
+		int num_blocks = 0, i, k;
+		for(i = 0; i < map->num_extents; i++) num_blocks += map->extents[i].length;
+		int * blocks = malloc((num_blocks > 0 ? num_blocks : 1) * sizeof(int));
+		for(i = 0, num_blocks = 0; i < map->num_extents; i++) {
+			for(k = 0; k < map->extents[i].length; k++) blocks[num_blocks++] = map->extents[i].start + k;
+		}
+		int ret = DiskDriver_freeBlocks(disk, blocks, num_blocks);
+		free(blocks);
+		SimpleFS_freeExtentMap(map);
+		return SimpleFS_freeChain(disk, first_block) == -1 ? -1 : ret;
+	}
+	if(!(first->fcb.flags & SIMPLEFS_FILE_COMPRESSED)) {
+		DiskDriver_releaseBlockPtr(disk, first_block);
+		return SimpleFS_freeChain(disk, first_block);
+	}
+
+	// Raccolgo i blocchi di tutti i chunk, e li libero tutti insieme
+	int num_chunks = SimpleFS_numChunks(first->fcb.size_in_bytes), per_first = sizeof(first->chunks) / sizeof(ChunkEntry);
+	int per_block = sizeof(((ChunkIndexBlock *) 0)->chunks) / sizeof(ChunkEntry), num_blocks = 0, capacity = 64, chunk = 0, i;
+	int * blocks = malloc(capacity * sizeof(int));
+	const ChunkEntry * entries = first->chunks;
+	int index_block = first_block, next_block = first->header.next_block, in_index = per_first;
+	while(chunk < num_chunks) {
+		for(i = 0; i < in_index && chunk < num_chunks; i++, chunk++) {
+			int n = entries[i].first_block != -1 ? SimpleFS_chunkBlocks(entries[i].bytes) : 0;
+			if(num_blocks + n > capacity) {
+				capacity = 2 * capacity + n;
+				blocks = realloc(blocks, capacity * sizeof(int));
+			}
+			while(n-- > 0) blocks[num_blocks++] = entries[i].first_block + n;
+		}
+
+		// Passo al ChunkIndexBlock successivo
+		DiskDriver_releaseBlockPtr(disk, index_block);
+		index_block = -1;
+		if(chunk == num_chunks || next_block == -1) break;
+		const ChunkIndexBlock * index = DiskDriver_getBlockPtr(disk, next_block);
+		if(index == NULL) break;
+		index_block = next_block;
+		next_block = index->header.next_block;
+		entries = index->chunks;
+		in_index = per_block;
+	}
+	if(index_block != -1) DiskDriver_releaseBlockPtr(disk, index_block);
+	int ret = DiskDriver_freeBlocks(disk, blocks, num_blocks);
+	free(blocks);
+	return SimpleFS_freeChain(disk, first_block) == -1 ? -1 : ret;
+}
+
 // removes the file in the current directory
 // returns -1 on failure 0 on success
 // if a directory, it removes recursively all contained files
 int SimpleFS_remove(DirectoryHandle* d, char* filename) {
 
-	// Se uno dei parametri è vuoto, esco senza fare nulla
-	if(d == NULL || filename == NULL) return -1;
-	int current_block, next_block, i, j;
+	// Se uno dei parametri è vuoto (o il file system è uno snapshot), esco senza fare nulla
+	if(d == NULL || filename == NULL || d->sfs->read_only) return -1;
+	int current_block, i, j;
 
 	// Se la cartella un blocco successivo
 	if(d->dcb->header.next_block != -1) {
@@ -851,20 +2569,9 @@ int SimpleFS_remove(DirectoryHandle* d, char* filename) {
 
 						// Se è un file, cancello tutti i blocchi del file stesso
 						if(file->fcb.is_dir == 0) {
-							if(file->header.next_block != -1) {
-								do {
-									next_block = file->header.next_block;
-									DiskDriver_freeBlock(d->sfs->disk, current_block);
-									db->file_blocks[i] = 0;
-									if(next_block != -1) DiskDriver_readBlock(d->sfs->disk, file, next_block);
-									current_block = next_block;
-								} while(next_block != -1);
-								return 0;
-							}else{
-
-								// Se è formato da un solo blocco, cancello il blocco stesso
-								DiskDriver_freeBlock(d->sfs->disk, current_block);
-							}
+							SimpleFS_freeFile(d->sfs->disk, current_block);
+							db->file_blocks[i] = 0;
+							return 0;
 						}else{
 
 							// Altrimenti, se è una cartella, leggo il primo blocco della cartella
@@ -874,6 +2581,7 @@ int SimpleFS_remove(DirectoryHandle* d, char* filename) {
 							// Creo un DirectoryHandle per la cartella appena creata
 							DirectoryHandle * dh = malloc(sizeof(DirectoryHandle));
 							dh->sfs = d->sfs;
+							dh->names = NULL;
 							dh->dcb = fdb2;
 							dh->directory = d->dcb;
 							dh->current_block = &fdb2->header;
@@ -958,28 +2666,8 @@ int SimpleFS_remove(DirectoryHandle* d, char* filename) {
 					// Se non si tratta di una cartella
 					if(file_to_delete->fcb.is_dir == 0) {
 
-						// Se il file ha più di un blocco
-						if(file_to_delete->header.next_block != -1) {
-							do {
-
-								// Memorizzo il prossimo blocco
-								next_block = file_to_delete->header.next_block;
-
-								// Cancello il blocco attuale
-								DiskDriver_freeBlock(d->sfs->disk, current_block);
-								d->dcb->file_blocks[i] = 0;
-
-								// Se esiste un blocco successivo, lo leggo
-								if(next_block != -1) DiskDriver_readBlock(d->sfs->disk, file_to_delete, next_block);
-
-								// Imposto il blocco successivo come attuale
-								current_block = next_block;
-							} while(next_block != -1);
-						}else{
-
-							// Se ha un solo blocco, lo cancello
-							DiskDriver_freeBlock(d->sfs->disk, current_block);
-						}
+						// Cancello tutti i blocchi del file, con un'unica operazione sul disco
+						SimpleFS_freeFile(d->sfs->disk, current_block);
 						d->dcb->file_blocks[i] = 0;
 
 						// Dopo aver canncellato tutti i blocchi del file, restituisco 0
@@ -993,6 +2681,7 @@ int SimpleFS_remove(DirectoryHandle* d, char* filename) {
 						// Creo un DirectoryHandle da passare alle chiamate ricorsive
 						DirectoryHandle * dh = malloc(sizeof(DirectoryHandle));
 						dh->sfs = d->sfs;
+						dh->names = NULL;
 						dh->dcb = fdb2;
 						FirstDirectoryBlock * parent_folder = malloc(sizeof(FirstDirectoryBlock));
 						DiskDriver_readBlock(d->sfs->disk, parent_folder, fdb2->fcb.directory_block);
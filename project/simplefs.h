@@ -1,9 +1,53 @@
 #pragma once
 #include "bitmap.h"
 #include "disk_driver.h"
+#include "journal.h"
+#include "lz.h"
 
 /*these are structures stored on disk*/
 
+// version of the structures stored on disk, kept in DiskHeader.fs_version
+// (0: sizes of the files were 32-bit; 1: no journal; 2: no flags in the FileControlBlock;
+// SimpleFS_init converts the older versions)
+#define SIMPLEFS_VERSION 3
+
+// flags of a file, in FileControlBlock.flags
+#define SIMPLEFS_FILE_COMPRESSED 1 // the data is stored in compressed chunks (see FirstCompressedBlock)
+#define SIMPLEFS_FILE_EXTENTS 2    // the data is stored in runs of consecutive blocks (see FirstExtentBlock)
+#define SIMPLEFS_FILE_INDEXED 4    // the blocks of the data are found through an index (see FirstIndexedBlock)
+
+// layouts of the data of a file, chosen with SimpleFS_setLayout
+#define SIMPLEFS_LAYOUT_CHAINED 0  // blocks chained by BlockHeader.next_block (default)
+#define SIMPLEFS_LAYOUT_EXTENTS 1  // extents listed in the first block, blocks without headers
+#define SIMPLEFS_LAYOUT_INDEXED 2  // direct and indirect pointers in the first block, blocks without headers
+
+// block pointers in an IndexBlock, and levels of indirect IndexBlocks of an indexed file
+// (with 512-byte blocks, three levels are needed to reach 1 GiB: the first two only reach 8 MiB)
+#define SIMPLEFS_INDEX_POINTERS ((int) (BLOCK_SIZE / sizeof(int)))
+#define SIMPLEFS_INDIRECT_LEVELS 3
+
+// bytes of file data in a chunk of a compressed file (the last chunk can be shorter); each chunk
+// is compressed on its own, so a read decompresses only the chunks it needs
+#define SIMPLEFS_CHUNK_SIZE 32768
+
+// blocks of the disk for each entry of the dedup table reserved by SimpleFS_setDedup
+#define SIMPLEFS_DEDUP_RATIO 64
+
+// access patterns of a file, given with SimpleFS_advise
+#define SIMPLEFS_ADVISE_NORMAL DISK_ADVISE_NORMAL         // adaptive readahead (default)
+#define SIMPLEFS_ADVISE_SEQUENTIAL DISK_ADVISE_SEQUENTIAL // the file will be read in order: largest readahead window
+#define SIMPLEFS_ADVISE_RANDOM DISK_ADVISE_RANDOM         // the file will be read in random order: no readahead
+#define SIMPLEFS_ADVISE_WILLNEED DISK_ADVISE_WILLNEED     // the range will be read soon: start reading it now
+#define SIMPLEFS_ADVISE_DONTNEED DISK_ADVISE_DONTNEED     // the range won't be read soon: drop it from memory
+
+// readahead window of SimpleFS_read, in blocks: it starts from the minimum and doubles
+// every time the reads go on past the blocks already prefetched
+#define SIMPLEFS_READAHEAD_MIN 4
+#define SIMPLEFS_READAHEAD_MAX 256
+
+// 64-bit size of a file; it is aligned to 4 bytes, so that the structures on disk have no padding
+typedef int64_t fs_size_t __attribute__((aligned(4)));
+
 // header, occupies the first portion of each block in the disk
 // represents a chained list of blocks
 typedef struct {
@@ -17,9 +61,9 @@ typedef struct {
 typedef struct {
   int directory_block; // first block of the parent directory
   int block_in_disk;   // repeated position of the block on the disk
-  char name[128];
-  int  size_in_bytes;
-  int size_in_blocks;
+  char name[124];
+  int flags;           // SIMPLEFS_FILE_* (these were the last bytes of the name before version 3)
+  fs_size_t size_in_bytes; // the number of blocks follows from it
   int is_dir;          // 0 for file, 1 for dir
 } FileControlBlock;
 
@@ -57,6 +101,66 @@ typedef struct {
   BlockHeader header;
   int file_blocks[ (BLOCK_SIZE-sizeof(BlockHeader))/sizeof(int) ];
 } DirectoryBlock;
+
+// a chunk of a compressed file, stored in consecutive blocks without headers
+typedef struct {
+  int first_block;     // first block of the chunk (-1: never written, all zeros)
+  uint16_t bytes;      // bytes stored in the blocks
+  uint16_t compressed; // 1 if they were compressed with LZ_compress, 0 if they are the data itself
+} ChunkEntry;
+
+// first block of a compressed file: the data area holds the first entries of the chunk index,
+// the other entries are in the ChunkIndexBlocks chained from header.next_block
+typedef struct {
+  BlockHeader header;
+  FileControlBlock fcb;
+  ChunkEntry chunks[sizeof(((FirstFileBlock *) 0)->data) / sizeof(ChunkEntry)];
+} FirstCompressedBlock;
+
+// next blocks of the chunk index of a compressed file
+typedef struct {
+  BlockHeader header;
+  ChunkEntry chunks[(BLOCK_SIZE-sizeof(BlockHeader))/sizeof(ChunkEntry)];
+} ChunkIndexBlock;
+
+// a run of consecutive blocks of a file with the extent layout; the blocks hold BLOCK_SIZE bytes of data
+// each, and the blocks of the file not in any extent (holes) are all zeros
+typedef struct {
+  int file_block;      // position of the first block of the run in the file
+  int start;           // first block of the run on the disk
+  int length;          // blocks of the run
+} Extent;
+
+// first block of a file with the extent layout: the data area holds the first extents (sorted by
+// file_block), the others are in the ExtentBlocks chained from header.next_block
+typedef struct {
+  BlockHeader header;
+  FileControlBlock fcb;
+  int num_extents;     // extents of the file
+  Extent extents[(sizeof(((FirstFileBlock *) 0)->data) - sizeof(int)) / sizeof(Extent)];
+} FirstExtentBlock;
+
+// next blocks of the extents of a file
+typedef struct {
+  BlockHeader header;
+  Extent extents[(BLOCK_SIZE-sizeof(BlockHeader))/sizeof(Extent)];
+} ExtentBlock;
+
+// first block of a file with the indexed layout: the data area holds the pointers to the first blocks of
+// the file, then to the IndexBlocks of the single, double and triple indirect levels (0: none, the block
+// of the root directory is never a block of a file); the blocks of the file not pointed are all zeros
+typedef struct {
+  BlockHeader header;
+  FileControlBlock fcb;
+  int direct[sizeof(((FirstFileBlock *) 0)->data) / sizeof(int) - SIMPLEFS_INDIRECT_LEVELS];
+  int indirect[SIMPLEFS_INDIRECT_LEVELS];
+} FirstIndexedBlock;
+
+// a block of the index of an indexed file: pointers to blocks of the file (in the last level) or
+// to the IndexBlocks of the next level (0: none)
+typedef struct {
+  int blocks[SIMPLEFS_INDEX_POINTERS];
+} IndexBlock;
 /******************* stuff on disk END *******************/
 
 
@@ -65,16 +169,52 @@ typedef struct {
 
 typedef struct {
   DiskDriver* disk;
+  Journal* journal; // journal of the metadata (NULL if the disk has none)
+  int read_only;    // 1 for a snapshot mounted with SimpleFS_mountSnapshot, or on a disk mounted read only
+                    // (DiskDriver.read_only): nothing can be changed
+  int snapshot;     // 1 for a snapshot mounted with SimpleFS_mountSnapshot (its disk stays mounted by SimpleFS_unmount)
   // add more fields if needed
 } SimpleFS;
 
+// chunk index of a compressed file, read when the handle first needs it, and the last chunk decompressed
+typedef struct {
+  ChunkEntry* entries;             // one per chunk of the file
+  int num_entries;
+  int capacity;
+  int* index_blocks;               // ChunkIndexBlocks of the file, in order
+  int num_index_blocks;
+  int cached;                      // chunk in data (-1: none)
+  char data[SIMPLEFS_CHUNK_SIZE];  // decompressed chunk, followed by zeros up to SIMPLEFS_CHUNK_SIZE
+  char compressed[SIMPLEFS_CHUNK_SIZE]; // compressed bytes of a chunk being read or written
+} ChunkCache;
+
+// extents of a file with the extent layout, read when the handle first needs them
+typedef struct {
+  Extent* extents;                 // sorted by file_block
+  int num_extents;
+  int capacity;
+  int* index_blocks;               // ExtentBlocks of the file, in order
+  int num_index_blocks;
+  int dirty_from;                  // first extent changed since they were written
+} ExtentMap;
+
 // this is a file handle, used to refer to open files
 typedef struct {
   SimpleFS* sfs;                   // pointer to memory file system structure
   FirstFileBlock* fcb;             // pointer to the first block of the file(read it)
   FirstDirectoryBlock* directory;  // pointer to the directory where the file is stored
   BlockHeader* current_block;      // current block in the file
-  int pos_in_file;                 // position of the cursor in the file
+  int64_t pos_in_file;             // position of the cursor in the file
+  int block_num;                   // block of the chain that holds the cursor (its offset in the block follows from pos_in_file)
+  int block_index;                 // position of block_num in the chain (0: the first block of the file)
+  DiskCursor cursor;               // allocation cursor, keeps the blocks of the file in the same group
+  int advice;                      // access pattern (SIMPLEFS_ADVISE_NORMAL, SEQUENTIAL or RANDOM)
+  int readahead;                   // size of the next readahead window (0: no readahead)
+  int readahead_start;             // blocks already prefetched: readahead_start ... readahead_end - 1
+  int readahead_end;
+  int readahead_mark;              // reading this block (or a later one of the window) prefetches the next window
+  ChunkCache* chunks;              // chunk index of a compressed file (NULL until it is needed)
+  ExtentMap* extents;              // extents of a file with the extent layout (NULL until they are needed)
 } FileHandle;
 
 typedef struct {
@@ -84,9 +224,11 @@ typedef struct {
   BlockHeader* current_block;      // current block in the directory
   int pos_in_dir;                  // absolute position of the cursor in the directory
   int pos_in_block;                // relative position of the cursor in the block
+  char* names;                     // names returned by the last SimpleFS_readDir (NULL if none)
 } DirectoryHandle;
 
 // initializes a file system on an already made disk
+// the journal of the metadata is replayed first, so changes committed before a crash are not lost
 // returns a handle to the top level directory stored in the first block
 DirectoryHandle* SimpleFS_init(SimpleFS* fs, DiskDriver* disk);
 
@@ -97,15 +239,26 @@ DirectoryHandle* SimpleFS_init(SimpleFS* fs, DiskDriver* disk);
 // and set to the top level directory
 void SimpleFS_format(SimpleFS* fs);
 
+// unmounts the file system: the journal is checkpointed and closed, then the disk is closed
+// with DiskDriver_unmount, which marks it clean so that the next mount does not scan the bitmap
+// open handles must be closed before; fs->disk can't be used any more
+// (a mounted snapshot is only detached: the disk stays open)
+// returns -1 if the disk could not be closed cleanly, 0 otherwise
+int SimpleFS_unmount(SimpleFS* fs);
+
 // creates an empty file in the directory d
-// returns null on error (file existing, no free blocks)
+// returns null on error (file existing, name longer than 123 characters, no free blocks,
+// transaction not committed)
 // an empty file consists only of a block of type FirstBlock
+// the blocks changed are committed as a single transaction of the journal
 FileHandle* SimpleFS_createFile(DirectoryHandle* d, const char* filename);
 
 //Legge le entries e le mette nell'array names
 void read_entries(char** names, DirectoryBlock * d, DiskDriver * disk, int c);
 
 // reads in the (preallocated) blocks array, the name of all files in a directory
+// the names are copied in a buffer owned by the handle, and stay valid
+// until the next SimpleFS_readDir on the same handle
 int SimpleFS_readDir(char** names, DirectoryHandle* d);
 
 
@@ -118,18 +271,72 @@ int SimpleFS_close(FileHandle* f);
 
 // writes in the file, at current position for size bytes stored in data
 // overwriting and allocating new space if necessary
-// returns the number of bytes written
+// returns the number of bytes written, -1 if a block could not be written or the metadata
+// did not fit in a transaction of the journal (the file then keeps its old index, when it has one)
 int SimpleFS_write(FileHandle* f, void* data, int size);
 
-// writes in the file, at current position size bytes stored in data
-// overwriting and allocating new space if necessary
+// reads from the file, at current position, up to size bytes in data (less at the end of the file)
+// the data is copied as it is, so it can hold any byte; the rest of data is filled with zeros
 // returns the number of bytes read
 int SimpleFS_read(FileHandle* f, char* data, int size);
 
-// returns the number of bytes read (moving the current pointer to pos)
-// returns pos on success
-// -1 on error (file too short)
-int SimpleFS_seek(FileHandle* f, int pos);
+// turns the compression of an empty file on (compressed != 0) or off
+// the data of a compressed file is stored in chunks of SIMPLEFS_CHUNK_SIZE bytes, each compressed on its own
+// in consecutive blocks; SimpleFS_read and SimpleFS_write work from the current position, decompressing
+// only the chunks they need, and move it (turning it on or off, the file gets the chained layout otherwise)
+// returns -1 if the file is not empty, 0 otherwise
+int SimpleFS_setCompression(FileHandle* f, int compressed);
+
+// chooses the layout of the data of an empty file (SIMPLEFS_LAYOUT_*): with the extent layout, the first
+// block lists runs of consecutive blocks, so the block of any position is found with a binary search and
+// consecutive blocks are read and written without following a chain; with the indexed layout, the block of
+// any position is found reading at most SIMPLEFS_INDIRECT_LEVELS IndexBlocks, however big or scattered the
+// file is. With both, the file can have holes (all zeros)
+// a compressed file stores its data in chunks, so choosing a layout turns the compression off
+// returns -1 if the file is not empty or the layout is not valid, 0 otherwise
+int SimpleFS_setLayout(FileHandle* f, int layout);
+
+// turns the deduplication of the disk on (reserving a dedup table, an entry every SIMPLEFS_DEDUP_RATIO blocks)
+// or off: SimpleFS_write then stores each whole chunk of a compressed file only once, the files that write
+// the same chunk share its blocks, and the blocks are freed with the last file that uses them
+// returns -1 if the table can't be reserved, or (turning it off) if some chunk is still shared, 0 otherwise
+int SimpleFS_setDedup(SimpleFS* fs, int enabled);
+
+// takes a snapshot named name of the whole file system: the directories, the first blocks of the files and
+// the chunk indexes are copied, the data blocks are shared; after it, the file system copies a shared chain
+// before writing it (compressed chunks are always written in new blocks), and the blocks it frees are kept
+// while a snapshot uses them. Its cost depends on the metadata, not on the data
+// no other operation can run on the file system at the same time
+// returns -1 on error (name too long or taken, too many snapshots, disk full), 0 otherwise
+int SimpleFS_snapshot(SimpleFS* fs, const char* name);
+
+// mounts the snapshot named name of the file system on disk, read only (disk stays mounted by its file system)
+// returns a handle to the top level directory of the snapshot, NULL if there is no such snapshot
+DirectoryHandle* SimpleFS_mountSnapshot(SimpleFS* fs, DiskDriver* disk, const char* name);
+
+// deletes the snapshot named name: its copies, and the blocks released since it was taken that no other
+// snapshot uses, are freed
+// returns -1 if there is no such snapshot, 0 otherwise
+int SimpleFS_deleteSnapshot(SimpleFS* fs, const char* name);
+
+// tells how the len bytes of the file starting at offset will be read (len 0: up to the end of the file)
+// SIMPLEFS_ADVISE_SEQUENTIAL, RANDOM and NORMAL also choose the readahead of SimpleFS_read on this handle;
+// WILLNEED starts reading the blocks of the range in the background, DONTNEED drops them from memory
+// returns -1 if the advice is not valid, 0 otherwise
+int SimpleFS_advise(FileHandle* f, int64_t offset, int64_t len, int advice);
+
+// moves the current pointer to offset bytes from the start of the file (whence SEEK_SET), from the current
+// pointer (SEEK_CUR) or from the end of the file (SEEK_END), in constant time. The pointer can go past the end
+// of the file: a write there leaves zeros in between (holes in the extent and indexed layouts)
+// returns the new position, -1 on error (whence not valid, negative position)
+int64_t SimpleFS_seekFrom(FileHandle* f, int64_t offset, int whence);
+
+// moves the current pointer to pos (SimpleFS_seekFrom with SEEK_SET)
+// returns pos on success, -1 on error (negative pos)
+int64_t SimpleFS_seek(FileHandle* f, int64_t pos);
+
+// returns the size of the file in bytes, in constant time
+int64_t SimpleFS_size(FileHandle* f);
 
 //	Controlla se la cartella dirname già esiste in d
 int DirectoryExist(DirectoryHandle * d, char* dirname);
@@ -141,7 +348,7 @@ int DirectoryExist(DirectoryHandle * d, char* dirname);
 
 // creates a new directory in the current one (stored in fs->current_directory_block)
 // 0 on success
-// -1 on error
+// -1 on error (directory existing, name longer than 123 characters, no free blocks, transaction not committed)
 int SimpleFS_mkDir(DirectoryHandle* d, char* dirname);
 
 // removes the file in the current directory
@@ -1,5 +1,11 @@
+#define _GNU_SOURCE
 #include "bitmap.c" 
+#include "block_cache.c"
+#include "crc32c.c"
+#include "disk_io.c"
 #include "disk_driver.c"
+#include "journal.c"
+#include "lz.c"
 #include "simplefs.c"
 #include <stdio.h>
 #include <string.h>
@@ -7,6 +13,8 @@
 #include <fcntl.h> 
 #include <unistd.h>
 #include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
 #define TRUE 1
 #define FALSE 0
 
@@ -14,6 +22,7 @@
 // 1 = BitMap
 // 2 = DiskDriver
 // 3 = SimpleFS
+// 4 = Benchmark
 int test;
 int use_global_test = FALSE;
 int use_file_for_test = 0;
@@ -43,10 +52,100 @@ int space_in_dir(int * file_blocks, int dim) {
 	return free_spaces;
 }
 
+// Versione originale di BitMap_get, che controlla un bit per ogni iterazione: la usiamo come riferimento nei benchmark
+int BitMap_get_lineare(BitMap* bitmap, int start, int status) {
+	if(start < 0 || start >= bitmap->num_bits) return -1;
+	int i, result;
+	for(i = start; i < bitmap->num_bits; i++) {
+		BitMapEntryKey bmek = BitMap_blockToIndex(i);
+		result = (bitmap->entries[bmek.entry_num] & (1 << (7 - bmek.bit_num)));
+		if(status == 1) {
+			if(result > 0) return i;
+		}else{
+			if(result == 0) return i;
+		}
+	}
+	return -1;
+}
+
+// Restituisce il tempo attuale in secondi
+double secondi(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Un thread che fa il commit di transazioni sul journal: ogni transazione scrive i due blocchi del thread
+typedef struct {
+	Journal* journal;
+	int first_block;
+	int transactions;
+	pthread_t thread;
+} JournalThread;
+
+void* journal_thread(void* arg) {
+	JournalThread* t = arg;
+	char block[BLOCK_SIZE];
+	int i, j;
+	for(i = 0; i < t->transactions; i++) {
+		JournalTx* tx = Journal_begin(t->journal);
+		for(j = 0; j < 2; j++) {
+			memset(block, 0, BLOCK_SIZE);
+			sprintf(block, "Transazione %d del blocco %d", i, t->first_block + j);
+			Journal_write(tx, block, t->first_block + j);
+		}
+		Journal_commit(tx);
+	}
+	return NULL;
+}
+
+// Avvia "threads" thread che fanno "transactions" transazioni ciascuno sul journal (il thread i scrive i blocchi 2i e 2i+1
+// a partire da "first_block"), e restituisce il tempo impiegato in secondi
+double journal_threads(Journal* journal, int first_block, int threads, int transactions) {
+	JournalThread* t = malloc(threads * sizeof(JournalThread));
+	double start = secondi();
+	int i;
+	for(i = 0; i < threads; i++) {
+		t[i].journal = journal;
+		t[i].first_block = first_block + 2 * i;
+		t[i].transactions = transactions;
+		pthread_create(&t[i].thread, NULL, journal_thread, &t[i]);
+	}
+	for(i = 0; i < threads; i++) pthread_join(t[i].thread, NULL);
+	double elapsed = secondi() - start;
+	free(t);
+	return elapsed;
+}
+
+// Thread che riserva blocchi finché il disco non è pieno: ogni quattro blocchi uno è preso con DiskDriver_allocRun (due blocchi
+// consecutivi), gli altri con DiskDriver_allocBlock senza cursore. I blocchi riservati vengono messi in "blocks"
+typedef struct {
+	pthread_t thread;
+	DiskDriver* disk;
+	int* blocks;
+	int num_blocks;
+} AllocThread;
+
+void* alloc_thread(void* arg) {
+	AllocThread* t = arg;
+	int block;
+	t->num_blocks = 0;
+	for(;;) {
+		if(t->num_blocks % 4 == 0 && (block = DiskDriver_allocRun(t->disk, 2, -1)) != -1) {
+			t->blocks[t->num_blocks++] = block;
+			t->blocks[t->num_blocks++] = block + 1;
+			continue;
+		}
+		if((block = DiskDriver_allocBlock(t->disk, NULL)) == -1) break;
+		t->blocks[t->num_blocks++] = block;
+	}
+	return NULL;
+}
+
 int main(int agc, char** argv) {
 
 	if(!test) {
-		printf("\nCosa vuoi testare?\n1 = BitMap\n2 = DiskDriver\n3 = SimpleFS\n\n>>> ");
+		printf("\nCosa vuoi testare?\n1 = BitMap\n2 = DiskDriver\n3 = SimpleFS\n4 = Benchmark\n\n>>> ");
 	  scanf("%d", &test);
 	}
 
@@ -73,8 +172,7 @@ int main(int agc, char** argv) {
 			sprintf(disk_filename, "test/%d.txt", time(NULL));
 			DiskDriver_init(&disk, disk_filename, 50); 
 		}
-		bitmap.num_bits = disk.header->bitmap_entries * 8;
-		bitmap.entries = disk.bitmap_data;
+		bitmap = disk.bitmap;
 		printf("\n\n+++ Test BitMap_set()");
 		printf("\n+++ Test DiskDriver_init(disk, \"test.txt\", 15)");
 		printf("\n    Prima => ");
@@ -94,6 +192,17 @@ int main(int agc, char** argv) {
 		start = 13, status = 1;
 		printf("\n    Partiamo dalla posizione %d e cerchiamo %d => %d", start, status, BitMap_get(&bitmap, start, status));
 
+		// Test BitMap_setRange, BitMap_countRange e BitMap_clearRange
+		printf("\n\n+++ Test BitMap_setRange()");
+		printf("\n+++ Test BitMap_countRange()");
+		printf("\n+++ Test BitMap_clearRange()");
+		printf("\n    BitMap_setRange(10, 20) => %d", BitMap_setRange(&bitmap, 10, 20));
+		printf("\n    Dopo  => ");
+		stampa_in_binario(bitmap.entries);
+		printf("\n    Bit a 1 tra 0 e 40 => %d", BitMap_countRange(&bitmap, 0, 40, 1));
+		printf("\n    BitMap_clearRange(10, 20) => %d", BitMap_clearRange(&bitmap, 10, 20));
+		printf("\n    Bit a 1 tra 0 e 40 => %d", BitMap_countRange(&bitmap, 0, 40, 1));
+
 	}else if(test == 2) {
 
 		// Test DiskDriver_init   
@@ -108,11 +217,9 @@ int main(int agc, char** argv) {
 			sprintf(disk_filename, "test/%d.txt", time(NULL));
 			DiskDriver_init(&disk, disk_filename, 50); 
 		}
-		BitMap bitmap;
-		bitmap.num_bits = disk.header->bitmap_entries * 8;
-		bitmap.entries = disk.bitmap_data;
+		BitMap bitmap = disk.bitmap;
 		printf("\n    BitMap creata e inizializzata correttamente");
-		printf("\n    Primo blocco libero => %d", disk.header->first_free_block); 
+		printf("\n    Primo blocco libero => %d", (int) disk.header->first_free_block); 
 
 		// Test DiskDriver_writeBlock  
 		printf("\n\n+++ Test DiskDriver_writeBlock()");
@@ -129,6 +236,21 @@ int main(int agc, char** argv) {
 		printf("\n    Controlliamo tramite una readBlock(dest, 4)   => %d", DiskDriver_readBlock(&disk, dest, 4));
 		printf("\n    Dopo la readBlock, la dest contiene           => %s", (char *) dest);
 
+		// Test DiskDriver_getBlockPtr
+		printf("\n\n+++ Test DiskDriver_getBlockPtr()");
+		printf("\n+++ Test DiskDriver_getBlockPtrMut()");
+		printf("\n+++ Test DiskDriver_markDirty()");
+		printf("\n+++ Test DiskDriver_releaseBlockPtr()");
+		printf("\n    Il blocco 4, letto senza copiarlo, contiene => %s", (const char *) DiskDriver_getBlockPtr(&disk, 4));
+		DiskDriver_releaseBlockPtr(&disk, 4);
+		char * blocco_mut = DiskDriver_getBlockPtrMut(&disk, 4);
+		blocco_mut[0] = 'M';
+		printf("\n    Dopo averlo modificato sul posto, markDirty(4) => %d e la readBlock legge => ", DiskDriver_markDirty(&disk, 4));
+		DiskDriver_releaseBlockPtr(&disk, 4);
+		DiskDriver_readBlock(&disk, dest, 4);
+		printf("%s", (char *) dest);
+		printf("\n    Un blocco libero restituisce un puntatore nullo => %s", DiskDriver_getBlockPtr(&disk, 5) == NULL ? "NULL" : "errore");
+
 		// Test DiskDriver_freeBlock
 		printf("\n\n+++ Test DiskDriver_freeBlock()");
 		printf("\n    Prima => ");
@@ -137,6 +259,393 @@ int main(int agc, char** argv) {
 		printf("\n    Dopo  => ");
 		stampa_in_binario(bitmap.entries);
 
+		// Test DiskDriver_allocRun
+		printf("\n\n+++ Test DiskDriver_allocRun()");
+		printf("\n+++ Test BitMap_getRun()");
+		int run = DiskDriver_allocRun(&disk, 3, 2);
+		printf("\n    Riservo 3 blocchi consecutivi partendo dal blocco 2 => %d", run);
+		printf("\n    Dopo  => ");
+		stampa_in_binario(bitmap.entries);
+		printf("\n    Con best-fit, il primo gruppo di 3 blocchi liberi è => %d", BitMap_getBestRun(&bitmap, 0, 3));
+		for(int i = 0; i < 3; i++) DiskDriver_freeBlock(&disk, run + i);
+
+		// Test DiskDriver_allocBlock
+		printf("\n\n+++ Test DiskDriver_allocBlock()");
+		DiskCursor cursor;
+		DiskDriver_initCursor(&disk, &cursor, 10);
+		int b1 = DiskDriver_allocBlock(&disk, &cursor);
+		int b2 = DiskDriver_allocBlock(&disk, &cursor);
+		printf("\n    Con un cursore inizializzato al blocco 10 ottengo i blocchi %d e %d", b1, b2);
+		printf("\n    Il gruppo %d ha %d blocchi liberi su %d", cursor.group, disk.groups[cursor.group].free_blocks, disk.groups[cursor.group].num_blocks);
+		DiskDriver_freeBlock(&disk, b1);
+		DiskDriver_freeBlock(&disk, b2);
+
+		// Test DiskDriver_setAllocPolicy: con next-fit le allocazioni senza cursore ripartono da dove è finita l'ultima,
+		// e arrivate alla fine del disco ricominciano dall'inizio
+		printf("\n\n+++ Test DiskDriver_setAllocPolicy()");
+		printf("\n    DiskDriver_setAllocPolicy(DISK_ALLOC_NEXT_FIT) => %d", DiskDriver_setAllocPolicy(&disk, DISK_ALLOC_NEXT_FIT));
+		disk.header->alloc_cursor = disk.header->num_blocks - 1;
+		b1 = DiskDriver_allocBlock(&disk, NULL);
+		b2 = DiskDriver_allocBlock(&disk, NULL);
+		printf("\n    Partendo dall'ultimo blocco ottengo i blocchi %d e %d, il cursore è al blocco %d", b1, b2, (int) disk.header->alloc_cursor);
+		DiskDriver_freeBlock(&disk, b1);
+		DiskDriver_freeBlock(&disk, b2);
+		printf("\n    Dopo averli liberati, il primo blocco libero è %d", (int) disk.header->first_free_block);
+		DiskDriver_setAllocPolicy(&disk, DISK_ALLOC_GROUPS);
+
+		// Test DiskDriver_allocBlock con più thread: 8 thread riempiono insieme un disco da 16384 blocchi (4 gruppi), con ogni
+		// politica. Nessun blocco deve essere dato a due thread, e i contatori dei gruppi devono corrispondere alla bitmap
+		printf("\n\n+++ Test DiskDriver_allocBlock() [8 thread]");
+		{
+			const char * nomi_politiche[] = { "DISK_ALLOC_GROUPS", "DISK_ALLOC_NEXT_FIT", "DISK_ALLOC_FIRST_FIT" };
+			const int politiche_thread[] = { DISK_ALLOC_GROUPS, DISK_ALLOC_NEXT_FIT, DISK_ALLOC_FIRST_FIT };
+			DiskDriver disk_thread;
+			char disk_thread_filename[255];
+			sprintf(disk_thread_filename, "test/thread_%d.txt", (int) time(NULL));
+			DiskDriver_init(&disk_thread, disk_thread_filename, 16384);
+			DiskDriver_setDurability(&disk_thread, DISK_SYNC_FLUSH, 0);
+			AllocThread alloc_threads[8];
+			char * riservato = malloc(16384);
+			int p, t, j;
+			for(t = 0; t < 8; t++) alloc_threads[t].blocks = malloc(16384 * sizeof(int));
+			for(p = 0; p < 3; p++) {
+				DiskDriver_setAllocPolicy(&disk_thread, politiche_thread[p]);
+				int liberi_prima = DiskDriver_freeCount(&disk_thread);
+				for(t = 0; t < 8; t++) {
+					alloc_threads[t].disk = &disk_thread;
+					pthread_create(&alloc_threads[t].thread, NULL, alloc_thread, &alloc_threads[t]);
+				}
+				for(t = 0; t < 8; t++) pthread_join(alloc_threads[t].thread, NULL);
+
+				// Conto i blocchi riservati e quelli dati a più di un thread
+				int riservati = 0, doppioni = 0;
+				memset(riservato, 0, 16384);
+				for(t = 0; t < 8; t++) {
+					for(j = 0; j < alloc_threads[t].num_blocks; j++) {
+						if(riservato[alloc_threads[t].blocks[j]]++) doppioni++;
+						riservati++;
+					}
+				}
+				printf("\n    %s: riservati %d blocchi su %d liberi, dati a più thread => %d, liberi secondo i gruppi => %d, secondo la bitmap => %d",
+					nomi_politiche[p], riservati, liberi_prima, doppioni, DiskDriver_freeCount(&disk_thread), BitMap_countRange(&disk_thread.bitmap, 0, 16384, 0));
+				for(t = 0; t < 8; t++) DiskDriver_freeBlocks(&disk_thread, alloc_threads[t].blocks, alloc_threads[t].num_blocks);
+			}
+			DiskDriver_flush(&disk_thread);
+			printf("\n    Dopo averli liberati: liberi nel DiskHeader => %d, primo libero => %d", (int) disk_thread.header->free_blocks, (int) disk_thread.header->first_free_block);
+			for(t = 0; t < 8; t++) free(alloc_threads[t].blocks);
+			free(riservato);
+			DiskDriver_unmount(&disk_thread);
+			unlink(disk_thread_filename);
+		}
+
+		// Test DiskDriver_initConfig: lo stesso disco con il backend pread e una cache di soli 16 blocchi
+		printf("\n\n+++ Test DiskDriver_initConfig() [pread + cache]");
+		DiskConfig config = { DISK_BACKEND_PREAD, 16 * BLOCK_SIZE, 1 };
+		DiskDriver disk2;
+		char disk2_filename[255];
+		sprintf(disk2_filename, "test/cache_%d.txt", (int) time(NULL));
+		DiskDriver_initConfig(&disk2, disk2_filename, 50, &config);
+		printf("\n    Backend %s, %d frame, O_DIRECT %s", disk2.backend->name, disk2.cache->num_frames, disk2.direct_io ? "attivo" : "non usato (blocchi non allineati)");
+		for(int i = 0; i < 40; i++) DiskDriver_writeBlock(&disk2, i % 2 ? "Pari" : "Dispari", i);
+		DiskDriver_readBlock(&disk2, dest, 3);
+		printf("\n    Scritti 40 blocchi, la readBlock(3) legge => %s", (char *) dest);
+		printf("\n    Hit %llu, miss %llu, blocchi scritti nel file %llu", (unsigned long long) disk2.cache->hits,
+			(unsigned long long) disk2.cache->misses, (unsigned long long) disk2.cache->writebacks);
+
+		// Test delle richieste asincrone: 8 scritture e 8 letture inviate al disco insieme
+		printf("\n\n+++ Test DiskDriver_submitWrite()");
+		printf("\n+++ Test DiskDriver_submitRead()");
+		printf("\n+++ Test DiskDriver_poll()");
+		const char * engine[] = { "auto", "io_uring", "pool di thread", "in memoria" };
+		char blocchi[8][BLOCK_SIZE];
+		DiskIOCompletion completamenti[DISK_IO_DEPTH];
+		int k, errori_io = 0;
+		for(k = 0; k < 8; k++) {
+			memset(blocchi[k], 0, BLOCK_SIZE);
+			sprintf(blocchi[k], "Asincrono %d", k);
+			errori_io += DiskDriver_submitWrite(&disk2, blocchi[k], 40 + k, NULL) == -1;
+		}
+		printf("\n    Engine %s: 8 scritture accodate, inviate con una sola chiamata => %d", engine[disk2.io->engine], DiskDriver_submit(&disk2));
+		printf("\n    Completate => %d, blocchi liberi => %d", DiskDriver_poll(&disk2, completamenti, DISK_IO_DEPTH, 8), DiskDriver_freeCount(&disk2));
+		for(k = 0; k < 8; k++) {
+			memset(blocchi[k], 0, BLOCK_SIZE);
+			errori_io += DiskDriver_submitRead(&disk2, blocchi[k], k % 2 ? 45 : k, NULL) == -1;
+		}
+		int completati = DiskDriver_poll(&disk2, completamenti, DISK_IO_DEPTH, 8);
+		for(k = 0; k < completati; k++) errori_io += completamenti[k].result == -1;
+		printf("\n    8 letture completate => %d (errori %d): %s, %s", completati, errori_io, blocchi[0], blocchi[1]);
+
+		// Riapro il file con la mmap: i blocchi scritti tramite la cache devono essere nel file
+		DiskDriver disk3;
+		DiskDriver_init(&disk3, disk2_filename, 50);
+		DiskDriver_readBlock(&disk3, dest, 38);
+		printf("\n    Riaperto con la mmap: blocchi liberi %d, la readBlock(38) legge => %s", DiskDriver_freeCount(&disk3), (char *) dest);
+		unlink(disk2_filename);
+
+		// Test della conversione di un disco senza versione: DiskHeader con campi a 32 bit, una bitmap di un byte per blocco
+		// subito dopo, e i blocchi subito dopo la bitmap. Nel disco sono occupati i blocchi 1 e 7
+		printf("\n\n+++ Test DiskDriver_init() [disco senza versione]");
+		sprintf(disk2_filename, "test/legacy_%d.txt", (int) time(NULL));
+		int legacy_fd = open(disk2_filename, O_CREAT | O_RDWR, 0666);
+		int legacy_header[5] = { 50, 1, 50, 48, 0 };
+		char legacy_bitmap[50], legacy_block[BLOCK_SIZE];
+		memset(legacy_bitmap, 0, sizeof(legacy_bitmap));
+		BitMap legacy_map = { 50, legacy_bitmap, NULL };
+		BitMap_set(&legacy_map, 1, 1);
+		BitMap_set(&legacy_map, 7, 1);
+		memset(legacy_block, 0, BLOCK_SIZE);
+		strcpy(legacy_block, "Formato senza versione");
+		pwrite(legacy_fd, legacy_header, sizeof(legacy_header), 0);
+		pwrite(legacy_fd, legacy_bitmap, sizeof(legacy_bitmap), sizeof(legacy_header));
+		pwrite(legacy_fd, legacy_block, BLOCK_SIZE, sizeof(legacy_header) + sizeof(legacy_bitmap) + 7 * BLOCK_SIZE);
+		ftruncate(legacy_fd, sizeof(legacy_header) + sizeof(legacy_bitmap) + 50 * BLOCK_SIZE);
+		close(legacy_fd);
+		DiskDriver_init(&disk3, disk2_filename, 50);
+		printf("\n    Versione %u, bitmap a %lld, blocchi a %lld, blocchi liberi %d", disk3.header->version, (long long) disk3.header->bitmap_offset,
+			(long long) disk3.header->data_offset, DiskDriver_freeCount(&disk3));
+		memset(dest, 0, BLOCK_SIZE);
+		int legacy_ret = DiskDriver_readBlock(&disk3, dest, 7);
+		printf("\n    Primo blocco libero dopo il blocco 1 => %d, readBlock(7) => %d: %s", DiskDriver_getFreeBlock(&disk3, 1), legacy_ret, (char *) dest);
+		unlink(disk2_filename);
+
+		// Test del backend a finestre: 50 blocchi (7 finestre da una pagina), ma solo 2 finestre mappate alla volta
+		printf("\n\n+++ Test DiskDriver_initConfig() [finestre di mappatura]");
+		DiskConfig window_config = { DISK_BACKEND_WINDOWS, 0, 0, DISK_IO_AUTO, 4096, 2 };
+		sprintf(disk2_filename, "test/windows_%d.txt", (int) time(NULL));
+		DiskDriver_initConfig(&disk2, disk2_filename, 50, &window_config);
+		for(int i = 0; i < 50; i++) {
+			sprintf(legacy_block, "Finestra %d", i);
+			DiskDriver_writeBlock(&disk2, legacy_block, i);
+		}
+		DiskDriver_readBlock(&disk2, dest, 3);
+		printf("\n    Backend %s, %d finestre da %zu byte, %d mappate alla volta", disk2.backend->name, disk2.num_windows, disk2.window_size, disk2.max_windows);
+		printf("\n    Scritti 50 blocchi, la readBlock(3) legge => %s", (char *) dest);
+		printf("\n    Finestre mappate %llu, tolte %llu", (unsigned long long) disk2.window_maps, (unsigned long long) disk2.window_unmaps);
+		DiskDriver_init(&disk3, disk2_filename, 50);
+		DiskDriver_readBlock(&disk3, dest, 49);
+		printf("\n    Riaperto con la mmap: blocchi liberi %d, la readBlock(49) legge => %s", DiskDriver_freeCount(&disk3), (char *) dest);
+		unlink(disk2_filename);
+
+		// Test della crescita del disco con ogni backend: a 100 blocchi la bitmap si allunga sul posto,
+		// a 40000 non c'è più spazio prima dei blocchi e viene spostata dopo di loro
+		printf("\n\n+++ Test DiskDriver_grow()");
+		for(int backend = DISK_BACKEND_MMAP; backend <= DISK_BACKEND_WINDOWS; backend++) {
+			DiskConfig grow_config = { backend, 0, 0, DISK_IO_AUTO, 4096, 2 };
+			sprintf(disk2_filename, "test/grow_%d_%d.txt", backend, (int) time(NULL));
+			DiskDriver_initConfig(&disk2, disk2_filename, 50, &grow_config);
+			int grow_blocks[3] = { 10, 99, 39999 }, grow_sizes[3] = { 50, 100, 40000 }, grow_ret = 0;
+			for(int i = 0; i < 3; i++) {
+				if(i > 0) grow_ret |= DiskDriver_grow(&disk2, grow_sizes[i]);
+				sprintf(legacy_block, "Blocco %d", grow_blocks[i]);
+				grow_ret |= DiskDriver_writeBlock(&disk2, legacy_block, grow_blocks[i]);
+			}
+			printf("\n    Backend %s: grow => %d, blocchi %d, bitmap a %lld, blocchi liberi %d, grow(1000) => %d", disk2.backend->name, grow_ret,
+				(int) disk2.header->num_blocks, (long long) disk2.header->bitmap_offset, DiskDriver_freeCount(&disk2), DiskDriver_grow(&disk2, 1000));
+			printf("\n    La readBlock legge =>");
+			for(int i = 0; i < 3; i++) {
+				memset(dest, 0, BLOCK_SIZE);
+				DiskDriver_readBlock(&disk2, dest, grow_blocks[i]);
+				printf(" %s;", (char *) dest);
+			}
+			DiskDriver_init(&disk3, disk2_filename, 50);
+			memset(dest, 0, BLOCK_SIZE);
+			DiskDriver_readBlock(&disk3, dest, 39999);
+			printf("\n    Riaperto con la mmap: blocchi %d, blocchi liberi %d, primo libero dopo il 99 => %d, la readBlock(39999) legge => %s",
+				(int) disk3.header->num_blocks, DiskDriver_freeCount(&disk3), DiskDriver_getFreeBlock(&disk3, 99), (char *) dest);
+			unlink(disk2_filename);
+		}
+
+
+		// Test dell'aggiornamento di un disco della versione 2: il DiskHeader era di 80 byte (senza i campi del journal) e la bitmap
+		// lo seguiva subito. Il disco viene creato e poi riscritto nel vecchio formato; all'apertura la bitmap viene spostata dopo i blocchi
+		printf("\n\n+++ Test DiskDriver_init() [disco della versione 2]");
+		sprintf(disk2_filename, "test/v2_%d.txt", (int) time(NULL));
+		DiskDriver_init(&disk2, disk2_filename, 50);
+		memset(legacy_block, 0, BLOCK_SIZE);
+		strcpy(legacy_block, "Formato della versione 2");
+		DiskDriver_writeBlock(&disk2, legacy_block, 7);
+		DiskHeader v2_header = *disk2.header;
+		v2_header.version = 2;
+		v2_header.bitmap_offset = 80;
+		legacy_fd = open(disk2_filename, O_RDWR);
+		pwrite(legacy_fd, disk2.bitmap_data, v2_header.bitmap_entries, v2_header.bitmap_offset);
+		pwrite(legacy_fd, &v2_header, 80, 0);
+		close(legacy_fd);
+		DiskDriver_init(&disk3, disk2_filename, 50);
+		memset(dest, 0, BLOCK_SIZE);
+		legacy_ret = DiskDriver_readBlock(&disk3, dest, 7);
+		printf("\n    Versione %u, bitmap a %lld, blocchi a %lld, blocchi liberi %d, blocchi del journal %lld", disk3.header->version,
+			(long long) disk3.header->bitmap_offset, (long long) disk3.header->data_offset, DiskDriver_freeCount(&disk3), (long long) disk3.header->journal_blocks);
+		printf("\n    readBlock(7) => %d: %s", legacy_ret, (char *) dest);
+		unlink(disk2_filename);
+
+		// Test del journal: 4 thread fanno il commit di 50 transazioni ciascuno, con due blocchi per transazione. Le transazioni
+		// che arrivano mentre un gruppo viene scritto formano il gruppo successivo, scritto con una sola fdatasync
+		printf("\n\n+++ Test Journal_create()");
+		printf("\n+++ Test Journal_commit()");
+		sprintf(disk2_filename, "test/journal_%d.txt", (int) time(NULL));
+		DiskDriver_init(&disk2, disk2_filename, 1024);
+		int journal_start = DiskDriver_allocRun(&disk2, 64, 960);
+		Journal * journal = Journal_create(&disk2, journal_start, 64);
+		uint64_t journal_syncs = disk2.syncs;
+		journal_threads(journal, 10, 4, 50);
+		printf("\n    Journal di %lld blocchi dal blocco %lld", (long long) disk2.header->journal_blocks, (long long) disk2.header->journal_block);
+		printf("\n    %llu transazioni in %llu gruppi, %llu checkpoint, %llu fdatasync", (unsigned long long) journal->transactions,
+			(unsigned long long) journal->groups, (unsigned long long) journal->checkpoints, (unsigned long long) (disk2.syncs - journal_syncs));
+		printf("\n    La readBlock legge =>");
+		for(int i = 10; i < 18; i += 2) {
+			DiskDriver_readBlock(&disk2, dest, i);
+			printf(" %s;", (char *) dest);
+		}
+
+		// Test del replay: faccio il commit di due transazioni, poi simulo un crash rimettendo nel file il vecchio contenuto dei loro
+		// blocchi (come se non fossero mai stati scritti al loro posto) e cancellando il commit della seconda. Riaprendo il journal,
+		// solo la prima transazione viene riportata sul disco
+		printf("\n\n+++ Test Journal_open() [dopo un crash]");
+		char vecchio_blocco[BLOCK_SIZE];
+		memset(vecchio_blocco, 0, BLOCK_SIZE);
+		strcpy(vecchio_blocco, "Vecchio");
+		DiskDriver_writeBlock(&disk2, vecchio_blocco, 100);
+		DiskDriver_writeBlock(&disk2, vecchio_blocco, 101);
+		Journal_checkpoint(journal);
+		for(int i = 0; i < 2; i++) {
+			JournalTx * tx = Journal_begin(journal);
+			memset(legacy_block, 0, BLOCK_SIZE);
+			sprintf(legacy_block, "Nuovo %d", 100 + i);
+			Journal_write(tx, legacy_block, 100 + i);
+			Journal_commit(tx);
+		}
+		int commit_pos = journal->tail > 1 ? journal->tail - 1 : journal->num_blocks - 1;
+		memset(legacy_block, 0, BLOCK_SIZE);
+		legacy_fd = open(disk2_filename, O_RDWR);
+		pwrite(legacy_fd, vecchio_blocco, BLOCK_SIZE, disk2.header->data_offset + 100 * BLOCK_SIZE);
+		pwrite(legacy_fd, vecchio_blocco, BLOCK_SIZE, disk2.header->data_offset + 101 * BLOCK_SIZE);
+		pwrite(legacy_fd, legacy_block, BLOCK_SIZE, disk2.header->data_offset + (int64_t) (journal->start + commit_pos) * BLOCK_SIZE);
+		close(legacy_fd);
+		DiskDriver_init(&disk3, disk2_filename, 1024);
+		Journal * riaperto = Journal_open(&disk3);
+		printf("\n    Transazioni riportate sul disco => %llu", riaperto != NULL ? (unsigned long long) riaperto->replayed : 0ULL);
+		printf("\n    La readBlock legge =>");
+		for(int i = 100; i < 102; i++) {
+			DiskDriver_readBlock(&disk3, dest, i);
+			printf(" %s;", (char *) dest);
+		}
+		Journal_close(riaperto);
+		unlink(disk2_filename);
+
+		// Test della chiusura del disco con ogni backend: dopo DiskDriver_unmount il disco è pulito, e riaprendolo contatori e
+		// riassunto della bitmap vengono letti dal riassunto salvato, senza leggere la bitmap
+		printf("\n\n+++ Test DiskDriver_unmount()");
+		for(int backend = DISK_BACKEND_MMAP; backend <= DISK_BACKEND_WINDOWS; backend++) {
+			DiskConfig unmount_config = { backend, 0, 0, DISK_IO_AUTO, 4096, 2 };
+			sprintf(disk2_filename, "test/unmount_%d_%d.txt", backend, (int) time(NULL));
+			DiskDriver_initConfig(&disk2, disk2_filename, 10000, &unmount_config);
+			DiskDriver_allocRun(&disk2, 5000, 0);
+			memset(legacy_block, 0, BLOCK_SIZE);
+			strcpy(legacy_block, "Prima dello smontaggio");
+			DiskDriver_writeBlock(&disk2, legacy_block, 9000);
+			int unmount_ret = DiskDriver_unmount(&disk2);
+			DiskDriver_init(&disk3, disk2_filename, 10000);
+			memset(dest, 0, BLOCK_SIZE);
+			DiskDriver_readBlock(&disk3, dest, 9000);
+			printf("\n    Backend %s: unmount => %d, riaperto pulito => %d, blocchi liberi %d, nel gruppo 1 %d, nel gruppo 2 %d, primo libero %d, la readBlock(9000) legge => %s",
+				disk2.backend->name, unmount_ret, disk3.clean_mount, DiskDriver_freeCount(&disk3), disk3.groups[1].free_blocks,
+				disk3.groups[2].free_blocks, (int) disk3.header->first_free_block, (char *) dest);
+			DiskDriver_unmount(&disk3);
+			if(backend != DISK_BACKEND_WINDOWS) unlink(disk2_filename);
+		}
+
+		// Simulo un crash: il disco viene modificato e il contatore dei blocchi liberi nel DiskHeader è sbagliato, ma il disco non
+		// viene smontato. Riaprendolo, la bitmap viene letta di nuovo e il contatore viene ricalcolato
+		printf("\n\n+++ Test DiskDriver_init() [dopo un crash]");
+		DiskDriver_init(&disk2, disk2_filename, 10000);
+		DiskDriver_writeBlock(&disk2, legacy_block, 9001);
+		DiskDriver_flush(&disk2);
+		int64_t contatore_sbagliato = 1;
+		pwrite(disk2.fd, &contatore_sbagliato, sizeof(contatore_sbagliato), offsetof(DiskHeader, free_blocks));
+		DiskDriver_init(&disk3, disk2_filename, 10000);
+		printf("\n    Riaperto pulito => %d, blocchi liberi %d, nel gruppo 2 %d", disk3.clean_mount, DiskDriver_freeCount(&disk3), disk3.groups[2].free_blocks);
+
+		// Un riassunto rovinato non viene usato: il disco viene smontato, poi cambio un byte del riassunto
+		DiskDriver_unmount(&disk3);
+		legacy_fd = open(disk2_filename, O_RDWR);
+		DiskHeader unmount_header;
+		pread(legacy_fd, &unmount_header, sizeof(unmount_header), 0);
+		pwrite(legacy_fd, "X", 1, unmount_header.summary_offset + unmount_header.summary_bytes - 1);
+		close(legacy_fd);
+		DiskDriver_init(&disk3, disk2_filename, 10000);
+		printf("\n    Con il riassunto rovinato: disco pulito nel file => %d, riaperto pulito => %d, blocchi liberi %d", unmount_header.clean,
+			disk3.clean_mount, DiskDriver_freeCount(&disk3));
+		DiskDriver_unmount(&disk3);
+		unlink(disk2_filename);
+
+		// Test del CRC32C: il valore di controllo della stringa "123456789", con l'istruzione di SSE4.2 (se c'è) e con lo slicing-by-8
+		printf("\n\n+++ Test CRC32C_update()");
+		printf("\n    Istruzione SSE4.2 => %d, CRC32C(\"123456789\") => %08x, in software => %08x, in due pezzi => %08x", CRC32C_hardware(),
+			CRC32C_update(0, "123456789", 9), CRC32C_updateSoftware(0, "123456789", 9), CRC32C_update(CRC32C_update(0, "1234", 4), "56789", 5));
+
+		// Test dei checksum dei blocchi con ogni backend: il blocco 5 viene scritto prima di riservare la tabella, il 6 dopo.
+		// Poi cambio il blocco 5 nel file, senza passare dal disco: finché il blocco resta in memoria già verificato non viene
+		// controllato di nuovo, ma quando viene riletto dal file (qui, dopo aver smontato e rimontato il disco) l'errore viene trovato
+		printf("\n\n+++ Test DiskDriver_enableChecksums()");
+		for(int backend = DISK_BACKEND_MMAP; backend <= DISK_BACKEND_WINDOWS; backend++) {
+			DiskConfig checksum_config = { backend, 0, 0, DISK_IO_AUTO, 4096, 2 };
+			sprintf(disk2_filename, "test/checksum_%d_%d.txt", backend, (int) time(NULL));
+			DiskDriver_initConfig(&disk2, disk2_filename, 2000, &checksum_config);
+			memset(legacy_block, 0, BLOCK_SIZE);
+			strcpy(legacy_block, "Blocco 5");
+			DiskDriver_writeBlock(&disk2, legacy_block, 5);
+			int checksum_ret = DiskDriver_enableChecksums(&disk2);
+			strcpy(legacy_block, "Blocco 6");
+			DiskDriver_writeBlock(&disk2, legacy_block, 6);
+			int letture_ok = (DiskDriver_readBlock(&disk2, dest, 5) == 0) + (DiskDriver_readBlock(&disk2, dest, 6) == 0);
+			printf("\n    Backend %s: enableChecksums => %d, tabella di %lld blocchi dal blocco %lld, letture corrette %d su 2", disk2.backend->name,
+				checksum_ret, (long long) disk2.header->checksum_blocks, (long long) disk2.header->checksum_block, letture_ok);
+
+			legacy_fd = open(disk2_filename, O_RDWR);
+			pwrite(legacy_fd, "Blocco 7", 8, disk2.header->data_offset + 5 * BLOCK_SIZE);
+			close(legacy_fd);
+			int lettura_pigra = DiskDriver_readBlock(&disk2, dest, 5);
+			DiskDriver_unmount(&disk2);
+			DiskDriver_initConfig(&disk2, disk2_filename, 2000, &checksum_config);
+			int lettura_5 = DiskDriver_readBlock(&disk2, dest, 5), lettura_6 = DiskDriver_readBlock(&disk2, dest, 6);
+			DiskIOCompletion checksum_completion;
+			DiskDriver_submitRead(&disk2, dest, 5, NULL);
+			DiskDriver_poll(&disk2, &checksum_completion, 1, 1);
+			printf("\n    Blocco 5 cambiato nel file: readBlock(5) ancora in memoria => %d, dopo averlo riaperto readBlock(5) => %d, readBlock(6) => %d, "
+				"lettura asincrona del 5 => %d, checksum verificati %llu, errori %llu", lettura_pigra, lettura_5, lettura_6, checksum_completion.result,
+				(unsigned long long) disk2.checksum_verifies, (unsigned long long) disk2.checksum_errors);
+			DiskDriver_unmount(&disk2);
+			unlink(disk2_filename);
+		}
+
+		// Con la mmap il blocco viene verificato di nuovo dopo averne scartato le pagine con DISK_ADVISE_DONTNEED. Poi il disco cresce:
+		// la tabella deve coprire i nuovi blocchi, quindi viene spostata in una zona più grande
+		sprintf(disk2_filename, "test/checksum_grow_%d.txt", (int) time(NULL));
+		DiskDriver_init(&disk2, disk2_filename, 2000);
+		DiskDriver_enableChecksums(&disk2);
+		strcpy(legacy_block, "Blocco 5");
+		DiskDriver_writeBlock(&disk2, legacy_block, 5);
+		legacy_fd = open(disk2_filename, O_RDWR);
+		pwrite(legacy_fd, "Blocco 7", 8, disk2.header->data_offset + 5 * BLOCK_SIZE);
+		close(legacy_fd);
+		int lettura_pigra = DiskDriver_readBlock(&disk2, dest, 5);
+		DiskDriver_advise(&disk2, 5, 1, DISK_ADVISE_DONTNEED);
+		printf("\n    Backend mmap: readBlock(5) => %d, dopo DISK_ADVISE_DONTNEED => %d", lettura_pigra, DiskDriver_readBlock(&disk2, dest, 5));
+		DiskDriver_writeBlock(&disk2, legacy_block, 5);
+		int grow_ret = DiskDriver_grow(&disk2, 40000);
+		strcpy(legacy_block, "Blocco 39999");
+		DiskDriver_writeBlock(&disk2, legacy_block, 39999);
+		DiskDriver_unmount(&disk2);
+		DiskDriver_init(&disk2, disk2_filename, 40000);
+		int letture_grow = (DiskDriver_readBlock(&disk2, dest, 5) == 0) + (DiskDriver_readBlock(&disk2, dest, 39999) == 0);
+		printf("\n    grow(40000) => %d, tabella di %lld blocchi dal blocco %lld, dopo averlo riaperto letture corrette %d su 2: %s", grow_ret,
+			(long long) disk2.header->checksum_blocks, (long long) disk2.header->checksum_block, letture_grow, (char *) dest);
+		DiskDriver_disableChecksums(&disk2);
+		printf("\n    disableChecksums: tabella di %lld blocchi, blocchi liberi %d", (long long) disk2.header->checksum_blocks, DiskDriver_freeCount(&disk2));
+		DiskDriver_unmount(&disk2);
+		unlink(disk2_filename);
+
 	}else if(test == 3) {
 
 		// Test SimpleFS_init
@@ -176,6 +685,23 @@ int main(int agc, char** argv) {
 		printf("\n    BitMap => ");
 		stampa_in_binario(disk.bitmap_data);
 
+		// Un nome che non sta nel FileControlBlock (124 byte con il terminatore) viene rifiutato senza occupare blocchi
+		char nome_lungo[200];
+		memset(nome_lungo, 'x', 124);
+		nome_lungo[124] = '\0';
+		int liberi_nome = DiskDriver_freeCount(&disk);
+		FileHandle* fh_lungo = SimpleFS_createFile(directory_handle, nome_lungo);
+		int mkdir_lungo = SimpleFS_mkDir(directory_handle, nome_lungo);
+		int occupati_nome = liberi_nome - DiskDriver_freeCount(&disk);
+		nome_lungo[123] = '\0';
+		FileHandle* fh_massimo = SimpleFS_createFile(directory_handle, nome_lungo);
+		printf("\n    Nome di 124 caratteri: SimpleFS_createFile => %s, SimpleFS_mkDir => %d, blocchi occupati %d; nome di 123 caratteri => %s",
+			fh_lungo == NULL ? "NULL" : "creato", mkdir_lungo, occupati_nome, fh_massimo != NULL ? "creato" : "NULL");
+		if(fh_massimo != NULL) {
+			SimpleFS_close(fh_massimo);
+			SimpleFS_remove(directory_handle, nome_lungo);
+		}
+
 	 	// Test SimpleFS_mkDir
 		printf("\n\n+++ Test SimpleFS_mkDir()");
 		int ret = SimpleFS_mkDir(directory_handle, "pluto");
@@ -239,7 +765,7 @@ int main(int agc, char** argv) {
 		printf("\n\n+++ Test SimpleFS_write()");
 		SimpleFS_seek(file_handle, 12);
 		ret = SimpleFS_write(file_handle, "i viaggi", 8);
-		printf("\n    SimpleFS_seek(file_handle, 12) => %d", SimpleFS_seek(file_handle, 12));
+		printf("\n    SimpleFS_seek(file_handle, 12) => %d", (int) SimpleFS_seek(file_handle, 12));
 		printf("\n    SimpleFS_write(file_handle, stringa, %d) => %d", 8, ret);
 		if(ret == 8) {
 			printf("\n    Scrittura avvenuta correttamente");
@@ -253,6 +779,7 @@ int main(int agc, char** argv) {
 		printf("\n\n+++ Test SimpleFS_read()");
 		int size = file_handle->fcb->fcb.size_in_bytes;
 		char data[size];
+		SimpleFS_seek(file_handle, 0);
 		printf("\n    SimpleFS_read(file_handle, data, %d) ha restituito: %d", size, SimpleFS_read(file_handle, data, size));
 		printf("\n    Adesso \"data\" contiene: %s", data);
 
@@ -324,6 +851,1361 @@ int main(int agc, char** argv) {
 		printf("\n    BitMap => ");
 		stampa_in_binario(disk.bitmap_data);
 
+		// Test della conversione di un file system con SIMPLEFS_VERSION 0: la parte alta di size_in_bytes conteneva size_in_blocks
+		printf("\n\n+++ Test SimpleFS_init() [file system della versione 0]");
+		file_handle = SimpleFS_createFile(directory_handle, "versione_0.txt");
+		SimpleFS_write(file_handle, "abc", 3);
+		FirstFileBlock * vecchio = DiskDriver_getBlockPtrMut(&disk, file_handle->fcb->fcb.block_in_disk);
+		vecchio->fcb.size_in_bytes |= (int64_t) 1 << 32;
+		DiskDriver_markDirty(&disk, file_handle->fcb->fcb.block_in_disk);
+		DiskDriver_releaseBlockPtr(&disk, file_handle->fcb->fcb.block_in_disk);
+		SimpleFS_close(file_handle);
+		disk.header->fs_version = 0;
+		directory_handle = SimpleFS_init(&fs, &disk);
+		file_handle = SimpleFS_openFile(directory_handle, "versione_0.txt");
+		printf("\n    Dopo la conversione: versione %d, dimensione di versione_0.txt => %lld", disk.header->fs_version,
+			file_handle != NULL ? (long long) file_handle->fcb->fcb.size_in_bytes : -1LL);
+
+		// Test della crescita del disco con un file aperto: il FileHandle resta valido e può usare i nuovi blocchi
+		printf("\n\n+++ Test DiskDriver_grow() [file aperto]");
+		int blocchi_prima = disk.header->num_blocks;
+		ret = DiskDriver_grow(&disk, blocchi_prima + 10000);
+		printf("\n    DiskDriver_grow(&disk, %d) => %d, blocchi liberi => %d", blocchi_prima + 10000, ret, DiskDriver_freeCount(&disk));
+		SimpleFS_seek(file_handle, 3);
+		ret = SimpleFS_write(file_handle, "def", 3);
+		SimpleFS_seek(file_handle, 0);
+		memset(data, 0, 7);
+		printf("\n    SimpleFS_write(file_handle, \"def\", 3) => %d, SimpleFS_read(file_handle, data, 6) => %d: %s", ret,
+			SimpleFS_read(file_handle, data, 6), data);
+		SimpleFS_close(file_handle);
+
+		// Test del journal dei metadati: su un disco da 4096 blocchi il file system riserva un journal alla fine del disco, e ogni
+		// file creato è un'unica transazione (il suo primo blocco e il blocco della cartella) scritta con una sola fdatasync
+		printf("\n\n+++ Test SimpleFS_createFile() [journal]");
+		SimpleFS fs_journal;
+		DiskDriver disk_journal;
+		char journal_filename[255];
+		sprintf(journal_filename, "test/journal_%d.txt", (int) time(NULL));
+		DiskDriver_init(&disk_journal, journal_filename, 4096);
+		directory_handle = SimpleFS_init(&fs_journal, &disk_journal);
+		printf("\n    Journal di %lld blocchi dal blocco %lld", (long long) disk_journal.header->journal_blocks, (long long) disk_journal.header->journal_block);
+		uint64_t syncs = disk_journal.syncs;
+		char journal_name[32];
+		for(i = 0; i < 20; i++) {
+			sprintf(journal_name, "journal_%d.txt", i);
+			SimpleFS_close(SimpleFS_createFile(directory_handle, journal_name));
+		}
+		printf("\n    20 file creati con %llu fdatasync: %llu transazioni in %llu gruppi", (unsigned long long) (disk_journal.syncs - syncs),
+			(unsigned long long) fs_journal.journal->transactions, (unsigned long long) fs_journal.journal->groups);
+
+		// Simulo un crash subito dopo il commit della creazione di un file: nel file rimetto il vecchio contenuto della cartella,
+		// come se il blocco non fosse mai stato scritto al suo posto. Riaprendo il disco, il replay del journal lo riscrive
+		printf("\n\n+++ Test SimpleFS_init() [replay del journal]");
+		char vecchia_radice[BLOCK_SIZE];
+		DiskDriver_readBlock(&disk_journal, vecchia_radice, 0);
+		SimpleFS_close(SimpleFS_createFile(directory_handle, "dopo_il_crash.txt"));
+		int journal_fd = open(journal_filename, O_RDWR);
+		pwrite(journal_fd, vecchia_radice, BLOCK_SIZE, disk_journal.header->data_offset);
+		close(journal_fd);
+		SimpleFS fs_riaperto;
+		DiskDriver disk_riaperto;
+		DiskDriver_init(&disk_riaperto, journal_filename, 4096);
+		directory_handle = SimpleFS_init(&fs_riaperto, &disk_riaperto);
+		file_handle = SimpleFS_openFile(directory_handle, "dopo_il_crash.txt");
+		printf("\n    Transazioni riportate sul disco => %llu, SimpleFS_openFile(\"dopo_il_crash.txt\") => %s",
+			fs_riaperto.journal != NULL ? (unsigned long long) fs_riaperto.journal->replayed : 0ULL, file_handle != NULL ? "trovato" : "NULL");
+		SimpleFS_close(file_handle);
+
+		// Test dei consigli di accesso: un file di 40 blocchi letto con SEQUENTIAL (finestra di readahead più grande),
+		// dopo aver scartato le sue pagine con DONTNEED e averle anticipate con WILLNEED
+		printf("\n\n+++ Test SimpleFS_advise()");
+		file_handle = SimpleFS_createFile(directory_handle, "advise.txt");
+		char * testo = malloc(40 * BLOCK_SIZE + 1), * letto = malloc(40 * BLOCK_SIZE + 1);
+		for(i = 0; i < 40 * BLOCK_SIZE; i++) testo[i] = 'a' + i % 26;
+		testo[40 * BLOCK_SIZE] = '\0';
+		SimpleFS_write(file_handle, testo, 40 * BLOCK_SIZE);
+		printf("\n    SimpleFS_advise(file_handle, 0, 0, SIMPLEFS_ADVISE_DONTNEED) => %d", SimpleFS_advise(file_handle, 0, 0, SIMPLEFS_ADVISE_DONTNEED));
+		printf("\n    SimpleFS_advise(file_handle, 0, 4096, SIMPLEFS_ADVISE_WILLNEED) => %d", SimpleFS_advise(file_handle, 0, 4096, SIMPLEFS_ADVISE_WILLNEED));
+		ret = SimpleFS_advise(file_handle, 0, 0, SIMPLEFS_ADVISE_SEQUENTIAL);
+		printf("\n    SimpleFS_advise(file_handle, 0, 0, SIMPLEFS_ADVISE_SEQUENTIAL) => %d, finestra di readahead => %d blocchi", ret, file_handle->readahead);
+		printf("\n    SimpleFS_advise(file_handle, 0, 0, 7) => %d", SimpleFS_advise(file_handle, 0, 0, 7));
+		SimpleFS_seek(file_handle, 0);
+		ret = SimpleFS_read(file_handle, letto, 40 * BLOCK_SIZE);
+		printf("\n    SimpleFS_read(file_handle, letto, %d) => %d, uguale al testo scritto => %d, blocchi anticipati => %d", 40 * BLOCK_SIZE, ret,
+			strcmp(testo, letto) == 0, file_handle->readahead_end - file_handle->readahead_start);
+		SimpleFS_advise(file_handle, 0, 0, SIMPLEFS_ADVISE_RANDOM);
+		SimpleFS_seek(file_handle, 0);
+		ret = SimpleFS_read(file_handle, letto, 40 * BLOCK_SIZE);
+		printf("\n    Con SIMPLEFS_ADVISE_RANDOM: SimpleFS_read => %d, finestra di readahead => %d blocchi", ret, file_handle->readahead);
+		free(testo);
+		free(letto);
+		SimpleFS_close(file_handle);
+
+		// Test del cursore dei file: 20000 caratteri aggiunti 100 alla volta e riletti 100 alla volta, senza spostare il cursore; il
+		// FileHandle ricorda il blocco della catena in cui si trova, anche dopo una seek all'indietro e una scrittura a metà del file
+		printf("\n\n+++ Test SimpleFS_write() e SimpleFS_read() [cursore]");
+		file_handle = SimpleFS_createFile(directory_handle, "cursore.txt");
+		char * flusso = malloc(20001), * riletto = malloc(20001), pezzo[101];
+		for(i = 0; i < 20000; i++) flusso[i] = 'a' + i % 26;
+		flusso[20000] = '\0';
+		int scritti_cursore = 0, letti_cursore = 0;
+		for(i = 0; i < 20000; i += 100) {
+			memcpy(pezzo, flusso + i, 100);
+			pezzo[100] = '\0';
+			scritti_cursore += SimpleFS_write(file_handle, pezzo, 100);
+		}
+		printf("\n    200 SimpleFS_write da 100 byte => %d byte, dimensione %lld, cursore nel blocco %d della catena", scritti_cursore,
+			(long long) file_handle->fcb->fcb.size_in_bytes, file_handle->block_index);
+		SimpleFS_seek(file_handle, 0);
+		for(i = 0; i < 20000; i += 100) letti_cursore += SimpleFS_read(file_handle, riletto + i, 100);
+		printf("\n    200 SimpleFS_read da 100 byte => %d byte, uguali => %d, cursore nel blocco %d", letti_cursore,
+			memcmp(flusso, riletto, 20000) == 0, file_handle->block_index);
+		SimpleFS_seek(file_handle, 5000);
+		ret = SimpleFS_write(file_handle, "XYZ", 3);
+		memcpy(flusso + 5000, "XYZ", 3);
+		SimpleFS_seek(file_handle, 4990);
+		memset(pezzo, 0, sizeof(pezzo));
+		SimpleFS_read(file_handle, pezzo, 20);
+		printf("\n    SimpleFS_write(\"XYZ\") in 5000 => %d, SimpleFS_read di 20 byte da 4990 => %s, uguali => %d, cursore nel blocco %d", ret, pezzo,
+			memcmp(pezzo, flusso + 4990, 20) == 0, file_handle->block_index);
+		SimpleFS_close(file_handle);
+		file_handle = SimpleFS_openFile(directory_handle, "cursore.txt");
+		memset(riletto, 0, 20001);
+		ret = SimpleFS_read(file_handle, riletto, 20000);
+		printf("\n    Dopo averlo riaperto: SimpleFS_read => %d, uguale => %d", ret, memcmp(flusso, riletto, 20000) == 0);
+		SimpleFS_close(file_handle);
+		SimpleFS_remove(directory_handle, "cursore.txt");
+		free(flusso);
+		free(riletto);
+
+		// Test dei dati binari: 3000 byte con tutti i valori (anche zero) scritti in un file a catena e riletti uguali; una lettura che
+		// supera la fine del file si ferma alla fine e mette a zero il resto del buffer
+		printf("\n\n+++ Test SimpleFS_write() e SimpleFS_read() [dati binari]");
+		file_handle = SimpleFS_createFile(directory_handle, "binario.bin");
+		unsigned char binario[3000], binario_letto[4000];
+		for(i = 0; i < 3000; i++) binario[i] = (i * 31 + i / 256) % 256;
+		ret = SimpleFS_write(file_handle, binario, 3000);
+		SimpleFS_seek(file_handle, 0);
+		memset(binario_letto, 0xff, sizeof(binario_letto));
+		int letti_binario = SimpleFS_read(file_handle, (char *) binario_letto, 4000), zeri = 0;
+		for(i = 3000; i < 4000; i++) zeri += binario_letto[i] == 0;
+		printf("\n    SimpleFS_write(file_handle, binario, 3000) => %d, SimpleFS_read(file_handle, binario_letto, 4000) => %d, uguali => %d,"
+			" byte a zero dopo la fine %d", ret, letti_binario, memcmp(binario, binario_letto, 3000) == 0, zeri);
+		SimpleFS_seek(file_handle, 1000);
+		ret = SimpleFS_write(file_handle, "\0\0\0\0", 4);
+		memset(binario + 1000, 0, 4);
+		SimpleFS_seek(file_handle, 990);
+		letti_binario = SimpleFS_read(file_handle, (char *) binario_letto, 30);
+		printf("\n    SimpleFS_write di 4 byte a zero in 1000 => %d, SimpleFS_read di 30 byte da 990 => %d, uguali => %d, dimensione %lld", ret,
+			letti_binario, memcmp(binario + 990, binario_letto, 30) == 0, (long long) file_handle->fcb->fcb.size_in_bytes);
+		SimpleFS_close(file_handle);
+		SimpleFS_remove(directory_handle, "binario.bin");
+
+		// Test di SimpleFS_seekFrom: in ogni formato (a catena, compresso, a extent, indicizzato) il cursore va oltre la fine del file
+		// con SEEK_END, la scrittura lascia a zero i byte in mezzo (anche dopo aver riaperto il file) e SEEK_CUR torna indietro dalla
+		// posizione corrente. Una posizione negativa o un "whence" sconosciuto danno errore
+		printf("\n\n+++ Test SimpleFS_seek() [SEEK_CUR, SEEK_END, oltre la fine]");
+		const char * formati_seek[] = { "a catena", "compresso", "a extent", "indicizzato" };
+		int salto = 100000, lunghezza_seek = 6 + salto + 4;
+		char * letto_seek = malloc(lunghezza_seek + 100);
+		for(int formato = 0; formato < 4; formato++) {
+			file_handle = SimpleFS_createFile(directory_handle, "seek.txt");
+			if(formato == 1) SimpleFS_setCompression(file_handle, 1);
+			if(formato == 2) SimpleFS_setLayout(file_handle, SIMPLEFS_LAYOUT_EXTENTS);
+			if(formato == 3) SimpleFS_setLayout(file_handle, SIMPLEFS_LAYOUT_INDEXED);
+			SimpleFS_write(file_handle, "inizio", 6);
+			int64_t dopo_la_fine = SimpleFS_seekFrom(file_handle, salto, SEEK_END);
+			ret = SimpleFS_write(file_handle, "fine", 4);
+			int64_t dimensione_seek = SimpleFS_size(file_handle);
+			SimpleFS_close(file_handle);
+
+			// Rileggo il file riaperto: i byte in mezzo valgono zero
+			file_handle = SimpleFS_openFile(directory_handle, "seek.txt");
+			memset(letto_seek, 0xff, lunghezza_seek + 100);
+			int letti_seek = SimpleFS_read(file_handle, letto_seek, lunghezza_seek + 100), zeri_seek = 0;
+			for(i = 6; i < 6 + salto; i++) zeri_seek += letto_seek[i] == 0;
+			int64_t indietro = SimpleFS_seekFrom(file_handle, -4, SEEK_CUR);
+			char fine[5] = { 0 };
+			SimpleFS_read(file_handle, fine, 4);
+			printf("\n    [%s] SimpleFS_seekFrom(file_handle, %d, SEEK_END) => %lld, SimpleFS_write => %d, SimpleFS_size => %lld,"
+				" SimpleFS_read => %d, uguali => %d, byte a zero in mezzo %d", formati_seek[formato], salto, (long long) dopo_la_fine, ret,
+				(long long) dimensione_seek, letti_seek, memcmp(letto_seek, "inizio", 6) == 0 && memcmp(letto_seek + 6 + salto, "fine", 4) == 0,
+				zeri_seek);
+			printf("\n    [%s] SimpleFS_seekFrom(file_handle, -4, SEEK_CUR) => %lld, letti \"%s\", SimpleFS_seekFrom(file_handle, -%d, SEEK_END) => %lld",
+				formati_seek[formato], (long long) indietro, fine, lunghezza_seek, (long long) SimpleFS_seekFrom(file_handle, -lunghezza_seek, SEEK_END));
+			SimpleFS_close(file_handle);
+			SimpleFS_remove(directory_handle, "seek.txt");
+		}
+		free(letto_seek);
+		file_handle = SimpleFS_createFile(directory_handle, "seek.txt");
+		int64_t negativa = SimpleFS_seekFrom(file_handle, -1, SEEK_SET), prima_inizio = SimpleFS_seekFrom(file_handle, -1, SEEK_CUR);
+		int64_t sconosciuto = SimpleFS_seekFrom(file_handle, 0, 7), oltre = SimpleFS_seek(file_handle, 5000);
+		printf("\n    SimpleFS_seekFrom(file_handle, -1, SEEK_SET) => %lld, SimpleFS_seekFrom(file_handle, -1, SEEK_CUR) => %lld,"
+			" SimpleFS_seekFrom(file_handle, 0, 7) => %lld, SimpleFS_seek(file_handle, 5000) su un file vuoto => %lld", (long long) negativa,
+			(long long) prima_inizio, (long long) sconosciuto, (long long) oltre);
+		SimpleFS_close(file_handle);
+		SimpleFS_remove(directory_handle, "seek.txt");
+
+		// Test dei file compressi: la Divina Commedia scritta in un file compresso occupa meno blocchi, si legge tutta o da un punto
+		// qualunque (decomprimendo solo i chunk che servono), e dopo averla riaperta si legge dall'indice scritto sul disco
+		printf("\n\n+++ Test SimpleFS_setCompression()");
+		struct stat commedia_stat;
+		stat("divina_commedia.txt", &commedia_stat);
+		int commedia_size = commedia_stat.st_size;
+		char * commedia = malloc(commedia_size), * letta = malloc(commedia_size);
+		FILE * commedia_file = fopen("divina_commedia.txt", "r");
+		fread(commedia, 1, commedia_size, commedia_file);
+		fclose(commedia_file);
+		int64_t liberi_prima = DiskDriver_freeCount(&disk_riaperto);
+		file_handle = SimpleFS_createFile(directory_handle, "compresso.txt");
+		printf("\n    SimpleFS_setCompression(file_handle, 1) => %d", SimpleFS_setCompression(file_handle, 1));
+		ret = SimpleFS_write(file_handle, commedia, commedia_size);
+		int64_t usati = liberi_prima - DiskDriver_freeCount(&disk_riaperto);
+		printf("\n    SimpleFS_write(file_handle, commedia, %d) => %d, blocchi usati %lld invece di %d, %d chunk",
+			commedia_size, ret, (long long) usati, 1 + (int) ((commedia_size - sizeof(file_handle->fcb->data) + sizeof(((FileBlock *) 0)->data) - 1) /
+			sizeof(((FileBlock *) 0)->data)), file_handle->chunks->num_entries);
+		printf("\n    SimpleFS_setCompression(file_handle, 0) su un file non vuoto => %d", SimpleFS_setCompression(file_handle, 0));
+		SimpleFS_seek(file_handle, 0);
+		ret = SimpleFS_read(file_handle, letta, commedia_size);
+		printf("\n    SimpleFS_read(file_handle, letta, %d) => %d, uguale => %d", commedia_size, ret, memcmp(commedia, letta, commedia_size) == 0);
+
+		// Sovrascrivo 10 byte a cavallo di due chunk e li rileggo da un altro FileHandle, che legge l'indice dal disco
+		SimpleFS_seek(file_handle, 3 * SIMPLEFS_CHUNK_SIZE - 5);
+		SimpleFS_write(file_handle, "0123456789", 10);
+		memcpy(commedia + 3 * SIMPLEFS_CHUNK_SIZE - 5, "0123456789", 10);
+		SimpleFS_close(file_handle);
+		file_handle = SimpleFS_openFile(directory_handle, "compresso.txt");
+		SimpleFS_seek(file_handle, 3 * SIMPLEFS_CHUNK_SIZE - 8);
+		memset(letta, 0, 17);
+		ret = SimpleFS_read(file_handle, letta, 16);
+		printf("\n    Dopo averlo riaperto: SimpleFS_read dalla posizione %d => %d: %s", 3 * SIMPLEFS_CHUNK_SIZE - 8, ret, letta);
+		SimpleFS_seek(file_handle, commedia_size - 100);
+		ret = SimpleFS_read(file_handle, letta, 1000);
+		printf("\n    SimpleFS_read degli ultimi 100 byte => %d, uguale => %d", ret, memcmp(commedia + commedia_size - 100, letta, 100) == 0);
+		SimpleFS_seek(file_handle, 0);
+		SimpleFS_read(file_handle, letta, commedia_size);
+		printf(", tutto il file uguale => %d", memcmp(commedia, letta, commedia_size) == 0);
+
+		// Un byte scritto molto oltre la fine richiede centinaia di ChunkIndexBlock, che non stanno in una transazione del journal:
+		// la scrittura fallisce e il file resta com'era, senza blocchi persi
+		int64_t liberi_indice = DiskDriver_freeCount(&disk_riaperto);
+		SimpleFS_seek(file_handle, (int64_t) 20000 * SIMPLEFS_CHUNK_SIZE);
+		ret = SimpleFS_write(file_handle, "x", 1);
+		SimpleFS_seek(file_handle, 0);
+		SimpleFS_read(file_handle, letta, commedia_size);
+		printf("\n    SimpleFS_write oltre lo spazio del journal => %d, dimensione invariata => %d, blocchi liberi prima %lld e dopo %lld, uguale => %d",
+			ret, file_handle->fcb->fcb.size_in_bytes == commedia_size, (long long) liberi_indice, (long long) DiskDriver_freeCount(&disk_riaperto),
+			memcmp(commedia, letta, commedia_size) == 0);
+		SimpleFS_close(file_handle);
+		ret = SimpleFS_remove(directory_handle, "compresso.txt");
+		printf("\n    SimpleFS_remove(directory_handle, \"compresso.txt\") => %d, blocchi liberi prima %lld e dopo %lld", ret,
+			(long long) liberi_prima, (long long) DiskDriver_freeCount(&disk_riaperto));
+
+		// Test della deduplicazione: tre copie compresse dello stesso testo condividono i blocchi dei chunk interi (solo l'ultimo chunk,
+		// più corto, viene scritto tre volte); dopo aver rimontato il disco la tabella è la stessa, e i blocchi condivisi vengono
+		// liberati solo con l'ultimo file che li usa
+		printf("\n\n+++ Test SimpleFS_setDedup()");
+		int64_t liberi_dedup = DiskDriver_freeCount(&disk_riaperto);
+		printf("\n    SimpleFS_setDedup(&fs_riaperto, 1) => %d", SimpleFS_setDedup(&fs_riaperto, 1));
+		const char * copie_dedup[] = { "copia_0.txt", "copia_1.txt", "copia_2.txt" };
+		for(int c = 0; c < 3; c++) {
+			int64_t liberi_copia = DiskDriver_freeCount(&disk_riaperto);
+			file_handle = SimpleFS_createFile(directory_handle, copie_dedup[c]);
+			SimpleFS_setCompression(file_handle, 1);
+			ret = SimpleFS_write(file_handle, commedia, commedia_size);
+			printf("\n    SimpleFS_write(\"%s\") => %d, blocchi usati %lld", copie_dedup[c], ret, (long long) (liberi_copia - DiskDriver_freeCount(&disk_riaperto)));
+			SimpleFS_close(file_handle);
+		}
+		printf("\n    Blocchi risparmiati %lld, SimpleFS_setDedup(&fs_riaperto, 0) con chunk condivisi => %d",
+			(long long) DiskDriver_dedupSaved(&disk_riaperto), SimpleFS_setDedup(&fs_riaperto, 0));
+		SimpleFS_unmount(&fs_riaperto);
+		DiskDriver_init(&disk_riaperto, journal_filename, 4096);
+		directory_handle = SimpleFS_init(&fs_riaperto, &disk_riaperto);
+		printf("\n    Dopo averlo rimontato: voci della tabella %d, blocchi risparmiati %lld", disk_riaperto.dedup != NULL ? disk_riaperto.dedup->used : -1,
+			(long long) DiskDriver_dedupSaved(&disk_riaperto));
+		for(int c = 0; c < 3; c++) {
+			ret = SimpleFS_remove(directory_handle, (char *) copie_dedup[c]);
+			int uguali = 0;
+			for(int altra = c + 1; altra < 3; altra++) {
+				file_handle = SimpleFS_openFile(directory_handle, copie_dedup[altra]);
+				memset(letta, 0, commedia_size);
+				uguali += SimpleFS_read(file_handle, letta, commedia_size) == commedia_size && memcmp(commedia, letta, commedia_size) == 0;
+				SimpleFS_close(file_handle);
+			}
+			printf("\n    SimpleFS_remove(\"%s\") => %d, file rimasti uguali al testo %d su %d, blocchi liberi %lld", copie_dedup[c], ret, uguali, 2 - c,
+				(long long) DiskDriver_freeCount(&disk_riaperto));
+		}
+		ret = SimpleFS_setDedup(&fs_riaperto, 0);
+		printf("\n    SimpleFS_setDedup(&fs_riaperto, 0) => %d, blocchi liberi prima %lld e dopo %lld", ret, (long long) liberi_dedup,
+			(long long) DiskDriver_freeCount(&disk_riaperto));
+
+		// Se la tabella non si può leggere (qui il suo primo blocco viene cambiato nel file, e il checksum non torna più) il disco viene
+		// montato in sola lettura: i file si leggono ancora, ma non si possono cancellare (liberando i chunk condivisi con le altre copie)
+		SimpleFS fs_tabella;
+		DiskDriver disk_tabella;
+		char tabella_filename[255];
+		sprintf(tabella_filename, "test/dedup_rovinata_%d.txt", (int) time(NULL));
+		DiskDriver_init(&disk_tabella, tabella_filename, 4096);
+		DirectoryHandle * radice_tabella = SimpleFS_init(&fs_tabella, &disk_tabella);
+		DiskDriver_enableChecksums(&disk_tabella);
+		SimpleFS_setDedup(&fs_tabella, 1);
+		for(int c = 0; c < 2; c++) {
+			file_handle = SimpleFS_createFile(radice_tabella, copie_dedup[c]);
+			SimpleFS_setCompression(file_handle, 1);
+			SimpleFS_write(file_handle, commedia, commedia_size);
+			SimpleFS_close(file_handle);
+		}
+		off_t posizione_tabella = disk_tabella.header->data_offset + (off_t) disk_tabella.header->dedup_block * BLOCK_SIZE;
+		SimpleFS_unmount(&fs_tabella);
+		int tabella_fd = open(tabella_filename, O_RDWR);
+		pwrite(tabella_fd, "rovinata", 8, posizione_tabella);
+		close(tabella_fd);
+		DiskDriver_init(&disk_tabella, tabella_filename, 4096);
+		radice_tabella = SimpleFS_init(&fs_tabella, &disk_tabella);
+		int64_t liberi_tabella = DiskDriver_freeCount(&disk_tabella);
+		ret = SimpleFS_remove(radice_tabella, (char *) copie_dedup[0]);
+		file_handle = SimpleFS_openFile(radice_tabella, copie_dedup[1]);
+		memset(letta, 0, commedia_size);
+		int uguale_tabella = SimpleFS_read(file_handle, letta, commedia_size) == commedia_size && memcmp(commedia, letta, commedia_size) == 0;
+		SimpleFS_close(file_handle);
+		printf("\n    Con la tabella rovinata: disco in sola lettura => %d, file system in sola lettura => %d, SimpleFS_remove(\"%s\") => %d,"
+			" blocchi liberati %lld, \"%s\" uguale al testo => %d", disk_tabella.read_only, fs_tabella.read_only, copie_dedup[0], ret,
+			(long long) (DiskDriver_freeCount(&disk_tabella) - liberi_tabella), copie_dedup[1], uguale_tabella);
+		SimpleFS_unmount(&fs_tabella);
+		unlink(tabella_filename);
+
+		// Test dei file a extent: la Divina Commedia scritta in un file a extent occupa una sola sequenza di blocchi, si legge da
+		// qualunque posizione, e dopo averlo riaperto gli extent vengono letti dal disco. Una scrittura dopo uno snapshot sostituisce
+		// solo i blocchi che cambia, e lo snapshot vede ancora il vecchio contenuto
+		printf("\n\n+++ Test SimpleFS_setLayout()");
+		int64_t liberi_extent = DiskDriver_freeCount(&disk_riaperto);
+		file_handle = SimpleFS_createFile(directory_handle, "extent.txt");
+		printf("\n    SimpleFS_setLayout(file_handle, SIMPLEFS_LAYOUT_EXTENTS) => %d, con un formato sconosciuto => %d",
+			SimpleFS_setLayout(file_handle, SIMPLEFS_LAYOUT_EXTENTS), SimpleFS_setLayout(file_handle, 7));
+		ret = SimpleFS_write(file_handle, commedia, commedia_size);
+		printf("\n    SimpleFS_write(file_handle, commedia, %d) => %d, blocchi usati %lld, extent %d", commedia_size, ret,
+			(long long) (liberi_extent - DiskDriver_freeCount(&disk_riaperto)), file_handle->extents->num_extents);
+		SimpleFS_seek(file_handle, 100000);
+		SimpleFS_write(file_handle, "0123456789", 10);
+		memcpy(commedia + 100000, "0123456789", 10);
+		SimpleFS_close(file_handle);
+		file_handle = SimpleFS_openFile(directory_handle, "extent.txt");
+		int corrette_extent = 0;
+		for(int r = 0; r < 100; r++) {
+			int posizione = (int) ((r * 2654435761u) % (commedia_size - 1000));
+			SimpleFS_seek(file_handle, posizione);
+			corrette_extent += SimpleFS_read(file_handle, letta, 1000) == 1000 && memcmp(letta, commedia + posizione, 1000) == 0;
+		}
+		SimpleFS_seek(file_handle, 0);
+		ret = SimpleFS_read(file_handle, letta, commedia_size);
+		printf("\n    Dopo averlo riaperto: 100 letture in posizioni casuali corrette %d, SimpleFS_read di tutto il file => %d, uguale => %d",
+			corrette_extent, ret, memcmp(commedia, letta, commedia_size) == 0);
+		SimpleFS_snapshot(&fs_riaperto, "extent");
+		int64_t liberi_snapshot_extent = DiskDriver_freeCount(&disk_riaperto);
+		SimpleFS_seek(file_handle, 2 * BLOCK_SIZE - 5);
+		SimpleFS_write(file_handle, "ABCDEFGHIJ", 10);
+		printf("\n    SimpleFS_write di 10 byte dopo uno snapshot => blocchi nuovi %lld, extent %d",
+			(long long) (liberi_snapshot_extent - DiskDriver_freeCount(&disk_riaperto)), file_handle->extents->num_extents);
+		SimpleFS_close(file_handle);
+		SimpleFS fs_snapshot_extent;
+		DirectoryHandle * radice_extent = SimpleFS_mountSnapshot(&fs_snapshot_extent, &disk_riaperto, "extent");
+		file_handle = SimpleFS_openFile(radice_extent, "extent.txt");
+		ret = SimpleFS_read(file_handle, letta, commedia_size);
+		printf(", lo snapshot legge %d byte uguali al vecchio testo => %d", ret, memcmp(commedia, letta, commedia_size) == 0);
+		SimpleFS_close(file_handle);
+		SimpleFS_unmount(&fs_snapshot_extent);
+		SimpleFS_deleteSnapshot(&fs_riaperto, "extent");
+		ret = SimpleFS_remove(directory_handle, "extent.txt");
+		printf("\n    SimpleFS_remove(directory_handle, \"extent.txt\") => %d, blocchi liberi prima %lld e dopo %lld", ret,
+			(long long) liberi_extent, (long long) DiskDriver_freeCount(&disk_riaperto));
+
+		// Test dei file indicizzati: la Divina Commedia scritta in un file indicizzato usa i puntatori diretti e gli IndexBlock di
+		// primo e secondo livello, si legge da qualunque posizione anche dopo averlo riaperto, e uno snapshot vede ancora il vecchio
+		// contenuto dopo una scrittura. Cancellandolo tornano liberi tutti i blocchi, IndexBlock compresi
+		printf("\n\n+++ Test SimpleFS_setLayout() [indicizzato]");
+		int64_t liberi_indicizzato = DiskDriver_freeCount(&disk_riaperto);
+		file_handle = SimpleFS_createFile(directory_handle, "indicizzato.txt");
+		ret = SimpleFS_setLayout(file_handle, SIMPLEFS_LAYOUT_INDEXED);
+		printf("\n    SimpleFS_setLayout(file_handle, SIMPLEFS_LAYOUT_INDEXED) => %d, SimpleFS_write(file_handle, commedia, %d) => %d", ret,
+			commedia_size, SimpleFS_write(file_handle, commedia, commedia_size));
+		int blocchi_dati = (commedia_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		printf(", blocchi usati %lld (%d di dati)", (long long) (liberi_indicizzato - DiskDriver_freeCount(&disk_riaperto)), blocchi_dati);
+		SimpleFS_seek(file_handle, 200000);
+		SimpleFS_write(file_handle, "9876543210", 10);
+		memcpy(commedia + 200000, "9876543210", 10);
+		SimpleFS_close(file_handle);
+		file_handle = SimpleFS_openFile(directory_handle, "indicizzato.txt");
+		int corrette_indicizzato = 0;
+		for(int r = 0; r < 100; r++) {
+			int posizione = (int) ((r * 2654435761u) % (commedia_size - 1000));
+			SimpleFS_seek(file_handle, posizione);
+			corrette_indicizzato += SimpleFS_read(file_handle, letta, 1000) == 1000 && memcmp(letta, commedia + posizione, 1000) == 0;
+		}
+		SimpleFS_seek(file_handle, 0);
+		ret = SimpleFS_read(file_handle, letta, commedia_size);
+		printf("\n    Dopo averlo riaperto: 100 letture in posizioni casuali corrette %d, SimpleFS_read di tutto il file => %d, uguale => %d",
+			corrette_indicizzato, ret, memcmp(commedia, letta, commedia_size) == 0);
+		SimpleFS_snapshot(&fs_riaperto, "indicizzato");
+		int64_t liberi_snapshot_indicizzato = DiskDriver_freeCount(&disk_riaperto);
+		SimpleFS_seek(file_handle, 100 * BLOCK_SIZE - 5);
+		SimpleFS_write(file_handle, "ABCDEFGHIJ", 10);
+		printf("\n    SimpleFS_write di 10 byte dopo uno snapshot => blocchi nuovi %lld",
+			(long long) (liberi_snapshot_indicizzato - DiskDriver_freeCount(&disk_riaperto)));
+		SimpleFS_close(file_handle);
+		SimpleFS fs_snapshot_indicizzato;
+		DirectoryHandle * radice_indicizzato = SimpleFS_mountSnapshot(&fs_snapshot_indicizzato, &disk_riaperto, "indicizzato");
+		file_handle = SimpleFS_openFile(radice_indicizzato, "indicizzato.txt");
+		ret = SimpleFS_read(file_handle, letta, commedia_size);
+		printf(", lo snapshot legge %d byte uguali al vecchio testo => %d", ret, memcmp(commedia, letta, commedia_size) == 0);
+		SimpleFS_close(file_handle);
+		SimpleFS_unmount(&fs_snapshot_indicizzato);
+		SimpleFS_deleteSnapshot(&fs_riaperto, "indicizzato");
+		ret = SimpleFS_remove(directory_handle, "indicizzato.txt");
+		printf("\n    SimpleFS_remove(directory_handle, \"indicizzato.txt\") => %d, blocchi liberi prima %lld e dopo %lld", ret,
+			(long long) liberi_indicizzato, (long long) DiskDriver_freeCount(&disk_riaperto));
+
+		// Con il backend pread e una cache di 16 blocchi, gli IndexBlock cambiati durante la scrittura di quattro copie del testo (più
+		// IndexBlock di quanti frame ha la cache) escono dalla cache prima di essere scritti insieme ai dati: devono essere già segnati
+		// come modificati, altrimenti i puntatori nuovi vanno persi
+		SimpleFS fs_pread;
+		DiskDriver disk_pread;
+		DiskConfig config_pread = { DISK_BACKEND_PREAD, 16 * BLOCK_SIZE, 0 };
+		char pread_filename[255];
+		int dimensione_pread = 4 * commedia_size;
+		char * testo_pread = malloc(dimensione_pread), * letto_pread = malloc(dimensione_pread);
+		for(int c = 0; c < 4; c++) memcpy(testo_pread + c * commedia_size, commedia, commedia_size);
+		sprintf(pread_filename, "test/indicizzato_pread_%d.txt", (int) time(NULL));
+		for(int passata = 0; passata < 2; passata++) {
+			DiskDriver_initConfig(&disk_pread, pread_filename, 8192, &config_pread);
+			DirectoryHandle * radice_pread = SimpleFS_init(&fs_pread, &disk_pread);
+			if(passata == 0) {
+				file_handle = SimpleFS_createFile(radice_pread, "indicizzato.txt");
+				SimpleFS_setLayout(file_handle, SIMPLEFS_LAYOUT_INDEXED);
+				ret = SimpleFS_write(file_handle, testo_pread, dimensione_pread);
+				SimpleFS_seek(file_handle, 0);
+			}else{
+				file_handle = SimpleFS_openFile(radice_pread, "indicizzato.txt");
+			}
+			memset(letto_pread, 0, dimensione_pread);
+			int letti_pread = SimpleFS_read(file_handle, letto_pread, dimensione_pread);
+			if(passata == 0) printf("\n    Backend pread con una cache di 16 blocchi: SimpleFS_write => %d", ret);
+			printf("%s SimpleFS_read => %d, uguale => %d", passata == 0 ? "," : "\n    Dopo averlo riaperto:", letti_pread,
+				memcmp(testo_pread, letto_pread, dimensione_pread) == 0);
+			SimpleFS_close(file_handle);
+			SimpleFS_unmount(&fs_pread);
+		}
+		free(testo_pread);
+		free(letto_pread);
+		unlink(pread_filename);
+		free(commedia);
+		free(letta);
+
+		// Test degli snapshot: dopo lo snapshot il file system sovrascrive un file normale (la sua catena viene copiata prima della
+		// scrittura), allunga un file compresso e cancella un file; lo snapshot, montato in sola lettura su un altro SimpleFS, vede
+		// ancora i vecchi contenuti e non si può cambiare, anche dopo aver rimontato il disco. Cancellandolo tornano liberi i blocchi
+		printf("\n\n+++ Test SimpleFS_snapshot()");
+		char * testo_snapshot = malloc(4001), * letto_snapshot = malloc(8001);
+		for(int c = 0; c < 4000; c++) testo_snapshot[c] = 'a' + c % 26;
+		testo_snapshot[4000] = '\0';
+		const char * nomi_snapshot[] = { "snap.txt", "snap_compresso.txt", "snap_cancellato.txt" };
+		int64_t liberi_file = DiskDriver_freeCount(&disk_riaperto);
+		for(int c = 0; c < 3; c++) {
+			file_handle = SimpleFS_createFile(directory_handle, nomi_snapshot[c]);
+			if(c == 1) SimpleFS_setCompression(file_handle, 1);
+			SimpleFS_write(file_handle, testo_snapshot, 4000);
+			SimpleFS_close(file_handle);
+		}
+		int64_t liberi_snapshot = DiskDriver_freeCount(&disk_riaperto);
+		ret = SimpleFS_snapshot(&fs_riaperto, "prima");
+		printf("\n    SimpleFS_snapshot(&fs_riaperto, \"prima\") => %d, blocchi usati %lld, di nuovo con lo stesso nome => %d", ret,
+			(long long) (liberi_snapshot - DiskDriver_freeCount(&disk_riaperto)), SimpleFS_snapshot(&fs_riaperto, "prima"));
+
+		// Cambio il file system
+		file_handle = SimpleFS_openFile(directory_handle, "snap.txt");
+		char * nuovo_snapshot = malloc(4001);
+		memset(nuovo_snapshot, 'Z', 4000);
+		nuovo_snapshot[4000] = '\0';
+		ret = SimpleFS_write(file_handle, nuovo_snapshot, 4000);
+		printf("\n    SimpleFS_write(\"snap.txt\") => %d, primo blocco congelato dopo la scrittura => %d", ret,
+			DiskDriver_inSnapshot(&disk_riaperto, file_handle->fcb->header.next_block));
+		SimpleFS_close(file_handle);
+		file_handle = SimpleFS_openFile(directory_handle, "snap_compresso.txt");
+		SimpleFS_seek(file_handle, 4000);
+		printf("\n    SimpleFS_write(\"snap_compresso.txt\") in fondo => %d", SimpleFS_write(file_handle, nuovo_snapshot, 4000));
+		SimpleFS_close(file_handle);
+		int64_t liberi_cancellato = DiskDriver_freeCount(&disk_riaperto);
+		ret = SimpleFS_remove(directory_handle, "snap_cancellato.txt");
+		printf("\n    SimpleFS_remove(\"snap_cancellato.txt\") => %d, blocchi liberati %lld (restano allo snapshot)", ret,
+			(long long) (DiskDriver_freeCount(&disk_riaperto) - liberi_cancellato));
+
+		// Leggo lo snapshot, prima e dopo aver rimontato il disco
+		for(int passata = 0; passata < 2; passata++) {
+			if(passata == 1) {
+				SimpleFS_unmount(&fs_riaperto);
+				DiskDriver_init(&disk_riaperto, journal_filename, 4096);
+				directory_handle = SimpleFS_init(&fs_riaperto, &disk_riaperto);
+			}
+			SimpleFS fs_snapshot;
+			DirectoryHandle * radice_snapshot = SimpleFS_mountSnapshot(&fs_snapshot, &disk_riaperto, "prima");
+			int uguali = 0;
+			for(int c = 0; c < 3 && radice_snapshot != NULL; c++) {
+				FileHandle * nello_snapshot = SimpleFS_openFile(radice_snapshot, nomi_snapshot[c]);
+				if(nello_snapshot == NULL) continue;
+				memset(letto_snapshot, 0, 8001);
+				uguali += SimpleFS_read(nello_snapshot, letto_snapshot, 8000) == 4000 && memcmp(letto_snapshot, testo_snapshot, 4000) == 0;
+				if(c == 0) ret = SimpleFS_write(nello_snapshot, nuovo_snapshot, 10);
+				SimpleFS_close(nello_snapshot);
+			}
+			file_handle = SimpleFS_openFile(directory_handle, "snap.txt");
+			memset(letto_snapshot, 0, 8001);
+			SimpleFS_read(file_handle, letto_snapshot, 8000);
+			SimpleFS_close(file_handle);
+			printf("\n    %s: SimpleFS_mountSnapshot => %s, file uguali al vecchio testo %d su 3, SimpleFS_write nello snapshot => %d,"
+				" SimpleFS_createFile => %s, \"snap.txt\" nel file system nuovo => %d", passata == 0 ? "Subito" : "Dopo aver rimontato il disco",
+				radice_snapshot != NULL ? "trovato" : "NULL", uguali, ret, radice_snapshot != NULL && SimpleFS_createFile(radice_snapshot, "x") != NULL ? "creato" : "NULL",
+				memcmp(letto_snapshot, nuovo_snapshot, 4000) == 0);
+			SimpleFS_unmount(&fs_snapshot);
+		}
+		ret = SimpleFS_deleteSnapshot(&fs_riaperto, "prima");
+		for(int c = 0; c < 2; c++) SimpleFS_remove(directory_handle, (char *) nomi_snapshot[c]);
+		printf("\n    SimpleFS_deleteSnapshot(&fs_riaperto, \"prima\") => %d, di nuovo => %d, snapshot rimasti %s, blocchi liberi dopo aver"
+			" cancellato gli altri file %lld (prima dei file %lld)", ret, SimpleFS_deleteSnapshot(&fs_riaperto, "prima"),
+			disk_riaperto.snapshots == NULL ? "nessuno" : "alcuni", (long long) DiskDriver_freeCount(&disk_riaperto), (long long) liberi_file);
+
+		// Se la regione degli snapshot non si può leggere (qui il suo primo blocco viene cambiato nel file) il disco viene montato in
+		// sola lettura: i blocchi rilasciati dal file cancellato non si sa più che sono congelati, e non devono essere riusati
+		SimpleFS fs_regione;
+		DiskDriver disk_regione;
+		char regione_filename[255];
+		sprintf(regione_filename, "test/snapshot_rovinato_%d.txt", (int) time(NULL));
+		DiskDriver_init(&disk_regione, regione_filename, 1024);
+		DirectoryHandle * radice_regione = SimpleFS_init(&fs_regione, &disk_regione);
+		DiskDriver_enableChecksums(&disk_regione);
+		for(int c = 0; c < 2; c++) {
+			file_handle = SimpleFS_createFile(radice_regione, nomi_snapshot[c]);
+			SimpleFS_write(file_handle, testo_snapshot, 4000);
+			SimpleFS_close(file_handle);
+		}
+		SimpleFS_snapshot(&fs_regione, "prima");
+		SimpleFS_remove(radice_regione, (char *) nomi_snapshot[1]);
+
+		// Anche cancellare uno snapshot quando la bitmap di un altro non si legge (cambiata nel file, e scartata dalla memoria) non
+		// cambia niente: i blocchi che l'altro usa ancora verrebbero liberati
+		SimpleFS_snapshot(&fs_regione, "dopo");
+		for(int c = 0; c < DISK_MAX_SNAPSHOTS; c++) {
+			if(strcmp(disk_regione.snapshots->table[c].name, "prima") != 0) continue;
+			off_t posizione_bitmap = disk_regione.header->data_offset + (off_t) disk_regione.snapshots->table[c].bitmap_block * BLOCK_SIZE;
+			int bitmap_fd = open(regione_filename, O_RDWR);
+			pwrite(bitmap_fd, "rovinata", 8, posizione_bitmap);
+			close(bitmap_fd);
+			DiskDriver_advise(&disk_regione, disk_regione.snapshots->table[c].bitmap_block, 1, DISK_ADVISE_DONTNEED);
+		}
+		int64_t liberi_regione = DiskDriver_freeCount(&disk_regione);
+		ret = SimpleFS_deleteSnapshot(&fs_regione, "dopo");
+		printf("\n    Con la bitmap di \"prima\" rovinata: SimpleFS_deleteSnapshot(&fs_regione, \"dopo\") => %d, blocchi liberati %lld,"
+			" \"dopo\" c'è ancora => %d", ret, (long long) (DiskDriver_freeCount(&disk_regione) - liberi_regione),
+			DiskDriver_findSnapshot(&disk_regione, "dopo") != -1);
+		off_t posizione_regione = disk_regione.header->data_offset + (off_t) disk_regione.header->snapshot_block * BLOCK_SIZE;
+		SimpleFS_unmount(&fs_regione);
+		int regione_fd = open(regione_filename, O_RDWR);
+		pwrite(regione_fd, "rovinato", 8, posizione_regione);
+		struct stat stat_regione;
+		fstat(regione_fd, &stat_regione);
+		char * file_regione = malloc(stat_regione.st_size), * file_regione_dopo = malloc(stat_regione.st_size);
+		pread(regione_fd, file_regione, stat_regione.st_size, 0);
+		close(regione_fd);
+		DiskDriver_init(&disk_regione, regione_filename, 1024);
+		radice_regione = SimpleFS_init(&fs_regione, &disk_regione);
+		file_handle = SimpleFS_openFile(radice_regione, nomi_snapshot[0]);
+		memset(letto_snapshot, 0, 8001);
+		int uguale_regione = SimpleFS_read(file_handle, letto_snapshot, 8000) == 4000 && memcmp(letto_snapshot, testo_snapshot, 4000) == 0;
+		SimpleFS_close(file_handle);
+		printf("\n    Con la regione rovinata: disco in sola lettura => %d, SimpleFS_createFile => %s, DiskDriver_allocBlock => %d, \"%s\" uguale"
+			" al testo => %d", disk_regione.read_only, SimpleFS_createFile(radice_regione, "x") != NULL ? "creato" : "NULL",
+			DiskDriver_allocBlock(&disk_regione, NULL), nomi_snapshot[0], uguale_regione);
+
+		// Il disco in sola lettura non cambia: non cresce, e né il montaggio né lo smontaggio scrivono il file
+		int grow_regione = DiskDriver_grow(&disk_regione, 2048);
+		SimpleFS_unmount(&fs_regione);
+		regione_fd = open(regione_filename, O_RDONLY);
+		int invariato_regione = pread(regione_fd, file_regione_dopo, stat_regione.st_size, 0) == stat_regione.st_size
+			&& memcmp(file_regione, file_regione_dopo, stat_regione.st_size) == 0;
+		close(regione_fd);
+		printf("\n    DiskDriver_grow(2048) => %d, dopo lo smontaggio il file è invariato => %d", grow_regione, invariato_regione);
+		free(file_regione);
+		free(file_regione_dopo);
+		unlink(regione_filename);
+		free(testo_snapshot);
+		free(letto_snapshot);
+		free(nuovo_snapshot);
+
+		// Test dello smontaggio: il journal viene svuotato e il disco viene chiuso pulito, quindi il montaggio successivo
+		// non legge la bitmap e trova gli stessi blocchi liberi
+		printf("\n\n+++ Test SimpleFS_unmount()");
+		int64_t liberi = DiskDriver_freeCount(&disk_riaperto);
+		printf("\n    SimpleFS_unmount(&fs_riaperto) => %d", SimpleFS_unmount(&fs_riaperto));
+		DiskDriver_init(&disk_riaperto, journal_filename, 4096);
+		directory_handle = SimpleFS_init(&fs_riaperto, &disk_riaperto);
+		file_handle = SimpleFS_openFile(directory_handle, "advise.txt");
+		printf("\n    Rimontato pulito => %d, blocchi liberi prima %lld e dopo %lld, SimpleFS_openFile(\"advise.txt\") => %s", disk_riaperto.clean_mount,
+			(long long) liberi, (long long) DiskDriver_freeCount(&disk_riaperto), file_handle != NULL ? "trovato" : "NULL");
+		SimpleFS_close(file_handle);
+		SimpleFS_unmount(&fs_riaperto);
+		unlink(journal_filename);
+
+	}else if(test == 4) {
+
+		// Benchmark BitMap_get: bitmap da 16M bit quasi piena, con pochi bit liberi sparsi verso la fine
+		printf("\n+++ Benchmark BitMap_get()");
+		int num_bits = 1 << 24, i, ripetizioni = 20;
+		BitMap bitmap;
+		bitmap.num_bits = num_bits;
+		bitmap.entries = malloc(num_bits / 8);
+		bitmap.summary = NULL;
+		memset(bitmap.entries, 0xFF, num_bits / 8);
+		srand(42);
+		for(i = 0; i < 16; i++) BitMap_set(&bitmap, num_bits / 2 + rand() % (num_bits / 2), 0);
+
+		// Prima di misurare, verifico che le due versioni diano gli stessi risultati
+		int errori = 0;
+		for(i = 0; i < 2000; i++) {
+			int start = rand() % num_bits, status = rand() % 2;
+			if(BitMap_get(&bitmap, start, status) != BitMap_get_lineare(&bitmap, start, status)) errori++;
+		}
+		printf("\n    Confronto su 2000 ricerche casuali: %d differenze", errori);
+
+		double t0 = secondi();
+		int r1 = 0, r2 = 0;
+		for(i = 0; i < ripetizioni; i++) r1 += BitMap_get_lineare(&bitmap, i, 0);
+		double t1 = secondi();
+		for(i = 0; i < ripetizioni; i++) r2 += BitMap_get(&bitmap, i, 0);
+		double t2 = secondi();
+		printf("\n    Ricerca bit libero su %d bit (x%d): lineare %.3f ms, a parole %.3f ms (%.1fx) [%d/%d]",
+			num_bits, ripetizioni, (t1 - t0) * 1e3, (t2 - t1) * 1e3, (t1 - t0) / (t2 - t1), r1, r2);
+
+		// Stessa ricerca usando il riassunto gerarchico della bitmap, dopo aver verificato che resti coerente con BitMap_set
+		BitMap_buildSummary(&bitmap);
+		for(i = 0; i < 2000; i++) {
+			int pos = rand() % num_bits, start = rand() % num_bits;
+			BitMap_set(&bitmap, pos, 1);
+			if(BitMap_get(&bitmap, start, 0) != BitMap_get_lineare(&bitmap, start, 0)) errori++;
+		}
+		printf("\n    Confronto con riassunto su 2000 ricerche casuali: %d differenze", errori);
+		t0 = secondi();
+		for(i = 0; i < ripetizioni; i++) r2 += BitMap_get(&bitmap, i, 0);
+		t1 = secondi();
+		printf("\n    Ricerca bit libero con riassunto (x%d): %.3f ms", ripetizioni, (t1 - t0) * 1e3);
+
+		// Benchmark delle operazioni su intervalli: azzeramento e conteggio bit per bit contro BitMap_clearRange e BitMap_countRange
+		printf("\n\n+++ Benchmark BitMap_clearRange() e BitMap_countRange()");
+		t0 = secondi();
+		for(i = 0; i < num_bits; i++) BitMap_set(&bitmap, i, 0);
+		t1 = secondi();
+		BitMap_setRange(&bitmap, 0, num_bits);
+		BitMap_clearRange(&bitmap, 0, num_bits);
+		t2 = secondi();
+		printf("\n    Azzeramento di %d bit: uno alla volta %.3f ms, per intervallo %.3f ms", num_bits, (t1 - t0) * 1e3, (t2 - t1) * 1e3 / 2);
+		BitMap_setRange(&bitmap, 12345, num_bits / 3);
+		int contati = 0;
+		t0 = secondi();
+		for(i = 0; i < num_bits; i++) contati += (bitmap.entries[i / 8] >> (7 - i % 8)) & 1;
+		t1 = secondi();
+		int contati2 = BitMap_countRange(&bitmap, 0, num_bits, 1);
+		t2 = secondi();
+		printf("\n    Conteggio dei bit a 1: uno alla volta %.3f ms, con popcount %.3f ms [%d/%d]", (t1 - t0) * 1e3, (t2 - t1) * 1e3, contati, contati2);
+
+		BitMap_freeSummary(&bitmap);
+		free(bitmap.entries);
+
+		// Benchmark delle modalità di durabilità: scrittura di blocchi sparsi su un disco da 20000 blocchi
+		printf("\n\n+++ Benchmark DiskDriver_writeBlock() e DiskDriver_setDurability()");
+		DiskDriver disk;
+		char disk_filename[255];
+		sprintf(disk_filename, "test/bench_%d.txt", (int) time(NULL));
+		DiskDriver_init(&disk, disk_filename, 20000);
+		char blocco[BLOCK_SIZE];
+		memset(blocco, 0, BLOCK_SIZE);
+		int scritture = 500;
+		const char * modalita[] = { "msync di tutta la mmap", "DISK_SYNC_WRITE", "DISK_SYNC_FLUSH", "DISK_SYNC_PERIODIC" };
+		int m;
+
+		// Prima scrittura di tutti i blocchi usati, in modo che i page fault non pesino sulle misure
+		DiskDriver_setDurability(&disk, DISK_SYNC_FLUSH, 0);
+		for(i = 0; i < scritture; i++) DiskDriver_writeBlock(&disk, blocco, (i * 37) % 20000);
+		DiskDriver_flush(&disk);
+		for(m = 0; m < 4; m++) {
+			DiskDriver_setDurability(&disk, m == 0 ? DISK_SYNC_FLUSH : m - 1, 20);
+			t0 = secondi();
+			for(i = 0; i < scritture; i++) {
+				DiskDriver_writeBlock(&disk, blocco, (i * 37) % 20000);
+
+				// Come faceva DiskDriver_flush in origine, sincronizzo ad ogni scrittura tutta la mmap
+				if(m == 0) msync(disk.header, disk.map_size, MS_SYNC);
+			}
+			DiskDriver_flush(&disk);
+			t1 = secondi();
+			printf("\n    %d scritture con %-24s => %.3f ms", scritture, modalita[m], (t1 - t0) * 1e3);
+		}
+		DiskDriver_setDurability(&disk, DISK_SYNC_WRITE, 0);
+		unlink(disk_filename);
+
+		// Benchmark dei backend: un gruppo di 128 blocchi letti spesso, alternato a scansioni di blocchi letti una sola volta.
+		// Con ARC la scansione passa per T1, mentre i blocchi letti spesso restano in T2: la percentuale di hit su di essi resta alta
+		printf("\n\n+++ Benchmark DiskDriver_initConfig() [mmap contro pread + cache ARC]");
+		const char * backend[] = { "mmap", "pread + cache da 256 blocchi" };
+		int b, letture = 0;
+		for(b = 0; b < 2; b++) {
+			DiskConfig config = { b == 0 ? DISK_BACKEND_MMAP : DISK_BACKEND_PREAD, 256 * BLOCK_SIZE, 0 };
+			sprintf(disk_filename, "test/bench_%d_%d.txt", (int) time(NULL), b);
+			DiskDriver_initConfig(&disk, disk_filename, 20000, &config);
+			DiskDriver_setDurability(&disk, DISK_SYNC_FLUSH, 0);
+			for(i = 0; i < 20000; i++) DiskDriver_writeBlock(&disk, blocco, i);
+			DiskDriver_flush(&disk);
+
+			uint64_t hit_caldi = 0, letture_calde = 0;
+			letture = 0;
+			t0 = secondi();
+			int giro, k;
+			for(giro = 0; giro < 20; giro++) {
+				uint64_t hit_prima = disk.cache ? disk.cache->hits : 0;
+				for(k = 0; k < 4 * 128; k++) letture += DiskDriver_readBlock(&disk, blocco, k % 128) == 0;
+				if(disk.cache) hit_caldi += disk.cache->hits - hit_prima;
+				letture_calde += 4 * 128;
+				for(k = 0; k < 1000; k++) letture += DiskDriver_readBlock(&disk, blocco, 128 + (giro * 1000 + k) % (20000 - 128)) == 0;
+			}
+			t1 = secondi();
+			printf("\n    %-30s => %d letture in %.3f ms", backend[b], letture, (t1 - t0) * 1e3);
+			if(disk.cache) {
+				printf(", hit %llu, miss %llu, hit sui blocchi caldi %.1f%%", (unsigned long long) disk.cache->hits,
+					(unsigned long long) disk.cache->misses, 100.0 * hit_caldi / letture_calde);
+			}
+			unlink(disk_filename);
+		}
+
+		// Benchmark del backend a finestre: letture casuali su un disco da 64 MiB, mappato tutto insieme
+		// oppure attraverso 4 finestre da 1 MiB
+		printf("\n\n+++ Benchmark DiskDriver_initConfig() [mmap contro finestre di mappatura]");
+		const char * finestre[] = { "mmap di tutto il disco", "4 finestre da 1 MiB" };
+		int blocchi_finestre = 131072;
+		for(b = 0; b < 2; b++) {
+			DiskConfig config = { b == 0 ? DISK_BACKEND_MMAP : DISK_BACKEND_WINDOWS, 0, 0, DISK_IO_AUTO, 1 << 20, 4 };
+			sprintf(disk_filename, "test/bench_%d_win%d.txt", (int) time(NULL), b);
+			DiskDriver_initConfig(&disk, disk_filename, blocchi_finestre, &config);
+			DiskDriver_setDurability(&disk, DISK_SYNC_FLUSH, 0);
+			for(i = 0; i < blocchi_finestre; i += 64) DiskDriver_writeBlock(&disk, blocco, i);
+			DiskDriver_flush(&disk);
+
+			// Letture sparse su tutto il disco, poi concentrate in 4 MiB (quanto le finestre possono tenere mappato)
+			srand(7);
+			letture = 0;
+			t0 = secondi();
+			for(i = 0; i < 20000; i++) letture += DiskDriver_readBlock(&disk, blocco, (rand() % (blocchi_finestre / 64)) * 64) == 0;
+			t1 = secondi();
+			for(i = 0; i < 20000; i++) letture += DiskDriver_readBlock(&disk, blocco, (rand() % 128) * 64) == 0;
+			t2 = secondi();
+			size_t mappati = b == 0 ? disk.map_size : disk.data_offset + disk.max_windows * disk.window_size;
+			printf("\n    %-24s => %d letture, su tutto il disco %.3f ms, su 4 MiB %.3f ms, %zu KiB mappati", finestre[b], letture,
+				(t1 - t0) * 1e3, (t2 - t1) * 1e3, mappati >> 10);
+			if(b == 1) printf(", finestre mappate %llu, tolte %llu", (unsigned long long) disk.window_maps, (unsigned long long) disk.window_unmaps);
+			unlink(disk_filename);
+		}
+
+		// Benchmark delle richieste asincrone: 2000 blocchi scritti e poi letti (senza cache) con il backend pread,
+		// uno alla volta con writeBlock/readBlock contro gruppi di DISK_IO_DEPTH richieste inviate insieme
+		printf("\n\n+++ Benchmark DiskDriver_submitWrite() e DiskDriver_submitRead()");
+		const char * engine[] = { "writeBlock/readBlock", "io_uring", "pool di thread" };
+		DiskIOCompletion completamenti[DISK_IO_DEPTH];
+		int e, blocchi_io = 2000;
+		for(e = 0; e < 3; e++) {
+			DiskConfig config = { DISK_BACKEND_PREAD, 0, 0, e == 2 ? DISK_IO_THREADS : DISK_IO_AUTO };
+			config.cache_bytes = CACHE_MIN_FRAMES * BLOCK_SIZE;
+			sprintf(disk_filename, "test/bench_%d_io%d.txt", (int) time(NULL), e);
+			DiskDriver_initConfig(&disk, disk_filename, blocchi_io, &config);
+			if(e > 0 && disk.io->engine != (e == 1 ? DISK_IO_URING : DISK_IO_THREADS)) {
+				printf("\n    %-22s => non disponibile", engine[e]);
+				unlink(disk_filename);
+				continue;
+			}
+
+			// Scritture, con DISK_SYNC_WRITE: una sincronizzazione per blocco contro una per gruppo
+			t0 = secondi();
+			for(i = 0; i < blocchi_io; i++) {
+				if(e == 0) {
+					DiskDriver_writeBlock(&disk, blocco, i);
+				}else{
+					while(DiskDriver_submitWrite(&disk, blocco, i, NULL) == -1) DiskDriver_poll(&disk, completamenti, DISK_IO_DEPTH, 1);
+				}
+			}
+			while(DiskIO_pending(disk.io) > 0) DiskDriver_poll(&disk, completamenti, DISK_IO_DEPTH, DiskIO_pending(disk.io));
+			t1 = secondi();
+
+			// Letture: la cache ha solo CACHE_MIN_FRAMES blocchi, quindi quasi tutte vanno sul file
+			posix_fadvise(disk.fd, 0, 0, POSIX_FADV_DONTNEED);
+			for(i = 0; i < blocchi_io; i++) {
+				if(e == 0) {
+					DiskDriver_readBlock(&disk, blocco, i);
+				}else{
+					while(DiskDriver_submitRead(&disk, blocco, i, NULL) == -1) DiskDriver_poll(&disk, completamenti, DISK_IO_DEPTH, 1);
+				}
+			}
+			while(DiskIO_pending(disk.io) > 0) DiskDriver_poll(&disk, completamenti, DISK_IO_DEPTH, DiskIO_pending(disk.io));
+			t2 = secondi();
+			printf("\n    %-22s => %d scritture %.3f ms, %d letture %.3f ms", engine[e], blocchi_io, (t1 - t0) * 1e3, blocchi_io, (t2 - t1) * 1e3);
+			unlink(disk_filename);
+		}
+
+		// Benchmark del readahead: la Divina Commedia (più di 1000 blocchi) scritta in un file e letta tutta, dopo aver tolto le sue
+		// pagine dalla memoria, senza readahead (SIMPLEFS_ADVISE_RANDOM), con il readahead adattivo e con SIMPLEFS_ADVISE_SEQUENTIAL;
+		// per ogni lettura conto i page fault che hanno dovuto aspettare il disco
+		printf("\n\n+++ Benchmark SimpleFS_read() e SimpleFS_advise()");
+		struct stat commedia_stat;
+		FILE * commedia = fopen("divina_commedia.txt", "r");
+		if(commedia == NULL || stat("divina_commedia.txt", &commedia_stat) == -1) {
+			printf("\n    divina_commedia.txt non trovato");
+		}else{
+			char * testo = malloc(commedia_stat.st_size + 1), * letto = malloc(commedia_stat.st_size + 1);
+			testo[fread(testo, 1, commedia_stat.st_size, commedia)] = '\0';
+			fclose(commedia);
+			SimpleFS fs;
+			sprintf(disk_filename, "test/bench_%d_readahead.txt", (int) time(NULL));
+			DiskDriver_init(&disk, disk_filename, 4096);
+			DirectoryHandle * radice = SimpleFS_init(&fs, &disk);
+			FileHandle * commedia_handle = SimpleFS_createFile(radice, "divina_commedia.txt");
+			SimpleFS_write(commedia_handle, testo, strlen(testo));
+			DiskDriver_flush(&disk);
+			const char * consiglio[] = { "senza readahead", "readahead adattivo", "SIMPLEFS_ADVISE_SEQUENTIAL" };
+			const int consigli[] = { SIMPLEFS_ADVISE_RANDOM, SIMPLEFS_ADVISE_NORMAL, SIMPLEFS_ADVISE_SEQUENTIAL };
+			for(int c = 0; c < 3; c++) {
+				SimpleFS_advise(commedia_handle, 0, 0, SIMPLEFS_ADVISE_DONTNEED);
+				SimpleFS_advise(commedia_handle, 0, 0, consigli[c]);
+				SimpleFS_seek(commedia_handle, 0);
+				struct rusage prima, dopo;
+				getrusage(RUSAGE_SELF, &prima);
+				t0 = secondi();
+				int letti = SimpleFS_read(commedia_handle, letto, commedia_stat.st_size);
+				t1 = secondi();
+				getrusage(RUSAGE_SELF, &dopo);
+				printf("\n    %-26s => %d byte in %.3f ms, page fault con attesa del disco %ld, senza %ld", consiglio[c], letti, (t1 - t0) * 1e3,
+					dopo.ru_majflt - prima.ru_majflt, dopo.ru_minflt - prima.ru_minflt);
+			}
+			SimpleFS_close(commedia_handle);
+			free(testo);
+			free(letto);
+			unlink(disk_filename);
+		}
+
+		// Benchmark delle politiche di allocazione: creazione di file (un blocco allocato e scritto per file) su un disco
+		// da 65536 blocchi riempito a caso fino a diversi livelli, cercando ogni volta il primo blocco libero con una
+		// scansione lineare da 0 (come in origine) contro DISK_ALLOC_FIRST_FIT, DISK_ALLOC_NEXT_FIT e DISK_ALLOC_GROUPS
+		printf("\n\n+++ Benchmark DiskDriver_allocBlock() e DiskDriver_setAllocPolicy()");
+		const char * politica[] = { "scansione lineare da 0", "DISK_ALLOC_FIRST_FIT", "DISK_ALLOC_NEXT_FIT", "DISK_ALLOC_GROUPS" };
+		const int politiche[] = { -1, DISK_ALLOC_FIRST_FIT, DISK_ALLOC_NEXT_FIT, DISK_ALLOC_GROUPS };
+		const int riempimenti[] = { 0, 50, 90, 99 };
+		int blocchi_disco = 65536, r, p;
+		int * creati = malloc(4000 * sizeof(int));
+		sprintf(disk_filename, "test/bench_%d_alloc.txt", (int) time(NULL));
+		DiskDriver_init(&disk, disk_filename, blocchi_disco);
+		DiskDriver_setDurability(&disk, DISK_SYNC_FLUSH, 0);
+		for(r = 0; r < 4; r++) {
+
+			// Riempio il disco fino al livello richiesto: ogni blocco ha una sua soglia pseudo-casuale,
+			// quindi i blocchi occupati ad un livello restano occupati ai livelli successivi
+			for(i = 0; i < blocchi_disco; i++) {
+				if((int) ((i * 2654435761u) >> 8) % 100 < riempimenti[r]) DiskDriver_writeBlock(&disk, blocco, i);
+			}
+			int file = DiskDriver_freeCount(&disk) / 2 < 4000 ? DiskDriver_freeCount(&disk) / 2 : 4000;
+			printf("\n    Disco pieno al %d%% (%d blocchi liberi), %d file:", riempimenti[r], DiskDriver_freeCount(&disk), file);
+
+			for(p = 0; p < 4; p++) {
+				if(politiche[p] != -1) DiskDriver_setAllocPolicy(&disk, politiche[p]);
+				t0 = secondi();
+				for(i = 0; i < file; i++) {
+					if(politiche[p] == -1) {
+						// Come in origine: cerco il primo blocco libero da 0, e dopo la scrittura lo ricalcolo da 0
+						creati[i] = BitMap_get_lineare(&disk.bitmap, 0, 0);
+						DiskDriver_writeBlock(&disk, blocco, creati[i]);
+						disk.header->first_free_block = BitMap_get_lineare(&disk.bitmap, 0, 0);
+					}else{
+						creati[i] = DiskDriver_allocBlock(&disk, NULL);
+						DiskDriver_writeBlock(&disk, blocco, creati[i]);
+					}
+				}
+				t1 = secondi();
+				printf("\n        %-24s => %.3f ms, %.0f file/s", politica[p], (t1 - t0) * 1e3, file / (t1 - t0));
+
+				// Libero i blocchi creati, in modo che ogni politica parta dallo stesso riempimento
+				DiskDriver_freeBlocks(&disk, creati, file);
+			}
+		}
+		DiskDriver_setAllocPolicy(&disk, DISK_ALLOC_GROUPS);
+		DiskDriver_flush(&disk);
+		free(creati);
+		unlink(disk_filename);
+
+		// Benchmark del journal dei metadati: creazione di 80 file (DISK_SYNC_WRITE) su un disco da 16384 blocchi, con i blocchi
+		// scritti uno alla volta (ognuno con la sua fdatasync) contro una transazione per file; poi il commit di 800 transazioni
+		// da parte di 1, 2, 4 e 8 thread, in cui le transazioni che arrivano insieme vengono scritte in gruppo
+		printf("\n\n+++ Benchmark SimpleFS_createFile() e Journal_commit()");
+		char nome_file[32];
+		for(p = 0; p < 2; p++) {
+			SimpleFS fs;
+			sprintf(disk_filename, "test/bench_%d_journal_%d.txt", (int) time(NULL), p);
+			DiskDriver_init(&disk, disk_filename, 16384);
+			DirectoryHandle * radice = SimpleFS_init(&fs, &disk);
+			if(p == 0) fs.journal = NULL;
+			uint64_t syncs = disk.syncs;
+			t0 = secondi();
+			for(i = 0; i < 80; i++) {
+				sprintf(nome_file, "file_%d.txt", i);
+				SimpleFS_close(SimpleFS_createFile(radice, nome_file));
+			}
+			t1 = secondi();
+			printf("\n    %-22s => %.3f ms, %.0f file/s, %.1f fdatasync per file", p == 0 ? "senza journal" : "con il journal", (t1 - t0) * 1e3,
+				80 / (t1 - t0), (double) (disk.syncs - syncs) / 80);
+			if(p == 1) {
+				int thread_bench[4] = { 1, 2, 4, 8 };
+				for(r = 0; r < 4; r++) {
+					uint64_t gruppi = fs.journal->groups;
+					syncs = disk.syncs;
+					double tempo = journal_threads(fs.journal, 1000, thread_bench[r], 800 / thread_bench[r]);
+					printf("\n    Journal_commit, %d thread => %.0f transazioni/s, %llu gruppi, %llu fdatasync", thread_bench[r], 800 / tempo,
+						(unsigned long long) (fs.journal->groups - gruppi), (unsigned long long) (disk.syncs - syncs));
+				}
+			}
+			unlink(disk_filename);
+		}
+
+		// Benchmark del montaggio: dischi da 128 MiB a 8 GiB, pieni a metà. Il disco viene aperto dopo DiskDriver_unmount (legge solo
+		// DiskHeader e riassunto, e sincronizza il DiskHeader per togliere il segno di disco pulito) e poi aperto di nuovo senza essere
+		// stato smontato (legge tutta la bitmap); prima di ogni apertura le pagine del file vengono tolte dalla page cache
+		printf("\n\n+++ Benchmark DiskDriver_init() e DiskDriver_unmount()");
+		for(p = 18; p <= 24; p += 2) {
+			DiskDriver pulito, sporco;
+			int blocchi_mount = 1 << p;
+			sprintf(disk_filename, "test/bench_%d_mount_%d.txt", (int) time(NULL), p);
+			DiskDriver_init(&disk, disk_filename, blocchi_mount);
+			DiskDriver_allocRun(&disk, blocchi_mount / 2, 0);
+			DiskDriver_unmount(&disk);
+
+			int mount_fd = open(disk_filename, O_RDONLY);
+			posix_fadvise(mount_fd, 0, 0, POSIX_FADV_DONTNEED);
+			t0 = secondi();
+			DiskDriver_init(&pulito, disk_filename, blocchi_mount);
+			t1 = secondi();
+			posix_fadvise(mount_fd, 0, 0, POSIX_FADV_DONTNEED);
+			t2 = secondi();
+			DiskDriver_init(&sporco, disk_filename, blocchi_mount);
+			double t3 = secondi();
+			close(mount_fd);
+			int64_t letti_pulito = sizeof(DiskHeader) + pulito.header->summary_bytes, letti_sporco = sizeof(DiskHeader) + sporco.header->bitmap_entries;
+			printf("\n    %5d MiB => smontato pulito %.3f ms (pulito %d, letti %lld KiB), dopo un crash %.3f ms (pulito %d, letti %lld KiB), blocchi liberi %lld e %lld",
+				(int) ((int64_t) blocchi_mount * BLOCK_SIZE >> 20), (t1 - t0) * 1e3, pulito.clean_mount, (long long) (letti_pulito >> 10), (t3 - t2) * 1e3,
+				sporco.clean_mount, (long long) (letti_sporco >> 10), (long long) DiskDriver_freeCount(&pulito), (long long) DiskDriver_freeCount(&sporco));
+			DiskDriver_unmount(&sporco);
+			DiskDriver_unmount(&pulito);
+			unlink(disk_filename);
+		}
+
+		// Benchmark dei checksum: CRC32C su 64 MiB con l'istruzione di SSE4.2 e con lo slicing-by-8, poi 64 MiB di blocchi letti
+		// con readBlock (backend mmap) senza checksum, la prima volta dopo enableChecksums (ogni blocco viene verificato)
+		// e la seconda (i blocchi sono già verificati)
+		printf("\n\n+++ Benchmark CRC32C_update() e DiskDriver_readBlock() [checksum]");
+		size_t crc_bytes = 64 << 20;
+		unsigned char* crc_buffer = (unsigned char*) malloc(crc_bytes);
+		for(size_t c = 0; c < crc_bytes; c++) crc_buffer[c] = (unsigned char) (c * 31 + (c >> 9));
+		t0 = secondi();
+		uint32_t crc_hardware = CRC32C_update(0, crc_buffer, crc_bytes);
+		t1 = secondi();
+		uint32_t crc_software = CRC32C_updateSoftware(0, crc_buffer, crc_bytes);
+		t2 = secondi();
+		printf("\n    CRC32C di %d MiB => %s %.2f GB/s, slicing-by-8 %.2f GB/s, stesso risultato %d", (int) (crc_bytes >> 20),
+			CRC32C_hardware() ? "SSE4.2" : "(senza SSE4.2)", crc_bytes / (t1 - t0) / 1e9, crc_bytes / (t2 - t1) / 1e9, crc_hardware == crc_software);
+		free(crc_buffer);
+
+		int blocchi_crc = (int) (crc_bytes / BLOCK_SIZE);
+		sprintf(disk_filename, "test/bench_%d_crc.txt", (int) time(NULL));
+		DiskDriver_init(&disk, disk_filename, blocchi_crc + 4096);
+		DiskDriver_allocRun(&disk, blocchi_crc, 0);
+		for(int c = 0; c < blocchi_crc; c++) {
+			memset(blocco, 0, BLOCK_SIZE);
+			sprintf(blocco, "Blocco %d", c);
+			DiskDriver_writeBlock(&disk, blocco, c);
+		}
+		t0 = secondi();
+		for(int c = 0; c < blocchi_crc; c++) DiskDriver_readBlock(&disk, blocco, c);
+		t1 = secondi();
+		printf("\n    readBlock senza checksum               => %.2f GB/s, DiskDriver_enableChecksums() => %d", crc_bytes / (t1 - t0) / 1e9,
+			DiskDriver_enableChecksums(&disk));
+		DiskDriver_unmount(&disk);
+		DiskDriver_init(&disk, disk_filename, blocchi_crc + 4096);
+		for(int passata = 0; passata < 2; passata++) {
+			int errori = 0;
+			t0 = secondi();
+			for(int c = 0; c < blocchi_crc; c++) errori += DiskDriver_readBlock(&disk, blocco, c) == -1;
+			t1 = secondi();
+			printf("\n    readBlock con checksum, %s => %.2f GB/s, errori %d", passata == 0 ? "la prima volta" : "di nuovo      ", crc_bytes / (t1 - t0) / 1e9, errori);
+		}
+		printf(", blocchi verificati %llu", (unsigned long long) disk.checksum_verifies);
+		DiskDriver_unmount(&disk);
+		unlink(disk_filename);
+
+		// Benchmark dei file compressi: 4 copie della Divina Commedia scritte in un file normale e in un file compresso, e lette tutte
+		// dopo aver tolto le pagine dalla memoria; nel file compresso anche 1000 letture da 4 KiB in posizioni casuali
+		printf("\n\n+++ Benchmark SimpleFS_write() e SimpleFS_read() [file compressi]");
+		FILE * copie_file = fopen("divina_commedia.txt", "r");
+		if(copie_file == NULL) {
+			printf("\n    divina_commedia.txt non trovato");
+		}else{
+			int dimensione = (int) commedia_stat.st_size * 4;
+			char * copie = malloc(dimensione + 1), * lette = malloc(dimensione + 1);
+			int copia = fread(copie, 1, commedia_stat.st_size, copie_file);
+			fclose(copie_file);
+			for(int c = 1; c < 4; c++) memcpy(copie + c * copia, copie, copia);
+			copie[dimensione] = '\0';
+			SimpleFS fs_compressi;
+			sprintf(disk_filename, "test/bench_%d_compressi.txt", (int) time(NULL));
+			DiskDriver_init(&disk, disk_filename, 16384);
+			DirectoryHandle * radice_compressi = SimpleFS_init(&fs_compressi, &disk);
+			const char * formato[] = { "file normale ", "file compresso" };
+			for(int c = 0; c < 2; c++) {
+				int64_t liberi_prima = DiskDriver_freeCount(&disk);
+				FileHandle * copie_handle = SimpleFS_createFile(radice_compressi, c == 0 ? "normale.txt" : "compresso.txt");
+				if(c == 1) SimpleFS_setCompression(copie_handle, 1);
+				t0 = secondi();
+				SimpleFS_write(copie_handle, copie, dimensione);
+				t1 = secondi();
+				int64_t usati = liberi_prima - DiskDriver_freeCount(&disk);
+				SimpleFS_advise(copie_handle, 0, 0, SIMPLEFS_ADVISE_DONTNEED);
+				SimpleFS_seek(copie_handle, 0);
+				t2 = secondi();
+				int letti = SimpleFS_read(copie_handle, lette, dimensione);
+				double t3 = secondi();
+				printf("\n    %s => %lld blocchi (%.0f byte di dati per blocco), scrittura %.3f ms, lettura di %d byte %.3f ms, uguale %d", formato[c],
+					(long long) usati, (double) dimensione / usati, (t1 - t0) * 1e3, letti, (t3 - t2) * 1e3, memcmp(copie, lette, dimensione) == 0);
+				if(c == 1) {
+					int corrette = 0;
+					t0 = secondi();
+					for(int r = 0; r < 1000; r++) {
+						int posizione = (int) ((r * 2654435761u) % (dimensione - 4096));
+						SimpleFS_seek(copie_handle, posizione);
+						corrette += SimpleFS_read(copie_handle, lette, 4096) == 4096 && memcmp(lette, copie + posizione, 4096) == 0;
+					}
+					t1 = secondi();
+					printf("\n    %s => 1000 letture casuali da 4 KiB in %.3f ms (%.1f us l'una), corrette %d", formato[c], (t1 - t0) * 1e3, (t1 - t0) * 1e3, corrette);
+				}
+				SimpleFS_close(copie_handle);
+			}
+			unlink(disk_filename);
+
+			// Benchmark della deduplicazione: 8 versioni compresse delle copie, ognuna uguale alla precedente tranne 10 byte in un altro chunk,
+			// quindi ogni versione scrive solo il chunk cambiato e l'ultimo (che è più corto). Poi la latenza delle ricerche nella tabella:
+			// quelle che non trovano niente, e quelle che trovano una sequenza (e confrontano i suoi blocchi)
+			printf("\n\n+++ Benchmark SimpleFS_setDedup() e DiskDriver_dedupLookup()");
+			SimpleFS fs_dedup;
+			sprintf(disk_filename, "test/bench_%d_dedup.txt", (int) time(NULL));
+			DiskDriver_init(&disk, disk_filename, 16384);
+			DirectoryHandle * radice_dedup = SimpleFS_init(&fs_dedup, &disk);
+			SimpleFS_setDedup(&fs_dedup, 1);
+			int64_t liberi_versioni = DiskDriver_freeCount(&disk);
+			char nome_versione[32];
+			t0 = secondi();
+			for(int c = 0; c < 8; c++) {
+				if(c > 0) memcpy(copie + c * (dimensione / 8), "0123456789", 10);
+				sprintf(nome_versione, "versione_%d.txt", c);
+				FileHandle * versione = SimpleFS_createFile(radice_dedup, nome_versione);
+				SimpleFS_setCompression(versione, 1);
+				SimpleFS_write(versione, copie, dimensione);
+				SimpleFS_close(versione);
+			}
+			t1 = secondi();
+			int64_t usati = liberi_versioni - DiskDriver_freeCount(&disk), risparmiati = DiskDriver_dedupSaved(&disk);
+			printf("\n    8 versioni da %d byte => %lld blocchi invece di %lld, rapporto di deduplicazione %.2f, scrittura %.3f ms (%llu ricerche, %llu trovate)",
+				dimensione, (long long) usati, (long long) (usati + risparmiati), (double) (usati + risparmiati) / usati, (t1 - t0) * 1e3,
+				(unsigned long long) disk.dedup->lookups, (unsigned long long) disk.dedup->hits);
+
+			// Le ricerche che trovano la sequenza le aggiungono un riferimento, che tolgo alla fine con una sola DiskDriver_freeBlocks
+			int voce = 0;
+			while(disk.dedup->entries[voce].refs == 0) voce++;
+			DiskDedupEntry trovata = disk.dedup->entries[voce];
+			char * sequenza = malloc((size_t) trovata.num_blocks * BLOCK_SIZE);
+			for(int b = 0; b < trovata.num_blocks; b++) {
+				memcpy(sequenza + b * BLOCK_SIZE, DiskDriver_getBlockPtr(&disk, trovata.block + b), BLOCK_SIZE);
+				DiskDriver_releaseBlockPtr(&disk, trovata.block + b);
+			}
+			int ricerche = 100000, trovate = 10000, * riferimenti = malloc(trovate * sizeof(int));
+			t0 = secondi();
+			for(int r = 0; r < ricerche; r++) DiskDriver_dedupLookup(&disk, (uint64_t) r * 0x9e3779b97f4a7c15ull | 1ull << 63, sequenza, trovata.num_blocks);
+			t1 = secondi();
+			for(int r = 0; r < trovate; r++) riferimenti[r] = DiskDriver_dedupLookup(&disk, trovata.fingerprint, sequenza, trovata.num_blocks);
+			t2 = secondi();
+			DiskDriver_freeBlocks(&disk, riferimenti, trovate);
+			printf("\n    DiskDriver_dedupLookup() => %.3f us senza risultato, %.3f us per trovare una sequenza di %d blocchi, riferimenti dopo %d (prima %d)",
+				(t1 - t0) * 1e6 / ricerche, (t2 - t1) * 1e6 / trovate, trovata.num_blocks, disk.dedup->entries[voce].refs, trovata.refs);
+			free(sequenza);
+			free(riferimenti);
+			SimpleFS_unmount(&fs_dedup);
+			unlink(disk_filename);
+			free(copie);
+			free(lette);
+		}
+
+		// Benchmark degli snapshot: lo snapshot copia solo i metadati, quindi il suo tempo dipende dal numero di file e non dai dati
+		// (64 file da 4 KiB e 64 file da 1 MiB); poi il costo della prima scrittura di un file condiviso, che copia la sua catena,
+		// rispetto alla seconda
+		printf("\n\n+++ Benchmark SimpleFS_snapshot()");
+		int dimensioni_snapshot[] = { 4096, 1 << 20 };
+		char * dati_snapshot = malloc((1 << 20) + 1);
+		for(i = 0; i < 1 << 20; i++) dati_snapshot[i] = 'a' + i % 26;
+		dati_snapshot[1 << 20] = '\0';
+		for(int d = 0; d < 2; d++) {
+			SimpleFS fs_snapshot;
+			sprintf(disk_filename, "test/bench_%d_snapshot_%d.txt", (int) time(NULL), d);
+			DiskDriver_init(&disk, disk_filename, 262144);
+			DirectoryHandle * radice_snapshot = SimpleFS_init(&fs_snapshot, &disk);
+			char nome_file[32];
+			dati_snapshot[dimensioni_snapshot[d]] = '\0';
+			for(int c = 0; c < 64; c++) {
+				sprintf(nome_file, "file_%d.txt", c);
+				FileHandle * file_snapshot = SimpleFS_createFile(radice_snapshot, nome_file);
+				SimpleFS_write(file_snapshot, dati_snapshot, dimensioni_snapshot[d]);
+				SimpleFS_close(file_snapshot);
+			}
+			dati_snapshot[dimensioni_snapshot[d]] = 'a' + dimensioni_snapshot[d] % 26;
+			int64_t liberi_prima = DiskDriver_freeCount(&disk);
+			t0 = secondi();
+			int ret_snapshot = SimpleFS_snapshot(&fs_snapshot, "bench");
+			t1 = secondi();
+			printf("\n    64 file da %7d byte => SimpleFS_snapshot %d in %.3f ms, blocchi usati %lld", dimensioni_snapshot[d], ret_snapshot,
+				(t1 - t0) * 1e3, (long long) (liberi_prima - DiskDriver_freeCount(&disk)));
+
+			// Sovrascrivo due volte l'inizio di un file: la prima scrittura copia la catena condivisa con lo snapshot
+			FileHandle * file_snapshot = SimpleFS_openFile(radice_snapshot, "file_0.txt");
+			double scritture[2];
+			for(int w = 0; w < 2; w++) {
+				SimpleFS_seek(file_snapshot, 0);
+				t0 = secondi();
+				SimpleFS_write(file_snapshot, "0123456789", 10);
+				scritture[w] = secondi() - t0;
+			}
+			printf(", prima scrittura di 10 byte %.3f ms, seconda %.3f ms", scritture[0] * 1e3, scritture[1] * 1e3);
+			SimpleFS_close(file_snapshot);
+			SimpleFS_unmount(&fs_snapshot);
+			unlink(disk_filename);
+		}
+		free(dati_snapshot);
+
+		// Benchmark dei file a extent: 8 MiB scritti in un file a catena e in un file a extent su un disco frammentato (un blocco
+		// occupato ogni 64), e letti dopo aver tolto le pagine dalla memoria; nel file a extent anche 10000 letture da 4 KiB in
+		// posizioni casuali, che trovano il blocco con la ricerca binaria invece di seguire la catena
+		printf("\n\n+++ Benchmark SimpleFS_setLayout()");
+		int dimensione_extent = 8 << 20;
+		char * dati_extent = malloc(dimensione_extent + 1), * letti_extent = malloc(dimensione_extent + 1);
+		for(i = 0; i < dimensione_extent; i++) dati_extent[i] = 'a' + (i * 7 + i / 4096) % 26;
+		dati_extent[dimensione_extent] = '\0';
+		SimpleFS fs_extent;
+		sprintf(disk_filename, "test/bench_%d_extent.txt", (int) time(NULL));
+		DiskDriver_init(&disk, disk_filename, 65536);
+		DirectoryHandle * radice_extent = SimpleFS_init(&fs_extent, &disk);
+		int * occupati = malloc(65536 * sizeof(int)), num_occupati = 0, num_liberati = 0, occupato;
+		while((occupato = DiskDriver_allocBlock(&disk, NULL)) != -1) occupati[num_occupati++] = occupato;
+		for(i = 0; i < num_occupati; i++) {
+			if(occupati[i] % 64 != 0) occupati[num_liberati++] = occupati[i];
+		}
+		DiskDriver_freeBlocks(&disk, occupati, num_liberati);
+		free(occupati);
+		const char * formati_extent[] = { "a catena", "a extent" };
+		for(int c = 0; c < 2; c++) {
+			FileHandle * file_extent = SimpleFS_createFile(radice_extent, c == 0 ? "catena.txt" : "extent.txt");
+			if(c == 1) SimpleFS_setLayout(file_extent, SIMPLEFS_LAYOUT_EXTENTS);
+			t0 = secondi();
+			SimpleFS_write(file_extent, dati_extent, dimensione_extent);
+			t1 = secondi();
+			SimpleFS_advise(file_extent, 0, 0, SIMPLEFS_ADVISE_DONTNEED);
+			SimpleFS_seek(file_extent, 0);
+			t2 = secondi();
+			int letti = SimpleFS_read(file_extent, letti_extent, dimensione_extent);
+			double t3 = secondi();
+			printf("\n    File %s => scrittura %.3f ms, lettura di %d byte %.3f ms, uguale %d", formati_extent[c], (t1 - t0) * 1e3, letti,
+				(t3 - t2) * 1e3, memcmp(dati_extent, letti_extent, dimensione_extent) == 0);
+			if(c == 1) {
+				int corrette = 0;
+				t0 = secondi();
+				for(int r = 0; r < 10000; r++) {
+					int posizione = (int) ((r * 2654435761u) % (dimensione_extent - 4096));
+					SimpleFS_seek(file_extent, posizione);
+					corrette += SimpleFS_read(file_extent, letti_extent, 4096) == 4096 && memcmp(letti_extent, dati_extent + posizione, 4096) == 0;
+				}
+				t1 = secondi();
+				printf(", %d extent\n    File %s => 10000 letture casuali da 4 KiB in %.3f ms (%.2f us l'una), corrette %d", file_extent->extents->num_extents,
+					formati_extent[c], (t1 - t0) * 1e3, (t1 - t0) * 1e2, corrette);
+			}
+			SimpleFS_close(file_extent);
+		}
+		SimpleFS_unmount(&fs_extent);
+		unlink(disk_filename);
+		free(dati_extent);
+		free(letti_extent);
+
+		// Benchmark dei file indicizzati: un file da 1 GiB indicizzato e uno a catena (scritti 1 MiB alla volta), con letture da 4 KiB in
+		// posizioni casuali. Nel file indicizzato il blocco di una posizione si trova leggendo al massimo tre IndexBlock; in quello a catena
+		// bisogna seguire next_block dal cursore o dall'inizio, quindi le letture sono meno. Il disco viene scritto solo con DiskDriver_flush,
+		// per non aspettare la sincronizzazione di ogni scrittura
+		printf("\n\n+++ Benchmark SimpleFS_setLayout() [indicizzato, file da 1 GiB]");
+		int64_t dimensione_indicizzato = (int64_t) 1 << 30;
+		int periodo = 1 << 20;
+		char * dati_indicizzato = malloc(periodo + 4096), * letti_indicizzato = malloc(4096);
+		for(i = 0; i < periodo + 4096; i++) dati_indicizzato[i] = 'a' + (i % periodo * 7 + i % periodo / 4096) % 26;
+		SimpleFS fs_indicizzato;
+		sprintf(disk_filename, "test/bench_%d_indicizzato.txt", (int) time(NULL));
+		DiskDriver_init(&disk, disk_filename, 2200000);
+		DirectoryHandle * radice_indicizzato = SimpleFS_init(&fs_indicizzato, &disk);
+		DiskDriver_setDurability(&disk, DISK_SYNC_FLUSH, 0);
+		const char * formati_indicizzato[] = { "indicizzato", "a catena" };
+		for(int c = 0; c < 2; c++) {
+			FileHandle * file_indicizzato = SimpleFS_createFile(radice_indicizzato, "grande.txt");
+			if(c == 0) SimpleFS_setLayout(file_indicizzato, SIMPLEFS_LAYOUT_INDEXED);
+			int64_t scritti_indicizzato = 0;
+			t0 = secondi();
+			while(scritti_indicizzato < dimensione_indicizzato) {
+				int scritti = SimpleFS_write(file_indicizzato, dati_indicizzato, periodo);
+				if(scritti <= 0) break;
+				scritti_indicizzato += scritti;
+			}
+			t1 = secondi();
+			printf("\n    File %s => scrittura di %lld byte in %.3f s", formati_indicizzato[c], (long long) scritti_indicizzato, t1 - t0);
+			int letture = c == 0 ? 10000 : 20, corrette_indicizzato = 0;
+			t0 = secondi();
+			for(int r = 0; r < letture; r++) {
+				int64_t posizione = (int64_t) (r * 2654435761u % 1024) * periodo + r * 40503u % (periodo - 4096);
+				SimpleFS_seek(file_indicizzato, posizione);
+				corrette_indicizzato += SimpleFS_read(file_indicizzato, letti_indicizzato, 4096) == 4096 &&
+					memcmp(letti_indicizzato, dati_indicizzato + posizione % periodo, 4096) == 0;
+			}
+			t1 = secondi();
+			printf(", %d letture casuali da 4 KiB in %.3f ms (%.2f us l'una), corrette %d", letture, (t1 - t0) * 1e3, (t1 - t0) * 1e6 / letture,
+				corrette_indicizzato);
+			SimpleFS_close(file_indicizzato);
+			SimpleFS_remove(radice_indicizzato, "grande.txt");
+		}
+		SimpleFS_unmount(&fs_indicizzato);
+		unlink(disk_filename);
+		free(dati_indicizzato);
+		free(letti_indicizzato);
+
+		// Benchmark del cursore dei file: un file a catena da 4 MiB scritto con SimpleFS_write da 1000 byte e riletto con SimpleFS_read da
+		// 1000 byte. Il FileHandle ricorda il blocco del cursore, quindi ogni chiamata costa uguale anche in fondo al file: confronto il
+		// tempo del primo e dell'ultimo quarto
+		printf("\n\n+++ Benchmark SimpleFS_write() e SimpleFS_read() [cursore]");
+		int dimensione_cursore = 4 << 20, pezzo_cursore = 1000;
+		char * dati_cursore = malloc(dimensione_cursore + 1), * letti_cursore = malloc(dimensione_cursore + 1), pezzo[1001];
+		for(i = 0; i < dimensione_cursore; i++) dati_cursore[i] = 'a' + (i * 7 + i / 4096) % 26;
+		dati_cursore[dimensione_cursore] = '\0';
+		SimpleFS fs_cursore;
+		sprintf(disk_filename, "test/bench_%d_cursore.txt", (int) time(NULL));
+		DiskDriver_init(&disk, disk_filename, 32768);
+		DirectoryHandle * radice_cursore = SimpleFS_init(&fs_cursore, &disk);
+		DiskDriver_setDurability(&disk, DISK_SYNC_FLUSH, 0);
+		FileHandle * file_cursore = SimpleFS_createFile(radice_cursore, "cursore.txt");
+		for(int fase = 0; fase < 2; fase++) {
+			double quarti[4];
+			int64_t totale = 0;
+			if(fase == 1) SimpleFS_seek(file_cursore, 0);
+			for(int q = 0; q < 4; q++) {
+				t0 = secondi();
+				for(i = q * dimensione_cursore / 4; i < (q + 1) * dimensione_cursore / 4; i += pezzo_cursore) {
+					int n = (q + 1) * dimensione_cursore / 4 - i < pezzo_cursore ? (q + 1) * dimensione_cursore / 4 - i : pezzo_cursore;
+					if(fase == 0) {
+						memcpy(pezzo, dati_cursore + i, n);
+						pezzo[n] = '\0';
+						totale += SimpleFS_write(file_cursore, pezzo, n);
+					}else{
+						totale += SimpleFS_read(file_cursore, letti_cursore + i, n);
+					}
+				}
+				quarti[q] = secondi() - t0;
+			}
+			printf("\n    %s => %lld byte in %.3f ms, primo quarto %.3f ms, ultimo quarto %.3f ms", fase == 0 ? "SimpleFS_write da 1000 byte" :
+				"SimpleFS_read da 1000 byte ", (long long) totale, (quarti[0] + quarti[1] + quarti[2] + quarti[3]) * 1e3, quarti[0] * 1e3, quarti[3] * 1e3);
+		}
+		printf(", uguale %d", memcmp(dati_cursore, letti_cursore, dimensione_cursore) == 0);
+		SimpleFS_close(file_cursore);
+		SimpleFS_unmount(&fs_cursore);
+		unlink(disk_filename);
+		free(dati_cursore);
+		free(letti_cursore);
+
+		// Benchmark dei dati binari: 8 MiB di byte qualunque (anche zero) scritti in un file a catena e letti tutti insieme e a pezzi da
+		// 4 KiB. Ogni blocco viene copiato con memcpy, quindi il tempo cresce con i byte e non col quadrato della loro lunghezza
+		printf("\n\n+++ Benchmark SimpleFS_write() e SimpleFS_read() [dati binari]");
+		int dimensione_binaria = 8 << 20;
+		char * dati_binari = malloc(dimensione_binaria), * letti_binari = malloc(dimensione_binaria);
+		for(i = 0; i < dimensione_binaria; i++) dati_binari[i] = (i * 2654435761u) >> 24;
+		SimpleFS fs_binario;
+		sprintf(disk_filename, "test/bench_%d_binario.txt", (int) time(NULL));
+		DiskDriver_init(&disk, disk_filename, 32768);
+		DirectoryHandle * radice_binaria = SimpleFS_init(&fs_binario, &disk);
+		FileHandle * file_binario = SimpleFS_createFile(radice_binaria, "binario.bin");
+		t0 = secondi();
+		int scritti_binari = SimpleFS_write(file_binario, dati_binari, dimensione_binaria);
+		t1 = secondi();
+		SimpleFS_seek(file_binario, 0);
+		t2 = secondi();
+		int letti_tutti = SimpleFS_read(file_binario, letti_binari, dimensione_binaria);
+		double t3 = secondi();
+		printf("\n    SimpleFS_write di %d byte => %d in %.3f ms, SimpleFS_read => %d in %.3f ms (%.0f MB/s), uguali %d", dimensione_binaria,
+			scritti_binari, (t1 - t0) * 1e3, letti_tutti, (t3 - t2) * 1e3, dimensione_binaria / (t3 - t2) / 1e6,
+			memcmp(dati_binari, letti_binari, dimensione_binaria) == 0);
+		SimpleFS_seek(file_binario, 0);
+		memset(letti_binari, 0, dimensione_binaria);
+		letti_tutti = 0;
+		t0 = secondi();
+		for(i = 0; i < dimensione_binaria; i += 4096) letti_tutti += SimpleFS_read(file_binario, letti_binari + i, 4096);
+		t1 = secondi();
+		printf("\n    %d SimpleFS_read da 4 KiB => %d byte in %.3f ms (%.0f MB/s), uguali %d", dimensione_binaria / 4096, letti_tutti, (t1 - t0) * 1e3,
+			dimensione_binaria / (t1 - t0) / 1e6, memcmp(dati_binari, letti_binari, dimensione_binaria) == 0);
+		SimpleFS_close(file_binario);
+		SimpleFS_unmount(&fs_binario);
+		unlink(disk_filename);
+		free(dati_binari);
+		free(letti_binari);
+
+		// Benchmark di SimpleFS_seek su un file a catena da 16 MiB: lo spostamento del cursore non segue più la catena fino in fondo per
+		// calcolare la capacità del file, quindi costa lo stesso in qualunque punto. Il blocco del cursore viene cercato dalla lettura
+		// successiva, partendo dal blocco precedente: le letture in avanti di SEEK_CUR seguono solo i blocchi saltati
+		printf("\n\n+++ Benchmark SimpleFS_seek()");
+		int dimensione_seek = 16 << 20, spostamenti = 100000;
+		char * dati_seek = malloc(dimensione_seek), letto_seek[16];
+		for(i = 0; i < dimensione_seek; i++) dati_seek[i] = 'a' + i % 26;
+		SimpleFS fs_seek;
+		sprintf(disk_filename, "test/bench_%d_seek.txt", (int) time(NULL));
+		DiskDriver_init(&disk, disk_filename, 40000);
+		DiskDriver_setDurability(&disk, DISK_SYNC_FLUSH, 0);
+		DirectoryHandle * radice_seek = SimpleFS_init(&fs_seek, &disk);
+		FileHandle * file_seek = SimpleFS_createFile(radice_seek, "seek.txt");
+		SimpleFS_write(file_seek, dati_seek, dimensione_seek);
+		int64_t somma_seek = 0;
+		t0 = secondi();
+		for(i = 0; i < spostamenti; i++) somma_seek += SimpleFS_seekFrom(file_seek, -(int64_t) (i * 7919 % dimensione_seek) - 1, SEEK_END);
+		t1 = secondi();
+		printf("\n    %d SimpleFS_seekFrom(SEEK_END) in punti a caso => %.3f ms (%.3f us ciascuno), posizione media %lld", spostamenti,
+			(t1 - t0) * 1e3, (t1 - t0) * 1e6 / spostamenti, (long long) (somma_seek / spostamenti));
+		int corretti_seek = 0, letture_seek = 1000;
+		SimpleFS_seek(file_seek, 0);
+		t0 = secondi();
+		for(i = 0; i < letture_seek; i++) {
+			SimpleFS_seekFrom(file_seek, dimensione_seek / letture_seek - 16, SEEK_CUR);
+			int64_t posizione = file_seek->pos_in_file;
+			SimpleFS_read(file_seek, letto_seek, 16);
+			corretti_seek += memcmp(letto_seek, dati_seek + posizione, 16) == 0;
+		}
+		t1 = secondi();
+		printf("\n    %d SimpleFS_seekFrom(SEEK_CUR) in avanti e SimpleFS_read di 16 byte => %.3f ms (%.3f us ciascuno), corretti %d", letture_seek,
+			(t1 - t0) * 1e3, (t1 - t0) * 1e6 / letture_seek, corretti_seek);
+		SimpleFS_close(file_seek);
+		SimpleFS_unmount(&fs_seek);
+		unlink(disk_filename);
+		free(dati_seek);
+
 	}
 	printf("\n\n");
 }